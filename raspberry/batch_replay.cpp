@@ -0,0 +1,103 @@
+#include "batch_replay.h"
+#include "log_file.h"
+#include "random_generator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <boost/optional.hpp>
+
+namespace {
+    // The scan lines of a log file that ParseLogFile passes to the SLAM algorithm
+    boost::optional<std::vector<SScanLine>> ReadScanLines(std::string const& strLogFile) {
+        std::vector<SScanLine> vecscanline;
+        SScanLine scanline;
+        bool const bRead = ReadLogFile(strLogFile,
+            [&](double /*fSeconds*/, SOdometryData const& odom) {
+                scanline.add(odom);
+            },
+            [&](double /*fSeconds*/, SLogScan const* pscan, std::size_t cScans) {
+                AssignReplayScans(pscan, cScans, scanline.m_vecscan);
+                if(scanline.translation()!=rbt::size<double>::zero() || scanline.rotation()!=0.0) {
+                    vecscanline.emplace_back(scanline);
+                }
+                scanline.clear();
+            });
+        if(!bRead) return boost::none;
+        return vecscanline;
+    }
+
+    struct SReplayResult {
+        double m_fSeconds = 0;
+        int m_cUpdates = 0;   // scan lines that passed the update gate
+        int m_cParticles = 0; // after the last update
+        rbt::pose<double> m_poseFinal = rbt::pose<double>::zero();
+    };
+
+    SReplayResult Replay(std::vector<SScanLine> const& vecscanline, SFastSlamParameters const& params) {
+        SReplayResult result;
+        auto const tpStart = std::chrono::steady_clock::now();
+        CFastParticleSlamBase pfslam(params);
+        for(auto const& scanline : vecscanline) {
+            if(pfslam.receivedSensorData(scanline)) ++result.m_cUpdates;
+        }
+        std::chrono::duration<double> const durDiff = std::chrono::steady_clock::now() - tpStart;
+        result.m_fSeconds = durDiff.count();
+        result.m_cParticles = pfslam.ParticleCount();
+        if(!pfslam.Poses().empty()) result.m_poseFinal = pfslam.Poses().back();
+        return result;
+    }
+}
+
+bool BatchReplay(std::vector<std::string> const& vecstrLogFile, std::vector<SFastSlamParameters> const& vecparams, int cJobs, std::ostream& os) {
+    std::vector<std::vector<SScanLine>> vecvecscanline;
+    for(auto const& strLogFile : vecstrLogFile) {
+        auto ovecscanline = ReadScanLines(strLogFile);
+        if(!ovecscanline) {
+            std::cerr << "Couldn't read " << strLogFile << std::endl;
+            return false;
+        }
+        vecvecscanline.emplace_back(std::move(ovecscanline.get()));
+    }
+
+    // The seed is chosen on first use, which must not happen concurrently
+    RandomSeed();
+
+    // Replay i replays log i / vecparams.size() with parameters i % vecparams.size()
+    auto const cReplays = vecstrLogFile.size() * vecparams.size();
+    std::vector<SReplayResult> vecresult(cReplays);
+    std::atomic<std::size_t> iReplayNext(0);
+    std::vector<std::thread> vecthread;
+    for(std::size_t i = 0; i < std::min(static_cast<std::size_t>(std::max(cJobs, 1)), cReplays); ++i) {
+        vecthread.emplace_back([&] {
+            for(auto iReplay = iReplayNext++; iReplay < cReplays; iReplay = iReplayNext++) {
+                vecresult[iReplay] = Replay(vecvecscanline[iReplay / vecparams.size()], vecparams[iReplay % vecparams.size()]);
+            }
+        });
+    }
+    for(auto& thread : vecthread) thread.join();
+
+    os << "log\tparticles\tsensor sigma\trange stddev\tturn var\tdrift var\tupdates\tseconds\tfinal particles\tx\ty\tyaw\n";
+    for(std::size_t iReplay = 0; iReplay < cReplays; ++iReplay) {
+        auto const& params = vecparams[iReplay % vecparams.size()];
+        auto const& result = vecresult[iReplay];
+        os << vecstrLogFile[iReplay / vecparams.size()]
+            << '\t' << params.m_cParticles
+            << '\t' << params.m_sensor.m_fSigma
+            << '\t' << params.m_motion.m_fRangeStdDev
+            << '\t' << params.m_motion.m_fTurnVar
+            << '\t' << params.m_motion.m_fDriftVar
+            << '\t' << result.m_cUpdates
+            << '\t' << result.m_fSeconds
+            << '\t' << result.m_cParticles
+            << '\t' << result.m_poseFinal.m_pt.x
+            << '\t' << result.m_poseFinal.m_pt.y
+            << '\t' << result.m_poseFinal.m_fYaw
+            << '\n';
+    }
+    os.flush();
+    return true;
+}
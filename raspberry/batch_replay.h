@@ -0,0 +1,15 @@
+#pragma once
+
+#include "fast_particle_slam.h"
+
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Offline replay of many logs with many parameter sets, e.g. to tune the
+// particle filter. Each log file is read only once, then every log is
+// replayed with every parameter set, cJobs replays at a time. All replays
+// start from the same random seed.
+// Writes a tab-separated table with one line per replay to os. Returns false
+// if a log file couldn't be read.
+bool BatchReplay(std::vector<std::string> const& vecstrLogFile, std::vector<SFastSlamParameters> const& vecparams, int cJobs, std::ostream& os);
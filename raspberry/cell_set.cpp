@@ -0,0 +1,75 @@
+#include "cell_set.h"
+
+#include <limits>
+
+namespace {
+    rbt::point<int> const c_ptEmpty(std::numeric_limits<int>::min(), std::numeric_limits<int>::min());
+    std::size_t constexpr c_nMinSlots = 16;
+}
+
+/*static*/ bool CCellSet::IsEmpty(rbt::point<int> const& pt) {
+    return pt==c_ptEmpty;
+}
+
+std::size_t CCellSet::Slot(rbt::point<int> const& pt) const {
+    // Multiplicative hashing, the table size is a power of two
+    auto const n = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(pt.x)) << 32) | static_cast<std::uint32_t>(pt.y);
+    return static_cast<std::size_t>((n * 0x9E3779B97F4A7C15ull) >> 32) & (m_vecpt.size() - 1);
+}
+
+std::size_t CCellSet::Find(rbt::point<int> const& pt) const {
+    auto i = Slot(pt);
+    while(!IsEmpty(m_vecpt[i]) && !(m_vecpt[i]==pt)) {
+        i = (i + 1) & (m_vecpt.size() - 1);
+    }
+    return i;
+}
+
+bool CCellSet::contains(rbt::point<int> const& pt) const {
+    return !m_vecpt.empty() && !IsEmpty(m_vecpt[Find(pt)]);
+}
+
+bool CCellSet::insert(rbt::point<int> const& pt) {
+    if(m_vecpt.size() < 2 * (m_cpt + 1)) Grow();
+
+    auto const i = Find(pt);
+    if(!IsEmpty(m_vecpt[i])) return false;
+    m_vecpt[i] = pt;
+    ++m_cpt;
+    return true;
+}
+
+bool CCellSet::erase(rbt::point<int> const& pt) {
+    if(m_vecpt.empty()) return false;
+
+    auto i = Find(pt);
+    if(IsEmpty(m_vecpt[i])) return false;
+
+    // Backward shift deletion: Move entries of the probe sequence behind i
+    // into the gap unless their home slot lies cyclically in (i, j]
+    auto const nMask = m_vecpt.size() - 1;
+    for(auto j = (i + 1) & nMask; !IsEmpty(m_vecpt[j]); j = (j + 1) & nMask) {
+        auto const k = Slot(m_vecpt[j]);
+        bool const bStays = i<=j ? (i<k && k<=j) : (i<k || k<=j);
+        if(!bStays) {
+            m_vecpt[i] = m_vecpt[j];
+            i = j;
+        }
+    }
+    m_vecpt[i] = c_ptEmpty;
+    --m_cpt;
+    return true;
+}
+
+void CCellSet::clear() {
+    m_vecpt.clear();
+    m_cpt = 0;
+}
+
+void CCellSet::Grow() {
+    std::vector<rbt::point<int>> vecpt(std::max(c_nMinSlots, 2 * m_vecpt.size()), c_ptEmpty);
+    std::swap(vecpt, m_vecpt);
+    for(auto const& pt : vecpt) {
+        if(!IsEmpty(pt)) m_vecpt[Find(pt)] = pt;
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "geometry.h"
+
+#include <cstdint>
+#include <vector>
+
+// A set of grid cells with O(1) insert, erase and lookup.
+// Open addressing with linear probing in a power of two sized table that is
+// at most half full. Erase shifts the following entries back instead of
+// leaving tombstones, so lookups never degrade.
+// Iteration order is unspecified and changes on insert and erase.
+struct CCellSet {
+    // Returns false if pt was already in the set
+    bool insert(rbt::point<int> const& pt);
+    // Returns false if pt was not in the set
+    bool erase(rbt::point<int> const& pt);
+    bool contains(rbt::point<int> const& pt) const;
+
+    std::size_t size() const { return m_cpt; }
+    bool empty() const { return 0==m_cpt; }
+    void clear();
+
+    template<typename Func>
+    void for_each(Func fn) const {
+        for(auto const& pt : m_vecpt) {
+            if(!IsEmpty(pt)) fn(pt);
+        }
+    }
+
+private:
+    static bool IsEmpty(rbt::point<int> const& pt);
+    std::size_t Slot(rbt::point<int> const& pt) const;
+    std::size_t Find(rbt::point<int> const& pt) const; // slot of pt or of the empty slot where it would be inserted
+    void Grow();
+
+    std::vector<rbt::point<int>> m_vecpt; // empty slots are c_ptEmpty
+    std::size_t m_cpt = 0;
+};
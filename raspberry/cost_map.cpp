@@ -0,0 +1,71 @@
+#include "cost_map.h"
+#include "robot_configuration.h"
+
+#include <opencv2/opencv.hpp>
+
+namespace {
+    // The obstacles are eroded by the robot extent, the Gaussian kernel is
+    // twice as wide. A cost depends on the map cells up to c_nErodeRadius +
+    // c_nBlurRadius away.
+    int constexpr c_nMaxExtent = std::max(c_nRobotWidth/c_nScale, c_nRobotHeight/c_nScale);
+    int constexpr c_nErodeRadius = c_nMaxExtent/2;
+    int constexpr c_nBlurRadius = c_nMaxExtent;
+
+    void Erode(cv::Mat const& matn, cv::Mat& matnEroded) {
+        cv::erode(
+            matn,
+            matnEroded,
+            cv::Mat::ones(c_nMaxExtent, c_nMaxExtent, CV_8U)
+        );
+    }
+
+    // Include costs of traveling close to an obstacle in calculation
+    void Blur(cv::Mat const& matnEroded, cv::Mat& matnCost) {
+        cv::GaussianBlur(matnEroded, matnCost, cv::Size(2*c_nBlurRadius + 1, 2*c_nBlurRadius + 1), 0, 0);
+    }
+
+    cv::Rect Grow(cv::Rect const& rect, int n, cv::Size const& sz) {
+        return cv::Rect(rect.x - n, rect.y - n, rect.width + 2*n, rect.height + 2*n) & cv::Rect(0, 0, sz.width, sz.height);
+    }
+}
+
+void CCostMap::update(CTiledGrid<std::uint8_t> const& gridn) {
+    auto const& matn = m_imageMap.update(gridn);
+    if(!(m_ptnOrigin==gridn.Origin()) || m_matnCost.size()!=matn.size()) {
+        update(matn, gridn.Origin());
+    } else if(m_imageMap.Changed().left <= m_imageMap.Changed().right) {
+        UpdateRect(matn, m_imageMap.Changed());
+    } else {
+        ++m_nVersion;
+        m_rectChanged = rbt::rect<int>::empty();
+    }
+}
+
+void CCostMap::update(cv::Mat const& matn, rbt::point<int> const& ptnOrigin) {
+    cv::Mat matnEroded;
+    Erode(matn, matnEroded);
+    Blur(matnEroded, m_matnCost);
+    m_ptnOrigin = ptnOrigin;
+    ++m_nVersion;
+    m_rectChanged = {0, 0, m_matnCost.cols - 1, m_matnCost.rows - 1};
+}
+
+void CCostMap::UpdateRect(cv::Mat const& matn, rbt::rect<int> const& rectChanged) {
+    // The costs in rectCost depend on the changed cells. They are calculated from the
+    // eroded cells in rectEroded, which in turn depend on the map cells in rectMap.
+    // Where a rectangle is clipped at the image border, the filters see the same
+    // border as when filtering the whole image.
+    cv::Rect const rect(rectChanged.left, rectChanged.bottom, rectChanged.right - rectChanged.left + 1, rectChanged.top - rectChanged.bottom + 1);
+    auto const rectCost = Grow(rect, c_nErodeRadius + c_nBlurRadius, matn.size());
+    auto const rectEroded = Grow(rectCost, c_nBlurRadius, matn.size());
+    auto const rectMap = Grow(rectEroded, c_nErodeRadius, matn.size());
+
+    cv::Mat matnEroded;
+    Erode(matn(rectMap).clone(), matnEroded);
+
+    cv::Mat matnCost;
+    Blur(matnEroded(rectEroded - rectMap.tl()).clone(), matnCost);
+    matnCost(rectCost - rectEroded.tl()).copyTo(m_matnCost(rectCost));
+    ++m_nVersion;
+    m_rectChanged = {rectCost.x, rectCost.y, rectCost.x + rectCost.width - 1, rectCost.y + rectCost.height - 1};
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "geometry.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <opencv2/core.hpp>
+
+// The cost of driving through each cell of the map, shared by the path planners.
+// Obstacles are grown by the robot size and cells close to obstacles are more
+// expensive, i.e., the obstacle map is eroded and blurred. 255 is free space far
+// from any obstacle, cells <= c_nMaxBlocked can't be driven through.
+//
+// update(grid) only recomputes the cells within reach of the map tiles that
+// changed since the previous update, so keeping the cost map up to date after
+// each scan costs a few small filters instead of two full image convolutions.
+struct CCostMap {
+    static std::uint8_t constexpr c_nMaxBlocked = 128;
+
+    // Incremental update from an obstacle grid, e.g. CFastParticleSlamBase::getObstacleGrid()
+    void update(CTiledGrid<std::uint8_t> const& gridn);
+    // Computes all costs from a map image, ptnOrigin is the grid coordinate of its top-left pixel
+    void update(cv::Mat const& matn, rbt::point<int> const& ptnOrigin);
+
+    // The top-left pixel of Costs() is the cell at Origin()
+    cv::Mat const& Costs() const { return m_matnCost; }
+    rbt::point<int> const& Origin() const { return m_ptnOrigin; }
+
+    // Version() counts the updates, Changed() contains the costs that changed
+    // in the last update, in image coordinates. Changed() is the whole image
+    // if the costs have been computed from scratch.
+    int Version() const { return m_nVersion; }
+    rbt::rect<int> const& Changed() const { return m_rectChanged; }
+
+    std::uint8_t at(rbt::point<int> const& pt) const { return m_matnCost.at<std::uint8_t>(pt.y, pt.x); } // in image coordinates
+    bool is_inside(rbt::point<int> const& pt) const { // in image coordinates
+        return 0<=pt.x && pt.x<m_matnCost.cols && 0<=pt.y && pt.y<m_matnCost.rows;
+    }
+
+private:
+    void UpdateRect(cv::Mat const& matn, rbt::rect<int> const& rectChanged);
+
+    CTiledGridImage<std::uint8_t> m_imageMap;
+    cv::Mat m_matnCost;
+    rbt::point<int> m_ptnOrigin = rbt::point<int>::zero();
+    int m_nVersion = 0;
+    rbt::rect<int> m_rectChanged = rbt::rect<int>::empty();
+};
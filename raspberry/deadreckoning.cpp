@@ -12,22 +12,24 @@
 #include <boost/algorithm/cxx11/all_of.hpp>
 
 CDeadReckoningMapping::CDeadReckoningMapping()
-{}
+{
+    m_vecpose.emplace_back(rbt::pose<double>::zero());
+}
         
 void CDeadReckoningMapping::receivedSensorData(SOdometryData const& odom) {
-    auto const posePrev = m_vecpose.empty() 
-        ? rbt::pose<double>(rbt::point<double>::zero(), 0)
-        : m_vecpose.back();
-    
-    auto const poseNew = UpdatePose(posePrev, odom);
-
-    m_vecpose.emplace_back(poseNew);
+    m_vecpose.emplace_back(UpdatePose(m_vecpose.back(), odom));
 }
 
-// void CDeadReckoningMapping::receivedSensorData(SScanLine const& scanline) {
-//     m_occgrid.update(m_vecpose.back(), rbt::rad(data.m_nAngle), data.m_nDistance);    
-// }
+bool CDeadReckoningMapping::receivedSensorData(SScanLine const& scanline) {
+    auto const& posePrev = m_vecpose.back();
+    m_vecpose.emplace_back(
+        posePrev.m_pt + scanline.translation().rotated(posePrev.m_fYaw),
+        posePrev.m_fYaw + scanline.rotation()
+    );
+    m_occgrid.update(m_vecpose.back(), scanline);
+    return true;
+}
 
-cv::Mat const& CDeadReckoningMapping::getMap() {
-    return m_occgrid.ObstacleMap();
+cv::Mat CDeadReckoningMapping::getMap() const {
+    return m_occgrid.ObstacleMapWithPoses(m_vecpose);
 }
@@ -2,9 +2,12 @@
 
 #include "rover.h" 
 #include "occupancy_grid.h"
+#include "map_file.h"
 #include "nonmoveable.h"
 #include "scanline.h"
 
+#include <vector>
+
 /*  Builds an occupancy grid using dead reckoning only, i.e.,
     only based on the odometry values. 
     Useful as a baseline comparison.
@@ -12,9 +15,16 @@
 struct CDeadReckoningMapping : rbt::nonmoveable {
     CDeadReckoningMapping();        
     void receivedSensorData(SOdometryData const& odom);
-    void receivedSensorData(SScanLine const& scanline);
+    // Moves by the odometry of the scan line and adds its scans to the map,
+    // always returns true
+    bool receivedSensorData(SScanLine const& scanline);
+
+    cv::Mat getMap() const;
+    rbt::point<int> const& getMapOrigin() const { return m_occgrid.Origin(); } // grid coordinate of top-left pixel of getMap()
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const { return m_occgrid.ObstacleGrid(); }
+    SSavedMap save() const { return {m_occgrid.LogOdds(), m_vecpose.back()}; }
 
-    cv::Mat const& getMap();
+    std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; }
 private:
     COccupancyGrid m_occgrid;
     std::vector<rbt::pose<double>> m_vecpose;
@@ -1,24 +1,73 @@
 #include "fast_particle_slam.h"
 #include "robot_configuration.h"
 #include "error_handling.h"
+#include "worker_pool.h"
+#include "profiling.h"
 #include "occupancy_grid.inl"
 
 #include <boost/range/algorithm/max_element.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cstdlib>
 #include <iostream>
 #include <random>
-#include <future>
 
 // Based on Grisetti, Stachniss, Burgard 
 // "Improving Grid-based SLAM with Rao-Blackwellized Particle Filters by Adaptive Proposals and Selective Resampling"
 // and their implementation at https://openslam.org/gmapping.html
 SFastSlamParticle::SFastSlamParticle() : m_pose(rbt::pose<double>::zero()) {}
 
-void SFastSlamParticle::updatePose(SScanLine const& scanline) {
+// Particles are only copied during resampling when there are no map updates in flight
+SFastSlamParticle::SFastSlamParticle(SFastSlamParticle const& p)
+    : m_pose(p.m_pose)
+    , m_fLogWeight(p.m_fLogWeight)
+    , m_fWeight(p.m_fWeight)
+    , m_rng(p.m_rng)
+    , m_pnode(p.m_pnode)
+    , m_pscanlinePending(p.m_pscanlinePending)
+    , m_occgrid(p.m_occgrid)
+{}
+
+SFastSlamParticle::SFastSlamParticle(SFastSlamParticle&& p)
+    : m_pose(p.m_pose)
+    , m_fLogWeight(p.m_fLogWeight)
+    , m_fWeight(p.m_fWeight)
+    , m_rng(p.m_rng)
+    , m_pnode(std::move(p.m_pnode))
+    , m_pscanlinePending(std::move(p.m_pscanlinePending))
+    , m_occgrid(std::move(p.m_occgrid))
+{}
+
+SFastSlamParticle& SFastSlamParticle::operator=(SFastSlamParticle const& p) {
+    m_pose = p.m_pose;
+    m_fLogWeight = p.m_fLogWeight;
+    m_fWeight = p.m_fWeight;
+    m_rng = p.m_rng;
+    m_pnode = p.m_pnode;
+    m_pscanlinePending = p.m_pscanlinePending;
+    m_occgrid = p.m_occgrid;
+    return *this;
+}
+
+SFastSlamParticle& SFastSlamParticle::operator=(SFastSlamParticle&& p) {
+    m_pose = p.m_pose;
+    m_fLogWeight = p.m_fLogWeight;
+    m_fWeight = p.m_fWeight;
+    m_rng = p.m_rng;
+    m_pnode = std::move(p.m_pnode);
+    m_pscanlinePending = std::move(p.m_pscanlinePending);
+    m_occgrid = std::move(p.m_occgrid);
+    return *this;
+}
+
+void SFastSlamParticle::updatePose(SScanLine const& scanline, SMotionModelParameters const& paramsMotion, SSensorModelParameters const& paramsSensor) {
+    flushMap();
+    CScopedTimer timer(estageUpdatePose);
+
     // 1. Update particles with probabilistic motion model
-    auto poseSampled = sample_motion_model(m_pose, scanline.translation(), scanline.rotation());
+    auto poseSampled = sample_motion_model(m_pose, scanline.translation(), scanline.rotation(), m_rng, paramsMotion);
 
     // 2. If not first update (and optionally: enough distance traveled since last update)
     //    scan match and update particle pose
@@ -26,40 +75,95 @@ void SFastSlamParticle::updatePose(SScanLine const& scanline) {
     
     // 3. Compute likelihood of resulting match
     // gmapping computes log likelihood, also skips distanceTransform and searches
-    // in small kernel around expected obstacle
-    m_fLogWeight += log_likelihood_field(m_pose, scanline, m_occgrid);
+    // in small kernel around expected obstacle. We look up the distance to the 
+    // closest obstacle in the incrementally updated likelihood field instead.
+    {
+        CScopedTimer timer(estageLikelihood);
+        m_fLogWeight += log_likelihood_field(m_pose, scanline, m_occgrid.LikelihoodField(), paramsSensor);
+    }
     
     LOG("Update Particle: poseSampled = " << poseSampled << " m_pose = " << m_pose << " m_fLogWeight = " << m_fLogWeight << "\n");
 }
 
-void SFastSlamParticle::updateMap(SScanLine const& scanline) {
-    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        m_occgrid.update(m_pose, scan.m_fRadAngle, scan.m_nDistance);
+void SFastSlamParticle::buildLocalMap(std::size_t cScans) {
+    CScopedTimer timer(estageUpdateMap);
+    std::vector<CTrajectoryTree::SNode const*> vecpnode;
+    for(auto pnode = m_pnode.get(); pnode && vecpnode.size()<cScans; pnode = pnode->m_pnodeParent) {
+        vecpnode.emplace_back(pnode);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mtxMap);
+    m_occgrid = COccupancyGridWithObstacleList();
+    std::for_each(vecpnode.rbegin(), vecpnode.rend(), [&](CTrajectoryTree::SNode const* pnode) {
+        m_occgrid.update(pnode->m_pose, *pnode->m_pscanline);
     });
+    m_occgrid.UpdateLikelihoodField();
 }
 
-CFastParticleSlamBase::CFastParticleSlamBase(int cParticles) 
-    : m_vecparticle(cParticles), m_itparticleBest(m_vecparticle.begin()), m_fNEff(1.0)
-{}
+void SFastSlamParticle::dropMap() {
+    std::lock_guard<std::mutex> lock(m_mtxMap);
+    m_occgrid = COccupancyGridWithObstacleList();
+}
 
-static std::random_device s_rd;
-void CFastParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
+void SFastSlamParticle::assignMap(COccupancyGridWithObstacleList const& occgrid) {
+    std::lock_guard<std::mutex> lock(m_mtxMap);
+    ASSERT(!m_pscanlinePending);
+    m_occgrid = occgrid;
+}
+
+void SFastSlamParticle::updateMap(std::shared_ptr<SScanLine const> pscanline) {
+    std::lock_guard<std::mutex> lock(m_mtxMap);
+    ASSERT(!m_pscanlinePending);
+    m_pscanlinePending = std::move(pscanline);
+}
+
+void SFastSlamParticle::flushMap() const {
+    std::lock_guard<std::mutex> lock(m_mtxMap);
+    if(!m_pscanlinePending) return;
+
+    CScopedTimer timer(estageUpdateMap);
+
+    m_occgrid.update(m_pose, *m_pscanlinePending);
+    m_occgrid.UpdateLikelihoodField();
+    m_pscanlinePending.reset();
+}
+
+CFastParticleSlamBase::CFastParticleSlamBase(SFastSlamParameters const& params) 
+    : m_vecparticle(CParticleCount(params.m_count).clamp(params.m_cParticles)), m_itparticleBest(m_vecparticle.begin()), m_fNEff(1.0)
+    , m_particlecount(params.m_count), m_filter(params.m_filter), m_gate(params.m_gate), m_rng(RandomSeed())
+    , m_cLazyMapScans(params.m_cLazyMapScans), m_paramsMotion(params.m_motion), m_paramsSensor(params.m_sensor)
+{
+    boost::for_each(m_vecparticle, [&](SFastSlamParticle& p) { p.m_rng = rbt::xoshiro256(m_rng()); });
+}
+
+CFastParticleSlamBase::~CFastParticleSlamBase() {
+    boost::for_each(m_vecfutureMap, [](auto& future) { WorkerPool().wait(future); });
+}
+
+bool CFastParticleSlamBase::receivedSensorData(SScanLine const& scanlineSensor) {
+    CScopedTimer timer(estageScan);
+    auto const pscanlineGated = m_gate.pass(scanlineSensor);
+    if(!pscanlineGated) return false;
+    auto const& scanline = *pscanlineGated;
      LOG("=== Update === ");
      LOG("t = " << scanline.translation() << " phi = " << scanline.rotation());
     
-    {
-        std::vector<std::future<void>> vecfuture;
-        boost::for_each(m_vecparticle, [&](auto& p) {
-            vecfuture.emplace_back( 
-                std::async(std::launch::async,
-                    [&] {
-                        p.updatePose(scanline);
-                    }
-                ));
-        });
-    }
+    // updatePose integrates the previous scan into the map first if
+    // the background task has not done it yet
+    auto const& scanlineMatch = m_filter.filter(scanline);
+    WorkerPool().for_each(m_vecparticle, [&](auto& p) {
+        if(LazyMaps()) p.buildLocalMap(m_cLazyMapScans);
+        p.updatePose(scanlineMatch, m_paramsMotion, m_paramsSensor);
+        if(LazyMaps()) p.dropMap();
+    });
+
+    // All background tasks have finished or have nothing left to do,
+    // but they must not outlive the particles they refer to
+    boost::for_each(m_vecfutureMap, [](auto& future) { WorkerPool().wait(future); });
+    m_vecfutureMap.clear();
 
     // 4. Normalize weights (see GridSlamProcessor::normalize())
+    CScopedTimer timerResample(estageResample);
     {
         // TODO: m_obsSigmaGain
         double const fGain = 1. / ( 3 * /* = m_obsSigmaGain */ m_vecparticle.size());
@@ -79,33 +183,37 @@ void CFastParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
         m_fNEff = 1.0 / m_fNEff;
     }
 
-    // 5. If neff < threshold, resample
-    if(m_fNEff<0.5 * m_vecparticle.size()) {
+    // 5. If neff < threshold or the particle count should change, resample
+    auto const cParticles = static_cast<int>(m_vecparticle.size());
+    auto const fnWeight = [&](int i) { return m_vecparticle[i].m_fWeight; };
+    auto cParticlesNew = cParticles;
+    bool bSampled = false;
+    if(m_particlecount.Adaptive()) {
+        LowVarianceSample(cParticles, fnWeight, 1.0, cParticles, m_rng, m_veciparticle);
+        bSampled = true;
+        auto const cNeeded = m_particlecount.count(m_veciparticle, [&](int i) { return m_vecparticle[i].m_pose; });
+        // Resampling too often loses diversity, small changes are ignored
+        if(cParticles < 4 * std::abs(cNeeded - cParticles)) cParticlesNew = cNeeded;
+    }
+    if(m_fNEff<0.5 * cParticles || cParticlesNew!=cParticles) {
         LOG("============ Resample ============");
-        // Resampling
-        // Thrun, Probabilistic robotics, p. 110
-        auto const fStepSize = 1.0/m_vecparticle.size();
-        auto const r = std::uniform_real_distribution<double>(0.0, fStepSize)(s_rd);
-        auto c = m_vecparticle.front().m_fWeight;
-
-        std::vector<int> veciparticle;
-        for(int i = 0, m = 0; m<m_vecparticle.size(); ++m) {
-            auto const u = r + m * fStepSize;
-            while(c<u) {
-                ++i;
-                c += m_vecparticle[i].m_fWeight;
-            }
-            veciparticle.emplace_back(i);
-            LOG("Keep particle " << i);
+        // Keep the draw that has been counted
+        if(bSampled) {
+            m_particlecount.resize(m_veciparticle, cParticlesNew, cParticles, fnWeight, 1.0, m_rng);
+        } else {
+            LowVarianceSample(cParticles, fnWeight, 1.0, cParticlesNew, m_rng, m_veciparticle);
         }
         
-        std::vector<SFastSlamParticle> vecparticle(m_vecparticle.size());
+        std::vector<SFastSlamParticle> vecparticle(m_veciparticle.size());
         auto itparticleOut = vecparticle.begin();
-        for(auto itn = veciparticle.begin(); itn!=veciparticle.end(); ++itn) {
-            if(boost::next(itn)==veciparticle.end() || *itn!=*boost::next(itn)) {
+        for(auto itn = m_veciparticle.begin(); itn!=m_veciparticle.end(); ++itn) {
+            LOG("Keep particle " << *itn);
+            if(boost::next(itn)==m_veciparticle.end() || *itn!=*boost::next(itn)) {
                 *itparticleOut = std::move(m_vecparticle[*itn]);
             } else {
                 *itparticleOut = m_vecparticle[*itn];
+                // Reseed, otherwise duplicated particles would sample the same motion
+                itparticleOut->m_rng = rbt::xoshiro256(m_rng());
             }
             itparticleOut->m_fLogWeight = 0.0;
             ++itparticleOut;
@@ -113,39 +221,101 @@ void CFastParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
         std::swap(m_vecparticle, vecparticle);
     }
     
+    // Resampled particles share the history of their ancestor
+    auto const pscanline = std::make_shared<SScanLine const>(scanline);
+    boost::for_each(m_vecparticle, [&](auto& p) {
+        p.m_pnode = m_trajectories.add(p.m_pnode, p.m_pose, LazyMaps() ? pscanline : nullptr);
+    });
+
     m_itparticleBest = boost::max_element(
         boost::adaptors::transform(m_vecparticle, std::mem_fn(&SFastSlamParticle::m_fWeight))
     ).base();
-    m_vecpose.emplace_back(m_itparticleBest->m_pose);
+    auto const& pnodeBest = m_itparticleBest->m_pnode;
+    if(m_pnodeBest && pnodeBest->m_pnodeParent==m_pnodeBest.get()) {
+        m_vecpose.emplace_back(pnodeBest->m_pose);
+    } else {
+        m_vecpose = CTrajectoryTree::trajectory(pnodeBest);
+    }
+    m_pnodeBest = pnodeBest;
+    timerResample.stop();
 
-    {
-        std::vector<std::future<void>> vecfuture;
-        boost::for_each(m_vecparticle, [&](auto& p) {
-            vecfuture.emplace_back( 
-                std::async(std::launch::async,
-                    [&] {
-                        p.updateMap(scanline);
-                    }
-                ));
+    if(LazyMaps() || m_bLocalizeOnly) return true;
+    boost::for_each(m_vecparticle, [&](auto& p) {
+        p.updateMap(pscanline);
+        m_vecfutureMap.emplace_back(WorkerPool().async([&p] { p.flushMap(); }));
+    });
+    return true;
+}
+
+void CFastParticleSlamBase::load(SSavedMap const& savedmap, bool bLocalizeOnly) {
+    ASSERT(m_vecpose.empty());
+    ASSERT(bLocalizeOnly || 0==m_cLazyMapScans);
+    // The particles share the tiles, kd trees and likelihood field of the map
+    COccupancyGridWithObstacleList occgrid;
+    occgrid.assign(savedmap.m_gridfLogOdds);
+    boost::for_each(m_vecparticle, [&](SFastSlamParticle& p) {
+        p.m_pose = savedmap.m_pose;
+        p.assignMap(occgrid);
+    });
+    m_bLocalizeOnly = bLocalizeOnly;
+}
+
+SSavedMap CFastParticleSlamBase::save() const {
+    ASSERT(m_itparticleBest!=m_vecparticle.end());
+    return {BestMap().LogOdds(), m_itparticleBest->m_pose};
+}
+
+COccupancyGridWithObstacleList const& CFastParticleSlamBase::BestMap() const {
+    ASSERT(m_itparticleBest!=m_vecparticle.end());
+    if(!LazyMaps()) return m_itparticleBest->occgrid();
+
+    auto const& pnodeBest = m_itparticleBest->m_pnode;
+    if(m_pnodeMap.get()!=pnodeBest.get()) {
+        // Only integrate the scans since m_pnodeMap if the best particle
+        // descends from it, otherwise rebuild the map from the first scan
+        CScopedTimer timer(estageUpdateMap);
+        std::vector<CTrajectoryTree::SNode const*> vecpnode;
+        auto pnode = pnodeBest.get();
+        for(; pnode && pnode!=m_pnodeMap.get(); pnode = pnode->m_pnodeParent) {
+            vecpnode.emplace_back(pnode);
+        }
+        if(!pnode) m_occgridBest = COccupancyGridWithObstacleList();
+        std::for_each(vecpnode.rbegin(), vecpnode.rend(), [&](CTrajectoryTree::SNode const* pnode) {
+            m_occgridBest.update(pnode->m_pose, *pnode->m_pscanline);
         });
+        m_pnodeMap = pnodeBest;
     }
+    return m_occgridBest;
+}
+
+cv::Mat CFastParticleSlamBase::MapImage() const {
+    CScopedTimer timer(estageObstacleMap);
+    std::lock_guard<std::mutex> lock(m_mtxImage);
+    // The callers draw into the image
+    return m_imageMap.update(BestMap().ObstacleGrid()).clone();
 }
 
 cv::Mat CFastParticleSlamBase::getMapWithPoses() const {
-    ASSERT(m_itparticleBest!=m_vecparticle.end());
-    return m_itparticleBest->m_occgrid.ObstacleMapWithPoses(m_vecpose);
+    return ObstacleMapWithPoses(MapImage(), getMapOrigin(), m_vecpose);
 }
 
 cv::Mat CFastParticleSlamBase::getMap() const {
-    ASSERT(m_itparticleBest!=m_vecparticle.end());
-    return m_itparticleBest->m_occgrid.ObstacleMap();
+    return MapImage();
+}
+
+rbt::point<int> const& CFastParticleSlamBase::getMapOrigin() const {
+    return BestMap().Origin();
+}
+
+CTiledGrid<std::uint8_t> const& CFastParticleSlamBase::getObstacleGrid() const {
+    return BestMap().ObstacleGrid();
 }
 
 cv::Mat CFastParticleSlamBase::getMapWithPose() const {
     ASSERT(m_itparticleBest!=m_vecparticle.end());
-    cv::Mat mat = m_itparticleBest->m_occgrid.ObstacleMap();
+    cv::Mat mat = MapImage();
     cv::Mat matColor;
     cvtColor(mat, matColor, CV_GRAY2RGB);
-    RenderRobotPose(matColor, m_vecpose.back(), cv::Scalar(255, 0, 0));
+    RenderRobotPose(matColor, BestMap().Origin(), m_vecpose.back(), cv::Scalar(255, 0, 0));
     return matColor;
 }
@@ -2,11 +2,20 @@
 
 #include "geometry.h"
 #include "occupancy_grid.h"
+#include "map_file.h"
 
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <future>
 #include <opencv2/core.hpp>
 #include "scanline.h"
 #include "scanmatching.h"
+#include "scan_filter.h"
+#include "update_gate.h"
+#include "trajectory_tree.h"
+#include "random_generator.h"
+#include "resampling.h"
 
 // Simple particle filter algorithm as described 
 // in Thrun et al "Probabilistic Robotics" p 478
@@ -14,28 +23,129 @@ struct SFastSlamParticle {
     rbt::pose<double> m_pose;    
     double m_fLogWeight;
     double m_fWeight;
-    
-    COccupancyGridWithObstacleList m_occgrid;
+    rbt::xoshiro256 m_rng;
+    CTrajectoryTree::node_ptr m_pnode; // the latest pose in the trajectory tree
     
     SFastSlamParticle();
-    void updatePose(SScanLine const& scanline);
-    void updateMap(SScanLine const& scanline);
+    SFastSlamParticle(SFastSlamParticle const& p);
+    SFastSlamParticle(SFastSlamParticle&& p);
+    SFastSlamParticle& operator=(SFastSlamParticle const& p);
+    SFastSlamParticle& operator=(SFastSlamParticle&& p);
+
+    void updatePose(SScanLine const& scanline, SMotionModelParameters const& paramsMotion, SSensorModelParameters const& paramsSensor);
+
+    // Lazy maps: The particle only keeps its trajectory. Before updatePose,
+    // the map is rebuilt from the last cScans scans of the trajectory,
+    // afterwards it is dropped again.
+    void buildLocalMap(std::size_t cScans);
+    void dropMap();
+    // Replaces the map, e.g. by a saved map
+    void assignMap(COccupancyGridWithObstacleList const& occgrid);
+
+    // The map update is deferred until the map is needed, i.e., until 
+    // the next updatePose, flushMap or occgrid() call
+    void updateMap(std::shared_ptr<SScanLine const> pscanline);
+    void flushMap() const;
+
+    COccupancyGridWithObstacleList const& occgrid() const { flushMap(); return m_occgrid; }
+
+private:
+    // flushMap() is called concurrently from a background task and from updatePose 
+    // or the map accessors, m_mtxMap protects the members below
+    mutable std::mutex m_mtxMap;
+    mutable std::shared_ptr<SScanLine const> m_pscanlinePending;
+    mutable COccupancyGridWithObstacleList m_occgrid;
 };
 
+// The parameters of CFastParticleSlamBase, see below
+struct SFastSlamParameters {
+    int m_cParticles = 10;
+    SScanFilterParameters m_filter;
+    SUpdateGateParameters m_gate;
+    std::size_t m_cLazyMapScans = 0;
+    SParticleCountParameters m_count;
+    SMotionModelParameters m_motion;
+    SSensorModelParameters m_sensor;
+};
+
+// The map updates of each scan are started in the background after resampling 
+// and receivedSensorData returns without waiting for them. Each particle
+// integrates the previous scan into its map, if that has not happened yet, 
+// before it estimates its next pose. The poses are estimated from the scans
+// selected by a CScanFilter, the maps are updated with all scans.
+// Scan lines are only processed once the robot has moved far enough, see CUpdateGate.
+// The trajectories of all particles are kept in a CTrajectoryTree.
+//
+// If m_cLazyMapScans is not 0, the particles keep no maps of their own, so the
+// memory doesn't grow with the number of particles. The tree nodes refer to
+// the scans instead. Each particle matches against a local map of the last
+// m_cLazyMapScans scans of its trajectory, the map of the best particle is
+// built when it is accessed. The map accessors must be called from the
+// thread calling receivedSensorData.
+//
+// Instead of an empty map, the particles can start from a saved map, see load().
+// In localization-only mode the map is never updated, all particles share it and
+// only track the robot pose.
+//
+// With adaptive SParticleCountParameters, the particle count starts at
+// m_cParticles within the bounds and is chosen by KLD sampling, see CParticleCount.
+// The particles are also resampled when the count needed differs by more than
+// a quarter from the current one.
 struct CFastParticleSlamBase : rbt::nonmoveable {
-    CFastParticleSlamBase(int cParticles = 10);
-    void receivedSensorData(SScanLine const& scanline);
+    explicit CFastParticleSlamBase(SFastSlamParameters const& params = SFastSlamParameters());
+    ~CFastParticleSlamBase();
+    // Returns false if the scan line has been gated out
+    bool receivedSensorData(SScanLine const& scanlineSensor);
+
+    // Starts all particles at the pose of savedmap with its map. Must be called
+    // before the first receivedSensorData. Lazy maps can only be used with
+    // bLocalizeOnly, the saved map is not part of the particles' trajectories.
+    void load(SSavedMap const& savedmap, bool bLocalizeOnly);
+    // The map and the pose of the best particle
+    SSavedMap save() const;
+
     cv::Mat getMapWithPoses() const;
     cv::Mat getMapWithPose() const;
     cv::Mat getMap() const;
+    rbt::point<int> const& getMapOrigin() const; // grid coordinate of top-left pixel of getMap()
+    // The obstacle grid of the best particle, copies share its tiles
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const;
 
+    // The trajectory of the best particle
     std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; } 
+    int ParticleCount() const { return static_cast<int>(m_vecparticle.size()); }
 
 private:
+    CTrajectoryTree m_trajectories; // outlives the particles referring to it
     std::vector<SFastSlamParticle> m_vecparticle;
     std::vector<SFastSlamParticle>::const_iterator m_itparticleBest;
     
     double m_fNEff;
+    CParticleCount m_particlecount;
+    std::vector<int> m_veciparticle; // resampled particles
+    CScanFilter m_filter;
+    CUpdateGate m_gate;
+    rbt::xoshiro256 m_rng; // for resampling and seeding the particles' generators
+    std::vector<std::future<void>> m_vecfutureMap; // background map updates
     
-    std::vector<rbt::pose<double>> m_vecpose; // history of best poses
+    // The trajectory of the best particle, only rebuilt when the best particle
+    // is not a descendant of the previous best one
+    CTrajectoryTree::node_ptr m_pnodeBest;
+    std::vector<rbt::pose<double>> m_vecpose;
+
+    // The map of the best particle
+    COccupancyGridWithObstacleList const& BestMap() const;
+    bool LazyMaps() const { return 0<m_cLazyMapScans && !m_bLocalizeOnly; }
+    std::size_t m_cLazyMapScans;
+    SMotionModelParameters m_paramsMotion;
+    SSensorModelParameters m_paramsSensor;
+    bool m_bLocalizeOnly = false;
+    mutable COccupancyGridWithObstacleList m_occgridBest; // with lazy maps, built up to m_pnodeMap
+    mutable CTrajectoryTree::node_ptr m_pnodeMap;
+
+    // Map image of the best particle. Each call to getMap() only copies the
+    // tiles that changed since the last call.
+    cv::Mat MapImage() const;
+    mutable std::mutex m_mtxImage;
+    mutable CTiledGridImage<std::uint8_t> m_imageMap;
 }; 
@@ -0,0 +1,117 @@
+#include "frontier.h"
+
+#include <boost/range/algorithm/sort.hpp>
+#include <boost/range/algorithm/unique.hpp>
+#include <boost/range/algorithm_ext/erase.hpp>
+
+namespace {
+    // Obstacle grids are 0 where occupied, 255 where free and grey otherwise
+    bool Free(std::uint8_t n) { return 255==n; }
+    bool Unknown(std::uint8_t n) { return 0!=n && 255!=n; }
+}
+
+void CFrontierDetector::update(grid_type const& gridn) {
+    // The tiles whose frontier cells may have changed
+    std::vector<rbt::point<int>> vecptTileDirty;
+    auto const MarkDirty = [&](rbt::point<int> const& ptTile) {
+        for(int y = -1; y <= 1; ++y) {
+            for(int x = -1; x <= 1; ++x) vecptTileDirty.emplace_back(ptTile + rbt::size<int>(x, y));
+        }
+    };
+
+    for(auto& pairpttile : m_mapptile) pairpttile.second.m_bSeen = false;
+    gridn.ForEachTile([&](rbt::point<int> const& ptTile, grid_type::STileVersion const& version, std::uint8_t const* pn) {
+        auto& tile = m_mapptile[ptTile]; // new tiles have version {0, 0}
+        if(!(tile.m_version==version)) {
+            tile.m_version = version;
+            MarkDirty(ptTile);
+        }
+        tile.m_bSeen = true;
+        tile.m_pn = pn;
+    });
+    for(auto itpairpttile = m_mapptile.begin(); itpairpttile!=m_mapptile.end();) {
+        if(itpairpttile->second.m_bSeen) {
+            ++itpairpttile;
+        } else {
+            MarkDirty(itpairpttile->first);
+            itpairpttile = m_mapptile.erase(itpairpttile);
+        }
+    }
+
+    boost::erase(vecptTileDirty, boost::unique<boost::return_found_end>(boost::sort(vecptTileDirty)));
+    for(auto const& ptTile : vecptTileDirty) {
+        // Tiles that have not been allocated are unknown, they contain no frontier cells
+        auto const itpairpttile = m_mapptile.find(ptTile);
+        if(itpairpttile!=m_mapptile.end()) UpdateTile(gridn, ptTile, itpairpttile->second);
+    }
+}
+
+void CFrontierDetector::UpdateTile(grid_type const& gridn, rbt::point<int> const& ptTile, STile& tile) {
+    auto constexpr c_nExtent = grid_type::c_nTileExtent;
+    // Neighbors inside of the tile are read directly, the others from the grid
+    auto const Cell = [&](int x, int y) {
+        return 0<=x && x<c_nExtent && 0<=y && y<c_nExtent
+            ? tile.m_pn[y * c_nExtent + x]
+            : gridn.at(ptTile * c_nExtent + rbt::size<int>(x, y));
+    };
+
+    tile.m_vecptn.clear();
+    for(int y = 0; y < c_nExtent; ++y) {
+        for(int x = 0; x < c_nExtent; ++x) {
+            if(Free(tile.m_pn[y * c_nExtent + x])
+            && (Unknown(Cell(x - 1, y)) || Unknown(Cell(x + 1, y)) || Unknown(Cell(x, y - 1)) || Unknown(Cell(x, y + 1)))) {
+                tile.m_vecptn.emplace_back(ptTile * c_nExtent + rbt::size<int>(x, y));
+            }
+        }
+    }
+}
+
+std::vector<SFrontier> CFrontierDetector::Frontiers(int cMinCells) const {
+    std::vector<rbt::point<int>> vecptn;
+    for(auto const& pairpttile : m_mapptile) {
+        vecptn.insert(vecptn.end(), pairpttile.second.m_vecptn.begin(), pairpttile.second.m_vecptn.end());
+    }
+    boost::sort(vecptn);
+    auto const Find = [&](rbt::point<int> const& pt) {
+        auto const itpt = std::lower_bound(vecptn.begin(), vecptn.end(), pt);
+        return itpt!=vecptn.end() && *itpt==pt ? static_cast<int>(itpt - vecptn.begin()) : -1;
+    };
+
+    // Flood fill the 8-connected clusters
+    std::vector<SFrontier> vecfrontier;
+    std::vector<bool> vecbVisited(vecptn.size(), false);
+    std::vector<int> veciStack;
+    std::vector<int> veciCluster;
+    for(int i = 0; i < static_cast<int>(vecptn.size()); ++i) {
+        if(vecbVisited[i]) continue;
+
+        vecbVisited[i] = true;
+        veciStack.assign(1, i);
+        veciCluster.clear();
+        while(!veciStack.empty()) {
+            auto const iCell = veciStack.back();
+            veciStack.pop_back();
+            veciCluster.emplace_back(iCell);
+            for(int y = -1; y <= 1; ++y) {
+                for(int x = -1; x <= 1; ++x) {
+                    auto const iNext = Find(vecptn[iCell] + rbt::size<int>(x, y));
+                    if(0<=iNext && !vecbVisited[iNext]) {
+                        vecbVisited[iNext] = true;
+                        veciStack.emplace_back(iNext);
+                    }
+                }
+            }
+        }
+        if(static_cast<int>(veciCluster.size()) < cMinCells) continue;
+
+        // The center of a curved frontier may not be a frontier cell
+        rbt::point<double> ptfCenter = rbt::point<double>::zero();
+        for(auto iCell : veciCluster) ptfCenter += rbt::size<double>(vecptn[iCell].x, vecptn[iCell].y);
+        ptfCenter /= static_cast<double>(veciCluster.size());
+        auto const iTarget = *std::min_element(veciCluster.begin(), veciCluster.end(), [&](int iA, int iB) {
+            return (rbt::point<double>(vecptn[iA]) - ptfCenter).SqrAbs() < (rbt::point<double>(vecptn[iB]) - ptfCenter).SqrAbs();
+        });
+        vecfrontier.push_back({vecptn[iTarget], static_cast<int>(veciCluster.size())});
+    }
+    return vecfrontier;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "geometry.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <map>
+#include <vector>
+
+// A cluster of 8-connected frontier cells, i.e., of free cells next to unknown cells
+struct SFrontier {
+    rbt::point<int> m_ptnTarget; // the cell of the cluster closest to its center, in grid coordinates
+    int m_cCells;
+};
+
+// Tracks the frontier cells of an obstacle grid, e.g.
+// CFastParticleSlamBase::getObstacleGrid(). Like CTiledGridImage, update()
+// only rescans the tiles whose version changed since the previous update
+// and their neighbors, whose border cells may have become frontier cells
+// or stopped being frontier cells. A scan usually changes a few tiles,
+// so keeping the frontier up to date does not require a pass over the map.
+struct CFrontierDetector {
+    void update(CTiledGrid<std::uint8_t> const& gridn);
+
+    // The clusters with at least cMinCells cells
+    std::vector<SFrontier> Frontiers(int cMinCells) const;
+
+private:
+    using grid_type = CTiledGrid<std::uint8_t>;
+
+    struct STile {
+        grid_type::STileVersion m_version = {0, 0};
+        bool m_bSeen = false;
+        std::uint8_t const* m_pn = nullptr; // the cells, only valid during update()
+        std::vector<rbt::point<int>> m_vecptn; // frontier cells in grid coordinates
+    };
+    void UpdateTile(grid_type const& gridn, rbt::point<int> const& ptTile, STile& tile);
+
+    std::map<rbt::point<int>, STile> m_mapptile; // by tile coordinate
+};
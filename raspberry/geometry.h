@@ -141,6 +141,46 @@ namespace rbt {
 
     };
 
+    // Iterates over the grid points on the line from ptA to ptB, both included.
+    // Same interface as an 8-connected cv::LineIterator, but does not 
+    // clip the line to an image.
+    struct line_iterator {
+        line_iterator(point<int> const& ptA, point<int> const& ptB)
+            : count(std::max(std::abs(ptB.x - ptA.x), std::abs(ptB.y - ptA.y)) + 1)
+            , m_pt(ptA)
+            , m_nDX(std::abs(ptB.x - ptA.x))
+            , m_nDY(-std::abs(ptB.y - ptA.y))
+            , m_nStepX(ptA.x < ptB.x ? 1 : -1)
+            , m_nStepY(ptA.y < ptB.y ? 1 : -1)
+            , m_nError(m_nDX + m_nDY)
+        {}
+
+        point<int> const& pos() const { return m_pt; }
+
+        line_iterator& operator++() {
+            auto const nError2 = 2 * m_nError;
+            if(m_nDY <= nError2) {
+                m_nError += m_nDY;
+                m_pt.x += m_nStepX;
+            }
+            if(nError2 <= m_nDX) {
+                m_nError += m_nDX;
+                m_pt.y += m_nStepY;
+            }
+            return *this;
+        }
+
+        int const count;
+
+    private:
+        point<int> m_pt;
+        int m_nDX;
+        int m_nDY;
+        int m_nStepX;
+        int m_nStepY;
+        int m_nError;
+    };
+
     template<typename T>
     struct pose {
         point<T> m_pt;
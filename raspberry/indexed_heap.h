@@ -0,0 +1,109 @@
+#pragma once
+
+#include "error_handling.h"
+
+#include <utility>
+#include <vector>
+
+// A binary min-heap of the elements [0, n) ordered by Key, e.g. the cells of
+// a grid. Unlike std::priority_queue, the heap knows where each element is,
+// so the key of an element can be changed and elements can be removed
+// without leaving stale entries. clear() only touches the elements that are
+// still in the heap.
+template<typename Key>
+struct CIndexedHeap {
+    // Empty heap for the elements [0, n)
+    void reset(int n) {
+        m_vecentry.clear();
+        m_veciPos.assign(n, c_iNotQueued);
+    }
+
+    void clear() {
+        for(auto const& entry : m_vecentry) m_veciPos[entry.m_i] = c_iNotQueued;
+        m_vecentry.clear();
+    }
+
+    bool empty() const { return m_vecentry.empty(); }
+    int size() const { return static_cast<int>(m_vecentry.size()); }
+    bool contains(int i) const { return c_iNotQueued!=m_veciPos[i]; }
+
+    int top() const { return m_vecentry.front().m_i; }
+    Key const& top_key() const { return m_vecentry.front().m_key; }
+
+    // i must not be in the heap
+    void push(int i, Key const& key) {
+        ASSERT(!contains(i));
+        m_vecentry.push_back({key, i});
+        SiftUp(size() - 1);
+    }
+
+    // i must be in the heap, key may be smaller or larger than before
+    void update(int i, Key const& key) {
+        auto const iPos = m_veciPos[i];
+        auto const bDecrease = key < m_vecentry[iPos].m_key;
+        m_vecentry[iPos].m_key = key;
+        if(bDecrease) SiftUp(iPos); else SiftDown(iPos);
+    }
+
+    int pop() {
+        auto const i = top();
+        erase(i);
+        return i;
+    }
+
+    void erase(int i) {
+        auto const iPos = m_veciPos[i];
+        m_veciPos[i] = c_iNotQueued;
+        auto const entryLast = m_vecentry.back();
+        m_vecentry.pop_back();
+        if(iPos < size()) {
+            auto const bDecrease = entryLast.m_key < m_vecentry[iPos].m_key;
+            m_vecentry[iPos] = entryLast;
+            m_veciPos[entryLast.m_i] = iPos;
+            if(bDecrease) SiftUp(iPos); else SiftDown(iPos);
+        }
+    }
+
+private:
+    static int constexpr c_iNotQueued = -1;
+
+    struct SEntry {
+        Key m_key;
+        int m_i;
+    };
+
+    void SiftUp(int iPos) {
+        auto const entry = m_vecentry[iPos];
+        while(0 < iPos) {
+            auto const iPosParent = (iPos - 1) / 2;
+            if(!(entry.m_key < m_vecentry[iPosParent].m_key)) break;
+            Place(iPos, m_vecentry[iPosParent]);
+            iPos = iPosParent;
+        }
+        Place(iPos, entry);
+    }
+
+    void SiftDown(int iPos) {
+        auto const entry = m_vecentry[iPos];
+        while(true) {
+            auto iPosChild = 2 * iPos + 1;
+            if(size() <= iPosChild) break;
+            if(iPosChild + 1 < size() && m_vecentry[iPosChild + 1].m_key < m_vecentry[iPosChild].m_key) ++iPosChild;
+            if(!(m_vecentry[iPosChild].m_key < entry.m_key)) break;
+            Place(iPos, m_vecentry[iPosChild]);
+            iPos = iPosChild;
+        }
+        Place(iPos, entry);
+    }
+
+    void Place(int iPos, SEntry const& entry) {
+        m_vecentry[iPos] = entry;
+        m_veciPos[entry.m_i] = iPos;
+    }
+
+    std::vector<SEntry> m_vecentry;
+    std::vector<int> m_veciPos; // position in m_vecentry or c_iNotQueued
+};
+
+template<typename Key>
+int constexpr CIndexedHeap<Key>::c_iNotQueued;
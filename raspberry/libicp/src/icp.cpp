@@ -22,20 +22,37 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 
 using namespace std;
 
+namespace {
+
+  // default model: nearest neighbor search in kd tree
+  class KDTreeModel : public IcpModel {
+  public:
+    KDTreeModel (kdtree::KDTree *tree) : tree(tree) {}
+    void nearest (const float *query,float *model,float &dis) const {
+      std::vector<float>         qv(query,query+tree->dim);
+      kdtree::KDTreeResultVector result;
+      tree->n_nearest(qv,1,result);
+      for (int32_t n=0; n<tree->dim; n++)
+        model[n] = tree->the_data[result[0].idx][n];
+      dis = result[0].dis;
+    }
+  private:
+    kdtree::KDTree *tree;
+  };
+}
+
 Icp::Icp (double const* M,const int32_t M_num,const int32_t dim) :
-  dim(dim), max_iter(200), min_delta(1e-4) {
+  M_tree(0), M_model(0), M_tree_model(0), dim(dim), max_iter(200), min_delta(1e-4) {
   
   // check for correct dimensionality
   if (dim!=2 && dim!=3) {
     cout << "ERROR: LIBICP works only for data of dimensionality 2 or 3" << endl;
-    M_tree = 0;
     return;
   }
   
   // check for minimum number of points
   if (M_num<5) {
     cout << "ERROR: LIBICP works only with at least 5 model points" << endl;
-    M_tree = 0;
     return;
   }
 
@@ -47,17 +64,31 @@ Icp::Icp (double const* M,const int32_t M_num,const int32_t dim) :
 
   // build a kd tree from the model point cloud
   M_tree = new kdtree::KDTree(M_data);
+  M_tree_model = new KDTreeModel(M_tree);
+  M_model = M_tree_model;
+}
+
+Icp::Icp (const IcpModel *model,const int32_t dim) :
+  M_tree(0), M_model(model), M_tree_model(0), dim(dim), max_iter(200), min_delta(1e-4) {
+
+  // check for correct dimensionality
+  if (dim!=2 && dim!=3) {
+    cout << "ERROR: LIBICP works only for data of dimensionality 2 or 3" << endl;
+    M_model = 0;
+  }
 }
 
 Icp::~Icp () {
+  if (M_tree_model)
+    delete M_tree_model;
   if (M_tree)
     delete M_tree;
 }
 
 void Icp::fit (double *T,const int32_t T_num,Matrix &R,Matrix &t,const double indist) {
   
-  // make sure we have a model tree
-  if (!M_tree) {
+  // make sure we have a model
+  if (!M_model) {
     cout << "ERROR: No model available." << endl;
     return;
   }
@@ -30,6 +30,23 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #include "matrix.h"
 #include "kdtree.h"
 
+// nearest neighbor search in the model point set
+// Icp uses a kd tree built from the model points by default. An index that
+// is maintained by the caller can be passed to Icp instead, e.g., to avoid
+// rebuilding the kd tree for every fit when the model points change slowly.
+class IcpModel {
+
+public:
+
+  virtual ~IcpModel () {}
+
+  // find the model point closest to a query point
+  // input:  query ... pointer to query point (dim coordinates)
+  // output: model ... closest model point (dim coordinates)
+  //         dis ..... squared distance between query and model point
+  virtual void nearest (const float *query,float *model,float &dis) const = 0;
+};
+
 class Icp {
 
 public:
@@ -39,6 +56,12 @@ public:
   //        M_num ... number of model points
   //        dim   ... dimensionality of model points (2 or 3)
   Icp (double const* M,const int32_t M_num,const int32_t dim);
+
+  // constructor using a nearest neighbor index owned by the caller
+  // input: model ... model point index, must outlive the Icp object
+  //        dim   ... dimensionality of model points (2 or 3)
+  // note:  only supported by IcpPointToPoint which does not need a kd tree
+  Icp (const IcpModel *model,const int32_t dim);
   
   // deconstructor
   virtual ~Icp ();
@@ -73,6 +96,10 @@ protected:
   // kd tree of model points
   kdtree::KDTree*     M_tree;
   kdtree::KDTreeArray M_data;
+
+  // nearest neighbor search in model points, either M_tree or passed by caller
+  const IcpModel*     M_model;
+  IcpModel*           M_tree_model;
   
   int32_t dim;       // dimensionality of model + template data (2 or 3)
   int32_t max_iter;  // max number of iterations
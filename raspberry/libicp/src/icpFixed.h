@@ -0,0 +1,209 @@
+#ifndef ICP_FIXED_H
+#define ICP_FIXED_H
+
+// Point-to-point ICP with the dimension as template parameter
+//
+// Same algorithm as IcpPointToPoint, but rotation and translation are fixed-size
+// matrices on the stack, loops over the dimension have a constant trip count
+// and the model is a template parameter, so the nearest neighbor query in the
+// inner loop is not a virtual call. Model must provide
+//   void nearest (const float *query,float *model,float &dis) const;
+// like IcpModel. Only the 2d case is implemented.
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "icpSimd.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <stdint.h>
+#include <vector>
+
+namespace libicp {
+
+template<int M,int N>
+struct Matrix {
+
+  double val[M][N];
+
+  static Matrix zeros () {
+    Matrix A;
+    for (int32_t i=0; i<M; i++)
+      for (int32_t j=0; j<N; j++)
+        A.val[i][j] = 0;
+    return A;
+  }
+
+  static Matrix eye () {
+    static_assert(M==N,"");
+    Matrix A = zeros();
+    for (int32_t i=0; i<M; i++)
+      A.val[i][i] = 1;
+    return A;
+  }
+
+  template<int K>
+  Matrix<M,K> operator* (const Matrix<N,K> &B) const {
+    Matrix<M,K> C = Matrix<M,K>::zeros();
+    for (int32_t i=0; i<M; i++)
+      for (int32_t j=0; j<K; j++)
+        for (int32_t k=0; k<N; k++)
+          C.val[i][j] += val[i][k]*B.val[k][j];
+    return C;
+  }
+
+  Matrix operator+ (const Matrix &B) const {
+    Matrix C;
+    for (int32_t i=0; i<M; i++)
+      for (int32_t j=0; j<N; j++)
+        C.val[i][j] = val[i][j]+B.val[i][j];
+    return C;
+  }
+
+  Matrix operator- (const Matrix &B) const {
+    Matrix C;
+    for (int32_t i=0; i<M; i++)
+      for (int32_t j=0; j<N; j++)
+        C.val[i][j] = val[i][j]-B.val[i][j];
+    return C;
+  }
+
+  // frobenius norm
+  double l2norm () const {
+    double norm = 0;
+    for (int32_t i=0; i<M; i++)
+      for (int32_t j=0; j<N; j++)
+        norm += val[i][j]*val[i][j];
+    return std::sqrt(norm);
+  }
+};
+
+template<int D,typename Model>
+class IcpPointToPoint {
+
+  static_assert(D==2,"the closed form rotation is only implemented for 2d");
+
+public:
+
+  // input: model ... model point index, must outlive the Icp object
+  explicit IcpPointToPoint (const Model &model) : model(model), max_iter(200), min_delta(1e-4) {}
+
+  // set maximum number of iterations (1. stopping criterion)
+  void setMaxIterations (int32_t val) { max_iter  = val; }
+
+  // set minimum delta of rot/trans parameters (2. stopping criterion)
+  void setMinDeltaParam (double  val) { min_delta = val; }
+
+  // fit template to model yielding R,t (M = R*T + t)
+  // input:  T ....... pointer to first template point, borrowed for the duration
+  //                   of the call, float or double coordinates, D per point
+  //         T_num ... number of template points
+  //         R ....... initial rotation matrix
+  //         t ....... initial translation vector
+  //         indist .. inlier distance (if <=0: use all points)
+  // output: R ....... final rotation matrix
+  //         t ....... final translation vector
+  template<typename Scalar>
+  void fit (const Scalar *T,const int32_t T_num,Matrix<D,D> &R,Matrix<D,1> &t,const double indist) {
+    if (T_num<5)
+      return;
+
+    // set active points
+    active.clear();
+    for (int32_t i=0; i<T_num; i++) {
+      float query[D], result[D], dis;
+      transform(T+i*D,R,t,query);
+      model.nearest(query,result,dis);
+      if (indist<=0 || dis<indist)
+        active.push_back(i);
+    }
+    if (active.size()<5)
+      return;
+
+    // iterate until convergence
+    for (int32_t iter=0; iter<max_iter; iter++)
+      if (fitStep(T,R,t)<min_delta)
+        break;
+  }
+
+private:
+
+  template<typename Scalar>
+  static void transform (const Scalar *p,const Matrix<D,D> &R,const Matrix<D,1> &t,float *query) {
+    for (int32_t i=0; i<D; i++) {
+      double q = t.val[i][0];
+      for (int32_t j=0; j<D; j++)
+        q += R.val[i][j]*p[j];
+      query[i] = (float)q;
+    }
+  }
+
+  template<typename Scalar>
+  double fitStep (const Scalar *T,Matrix<D,D> &R,Matrix<D,1> &t) {
+    int32_t nact = (int32_t)active.size();
+    for (int32_t d=0; d<D; d++) {
+      tp[d].resize(nact);
+      mp[d].resize(nact);
+    }
+
+    // establish correspondences
+    const Matrix<D,D> R0 = R;
+    const Matrix<D,1> t0 = t;
+#pragma omp parallel for
+    for (int32_t i=0; i<nact; i++) {
+      float query[D], result[D], dis;
+      transform(T+active[i]*D,R0,t0,query);
+      model.nearest(query,result,dis);
+      for (int32_t d=0; d<D; d++) {
+        tp[d][i] = query[d];
+        mp[d][i] = result[d];
+      }
+    }
+
+    // means
+    float mu_t[D], mu_m[D];
+    for (int32_t d=0; d<D; d++) {
+      mu_t[d] = sum(tp[d].data(),nact)/nact;
+      mu_m[d] = sum(mp[d].data(),nact)/nact;
+    }
+
+    // relative rotation R_ minimizing the squared distances and t_ = mu_m - R_*mu_t
+    float a,b;
+    rotationTerms(tp[0].data(),tp[1].data(),mp[0].data(),mp[1].data(),nact,mu_t[0],mu_t[1],mu_m[0],mu_m[1],a,b);
+    double phi = std::atan2((double)b,(double)a);
+    double c = std::cos(phi), s = std::sin(phi);
+
+    Matrix<D,D> R_;
+    R_.val[0][0] = c; R_.val[0][1] = -s;
+    R_.val[1][0] = s; R_.val[1][1] = c;
+    Matrix<D,1> t_;
+    for (int32_t i=0; i<D; i++) {
+      t_.val[i][0] = mu_m[i];
+      for (int32_t j=0; j<D; j++)
+        t_.val[i][0] -= R_.val[i][j]*mu_t[j];
+    }
+
+    // compose: R|t = R_|t_ * R|t
+    R = R_*R;
+    t = R_*t+t_;
+
+    // return max delta in parameters
+    return std::max((R_-Matrix<D,D>::eye()).l2norm(),t_.l2norm());
+  }
+
+  const Model &model;
+  int32_t max_iter;
+  double  min_delta;
+
+  // reused in all iterations
+  std::vector<int32_t> active;
+  std::array<std::vector<float>,D> tp; // transformed template points, structure of arrays
+  std::array<std::vector<float>,D> mp; // closest model points
+};
+
+} // namespace libicp
+
+#endif // ICP_FIXED_H
@@ -25,12 +25,20 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #endif
 
 #include "icpPointToPoint.h"
+#include "icpSimd.h"
+
+#include <cmath>
 
 using namespace std;
+using libicp::sum;
+using libicp::rotationTerms;
 
 // Also see (3d part): "Least-Squares Fitting of Two 3-D Point Sets" (Arun, Huang and Blostein)
 double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix &t,const std::vector<int32_t> &active) {
   
+  if (dim==2)
+    return fitStep2D(T,T_num,R,t,active);
+
   int i;
   int nact = (int)active.size();
 
@@ -42,49 +50,8 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
   Matrix mu_m(1,dim);
   Matrix mu_t(1,dim);
   
-  // dimensionality 2
-  if (dim==2) {
-    
-    // extract matrix and translation vector
-    double r00 = R.val[0][0]; double r01 = R.val[0][1];
-    double r10 = R.val[1][0]; double r11 = R.val[1][1];
-    double t0  = t.val[0][0]; double t1  = t.val[1][0];
-    double mum0 = 0.0, mum1 = 0.0;
-    double mut0 = 0.0, mut1 = 0.0;
-
-    // establish correspondences
-#pragma omp parallel for private(i) default(none) shared(T,active,nact,p_m,p_t,r00,r01,r10,r11,t0,t1) reduction(+:mum0,mum1, mut0,mut1) // schedule (dynamic,2)
-    for (i=0; i<nact; i++) {
-      // kd tree query + result
-      std::vector<float>         query(dim);
-      kdtree::KDTreeResultVector result;
-  
-      // get index of active point
-      int32_t idx = active[i];
-
-      // transform point according to R|t
-      query[0] = (float)(r00*T[idx*2+0] + r01*T[idx*2+1] + t0);
-      query[1] = (float)(r10*T[idx*2+0] + r11*T[idx*2+1] + t1);
-
-      // search nearest neighbor
-      M_tree->n_nearest(query,1,result);
-
-      // set model point
-      p_m.val[i][0] = M_tree->the_data[result[0].idx][0]; mum0 += p_m.val[i][0];
-      p_m.val[i][1] = M_tree->the_data[result[0].idx][1]; mum1 += p_m.val[i][1];
-
-      // set template point
-      p_t.val[i][0] = query[0]; mut0 += p_t.val[i][0];
-      p_t.val[i][1] = query[1]; mut1 += p_t.val[i][1];
-    }
-    mu_m.val[0][0] = mum0;
-    mu_m.val[0][1] = mum1;
-
-    mu_t.val[0][0] = mut0;
-    mu_t.val[0][1] = mut1;
-    
-  // dimensionality 3
-  } else {
+  // dimensionality 3, the 2d case is handled by fitStep2D
+  {
     
     // extract matrix and translation vector
     double r00 = R.val[0][0]; double r01 = R.val[0][1]; double r02 = R.val[0][2];
@@ -97,9 +64,10 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
     // establish correspondences
 #pragma omp parallel for private(i) default(none) shared(T,active,nact,p_m,p_t,r00,r01,r02,r10,r11,r12,r20,r21,r22,t0,t1,t2) reduction(+:mum0,mum1,mum2, mut0,mut1,mut2) // schedule (dynamic,2)
     for (i=0; i<nact; i++) {
-      // kd tree query + result
-      std::vector<float>         query(dim);
-      kdtree::KDTreeResultVector result;
+      // nearest neighbor query + result
+      float query[3];
+      float model[3];
+      float dis;
 
       // get index of active point
       int32_t idx = active[i];
@@ -110,12 +78,12 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
       query[2] = (float)(r20*T[idx*3+0] + r21*T[idx*3+1] + r22*T[idx*3+2] + t2);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,result);
+      M_model->nearest(query,model,dis);
 
       // set model point
-      p_m.val[i][0] = M_tree->the_data[result[0].idx][0]; mum0 += p_m.val[i][0];
-      p_m.val[i][1] = M_tree->the_data[result[0].idx][1]; mum1 += p_m.val[i][1];
-      p_m.val[i][2] = M_tree->the_data[result[0].idx][2]; mum2 += p_m.val[i][2];
+      p_m.val[i][0] = model[0]; mum0 += p_m.val[i][0];
+      p_m.val[i][1] = model[1]; mum1 += p_m.val[i][1];
+      p_m.val[i][2] = model[2]; mum2 += p_m.val[i][2];
 
       // set template point
       p_t.val[i][0] = query[0]; mut0 += p_t.val[i][0];
@@ -161,12 +129,76 @@ double IcpPointToPoint::fitStep (double *T,const int32_t T_num,Matrix &R,Matrix
   else        return max((R_-Matrix::eye(3)).l2norm(),t_.l2norm());
 }
 
+// 2d case in single precision: the rotation minimizing the squared distances
+// is atan2(b,a) with a and b from rotationTerms, so no SVD is needed
+double IcpPointToPoint::fitStep2D (double *T,const int32_t T_num,Matrix &R,Matrix &t,const std::vector<int32_t> &active) {
+
+  int i;
+  int nact = (int)active.size();
+
+  tx.resize(nact); ty.resize(nact);
+  mx.resize(nact); my.resize(nact);
+  float *ptx = tx.data(), *pty = ty.data();
+  float *pmx = mx.data(), *pmy = my.data();
+  const int32_t *pactive = active.data();
+  const IcpModel *model = M_model;
+
+  // extract matrix and translation vector
+  double r00 = R.val[0][0]; double r01 = R.val[0][1];
+  double r10 = R.val[1][0]; double r11 = R.val[1][1];
+  double t0  = t.val[0][0]; double t1  = t.val[1][0];
+
+  // establish correspondences
+#pragma omp parallel for private(i) default(none) shared(T,pactive,nact,model,ptx,pty,pmx,pmy,r00,r01,r10,r11,t0,t1)
+  for (i=0; i<nact; i++) {
+    float query[2];
+    float result[2];
+    float dis;
+
+    // transform point according to R|t
+    int32_t idx = pactive[i];
+    query[0] = (float)(r00*T[idx*2+0] + r01*T[idx*2+1] + t0);
+    query[1] = (float)(r10*T[idx*2+0] + r11*T[idx*2+1] + t1);
+
+    // search nearest neighbor
+    model->nearest(query,result,dis);
+
+    ptx[i] = query[0];  pty[i] = query[1];
+    pmx[i] = result[0]; pmy[i] = result[1];
+  }
+
+  // means
+  float mut0 = sum(ptx,nact)/nact, mut1 = sum(pty,nact)/nact;
+  float mum0 = sum(pmx,nact)/nact, mum1 = sum(pmy,nact)/nact;
+
+  // relative rotation R_ and translation t_ = mu_m - R_*mu_t
+  float a,b;
+  rotationTerms(ptx,pty,pmx,pmy,nact,mut0,mut1,mum0,mum1,a,b);
+  double phi = std::atan2((double)b,(double)a);
+  double c = std::cos(phi), s = std::sin(phi);
+
+  Matrix R_(2,2);
+  R_.val[0][0] = c; R_.val[0][1] = -s;
+  R_.val[1][0] = s; R_.val[1][1] = c;
+  Matrix t_(2,1);
+  t_.val[0][0] = mum0 - (c*mut0 - s*mut1);
+  t_.val[1][0] = mum1 - (s*mut0 + c*mut1);
+
+  // compose: R|t = R_|t_ * R|t
+  R = R_*R;
+  t = R_*t+t_;
+
+  // return max delta in parameters
+  return max((R_-Matrix::eye(2)).l2norm(),t_.l2norm());
+}
+
 std::vector<int32_t> IcpPointToPoint::getInliers (double *T,const int32_t T_num,const Matrix &R,const Matrix &t,const double indist) {
 
   // init inlier vector + query point + query result
-  vector<int32_t>            inliers;
-  std::vector<float>         query(dim);
-  kdtree::KDTreeResultVector neighbor;
+  vector<int32_t> inliers;
+  float           query[3];
+  float           model[3];
+  float           dis;
   
   // dimensionality 2
   if (dim==2) {
@@ -184,10 +216,10 @@ std::vector<int32_t> IcpPointToPoint::getInliers (double *T,const int32_t T_num,
       query[1] = (float)(r10*T[i*2+0] + r11*T[i*2+1] + t1);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,neighbor);
+      M_model->nearest(query,model,dis);
 
       // check if it is an inlier
-      if (neighbor[0].dis<indist)
+      if (dis<indist)
         inliers.push_back(i);
     }
     
@@ -209,10 +241,10 @@ std::vector<int32_t> IcpPointToPoint::getInliers (double *T,const int32_t T_num,
       query[2] = (float)(r20*T[i*3+0] + r21*T[i*3+1] + r22*T[i*3+2] + t2);
 
       // search nearest neighbor
-      M_tree->n_nearest(query,1,neighbor);
+      M_model->nearest(query,model,dis);
 
       // check if it is an inlier
-      if (neighbor[0].dis<indist)
+      if (dis<indist)
         inliers.push_back(i);
     }
   }
@@ -22,18 +22,26 @@ Street, Fifth Floor, Boston, MA 02110-1301, USA
 #define ICP_POINT_TO_POINT_H
 
 #include "icp.h"
+#include <vector>
 
 class IcpPointToPoint : public Icp {
 
 public:
 
   IcpPointToPoint (double const* M,const int32_t M_num,const int32_t dim) : Icp(M,M_num,dim) {}
+  IcpPointToPoint (const IcpModel *model,const int32_t dim) : Icp(model,dim) {}
   virtual ~IcpPointToPoint () {}
 
 private:
 
   double fitStep (double *T,const int32_t T_num,Matrix &R,Matrix &t,const std::vector<int32_t> &active);
+  double fitStep2D (double *T,const int32_t T_num,Matrix &R,Matrix &t,const std::vector<int32_t> &active);
   std::vector<int32_t> getInliers (double *T,const int32_t T_num,const Matrix &R,const Matrix &t,const double indist);
+
+  // correspondences of the 2d case as structure of arrays,
+  // reused in all iterations
+  std::vector<float> tx, ty; // transformed template points
+  std::vector<float> mx, my; // closest model points
 };
 
 #endif // ICP_POINT_TO_POINT_H
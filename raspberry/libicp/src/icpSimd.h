@@ -0,0 +1,88 @@
+#ifndef ICP_SIMD_H
+#define ICP_SIMD_H
+
+// Vectorized reductions of the 2d point-to-point ICP step,
+// works on structure of arrays in single precision
+
+#include <stdint.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace libicp {
+
+// sum of v[0..n)
+inline float sum (const float *v,const int32_t n) {
+  int32_t i = 0;
+  float s = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t vs = vdupq_n_f32(0);
+  for (; i+4<=n; i+=4)
+    vs = vaddq_f32(vs,vld1q_f32(v+i));
+  s = vgetq_lane_f32(vs,0) + vgetq_lane_f32(vs,1) + vgetq_lane_f32(vs,2) + vgetq_lane_f32(vs,3);
+#elif defined(__SSE2__)
+  __m128 vs = _mm_setzero_ps();
+  for (; i+4<=n; i+=4)
+    vs = _mm_add_ps(vs,_mm_loadu_ps(v+i));
+  float buf[4];
+  _mm_storeu_ps(buf,vs);
+  s = buf[0] + buf[1] + buf[2] + buf[3];
+#endif
+  for (; i<n; i++)
+    s += v[i];
+  return s;
+}
+
+// with centered points qt = (tx,ty)-mu_t and qm = (mx,my)-mu_m computes
+// a = sum qt.x*qm.x + qt.y*qm.y and b = sum qt.x*qm.y - qt.y*qm.x,
+// i.e., the entries of the 2d cross-covariance that determine the rotation
+inline void rotationTerms (const float *tx,const float *ty,const float *mx,const float *my,const int32_t n,
+                    const float mut0,const float mut1,const float mum0,const float mum1,float &a,float &b) {
+  int32_t i = 0;
+  a = 0; b = 0;
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+  float32x4_t va = vdupq_n_f32(0), vb = vdupq_n_f32(0);
+  float32x4_t vmut0 = vdupq_n_f32(mut0), vmut1 = vdupq_n_f32(mut1);
+  float32x4_t vmum0 = vdupq_n_f32(mum0), vmum1 = vdupq_n_f32(mum1);
+  for (; i+4<=n; i+=4) {
+    float32x4_t qt0 = vsubq_f32(vld1q_f32(tx+i),vmut0);
+    float32x4_t qt1 = vsubq_f32(vld1q_f32(ty+i),vmut1);
+    float32x4_t qm0 = vsubq_f32(vld1q_f32(mx+i),vmum0);
+    float32x4_t qm1 = vsubq_f32(vld1q_f32(my+i),vmum1);
+    va = vmlaq_f32(vmlaq_f32(va,qt0,qm0),qt1,qm1);
+    vb = vmlsq_f32(vmlaq_f32(vb,qt0,qm1),qt1,qm0);
+  }
+  a = vgetq_lane_f32(va,0) + vgetq_lane_f32(va,1) + vgetq_lane_f32(va,2) + vgetq_lane_f32(va,3);
+  b = vgetq_lane_f32(vb,0) + vgetq_lane_f32(vb,1) + vgetq_lane_f32(vb,2) + vgetq_lane_f32(vb,3);
+#elif defined(__SSE2__)
+  __m128 va = _mm_setzero_ps(), vb = _mm_setzero_ps();
+  __m128 vmut0 = _mm_set1_ps(mut0), vmut1 = _mm_set1_ps(mut1);
+  __m128 vmum0 = _mm_set1_ps(mum0), vmum1 = _mm_set1_ps(mum1);
+  for (; i+4<=n; i+=4) {
+    __m128 qt0 = _mm_sub_ps(_mm_loadu_ps(tx+i),vmut0);
+    __m128 qt1 = _mm_sub_ps(_mm_loadu_ps(ty+i),vmut1);
+    __m128 qm0 = _mm_sub_ps(_mm_loadu_ps(mx+i),vmum0);
+    __m128 qm1 = _mm_sub_ps(_mm_loadu_ps(my+i),vmum1);
+    va = _mm_add_ps(va,_mm_add_ps(_mm_mul_ps(qt0,qm0),_mm_mul_ps(qt1,qm1)));
+    vb = _mm_add_ps(vb,_mm_sub_ps(_mm_mul_ps(qt0,qm1),_mm_mul_ps(qt1,qm0)));
+  }
+  float buf[4];
+  _mm_storeu_ps(buf,va);
+  a = buf[0] + buf[1] + buf[2] + buf[3];
+  _mm_storeu_ps(buf,vb);
+  b = buf[0] + buf[1] + buf[2] + buf[3];
+#endif
+  for (; i<n; i++) {
+    float qt0 = tx[i]-mut0, qt1 = ty[i]-mut1;
+    float qm0 = mx[i]-mum0, qm1 = my[i]-mum1;
+    a += qt0*qm0 + qt1*qm1;
+    b += qt0*qm1 - qt1*qm0;
+  }
+}
+
+} // namespace libicp
+
+#endif // ICP_SIMD_H
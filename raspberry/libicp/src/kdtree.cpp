@@ -377,7 +377,6 @@ namespace kdtree {
   
   void KDTree::n_nearest(std::vector<float>& qv, int nn, KDTreeResultVector& result) {
     SearchRecord sr(qv, *this, result);
-    std::vector<float> vdiff(dim, 0.0);
     
     result.clear();
     
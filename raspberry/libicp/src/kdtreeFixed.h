@@ -0,0 +1,121 @@
+#ifndef KDTREE_FIXED_H
+#define KDTREE_FIXED_H
+
+// kd tree with the dimension as template parameter
+//
+// Unlike kdtree::KDTree, points are stored contiguously as std::array<float,D>,
+// all loops over the dimension have a constant trip count and a nearest
+// neighbor query does not allocate. The tree is implicit: the node splitting
+// the index range [l,u) is the median element (l+u)/2, only its cut dimension
+// is stored.
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <stdint.h>
+#include <vector>
+
+namespace libicp {
+
+template<int D>
+class KDTree {
+
+public:
+
+  typedef std::array<float,D> Point;
+
+  // builds the tree, reorders points
+  explicit KDTree (std::vector<Point> points) : pts(std::move(points)), cut_dim(pts.size(),0) {
+    build(0,(int32_t)pts.size());
+  }
+
+  int32_t size () const { return (int32_t)pts.size(); }
+  const Point& operator[] (int32_t i) const { return pts[i]; }
+
+  // the points in tree order, callers can use them instead of keeping a copy
+  const std::vector<Point>& points () const { return pts; }
+
+  // index of the point closest to query, -1 if the tree is empty
+  // output: dis ... squared distance between query and closest point
+  int32_t nearest (const float *query,float &dis) const {
+    int32_t best = -1;
+    dis = std::numeric_limits<float>::max();
+    search(0,(int32_t)pts.size(),query,best,dis);
+    return best;
+  }
+
+private:
+
+  static const int32_t bucketsize = 8;
+
+  static float distance (const Point &p,const float *query) {
+    float dis = 0;
+    for (int32_t d=0; d<D; d++) {
+      float diff = p[d]-query[d];
+      dis += diff*diff;
+    }
+    return dis;
+  }
+
+  void build (const int32_t l,const int32_t u) {
+    if (u-l<=bucketsize)
+      return;
+
+    // split at the median of the dimension with the largest spread
+    Point lower = pts[l], upper = pts[l];
+    for (int32_t i=l+1; i<u; i++) {
+      for (int32_t d=0; d<D; d++) {
+        lower[d] = std::min(lower[d],pts[i][d]);
+        upper[d] = std::max(upper[d],pts[i][d]);
+      }
+    }
+    int32_t c = 0;
+    for (int32_t d=1; d<D; d++)
+      if (upper[c]-lower[c] < upper[d]-lower[d])
+        c = d;
+
+    int32_t m = (l+u)/2;
+    std::nth_element(pts.begin()+l,pts.begin()+m,pts.begin()+u,[c](const Point &a,const Point &b) { return a[c]<b[c]; });
+    cut_dim[m] = (uint8_t)c;
+
+    build(l,m);
+    build(m+1,u);
+  }
+
+  void search (const int32_t l,const int32_t u,const float *query,int32_t &best,float &dis) const {
+    if (u-l<=bucketsize) {
+      for (int32_t i=l; i<u; i++) {
+        float d = distance(pts[i],query);
+        if (d<dis) {
+          dis = d;
+          best = i;
+        }
+      }
+      return;
+    }
+
+    int32_t m = (l+u)/2;
+    float diff = query[cut_dim[m]]-pts[m][cut_dim[m]];
+    float d = distance(pts[m],query);
+    if (d<dis) {
+      dis = d;
+      best = m;
+    }
+
+    // the side containing the query first, the other one only if it can be closer
+    if (diff<0) {
+      search(l,m,query,best,dis);
+      if (diff*diff<dis) search(m+1,u,query,best,dis);
+    } else {
+      search(m+1,u,query,best,dis);
+      if (diff*diff<dis) search(l,m,query,best,dis);
+    }
+  }
+
+  std::vector<Point>   pts;
+  std::vector<uint8_t> cut_dim;
+};
+
+} // namespace libicp
+
+#endif // KDTREE_FIXED_H
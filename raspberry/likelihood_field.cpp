@@ -0,0 +1,94 @@
+#include "likelihood_field.h"
+#include "robot_configuration.h"
+
+#include <algorithm>
+
+#include <boost/range/algorithm/for_each.hpp>
+#include <opencv2/imgproc.hpp>
+
+CLikelihoodField::CLikelihoodField()
+    : m_agridfDistance{{
+        grid_type(rbt::size<int>(c_nMapExtent, c_nMapExtent), c_nMaxDistance),
+        grid_type(rbt::size<int>(c_nMapExtent, c_nMapExtent) / 2, c_nMaxDistance),
+        grid_type(rbt::size<int>(c_nMapExtent, c_nMapExtent) / 4, c_nMaxDistance)
+    }}
+{
+    static_assert(3==c_nLevels, "");
+}
+
+void CLikelihoodField::invalidate(rbt::point<int> const& pt) {
+    // pt affects the distances of all cells within c_nMaxDistance,
+    // these are at most four tiles because c_nMaxDistance < c_nTileExtent
+    static_assert(c_nMaxDistance < grid_type::c_nTileExtent, "");
+    auto const ptTileMin = grid_type::TileCoordinate(pt - rbt::size<int>(c_nMaxDistance, c_nMaxDistance));
+    auto const ptTileMax = grid_type::TileCoordinate(pt + rbt::size<int>(c_nMaxDistance, c_nMaxDistance));
+    for(int nTileY = ptTileMin.y; nTileY <= ptTileMax.y; ++nTileY) {
+        for(int nTileX = ptTileMin.x; nTileX <= ptTileMax.x; ++nTileX) {
+            m_vecptTileDirty.emplace_back(nTileX, nTileY);
+        }
+    }
+}
+
+void CLikelihoodField::update(std::function<bool(rbt::point<int> const&)> const& fnOccupied) {
+    std::sort(m_vecptTileDirty.begin(), m_vecptTileDirty.end());
+    m_vecptTileDirty.erase(std::unique(m_vecptTileDirty.begin(), m_vecptTileDirty.end()), m_vecptTileDirty.end());
+
+    // The distance transform of a tile and a c_nMaxDistance border around it
+    // is exact inside the tile for all distances up to c_nMaxDistance
+    int constexpr c_nExtent = grid_type::c_nTileExtent + 2 * c_nMaxDistance;
+    cv::Mat matnObstacle(c_nExtent, c_nExtent, CV_8UC1);
+    cv::Mat matfDistance;
+
+    boost::for_each(m_vecptTileDirty, [&](rbt::point<int> const& ptTile) {
+        auto const ptnTile = ptTile * grid_type::c_nTileExtent;
+        auto const ptnMin = ptnTile - rbt::size<int>(c_nMaxDistance, c_nMaxDistance);
+        for(int y = 0; y < c_nExtent; ++y) {
+            auto* pn = matnObstacle.ptr<std::uint8_t>(y);
+            for(int x = 0; x < c_nExtent; ++x) {
+                pn[x] = fnOccupied(ptnMin + rbt::size<int>(x, y)) ? 0 : 255;
+            }
+        }
+        cv::distanceTransform(matnObstacle, matfDistance, CV_DIST_L2, 3);
+
+        for(int y = 0; y < grid_type::c_nTileExtent; ++y) {
+            auto const* pf = matfDistance.ptr<float>(y + c_nMaxDistance) + c_nMaxDistance;
+            for(int x = 0; x < grid_type::c_nTileExtent; ++x) {
+                auto const pt = ptnTile + rbt::size<int>(x, y);
+                auto const fDistance = std::min(pf[x], static_cast<float>(c_nMaxDistance));
+                // Keep tiles shared with other grids if nothing changed
+                if(m_agridfDistance[0].at(pt)!=fDistance) {
+                    m_agridfDistance[0].mutable_at(pt) = fDistance;
+                }
+            }
+        }
+
+        for(int nLevel = 1; nLevel < c_nLevels; ++nLevel) {
+            UpdateLevel(nLevel, ptTile);
+        }
+    });
+    m_vecptTileDirty.clear();
+}
+
+void CLikelihoodField::UpdateLevel(int nLevel, rbt::point<int> const& ptTile) {
+    // The level 0 tile ptTile maps to c_nTileExtent/2^nLevel cells on nLevel,
+    // each is the minimum of 2 x 2 cells of the level below
+    static_assert(grid_type::c_nTileExtent % (1 << (c_nLevels - 1)) == 0, "");
+    int const nExtent = grid_type::c_nTileExtent >> nLevel;
+    auto const ptnTile = ptTile * nExtent;
+
+    auto const& gridfFine = m_agridfDistance[nLevel - 1];
+    auto& gridfCoarse = m_agridfDistance[nLevel];
+    for(int y = 0; y < nExtent; ++y) {
+        for(int x = 0; x < nExtent; ++x) {
+            auto const pt = ptnTile + rbt::size<int>(x, y);
+            auto const ptFine = pt * 2;
+            auto const fDistance = std::min(
+                std::min(gridfFine.at(ptFine), gridfFine.at(ptFine + rbt::size<int>(1, 0))),
+                std::min(gridfFine.at(ptFine + rbt::size<int>(0, 1)), gridfFine.at(ptFine + rbt::size<int>(1, 1)))
+            );
+            if(gridfCoarse.at(pt)!=fDistance) {
+                gridfCoarse.mutable_at(pt) = fDistance;
+            }
+        }
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include "geometry.h"
+#include "tiled_grid.h"
+
+#include <array>
+#include <vector>
+#include <functional>
+
+// Distance of each grid cell to the closest occupied cell, truncated at
+// c_nMaxDistance, i.e., the likelihood field of Thrun et al,
+// "Probabilistic Robotics" p 169ff. Distances are in grid cells.
+//
+// Instead of recomputing the distance transform of the whole map after
+// every scan, the occupancy grid reports each cell that changes between
+// free and occupied and update() recomputes only the tiles that are
+// within c_nMaxDistance of a changed cell.
+//
+// The field is kept as a pyramid of c_nLevels resolutions. A cell on level n
+// covers 2^n x 2^n cells of level 0 and stores the minimum distance in this
+// block, i.e., a lower bound of the distance of every point in the block.
+// The coarse levels are used to search large pose offsets cheaply.
+struct CLikelihoodField {
+    static int constexpr c_nMaxDistance = 10;
+    static int constexpr c_nLevels = 3; // 5cm, 10cm and 20cm cells
+
+    CLikelihoodField();
+
+    // Distance to the closest occupied cell in grid cells,
+    // c_nMaxDistance if there is none within c_nMaxDistance
+    float distance(rbt::point<int> const& pt) const { return m_agridfDistance[0].at(pt); }
+
+    // Minimum distance in grid cells within the 2^nLevel x 2^nLevel block containing pt
+    float distance(rbt::point<int> const& pt, int nLevel) const {
+        return m_agridfDistance[nLevel].at(rbt::point<int>(Coarse(pt.x, nLevel), Coarse(pt.y, nLevel)));
+    }
+
+    // Called when pt switched between free and occupied
+    void invalidate(rbt::point<int> const& pt);
+
+    // Recomputes the distances in all invalidated tiles
+    void update(std::function<bool(rbt::point<int> const&)> const& fnOccupied);
+
+private:
+    using grid_type = CTiledGrid<float>;
+
+    // Rounds towards negative infinity
+    static int Coarse(int n, int nLevel) { return n<0 ? ~(~n >> nLevel) : n >> nLevel; }
+
+    void UpdateLevel(int nLevel, rbt::point<int> const& ptTile);
+
+    std::array<grid_type, c_nLevels> m_agridfDistance;
+
+    std::vector<rbt::point<int>> m_vecptTileDirty; // tile coordinates, may contain duplicates
+};
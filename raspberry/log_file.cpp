@@ -0,0 +1,195 @@
+#include "log_file.h"
+#include "error_handling.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <clocale>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+
+#include <boost/range/algorithm/for_each.hpp>
+
+namespace {
+    std::size_t constexpr c_cbAlignment = 8;
+
+    std::size_t Padded(std::size_t cb) {
+        return (cb + c_cbAlignment - 1) / c_cbAlignment * c_cbAlignment;
+    }
+
+    bool ReadBinaryLogFile(
+        char const* pbBegin, char const* pbEnd,
+        std::function<void(double, SOdometryData const&)> const& fnOdometry,
+        std::function<void(double, SLogScan const*, std::size_t)> const& fnLidar
+    ) {
+        for(auto pb = pbBegin; pb < pbEnd;) {
+            if(pbEnd - pb < static_cast<std::ptrdiff_t>(sizeof(SLogRecordHeader))) {
+                std::cerr << "Truncated record in log file" << std::endl;
+                return false;
+            }
+            auto const& header = *reinterpret_cast<SLogRecordHeader const*>(pb);
+            auto const pbPayload = pb + sizeof(SLogRecordHeader);
+            if(pbEnd - pbPayload < static_cast<std::ptrdiff_t>(header.m_cbPayload)) {
+                std::cerr << "Truncated record in log file" << std::endl;
+                return false;
+            }
+
+            switch(header.m_elogrec) {
+                case elogrecOdometry:
+                    if(sizeof(SOdometryData)!=header.m_cbPayload) {
+                        std::cerr << "Invalid odometry record in log file" << std::endl;
+                        return false;
+                    }
+                    fnOdometry(header.m_fSeconds, *reinterpret_cast<SOdometryData const*>(pbPayload));
+                    break;
+                case elogrecLidar:
+                    if(0!=header.m_cbPayload % sizeof(SLogScan)) {
+                        std::cerr << "Invalid lidar record in log file" << std::endl;
+                        return false;
+                    }
+                    fnLidar(header.m_fSeconds, reinterpret_cast<SLogScan const*>(pbPayload), header.m_cbPayload / sizeof(SLogScan));
+                    break;
+                default:
+                    std::cerr << "Invalid record type in log file: " << header.m_elogrec << std::endl;
+                    return false;
+            }
+            pb = pbPayload + Padded(header.m_cbPayload);
+        }
+        return true;
+    }
+
+    bool ReadTextLogFile(
+        std::string const& strFile,
+        std::function<void(double, SOdometryData const&)> const& fnOdometry,
+        std::function<void(double, SLogScan const*, std::size_t)> const& fnLidar
+    ) {
+        std::ifstream ifs(strFile.c_str());
+        if(!ifs) return false;
+
+        std::setlocale(LC_ALL, "en_US.utf8");
+        std::vector<SLogScan> vecscan;
+        for( std::string strLine; std::getline( ifs, strLine ); ) {
+            if(!strLine.empty()) {
+                switch(strLine[0]) {
+                    case 'o':
+                        SOdometryData odom;
+                        double fSeconds;
+                        if(5==sscanf(strLine.data(), "o;%lf;%hd;%hd;%hd;%hd",
+                            &fSeconds,
+                            &odom.m_nFrontLeft,
+                            &odom.m_nFrontRight,
+                            &odom.m_nBackLeft,
+                            &odom.m_nBackRight))
+                        {
+                            fnOdometry(fSeconds, odom);
+                        } else {
+                            std::cerr << "Invalid odometry data: " << strLine << std::endl;
+                        }
+                        break;
+                    case 'l':
+                    {
+                        double fSeconds = 0;
+                        sscanf(strLine.data(), "l;%lf", &fSeconds);
+
+                        vecscan.clear();
+                        for(auto i = strLine.find(';', strLine.find(';') + 1);;) {
+                            auto iEnd = strLine.find(';', i+1);
+                            if(iEnd==std::string::npos) break;
+
+                            int nAngle;
+                            int nDistance;
+                            if(2==sscanf(&strLine[i+1], "%d/%d", &nAngle, &nDistance)) {
+                                vecscan.push_back({static_cast<std::int16_t>(nAngle), static_cast<std::int16_t>(nDistance)});
+                            } else {
+                                std::cerr << "Invalid lidar data: " << &strLine[i] << std::endl;
+                            }
+                            i = iEnd;
+                        }
+                        fnLidar(fSeconds, vecscan.data(), vecscan.size());
+                        break;
+                    }
+                    default:
+                        std::cerr << "Invalid line in log file: " << strLine << std::endl;
+                        return false;
+                }
+            }
+        }
+        return true;
+    }
+}
+
+bool CLogWriter::open(std::string const& strFile) {
+    m_ofs.open(strFile, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+    m_ofs.write(c_achLogMagic, sizeof(c_achLogMagic));
+    return m_ofs.good();
+}
+
+void CLogWriter::write(double fSeconds, SOdometryData const& odom) {
+    write(fSeconds, elogrecOdometry, &odom, sizeof(odom));
+}
+
+void CLogWriter::write(double fSeconds, std::vector<SScanLine::SScan> const& vecscan) {
+    std::vector<SLogScan> vecscanLog;
+    vecscanLog.reserve(vecscan.size());
+    boost::for_each(vecscan, [&](SScanLine::SScan const& scan) {
+        vecscanLog.push_back({
+            static_cast<std::int16_t>(scan.m_nAngle),
+            static_cast<std::int16_t>(scan.m_nDistance)
+        });
+    });
+    write(fSeconds, vecscanLog.data(), vecscanLog.size());
+}
+
+void CLogWriter::write(double fSeconds, SLogScan const* pscan, std::size_t cScans) {
+    write(fSeconds, elogrecLidar, pscan, cScans * sizeof(SLogScan));
+}
+
+void CLogWriter::write(double fSeconds, ELogRecord elogrec, void const* pvPayload, std::size_t cbPayload) {
+    SLogRecordHeader const header = {static_cast<std::uint32_t>(cbPayload), elogrec, fSeconds};
+
+    m_vecchBuffer.assign(sizeof(header) + Padded(cbPayload), 0);
+    std::memcpy(m_vecchBuffer.data(), &header, sizeof(header));
+    std::memcpy(m_vecchBuffer.data() + sizeof(header), pvPayload, cbPayload);
+    m_ofs.write(m_vecchBuffer.data(), m_vecchBuffer.size());
+}
+
+bool ReadLogFile(
+    std::string const& strFile,
+    std::function<void(double fSeconds, SOdometryData const& odom)> const& fnOdometry,
+    std::function<void(double fSeconds, SLogScan const* pscan, std::size_t cScans)> const& fnLidar
+) {
+    SMappedFile file(strFile);
+    if(0<=file.m_fd && !file.m_pb) {
+        // empty or cannot be mapped, try reading as text
+        return ReadTextLogFile(strFile, fnOdometry, fnLidar);
+    } else if(!file.m_pb) {
+        return false;
+    }
+
+    if(sizeof(c_achLogMagic)<=file.m_cb && 0==std::memcmp(file.m_pb, c_achLogMagic, sizeof(c_achLogMagic))) {
+        return ReadBinaryLogFile(file.m_pb + sizeof(c_achLogMagic), file.m_pb + file.m_cb, fnOdometry, fnLidar);
+    } else {
+        return ReadTextLogFile(strFile, fnOdometry, fnLidar);
+    }
+}
+
+bool ConvertLogFile(std::string const& strFileIn, std::string const& strFileOut) {
+    CLogWriter logwriter;
+    if(!logwriter.open(strFileOut)) return false;
+    return ReadLogFile(strFileIn,
+        [&](double fSeconds, SOdometryData const& odom) {
+            logwriter.write(fSeconds, odom);
+        },
+        [&](double fSeconds, SLogScan const* pscan, std::size_t cScans) {
+            logwriter.write(fSeconds, pscan, cScans);
+        });
+}
+
+void AssignReplayScans(SLogScan const* pscan, std::size_t cScans, std::vector<SScanLine::SScan>& vecscan) {
+    // The lidar angles are logged as reported by ForEachScan, replay
+    // has always rotated them by 180 degrees
+    vecscan.clear();
+    std::for_each(pscan, pscan + cScans, [&](SLogScan const& scan) {
+        vecscan.emplace_back(scan.m_nAngle < 180 ? scan.m_nAngle + 180 : scan.m_nAngle - 180, scan.m_nDistance);
+    });
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "rover.h"
+#include "scanline.h"
+#include "nonmoveable.h"
+
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Sensor data log files
+//
+// The robot writes a binary log: The file starts with c_achLogMagic,
+// followed by a sequence of records. Each record is a SLogRecordHeader
+// followed by m_cbPayload bytes of payload and padding to a multiple of 8 bytes,
+// so every header and payload is naturally aligned in a memory-mapped file.
+// The payload of an odometry record is a SOdometryData, the payload of a
+// lidar record is an array of SLogScan.
+//
+// The old text format is still supported for reading. Each line is either
+// "o;<seconds>;<front left>;<front right>;<back left>;<back right>" or
+// "l;<seconds>;<angle>/<distance>;<angle>/<distance>;...;"
+
+constexpr char c_achLogMagic[8] = {'R', 'B', 'T', 'L', 'O', 'G', '1', '\0'};
+
+enum ELogRecord : std::uint32_t {
+    elogrecOdometry = 1,
+    elogrecLidar = 2
+};
+
+struct SLogRecordHeader {
+    std::uint32_t m_cbPayload;
+    ELogRecord m_elogrec;
+    double m_fSeconds; // since start of recording
+};
+static_assert(sizeof(SLogRecordHeader)==16, "");
+
+struct SLogScan {
+    std::int16_t m_nAngle; // SScanLine::SScan::m_nAngle
+    std::int16_t m_nDistance;
+};
+static_assert(sizeof(SLogScan)==4, "");
+
+// Writes a binary log file. Each message is written with a single write call.
+struct CLogWriter : rbt::nonmoveable {
+    bool open(std::string const& strFile);
+    bool is_open() const { return m_ofs.is_open(); }
+
+    void write(double fSeconds, SOdometryData const& odom);
+    void write(double fSeconds, std::vector<SScanLine::SScan> const& vecscan);
+    void write(double fSeconds, SLogScan const* pscan, std::size_t cScans);
+
+private:
+    void write(double fSeconds, ELogRecord elogrec, void const* pvPayload, std::size_t cbPayload);
+
+    std::ofstream m_ofs;
+    std::vector<char> m_vecchBuffer;
+};
+
+// Reads a binary or text log file and calls fnOdometry or fnLidar for each record.
+// Binary log files are memory-mapped and read without parsing, fnLidar gets
+// the cScans scans at pscan as logged, they are valid during the call.
+// Returns false if the file could not be read or contains invalid records.
+bool ReadLogFile(
+    std::string const& strFile,
+    std::function<void(double fSeconds, SOdometryData const& odom)> const& fnOdometry,
+    std::function<void(double fSeconds, SLogScan const* pscan, std::size_t cScans)> const& fnLidar
+);
+
+// Replaces vecscan by the logged scans as replayed, keeping its capacity
+void AssignReplayScans(SLogScan const* pscan, std::size_t cScans, std::vector<SScanLine::SScan>& vecscan);
+
+// Converts a text or binary log file to a binary log file
+bool ConvertLogFile(std::string const& strFileIn, std::string const& strFileOut);
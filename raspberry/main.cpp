@@ -1,14 +1,24 @@
 #include "error_handling.h"
+#include "worker_pool.h"
+#include "random_generator.h"
 
 #include "rover.h"
 #include "scanline.h"
+#include "log_file.h"
+#include "map_file.h"
+#include "batch_replay.h"
+#include "video_writer.h"
+#include "slam_backend.h"
 
+#include <algorithm>
 #include <chrono>
 #include <iostream>
 #include <fstream>
+#include <thread>
 
 #include <boost/program_options.hpp>
 #include <boost/optional.hpp>
+#include <boost/lexical_cast.hpp>
 
 constexpr char c_szHELP[] = "help";
 constexpr char c_szPORT[] = "port";
@@ -16,13 +26,33 @@ constexpr char c_szLIDAR[] = "lidar";
 constexpr char c_szLOG[] = "log";
 constexpr char c_szMANUAL[] = "manual";
 constexpr char c_szMAP[] = "map";
+constexpr char c_szMAPRATE[] = "map-rate";
+constexpr char c_szTHREADS[] = "threads";
+constexpr char c_szSEED[] = "seed";
+constexpr char c_szSLAM[] = "slam";
+constexpr char c_szMINPARTICLES[] = "min-particles";
+constexpr char c_szMAXPARTICLES[] = "max-particles";
+constexpr char c_szLOADMAP[] = "load-map";
+constexpr char c_szLOCALIZE[] = "localize";
+constexpr char c_szSAVEMAP[] = "save-map";
+constexpr char c_szCOMPRESSMAP[] = "compress-map";
 
 constexpr char c_szINPUT[] = "input-file";
 constexpr char c_szVIDEO[] = "video";
+constexpr char c_szVIDEOFPS[] = "video-fps";
+constexpr char c_szVIDEOCHANGED[] = "video-changed-only";
 constexpr char c_szOUTPUT[] = "out";
 
-int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput);
-int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& ostrOutput);
+constexpr char c_szBATCH[] = "batch";
+constexpr char c_szJOBS[] = "jobs";
+constexpr char c_szPARTICLES[] = "particles";
+constexpr char c_szSENSORSIGMA[] = "sensor-sigma";
+constexpr char c_szRANGENOISE[] = "range-noise";
+constexpr char c_szTURNNOISE[] = "turn-noise";
+constexpr char c_szDRIFTNOISE[] = "drift-noise";
+
+int ParseLogFile(std::string const& strLogFile, boost::optional<SVideoOptions> const& ovideooptions, boost::optional<std::string> const& ostrOutput, SSlamBackendOptions const& slamoptions, SMapFileOptions const& mapfileoptions);
+int ConnectToRobot(std::string const& strPort, std::string const& strLidar, CLogWriter& logwriter, bool bManual, boost::optional<std::string> const& ostrOutput, double fMapRate, SSlamBackendOptions const& slamoptions, SMapFileOptions const& mapfileoptions);
 
 int main(int nArgs, char* aczArgs[]) {
 	namespace po = boost::program_options;
@@ -35,58 +65,194 @@ int main(int nArgs, char* aczArgs[]) {
 	//	 Currently, the robot can be controlled manually using the WASD keys and 
 	//	 the robot controller will send the sensor data which can be saved for
 	//	 later analysis
+	std::string strSlamHelp = "SLAM algorithm used with --input-file and on the robot, one of";
+	for(int i = 0; i < c_cSlamBackend; ++i) strSlamHelp = strSlamHelp + " " + c_aszSlamBackend[i];
+
 	po::options_description optdescGeneric("Allowed options");
 	optdescGeneric.add_options()
 	    (c_szHELP, "Print help message")
 	    (c_szPORT, po::value<std::string>()->value_name("p"), "Connect to robot on port <p>")
 	    (c_szLIDAR, po::value<std::string>()->value_name("l"), "Connect to Lidar sensor on port <p>")
-	    (c_szINPUT, po::value<std::string>()->value_name("file"), "Read sensor data from input file <file>");
+	    (c_szINPUT, po::value<std::string>()->value_name("file"), "Read sensor data from binary or text log <file>")
+	    (c_szTHREADS, po::value<int>()->value_name("n"), "Update particles using <n> threads (default: number of cores)")
+	    (c_szSEED, po::value<std::uint64_t>()->value_name("n"), "Seed random number generators with <n> (default: random seed)")
+	    (c_szSLAM, po::value<std::string>()->value_name("name")->default_value(c_aszSlamBackend[0]), strSlamHelp.c_str())
+	    (c_szMAXPARTICLES, po::value<int>()->value_name("n"), "Adapt the particle count of fastslam, particle and mcl between --min-particles and <n> by KLD sampling (default: fixed count)")
+	    (c_szMINPARTICLES, po::value<int>()->value_name("n")->default_value(5), "The fewest particles with --max-particles")
+	    (c_szLOADMAP, po::value<std::string>()->value_name("file"), "Start from the map saved in <file> instead of an empty map")
+	    (c_szLOCALIZE, "With --load-map and --slam fastslam, only localize the robot in the loaded map without updating it")
+	    (c_szSAVEMAP, po::value<std::string>()->value_name("file"), "Save the map to <file> after replaying --input-file or when pressing 's' on the robot")
+	    (c_szCOMPRESSMAP, "Compress the map tiles saved by --save-map. Uncompressed maps load faster.");
 
 	po::options_description optdescRobot("Robot options");
 	optdescRobot.add_options()
-	    (c_szLOG, po::value<std::string>()->value_name("file"), "Log all sensor data to <file>")
+	    (c_szLOG, po::value<std::string>()->value_name("file"), "Log all sensor data to binary log <file>. With --input-file, convert input file to binary log <file>")
 	    (c_szMANUAL, "Control robot manually via AWSD keys")
-        (c_szMAP, po::value<std::string>()->value_name("file"), "Write map to <file>");
+        (c_szMAP, po::value<std::string>()->value_name("file"), "Write map to <file>")
+        (c_szMAPRATE, po::value<double>()->value_name("hz")->default_value(2.0), "Render the map served at http://<robot>:8088/map.png and written to --map at most <hz> times per second");
     
     po::options_description optdescInputFile("Input File Options");
 	optdescInputFile.add_options()
 	    (c_szVIDEO, "If specified, a video of path will be written instead of map image")
+        (c_szVIDEOFPS, po::value<double>()->value_name("fps")->default_value(SVideoOptions().m_fFps), "Frames per second of the video, at most one frame is taken per 1/<fps> seconds of the log")
+        (c_szVIDEOCHANGED, "Skip video frames that look exactly like the previous one")
         (c_szOUTPUT, po::value<std::string>()->value_name("file"), "Write output to <file>");
     
+    // Defaults from the default parameters and their description
+    SFastSlamParameters const params;
+    auto const Default = [](auto t) { return std::vector<decltype(t)>{t}; };
+    auto const Text = [](auto t) { return boost::lexical_cast<std::string>(t); };
+
+    po::options_description optdescBatch("Batch Options");
+    optdescBatch.add_options()
+        (c_szBATCH, po::value<std::vector<std::string>>()->value_name("files")->multitoken(), 
+            "Replay all log <files> with every combination of the parameters below and write a table of the results to --out or stdout")
+        (c_szJOBS, po::value<int>()->value_name("n"), "Run <n> replays at a time (default: number of cores), each on a single thread. --threads requires --jobs 1.")
+        (c_szPARTICLES, po::value<std::vector<int>>()->value_name("n")->multitoken()
+            ->default_value(Default(params.m_cParticles), Text(params.m_cParticles)), "Particle counts")
+        (c_szSENSORSIGMA, po::value<std::vector<double>>()->value_name("cm")->multitoken()
+            ->default_value(Default(params.m_sensor.m_fSigma), Text(params.m_sensor.m_fSigma)), "Sigmas of the sensor model, see SSensorModelParameters")
+        (c_szRANGENOISE, po::value<std::vector<double>>()->value_name("f")->multitoken()
+            ->default_value(Default(params.m_motion.m_fRangeStdDev), Text(params.m_motion.m_fRangeStdDev)), "Range errors of the motion model in cm/cm")
+        (c_szTURNNOISE, po::value<std::vector<double>>()->value_name("f")->multitoken()
+            ->default_value(Default(params.m_motion.m_fTurnVar), Text(params.m_motion.m_fTurnVar)), "Turn error variances of the motion model in rad^2/rad")
+        (c_szDRIFTNOISE, po::value<std::vector<double>>()->value_name("f")->multitoken()
+            ->default_value(Default(params.m_motion.m_fDriftVar), Text(params.m_motion.m_fDriftVar)), "Drift error variances of the motion model in rad^2/cm");
+
     po::options_description optdesc;
-    optdesc.add(optdescGeneric).add(optdescRobot).add(optdescInputFile);
+    optdesc.add(optdescGeneric).add(optdescRobot).add(optdescInputFile).add(optdescBatch);
     
 	po::variables_map vm;
 	po::store(po::parse_command_line(nArgs, aczArgs, optdesc), vm);
 	po::notify(vm);    
 	
+	if(vm.count(c_szTHREADS)) {
+		auto const cThreads = vm[c_szTHREADS].as<int>();
+		if(cThreads<1) {
+			std::cerr << "The number of threads must be at least 1" << std::endl;
+			return 1;
+		}
+		SetWorkerPoolThreads(cThreads);
+	} else if(vm.count(c_szBATCH)) {
+		// The replays run in parallel instead of the particle updates. A pool
+		// with a single thread runs the particle updates inline, so each
+		// replay is only timed for its own work.
+		SetWorkerPoolThreads(1);
+	}
+	if(vm.count(c_szSEED)) {
+		SetRandomSeed(vm[c_szSEED].as<std::uint64_t>());
+	}
+
+	SMapFileOptions mapfileoptions;
+	if(vm.count(c_szLOADMAP)) mapfileoptions.m_ostrLoad = vm[c_szLOADMAP].as<std::string>();
+	mapfileoptions.m_bLocalizeOnly = vm.count(c_szLOCALIZE);
+	if(vm.count(c_szSAVEMAP)) mapfileoptions.m_ostrSave = vm[c_szSAVEMAP].as<std::string>();
+	mapfileoptions.m_bCompress = vm.count(c_szCOMPRESSMAP);
+	if(mapfileoptions.m_bLocalizeOnly && !mapfileoptions.m_ostrLoad) {
+		std::cerr << "--localize requires --load-map" << std::endl;
+		return 1;
+	}
+	SSlamBackendOptions slamoptions;
+	slamoptions.m_strBackend = vm[c_szSLAM].as<std::string>();
+	if(vm.count(c_szMAXPARTICLES)) {
+		slamoptions.m_count.m_cMinParticles = vm[c_szMINPARTICLES].as<int>();
+		slamoptions.m_count.m_cMaxParticles = vm[c_szMAXPARTICLES].as<int>();
+		if(slamoptions.m_count.m_cMinParticles<1 || slamoptions.m_count.m_cMaxParticles<slamoptions.m_count.m_cMinParticles) {
+			std::cerr << "--max-particles must be at least --min-particles, which must be at least 1" << std::endl;
+			return 1;
+		}
+	}
+
 	if(vm.count(c_szHELP)) {
 		std::cout << optdesc << std::endl;
 		return 0;
+	} else if(vm.count(c_szBATCH)) {
+		auto const& veccParticles = vm[c_szPARTICLES].as<std::vector<int>>();
+		if(std::any_of(veccParticles.begin(), veccParticles.end(), [](int c) { return c<1; })) {
+			std::cerr << "The number of particles must be at least 1" << std::endl;
+			return 1;
+		}
+		auto const& vecfSigma = vm[c_szSENSORSIGMA].as<std::vector<double>>();
+		if(std::any_of(vecfSigma.begin(), vecfSigma.end(), [](double f) { return !(0<f); })) {
+			std::cerr << "The sensor sigma must be positive" << std::endl;
+			return 1;
+		}
+		for(auto sz : {c_szRANGENOISE, c_szTURNNOISE, c_szDRIFTNOISE}) {
+			auto const& vecf = vm[sz].as<std::vector<double>>();
+			if(std::any_of(vecf.begin(), vecf.end(), [](double f) { return !(0<=f); })) {
+				std::cerr << "--" << sz << " must not be negative" << std::endl;
+				return 1;
+			}
+		}
+
+		std::vector<SFastSlamParameters> vecparams;
+		for(int cParticles : veccParticles) {
+			for(double fSigma : vecfSigma) {
+				for(double fRange : vm[c_szRANGENOISE].as<std::vector<double>>()) {
+					for(double fTurn : vm[c_szTURNNOISE].as<std::vector<double>>()) {
+						for(double fDrift : vm[c_szDRIFTNOISE].as<std::vector<double>>()) {
+							auto paramsReplay = params;
+							paramsReplay.m_cParticles = cParticles;
+							paramsReplay.m_sensor.m_fSigma = fSigma;
+							paramsReplay.m_motion = {fRange, fTurn, fDrift};
+							paramsReplay.m_count = slamoptions.m_count;
+							vecparams.emplace_back(paramsReplay);
+						}
+					}
+				}
+			}
+		}
+		auto const cJobs = vm.count(c_szJOBS) 
+			? vm[c_szJOBS].as<int>() 
+			: static_cast<int>(std::max(1u, std::thread::hardware_concurrency()));
+		if(cJobs<1) {
+			std::cerr << "The number of jobs must be at least 1" << std::endl;
+			return 1;
+		}
+		if(1<cJobs && vm.count(c_szTHREADS)) {
+			// The replays would run each other's particle updates and the times would include them
+			std::cerr << "--threads with --batch requires --jobs 1" << std::endl;
+			return 1;
+		}
+
+		auto const& vecstrLogFile = vm[c_szBATCH].as<std::vector<std::string>>();
+		if(vm.count(c_szOUTPUT)) {
+			std::ofstream ofs(vm[c_szOUTPUT].as<std::string>());
+			return BatchReplay(vecstrLogFile, vecparams, cJobs, ofs) && ofs ? 0 : 1;
+		}
+		return BatchReplay(vecstrLogFile, vecparams, cJobs, std::cout) ? 0 : 1;
 	} else if(vm.count(c_szINPUT)) {
 		// Read saved sensor data from log file 
 		auto const strLogFile = vm[c_szINPUT].as<std::string>();
-		std::ifstream ifs(strLogFile.c_str());
-		if(!ifs) {
-			std::cerr << "Couldn't open " << vm[c_szINPUT].as<std::string>() << std::endl;
-			return 1;
-		}
 
-        bool const bVideo = vm.count(c_szVIDEO);
+        if(vm.count(c_szLOG)) {
+            // Convert input file to binary log
+            return ConvertLogFile(strLogFile, vm[c_szLOG].as<std::string>()) ? 0 : 1;
+        }
+
+        boost::optional<SVideoOptions> ovideooptions;
+        if(vm.count(c_szVIDEO)) {
+            ovideooptions = SVideoOptions();
+            ovideooptions->m_fFps = vm[c_szVIDEOFPS].as<double>();
+            ovideooptions->m_bChangedOnly = vm.count(c_szVIDEOCHANGED);
+            if(ovideooptions->m_fFps <= 0) {
+                std::cerr << "The video frame rate must be positive" << std::endl;
+                return 1;
+            }
+        }
         boost::optional<std::string> ostrOutput = vm.count(c_szOUTPUT)
              ? boost::make_optional(vm[c_szOUTPUT].as<std::string>())
              : boost::none;
         
-         return ParseLogFile(ifs, bVideo, ostrOutput);		
+         return ParseLogFile(strLogFile, ovideooptions, ostrOutput, slamoptions, mapfileoptions);		
 	} else if(vm.count(c_szPORT) && vm.count(c_szLIDAR)) {
 		// Read serial port, log file name etc
 		auto const strPort = vm[c_szPORT].as<std::string>();
 		auto const strLidar = vm[c_szLIDAR].as<std::string>();
 		
-		std::basic_ofstream<char> ofsLog;
+		CLogWriter logwriter;
 		if(vm.count(c_szLOG)) {
-			ofsLog.open(vm[c_szLOG].as<std::string>(), std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
-			VERIFY(ofsLog.good());
+			VERIFY(logwriter.open(vm[c_szLOG].as<std::string>()));
 		}
 		bool const bManual = vm.count(c_szMANUAL);
         
@@ -94,7 +260,12 @@ int main(int nArgs, char* aczArgs[]) {
         if(vm.count(c_szMAP)) {
 			strOutput = vm[c_szMAP].as<std::string>();
 		}
-        return ConnectToRobot(strPort, strLidar, ofsLog, bManual, strOutput);
+        auto const fMapRate = vm[c_szMAPRATE].as<double>();
+        if(!(0.0 < fMapRate)) {
+            std::cerr << "The map rate must be positive" << std::endl;
+            return 1;
+        }
+        return ConnectToRobot(strPort, strLidar, logwriter, bManual, strOutput, fMapRate, slamoptions, mapfileoptions);
 	} else {
 		std::cerr << "You must specify either the port to read from or an input file to parse" << std::endl;
 		std::cerr << optdesc << std::endl;
@@ -0,0 +1,199 @@
+#include "map_file.h"
+#include "mapped_file.h"
+#include "robot_configuration.h"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+#include <vector>
+
+namespace {
+    // Bound of the tile coordinates in a map file, 256 tiles of 32 cells of 5 cm are ~400 m
+    std::int32_t constexpr c_nMaxTileCoordinate = 256;
+
+    int constexpr c_cCells = CTiledGrid<float>::c_nTileExtent * CTiledGrid<float>::c_nTileExtent;
+    using planes_type = std::array<unsigned char, c_cbMapFileTile>;
+
+    std::size_t Padded(std::size_t cb) {
+        return (cb + c_cbMapFilePage - 1) / c_cbMapFilePage * c_cbMapFilePage;
+    }
+
+    // Byte i of the cells is at ab[i * c_cCells + cell], the sign and exponent
+    // bytes of the log odds vary much less than the mantissa bytes
+    void ToPlanes(float const* pf, planes_type& ab) {
+        for(int i = 0; i < c_cCells; ++i) {
+            unsigned char abCell[sizeof(float)];
+            std::memcpy(abCell, pf + i, sizeof(float));
+            for(std::size_t ib = 0; ib < sizeof(float); ++ib) ab[ib * c_cCells + i] = abCell[ib];
+        }
+    }
+
+    void FromPlanes(planes_type const& ab, float* pf) {
+        for(int i = 0; i < c_cCells; ++i) {
+            unsigned char abCell[sizeof(float)];
+            for(std::size_t ib = 0; ib < sizeof(float); ++ib) abCell[ib] = ab[ib * c_cCells + i];
+            std::memcpy(pf + i, abCell, sizeof(float));
+        }
+    }
+
+    // PackBits: A control byte n < 128 is followed by n + 1 literal bytes,
+    // n > 128 by one byte that is repeated 257 - n times
+    void Compress(float const* pf, std::vector<unsigned char>& vecb) {
+        planes_type ab;
+        ToPlanes(pf, ab);
+        for(std::size_t i = 0; i < ab.size();) {
+            std::size_t cRun = 1;
+            while(i + cRun < ab.size() && cRun < 128 && ab[i + cRun]==ab[i]) ++cRun;
+            if(2 <= cRun) {
+                vecb.push_back(static_cast<unsigned char>(257 - cRun));
+                vecb.push_back(ab[i]);
+                i += cRun;
+            } else {
+                // Literals up to the next run of three or more bytes
+                auto j = i;
+                while(j < ab.size() && j - i < 128 && !(j + 2 < ab.size() && ab[j]==ab[j + 1] && ab[j]==ab[j + 2])) ++j;
+                vecb.push_back(static_cast<unsigned char>(j - i - 1));
+                vecb.insert(vecb.end(), ab.begin() + i, ab.begin() + j);
+                i = j;
+            }
+        }
+    }
+
+    bool Decompress(unsigned char const* pb, std::size_t cb, float* pf) {
+        planes_type ab;
+        std::size_t i = 0;
+        for(auto const pbEnd = pb + cb; pb < pbEnd;) {
+            std::size_t const n = *pb++;
+            if(n < 128) {
+                auto const c = n + 1;
+                if(static_cast<std::size_t>(pbEnd - pb) < c || ab.size() - i < c) return false;
+                std::copy(pb, pb + c, ab.begin() + i);
+                pb += c;
+                i += c;
+            } else if(128 < n) {
+                auto const c = 257 - n;
+                if(pb==pbEnd || ab.size() - i < c) return false;
+                std::fill_n(ab.begin() + i, c, *pb++);
+                i += c;
+            } else {
+                return false;
+            }
+        }
+        if(ab.size()!=i) return false;
+        FromPlanes(ab, pf);
+        return true;
+    }
+}
+
+bool SaveMap(std::string const& strFile, SSavedMap const& savedmap, bool bCompress) {
+    std::vector<std::pair<rbt::point<int>, float const*>> vecpairptpf; // tile coordinate, cells
+    savedmap.m_gridfLogOdds.ForEachTile([&](rbt::point<int> const& ptTile, CTiledGrid<float>::STileVersion const&, float const* pf) {
+        vecpairptpf.emplace_back(ptTile, pf);
+    });
+
+    SMapFileHeader header = {};
+    std::memcpy(header.m_achMagic, c_achMapMagic, sizeof(c_achMapMagic));
+    header.m_nFlags = bCompress ? static_cast<std::uint32_t>(emapfileCompressed) : 0u;
+    header.m_nTileExtent = CTiledGrid<float>::c_nTileExtent;
+    header.m_fX = savedmap.m_pose.m_pt.x;
+    header.m_fY = savedmap.m_pose.m_pt.y;
+    header.m_fYaw = savedmap.m_pose.m_fYaw;
+    header.m_cTiles = static_cast<std::uint32_t>(vecpairptpf.size());
+
+    auto const cbDirectory = sizeof(SMapFileHeader) + vecpairptpf.size() * sizeof(SMapFileTile);
+    auto const ibData = bCompress ? cbDirectory : Padded(cbDirectory);
+
+    std::vector<SMapFileTile> vectile;
+    std::vector<unsigned char> vecbData; // compressed tiles
+    for(auto const& pairptpf : vecpairptpf) {
+        SMapFileTile tile = {pairptpf.first.x, pairptpf.first.y, static_cast<std::uint32_t>(c_cbMapFileTile), 0, 0};
+        if(bCompress) {
+            auto const ib = vecbData.size();
+            Compress(pairptpf.second, vecbData);
+            if(c_cbMapFileTile <= vecbData.size() - ib) {
+                vecbData.resize(ib);
+                auto const pb = reinterpret_cast<unsigned char const*>(pairptpf.second);
+                vecbData.insert(vecbData.end(), pb, pb + c_cbMapFileTile);
+            }
+            tile.m_cb = static_cast<std::uint32_t>(vecbData.size() - ib);
+            tile.m_ib = ibData + ib;
+        } else {
+            tile.m_ib = ibData + vectile.size() * c_cbMapFileTile;
+        }
+        vectile.push_back(tile);
+    }
+
+    auto const strFileTemp = strFile + ".tmp";
+    {
+        std::ofstream ofs(strFileTemp, std::ios_base::binary | std::ios_base::out | std::ios_base::trunc);
+        ofs.write(reinterpret_cast<char const*>(&header), sizeof(header));
+        ofs.write(reinterpret_cast<char const*>(vectile.data()), vectile.size() * sizeof(SMapFileTile));
+        if(bCompress) {
+            ofs.write(reinterpret_cast<char const*>(vecbData.data()), vecbData.size());
+        } else {
+            std::vector<char> const vecchPadding(ibData - cbDirectory, 0);
+            ofs.write(vecchPadding.data(), vecchPadding.size());
+            for(auto const& pairptpf : vecpairptpf) {
+                ofs.write(reinterpret_cast<char const*>(pairptpf.second), c_cbMapFileTile);
+            }
+        }
+        ofs.close();
+        if(!ofs) return false;
+    }
+    return 0==std::rename(strFileTemp.c_str(), strFile.c_str());
+}
+
+boost::optional<SSavedMap> LoadMap(std::string const& strFile) {
+    SMappedFile file(strFile);
+    if(!file.m_pb) return boost::none;
+
+    SMapFileHeader header;
+    if(file.m_cb < sizeof(header)) {
+        std::cerr << "Truncated map file" << std::endl;
+        return boost::none;
+    }
+    std::memcpy(&header, file.m_pb, sizeof(header));
+    if(0!=std::memcmp(header.m_achMagic, c_achMapMagic, sizeof(c_achMapMagic)) || CTiledGrid<float>::c_nTileExtent!=header.m_nTileExtent) {
+        std::cerr << "Invalid map file" << std::endl;
+        return boost::none;
+    }
+    if((file.m_cb - sizeof(header)) / sizeof(SMapFileTile) < header.m_cTiles) {
+        std::cerr << "Truncated map file" << std::endl;
+        return boost::none;
+    }
+
+    SSavedMap savedmap{
+        CTiledGrid<float>(rbt::size<int>(c_nMapExtent, c_nMapExtent), 0.0f),
+        rbt::pose<double>(rbt::point<double>(header.m_fX, header.m_fY), header.m_fYaw)
+    };
+    auto const bCompressed = 0!=(header.m_nFlags & emapfileCompressed);
+    for(std::uint32_t i = 0; i < header.m_cTiles; ++i) {
+        SMapFileTile tile;
+        std::memcpy(&tile, file.m_pb + sizeof(header) + i * sizeof(SMapFileTile), sizeof(tile));
+        if(file.m_cb < tile.m_ib || file.m_cb - tile.m_ib < tile.m_cb) {
+            std::cerr << "Truncated map file" << std::endl;
+            return boost::none;
+        }
+
+        // The bounding box of the grid covers all tiles, bogus coordinates would make it huge
+        if(tile.m_nX < -c_nMaxTileCoordinate || c_nMaxTileCoordinate < tile.m_nX
+        || tile.m_nY < -c_nMaxTileCoordinate || c_nMaxTileCoordinate < tile.m_nY) {
+            std::cerr << "Invalid tile in map file" << std::endl;
+            return boost::none;
+        }
+
+        auto const pb = reinterpret_cast<unsigned char const*>(file.m_pb + tile.m_ib);
+        auto const pf = savedmap.m_gridfLogOdds.mutable_tile(rbt::point<int>(tile.m_nX, tile.m_nY));
+        if(c_cbMapFileTile==tile.m_cb) {
+            std::memcpy(pf, pb, c_cbMapFileTile);
+        } else if(!bCompressed || !Decompress(pb, tile.m_cb, pf)) {
+            std::cerr << "Invalid tile in map file" << std::endl;
+            return boost::none;
+        }
+    }
+    return savedmap;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "geometry.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <string>
+
+#include <boost/optional.hpp>
+
+// Map files
+//
+// A map file holds the log odds of an occupancy grid and the robot pose, so
+// a map can be reused after a restart. The file starts with a SMapFileHeader,
+// followed by m_cTiles SMapFileTile entries that locate the cells of each tile.
+//
+// Uncompressed, the cells of a tile are c_nTileExtent x c_nTileExtent floats in
+// row-major order at an offset that is a multiple of c_cbMapFilePage, i.e.,
+// every tile of a memory-mapped file is page aligned. LoadMap copies the
+// tiles, the alignment lets a future reader map them in place.
+// Compressed tiles are stored back to back, each as the four byte planes of its
+// cells run-length encoded like PackBits. Tiles that don't compress are stored
+// as is, i.e., their m_cb is c_cbMapFileTile.
+constexpr char c_achMapMagic[8] = {'R', 'B', 'T', 'M', 'A', 'P', '1', '\0'};
+constexpr std::size_t c_cbMapFilePage = 4096;
+constexpr std::size_t c_cbMapFileTile = CTiledGrid<float>::c_nTileExtent * CTiledGrid<float>::c_nTileExtent * sizeof(float);
+
+enum EMapFileFlags : std::uint32_t {
+    emapfileCompressed = 1
+};
+
+struct SMapFileHeader {
+    char m_achMagic[8];
+    std::uint32_t m_nFlags; // EMapFileFlags
+    std::int32_t m_nTileExtent;
+    double m_fX; // robot pose
+    double m_fY;
+    double m_fYaw;
+    std::uint32_t m_cTiles;
+    std::uint32_t m_nReserved;
+};
+static_assert(sizeof(SMapFileHeader)==48, "");
+
+struct SMapFileTile {
+    std::int32_t m_nX; // tile coordinate, i.e., the top-left cell is (m_nX, m_nY) * c_nTileExtent
+    std::int32_t m_nY;
+    std::uint32_t m_cb; // of the cell data
+    std::uint32_t m_nReserved;
+    std::uint64_t m_ib; // offset of the cell data from the start of the file
+};
+static_assert(sizeof(SMapFileTile)==24, "");
+
+struct SSavedMap {
+    CTiledGrid<float> m_gridfLogOdds;
+    rbt::pose<double> m_pose;
+};
+
+// Writes to a temporary file first that replaces strFile when it is complete
+bool SaveMap(std::string const& strFile, SSavedMap const& savedmap, bool bCompress);
+boost::optional<SSavedMap> LoadMap(std::string const& strFile);
+
+// Command line options of the robot and the log file parser
+struct SMapFileOptions {
+    boost::optional<std::string> m_ostrLoad;
+    bool m_bLocalizeOnly = false; // only localize in the loaded map, see CFastParticleSlamBase::load
+    boost::optional<std::string> m_ostrSave;
+    bool m_bCompress = false;
+};
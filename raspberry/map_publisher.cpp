@@ -0,0 +1,161 @@
+#include "map_publisher.h"
+#include "occupancy_grid.h"
+#include "error_handling.h"
+#include "profiling.h"
+
+#include <fstream>
+#include <iostream>
+
+#include "opencv2/opencv.hpp"
+
+namespace {
+    // Appends n as little-endian
+    template<typename T>
+    void Append(std::vector<unsigned char>& vecb, T n) {
+        auto const u = static_cast<std::uint32_t>(n);
+        for(int i = 0; i < 4; ++i) vecb.push_back(static_cast<unsigned char>(u >> (8 * i)));
+    }
+}
+
+CMapPublisher::CMapPublisher(double fRate, boost::optional<std::string> ostrFile)
+    : m_durInterval(std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / fRate)))
+    , m_ostrFile(std::move(ostrFile))
+    , m_bPngRequested(false)
+    , m_bStop(false)
+    , m_vecptFootprint(4, rbt::point<int>::zero())
+    , m_nVersion(0)
+    , m_thread([this] { Run(); })
+{
+    ASSERT(0.0 < fRate);
+}
+
+CMapPublisher::~CMapPublisher() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_bStop = true;
+    }
+    m_cv.notify_one();
+    m_cvPublished.notify_all();
+    m_thread.join();
+}
+
+void CMapPublisher::post(SMapSnapshot snapshot) {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_osnapshot = std::move(snapshot);
+    }
+    m_cv.notify_one();
+}
+
+std::shared_ptr<std::vector<unsigned char> const> CMapPublisher::png() const {
+    std::lock_guard<std::mutex> lock(m_mtx);
+    if(!m_bPngRequested) {
+        m_bPngRequested = true;
+        m_cv.notify_one(); // encode the last snapshot
+    }
+    return m_pvecbPng;
+}
+
+std::vector<unsigned char> CMapPublisher::tiles(std::uint32_t nSince, std::chrono::steady_clock::duration durTimeout) const {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cvPublished.wait_for(lock, durTimeout, [&] { return m_bStop || nSince!=m_nVersion; });
+    if(m_nVersion < nSince) nSince = 0;
+
+    std::vector<unsigned char> vecb;
+    Append(vecb, m_nVersion);
+    for(auto const& pt : m_vecptFootprint) {
+        Append(vecb, pt.x);
+        Append(vecb, pt.y);
+    }
+    auto const ibCount = vecb.size();
+    Append(vecb, 0);
+
+    std::uint32_t cTiles = 0;
+    for(auto const& pairpttile : m_mapptile) {
+        auto const& tile = pairpttile.second;
+        // A new viewer does not need the removed tiles
+        if(tile.m_nPublished <= nSince || (0==nSince && tile.m_version==grid_type::STileVersion{0, 0})) continue;
+
+        Append(vecb, pairpttile.first.x);
+        Append(vecb, pairpttile.first.y);
+        vecb.insert(vecb.end(), tile.m_an.begin(), tile.m_an.end());
+        ++cTiles;
+    }
+    for(int i = 0; i < 4; ++i) vecb[ibCount + i] = static_cast<unsigned char>(cTiles >> (8 * i));
+    return vecb;
+}
+
+void CMapPublisher::Run() {
+    auto tpNext = std::chrono::steady_clock::now();
+    boost::optional<SMapSnapshot> osnapshot; // the last published snapshot
+    while(true) {
+        bool bEncodePng;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            auto const Pending = [&] { return m_osnapshot || (m_bPngRequested && !m_pvecbPng && osnapshot); };
+            m_cv.wait(lock, [&] { return m_bStop || Pending(); });
+            if(m_bStop) return;
+
+            // Wait for the next slot, newer snapshots replace m_osnapshot in the meantime
+            if(m_cv.wait_until(lock, tpNext, [&] { return m_bStop; })) return;
+            if(m_osnapshot) {
+                osnapshot = std::move(m_osnapshot);
+                m_osnapshot = boost::none;
+                PublishTiles(*osnapshot);
+            }
+            bEncodePng = m_ostrFile || m_bPngRequested;
+        }
+        tpNext = std::chrono::steady_clock::now() + m_durInterval;
+
+        if(bEncodePng) EncodePng(*osnapshot);
+    }
+}
+
+void CMapPublisher::PublishTiles(SMapSnapshot const& snapshot) {
+    CScopedTimer timer(estagePublishMap);
+    ++m_nVersion;
+    m_vecptFootprint = RobotFootprint(snapshot.m_pose);
+
+    // Like CTiledGridImage::update, only copies tiles whose version changed
+    for(auto& pairpttile : m_mapptile) pairpttile.second.m_bSeen = false;
+    snapshot.m_gridn.ForEachTile([&](rbt::point<int> const& ptTile, grid_type::STileVersion const& version, std::uint8_t const* pn) {
+        auto& tile = m_mapptile[ptTile]; // new tiles have version {0, 0}
+        if(!(tile.m_version==version)) {
+            tile.m_version = version;
+            tile.m_nPublished = m_nVersion;
+            std::copy(pn, pn + c_nTileCells, tile.m_an.begin());
+        }
+        tile.m_bSeen = true;
+    });
+    for(auto& pairpttile : m_mapptile) {
+        auto& tile = pairpttile.second;
+        if(!tile.m_bSeen && !(tile.m_version==grid_type::STileVersion{0, 0})) {
+            tile.m_version = {0, 0};
+            tile.m_nPublished = m_nVersion;
+            tile.m_an.fill(snapshot.m_gridn.Default());
+        }
+    }
+    m_cvPublished.notify_all();
+}
+
+void CMapPublisher::EncodePng(SMapSnapshot const& snapshot) {
+    std::vector<unsigned char> vecbPng;
+    {
+        CScopedTimer timer(estagePublishMap);
+        cv::Mat matColor;
+        cv::cvtColor(m_imageMap.update(snapshot.m_gridn), matColor, CV_GRAY2RGB);
+        RenderRobotPose(matColor, snapshot.m_gridn.Origin(), snapshot.m_pose, cv::Scalar(255, 0, 0));
+        VERIFY(cv::imencode(".png", matColor, vecbPng));
+    }
+    auto pvecbPng = std::make_shared<std::vector<unsigned char> const>(std::move(vecbPng));
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_pvecbPng = pvecbPng;
+    }
+
+    if(m_ostrFile) {
+        std::ofstream ofs(m_ostrFile.get(), std::ios::binary | std::ios::trunc);
+        ofs.write(reinterpret_cast<char const*>(pvecbPng->data()), pvecbPng->size());
+        if(!ofs) std::cerr << "Error writing to " << m_ostrFile.get() << std::endl;
+    }
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include "geometry.h"
+#include "nonmoveable.h"
+#include "tiled_grid.h"
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <boost/optional.hpp>
+
+// The obstacle map of the best particle and the current robot pose.
+// Copying the grid only copies its tile pointers, so a snapshot is cheap
+// enough to be taken after every scan.
+struct SMapSnapshot {
+    CTiledGrid<std::uint8_t> m_gridn;
+    rbt::pose<double> m_pose;
+};
+
+// Publishes the map for remote viewers on its own thread, so the SLAM thread
+// never waits for image encoding or disk I/O.
+// The SLAM thread post()s a snapshot after each scan, older snapshots that
+// have not been published yet are dropped. At most fRate snapshots per second
+// are published.
+//
+// Viewers can either fetch the whole map as PNG or only the tiles that changed
+// since the version they have seen last, see tiles().
+// The PNG image is only encoded once it has been requested or if ostrFile is
+// set, then it is also written to that file.
+struct CMapPublisher : rbt::nonmoveable {
+    CMapPublisher(double fRate, boost::optional<std::string> ostrFile);
+    ~CMapPublisher();
+
+    void post(SMapSnapshot snapshot);
+
+    // The latest PNG image, nullptr until the first image has been encoded
+    std::shared_ptr<std::vector<unsigned char> const> png() const;
+
+    // Waits up to durTimeout until a version newer than nSince has been published and
+    // returns the tiles that changed since nSince. nSince==0 returns the whole map.
+    // A version from a previous run of the publisher is treated like 0.
+    // The result is little-endian binary
+    //   uint32 version
+    //   4 x (int32 x, int32 y)   robot footprint in grid coordinates
+    //   uint32 number of tiles
+    //   per tile: int32 x, int32 y tile coordinate, i.e., the top-left cell is (x, y) * 32
+    //             32 x 32 uint8 cells in row-major order
+    // Tiles that have been removed from the map are sent as unknown cells.
+    std::vector<unsigned char> tiles(std::uint32_t nSince, std::chrono::steady_clock::duration durTimeout) const;
+
+private:
+    using grid_type = CTiledGrid<std::uint8_t>;
+    static int constexpr c_nTileCells = grid_type::c_nTileExtent * grid_type::c_nTileExtent;
+
+    void Run();
+    void PublishTiles(SMapSnapshot const& snapshot); // called with m_mtx locked
+    void EncodePng(SMapSnapshot const& snapshot);
+
+    std::chrono::steady_clock::duration const m_durInterval;
+    boost::optional<std::string> const m_ostrFile;
+
+    // m_mtx protects the members below
+    mutable std::mutex m_mtx;
+    mutable std::condition_variable m_cv; // wakes m_thread
+    mutable std::condition_variable m_cvPublished; // wakes tiles()
+    boost::optional<SMapSnapshot> m_osnapshot; // not published yet
+    std::shared_ptr<std::vector<unsigned char> const> m_pvecbPng;
+    mutable bool m_bPngRequested;
+    bool m_bStop;
+
+    struct STile {
+        grid_type::STileVersion m_version = {0, 0}; // {0, 0} if the tile has been removed
+        std::uint32_t m_nPublished = 0; // m_nVersion when the tile changed last
+        bool m_bSeen = false;
+        std::array<std::uint8_t, c_nTileCells> m_an;
+    };
+    std::map<rbt::point<int>, STile> m_mapptile; // by tile coordinate
+    std::vector<rbt::point<int>> m_vecptFootprint;
+    std::uint32_t m_nVersion;
+
+    CTiledGridImage<std::uint8_t> m_imageMap; // only used by m_thread
+    std::thread m_thread;
+};
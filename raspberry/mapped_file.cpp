@@ -0,0 +1,25 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+SMappedFile::SMappedFile(std::string const& strFile) : m_pb(nullptr), m_cb(0) {
+    m_fd = ::open(strFile.c_str(), O_RDONLY);
+    if(m_fd<0) return;
+
+    struct stat st;
+    if(0!=fstat(m_fd, &st) || 0==st.st_size) return;
+
+    void* pv = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, m_fd, 0);
+    if(MAP_FAILED==pv) return;
+    m_pb = static_cast<char const*>(pv);
+    m_cb = st.st_size;
+    madvise(pv, m_cb, MADV_SEQUENTIAL);
+}
+
+SMappedFile::~SMappedFile() {
+    if(m_pb) munmap(const_cast<char*>(m_pb), m_cb);
+    if(0<=m_fd) ::close(m_fd);
+}
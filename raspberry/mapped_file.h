@@ -0,0 +1,18 @@
+#pragma once
+
+#include "nonmoveable.h"
+
+#include <cstddef>
+#include <string>
+
+// A file mapped read-only into memory, e.g. a binary log or map file.
+// m_pb is nullptr if the file can't be opened, is empty or can't be mapped.
+// The kernel is advised that the file will be read sequentially.
+struct SMappedFile : rbt::nonmoveable {
+    explicit SMappedFile(std::string const& strFile);
+    ~SMappedFile();
+
+    int m_fd; // < 0 if the file can't be opened
+    char const* m_pb;
+    std::size_t m_cb;
+};
@@ -0,0 +1,154 @@
+#include "obstacle_index.h"
+#include "profiling.h"
+
+#include <algorithm>
+#include <limits>
+
+#include <boost/range/algorithm/for_each.hpp>
+
+namespace {
+    // Rebuild at least every c_nMinChanges changes
+    std::size_t constexpr c_nMinChanges = 32;
+
+    // Squared distance of (fX, fY) to rect
+    float SqrDistance(rbt::rect<int> const& rect, float fX, float fY) {
+        float const fDX = std::max({static_cast<float>(rect.left) - fX, 0.0f, fX - static_cast<float>(rect.right)});
+        float const fDY = std::max({static_cast<float>(rect.bottom) - fY, 0.0f, fY - static_cast<float>(rect.top)});
+        return fDX * fDX + fDY * fDY;
+    }
+}
+
+CObstacleIndex::SBlock::SBlock()
+    : m_ptree(std::make_shared<STree>(std::vector<STree::Point>()))
+{}
+
+std::size_t CObstacleIndex::SBlock::size() const {
+    return static_cast<std::size_t>(m_ptree->size()) + m_setptAdded.size() - m_setptRemoved.size();
+}
+
+bool CObstacleIndex::SBlock::needsRebuild() const {
+    auto const cChanges = m_setptAdded.size() + m_setptRemoved.size();
+    return std::max(c_nMinChanges, static_cast<std::size_t>(m_ptree->size()) / 4) < cChanges;
+}
+
+void CObstacleIndex::SBlock::rebuild(std::function<bool(rbt::point<int> const&)> const& fnOccupied) {
+    std::vector<STree::Point> vecpt;
+    vecpt.reserve(m_ptree->size() + m_setptAdded.size());
+    boost::for_each(m_ptree->points(), [&](STree::Point const& pt) {
+        if(fnOccupied(rbt::point<int>(pt[0], pt[1]))) vecpt.push_back(pt);
+    });
+    m_setptAdded.for_each([&](rbt::point<int> const& pt) {
+        if(fnOccupied(pt)) vecpt.push_back({{static_cast<float>(pt.x), static_cast<float>(pt.y)}});
+    });
+    // A cell cleared by the robot footprint may be reported again when it
+    // becomes occupied, so it can be in the tree and in m_setptAdded
+    std::sort(vecpt.begin(), vecpt.end());
+    vecpt.erase(std::unique(vecpt.begin(), vecpt.end()), vecpt.end());
+
+    m_ptree = std::make_shared<STree>(std::move(vecpt));
+    m_setptAdded.clear();
+    m_setptRemoved.clear();
+}
+
+void CObstacleIndex::SBlock::nearest(const float* query, float* model, float& dis) const {
+    float fDis;
+    auto const i = m_ptree->nearest(query, fDis);
+    if(0<=i && fDis < dis) {
+        model[0] = (*m_ptree)[i][0];
+        model[1] = (*m_ptree)[i][1];
+        dis = fDis;
+    }
+
+    m_setptAdded.for_each([&](rbt::point<int> const& pt) {
+        float const fDX = pt.x - query[0];
+        float const fDY = pt.y - query[1];
+        float const fDis = fDX * fDX + fDY * fDY;
+        if(fDis < dis) {
+            model[0] = static_cast<float>(pt.x);
+            model[1] = static_cast<float>(pt.y);
+            dis = fDis;
+        }
+    });
+}
+
+CObstacleIndex::CObstacleIndex(CObstacleIndex const& index)
+    : m_mapptblock(index.m_mapptblock)
+    , m_cOccupied(index.m_cOccupied)
+{}
+
+CObstacleIndex& CObstacleIndex::operator=(CObstacleIndex const& index) {
+    m_mapptblock = index.m_mapptblock;
+    m_cOccupied = index.m_cOccupied;
+    m_vecselected.clear();
+    return *this;
+}
+
+/*static*/ rbt::point<int> CObstacleIndex::BlockCoordinate(rbt::point<int> const& pt) {
+    auto const Coordinate = [](int n) {
+        return n<0 ? (n + 1) / c_nBlockExtent - 1 : n / c_nBlockExtent;
+    };
+    return rbt::point<int>(Coordinate(pt.x), Coordinate(pt.y));
+}
+
+void CObstacleIndex::insert(rbt::point<int> const& pt) {
+    // The grid only reports state changes, so pt is either
+    // a cell removed from the tree or a new cell
+    auto& block = m_mapptblock[BlockCoordinate(pt)];
+    if(!block.m_setptRemoved.erase(pt)) {
+        block.m_setptAdded.insert(pt);
+    }
+    ++m_cOccupied;
+}
+
+void CObstacleIndex::erase(rbt::point<int> const& pt) {
+    auto& block = m_mapptblock[BlockCoordinate(pt)];
+    if(!block.m_setptAdded.erase(pt)) {
+        block.m_setptRemoved.insert(pt);
+    }
+    --m_cOccupied;
+}
+
+std::size_t CObstacleIndex::select(rbt::rect<int> const& rect, std::function<bool(rbt::point<int> const&)> const& fnOccupied) {
+    m_vecselected.clear();
+
+    std::size_t cOccupied = 0;
+    auto const ptBlockMin = BlockCoordinate(rbt::point<int>(rect.left, rect.bottom));
+    auto const ptBlockMax = BlockCoordinate(rbt::point<int>(rect.right, rect.top));
+    for(int nBlockY = ptBlockMin.y; nBlockY <= ptBlockMax.y; ++nBlockY) {
+        for(int nBlockX = ptBlockMin.x; nBlockX <= ptBlockMax.x; ++nBlockX) {
+            auto const itblock = m_mapptblock.find(rbt::point<int>(nBlockX, nBlockY));
+            if(itblock==m_mapptblock.end()) continue;
+
+            auto& block = itblock->second;
+            if(block.needsRebuild()) {
+                CScopedTimer timer(estageIndexRebuild);
+                m_cOccupied -= block.size();
+                block.rebuild(fnOccupied);
+                m_cOccupied += block.size();
+            }
+            if(0==block.size()) continue;
+
+            m_vecselected.push_back({
+                {
+                    nBlockX * c_nBlockExtent,
+                    nBlockY * c_nBlockExtent,
+                    (nBlockX + 1) * c_nBlockExtent - 1,
+                    (nBlockY + 1) * c_nBlockExtent - 1
+                },
+                &block
+            });
+            cOccupied += block.size();
+        }
+    }
+    return cOccupied;
+}
+
+void CObstacleIndex::nearest(const float* query, float* model, float& dis) const {
+    dis = std::numeric_limits<float>::max();
+    boost::for_each(m_vecselected, [&](SSelected const& selected) {
+        // No cell in the block can be closer than its bounding box
+        if(SqrDistance(selected.m_rect, query[0], query[1]) < dis) {
+            selected.m_pblock->nearest(query, model, dis);
+        }
+    });
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "geometry.h"
+#include "cell_set.h"
+#include "icp.h"
+#include "kdtreeFixed.h"
+
+#include <map>
+#include <vector>
+#include <memory>
+#include <functional>
+
+// Nearest neighbor index over the occupied cells of an occupancy grid that
+// is passed to libicp instead of letting Icp build a new kd tree per scan.
+//
+// The grid is split into square blocks of c_nBlockExtent cells with one
+// kd tree each. Before matching a scan, select() restricts all queries to the
+// blocks that intersect the area covered by the scan, so the cost per scan
+// depends on the sensor range and not on the size of the map.
+//
+// The kd tree of a block is an immutable snapshot that is shared between copies
+// of the index, i.e., between particles. Cells that become occupied after
+// the snapshot has been taken are kept in a small hash set that is searched
+// exhaustively. Cells that become free are only counted; they remain in the
+// kd tree until the next rebuild. Rebuilding a block is deferred until the
+// number of changes exceeds a fraction of its tree size, so the cost of
+// building the tree is amortized over many scans.
+struct CObstacleIndex final : IcpModel {
+    static int constexpr c_nBlockExtent = 64; // grid cells
+
+    CObstacleIndex() = default;
+    // Copies do not keep the selection
+    CObstacleIndex(CObstacleIndex const& index);
+    CObstacleIndex& operator=(CObstacleIndex const& index);
+
+    // Notifications from the occupancy grid when a cell changes state
+    void insert(rbt::point<int> const& pt);
+    void erase(rbt::point<int> const& pt);
+
+    // Number of occupied cells
+    std::size_t size() const { return m_cOccupied; }
+
+    // Restricts nearest() to the blocks intersecting rect (grid coordinates, inclusive).
+    // Rebuilds the kd trees of these blocks first if necessary, including only
+    // cells for which fnOccupied is true.
+    // Returns the number of occupied cells in the selected blocks.
+    std::size_t select(rbt::rect<int> const& rect, std::function<bool(rbt::point<int> const&)> const& fnOccupied);
+
+    // IcpModel and model of libicp::IcpPointToPoint.
+    // Only searches the blocks chosen by the last call to select().
+    void nearest(const float* query, float* model, float& dis) const override;
+
+private:
+    // The kd tree owns the only copy of the cells
+    using STree = libicp::KDTree<2>;
+
+    struct SBlock {
+        SBlock();
+
+        std::size_t size() const;
+        bool needsRebuild() const;
+        void rebuild(std::function<bool(rbt::point<int> const&)> const& fnOccupied);
+        void nearest(const float* query, float* model, float& dis) const;
+
+        std::shared_ptr<STree const> m_ptree;
+        CCellSet m_setptAdded; // occupied, not in m_ptree
+        CCellSet m_setptRemoved; // in m_ptree, but no longer occupied
+    };
+
+    static rbt::point<int> BlockCoordinate(rbt::point<int> const& pt);
+
+    std::map<rbt::point<int>, SBlock> m_mapptblock; // by block coordinate
+    std::size_t m_cOccupied = 0;
+
+    // Blocks chosen by select() with their bounding boxes
+    struct SSelected {
+        rbt::rect<int> m_rect;
+        SBlock const* m_pblock;
+    };
+    std::vector<SSelected> m_vecselected;
+};
@@ -11,56 +11,82 @@
 #include <boost/range/iterator_range.hpp>
 #include <opencv2/imgproc.hpp>
 
-COccupancyGrid::COccupancyGrid()
-:   m_matnMapObstacle(c_nMapExtent, c_nMapExtent, CV_8UC1, cv::Scalar(128))
+template<typename TLogOdds>
+COccupancyGridT<TLogOdds>::COccupancyGridT()
+:   m_gridnObstacle(rbt::size<int>(c_nMapExtent, c_nMapExtent), 128)
 {}
 
-COccupancyGrid::COccupancyGrid(COccupancyGrid const& occgrid) 
-:   COccupancyGridBaseT(occgrid), m_matnMapObstacle(occgrid.m_matnMapObstacle.clone())
-{}
-
-COccupancyGrid& COccupancyGrid::operator=(COccupancyGrid const& occgrid) {
-    COccupancyGridBaseT::operator=(occgrid); 
-    m_matnMapObstacle=occgrid.m_matnMapObstacle.clone();
-    return *this;
-}
-
-void COccupancyGrid::updateGrid(rbt::point<int> const& pt, double fOdds) {
+template<typename TLogOdds>
+void COccupancyGridT<TLogOdds>::updateGrid(rbt::point<int> const& pt, TLogOdds /*tOddsPrev*/, TLogOdds tOdds) {
     // Calculating the greyscale map is pretty expensive
     // If we ever need a non-binary version, a lookup table
     // would be useful instead of this:
     // auto const nColor = rbt::numeric_cast<std::uint8_t>(1.0 / ( 1.0 + std::exp( fOdds )) * 255);
-    assert(is_inside(pt));
-    m_matnMapObstacle.at<std::uint8_t>(pt.y, pt.x) = 0 < fOdds ? 0 : 255;
+    m_gridnObstacle.mutable_at(pt) = TLogOdds(0) < tOdds ? 0 : 255;
 }
 
-void COccupancyGrid::updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds) {
-    std::vector<cv::Point> vecpt(boost::begin(rngpt), boost::end(rngpt));
-    cv::fillConvexPoly(m_matnMapObstacle, vecpt.data(), vecpt.size(), 0 < fOdds ? 0 : 255);
+template<typename TLogOdds>
+void COccupancyGridT<TLogOdds>::updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds) {
+    boost::for_each(ConvexPolygonCells(rngpt), [&](rbt::point<int> const& pt) {
+        m_gridnObstacle.mutable_at(pt) = 0 < fOdds ? 0 : 255;
+    });
 }
 
-cv::Mat ObstacleMapWithPoses(cv::Mat const& m, std::vector<rbt::pose<double>> const& vecpose) {
-    rbt::point<int> ptnPrev = ToGridCoordinate(vecpose.front().m_pt);
+cv::Mat ObstacleMapWithPoses(cv::Mat const& m, rbt::point<int> const& ptnOrigin, std::vector<rbt::pose<double>> const& vecpose) {
+    rbt::point<int> ptnPrev = ToGridCoordinate(vecpose.front().m_pt, ptnOrigin);
     boost::for_each(vecpose, [&](rbt::pose<double> const& pose) {
-        auto const ptnGrid = ToGridCoordinate(pose.m_pt);
+        auto const ptnGrid = ToGridCoordinate(pose.m_pt, ptnOrigin);
         cv::line(m, ptnPrev, ptnGrid, cv::Scalar(0));
         ptnPrev = ptnGrid;
     });
     return m;
 }
 
-std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::pose<double> const& pose, cv::Scalar color) {
+std::vector<rbt::point<int>> RobotFootprint(rbt::pose<double> const& pose) {
     rbt::size<double> const szfHalfSize(c_nRobotWidth/2.0, c_nRobotHeight/2.0);
-    std::vector<rbt::point<int>> vecpt = {
+    return {
         ToGridCoordinate(pose.m_pt - szfHalfSize.rotated(pose.m_fYaw)),
         ToGridCoordinate(pose.m_pt + rbt::size<double>(szfHalfSize.x, -szfHalfSize.y).rotated(pose.m_fYaw)),
         ToGridCoordinate(pose.m_pt + szfHalfSize.rotated(pose.m_fYaw)),
         ToGridCoordinate(pose.m_pt + rbt::size<double>(-szfHalfSize.x, szfHalfSize.y).rotated(pose.m_fYaw))
     };
+}
+
+std::vector<rbt::point<int>> ConvexPolygonCells(std::vector<rbt::point<int>> const& vecpt) {
+    // The grid is unbounded and not contiguous, so rasterize the polygon into 
+    // a small mask covering its bounding box
+    auto rect = rbt::rect<int>::empty();
+    boost::for_each(vecpt, [&](rbt::point<int> const& pt) { rect |= pt; });
+    rbt::size<int> const sznOffset(rect.left, rect.bottom);
+
+    std::vector<cv::Point> vecptMask;
+    boost::for_each(vecpt, [&](rbt::point<int> const& pt) {
+        vecptMask.emplace_back(pt - sznOffset);
+    });
+    cv::Mat matnMask = cv::Mat::zeros(rect.top - rect.bottom + 1, rect.right - rect.left + 1, CV_8U);
+    cv::fillConvexPoly(matnMask, vecptMask.data(), vecptMask.size(), cv::Scalar(1));
+
+    std::vector<rbt::point<int>> vecptCells;
+    for(int y = 0; y < matnMask.rows; ++y) {
+        for(int x = 0; x < matnMask.cols; ++x) {
+            if(matnMask.at<std::uint8_t>(y, x)) vecptCells.emplace_back(rbt::point<int>(x, y) + sznOffset);
+        }
+    }
+    return vecptCells;
+}
+
+std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::point<int> const& ptnOrigin, rbt::pose<double> const& pose, cv::Scalar color) {
+    auto vecpt = RobotFootprint(pose);
+    boost::for_each(vecpt, [&](rbt::point<int>& pt) { pt -= rbt::size<int>(ptnOrigin); });
     cv::fillConvexPoly(mat, reinterpret_cast<cv::Point*>(vecpt.data()), vecpt.size(), color);
     return vecpt;
 }
 
-cv::Mat COccupancyGrid::ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const {
-    return ::ObstacleMapWithPoses(ObstacleMap(), vecpose);
-}
\ No newline at end of file
+template<typename TLogOdds>
+cv::Mat COccupancyGridT<TLogOdds>::ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const {
+    return ::ObstacleMapWithPoses(ObstacleMap(), this->Origin(), vecpose);
+}
+
+template struct COccupancyGridT<float>;
+template struct COccupancyGridT<std::int8_t>;
+template struct COccupancyGridT<std::int16_t>;
\ No newline at end of file
@@ -3,19 +3,63 @@
 #include "rover.h"
 #include "nonmoveable.h"
 #include "geometry.h"
+#include "scanline.h"
+#include "tiled_grid.h"
+#include "likelihood_field.h"
+#include "profiling.h"
+#include "robot_configuration.h"
+
+#include <cstdint>
+#include <limits>
 
 #include <boost/range/iterator_range.hpp>
 #include <opencv2/core.hpp>
 
+// The cell types of the log odds grid. Integer cells store the log odds in
+// steps of 1/c_nSteps and saturate at the limits of T, so the updates
+// c_fOccupiedDelta and c_fFreeDelta are exact and cells can't grow without
+// bounds. Compared to float, int8 cells quarter and int16 cells halve the
+// memory and the cost of cloning a tile.
+template<typename T>
+struct SLogOddsTraits {
+    using delta_type = float;
+    static constexpr T value(double f) { return static_cast<T>(f); }
+    static constexpr double real(T t) { return t; }
+    static constexpr delta_type delta(double f) { return static_cast<delta_type>(f); }
+    static T add(T t, delta_type tDelta) { return t + tDelta; }
+};
+
+template<typename T>
+struct SIntegerLogOddsTraits {
+    static int constexpr c_nSteps = 2;
+    using delta_type = int;
+    static constexpr delta_type delta(double f) { return static_cast<delta_type>(Steps(f)); }
+    static constexpr T value(double f) { return saturate(Steps(f)); }
+    static constexpr double real(T t) { return static_cast<double>(t) / c_nSteps; }
+    static T add(T t, delta_type nDelta) { return saturate(t + nDelta); }
+
+private:
+    static constexpr double Steps(double f) { return f * c_nSteps + (f < 0 ? -0.5 : 0.5); } // rounded by the conversion to int
+    static constexpr T saturate(double f) {
+        return f <= std::numeric_limits<T>::min() ? std::numeric_limits<T>::min()
+            : std::numeric_limits<T>::max() <= f ? std::numeric_limits<T>::max()
+            : static_cast<T>(f);
+    }
+};
+template<> struct SLogOddsTraits<std::int8_t> : SIntegerLogOddsTraits<std::int8_t> {};
+template<> struct SLogOddsTraits<std::int16_t> : SIntegerLogOddsTraits<std::int16_t> {};
+
 // An implementation of an occupancy grid, as described e.g. 
 // in Thrun et al, "Probabilistic Robotics"
-template<typename Derived>
+// The log odds are stored in a CTiledGrid, so copies of an occupancy grid
+// share all tiles that neither copy has modified since. TLogOdds is the cell
+// type, see SLogOddsTraits. Derived::updateGrid is called with the cell values.
+template<typename Derived, typename TLogOdds = float>
 struct COccupancyGridBaseT {
+    using traits_type = SLogOddsTraits<TLogOdds>;
+    using delta_type = typename traits_type::delta_type;
+
     COccupancyGridBaseT();        
-    COccupancyGridBaseT(COccupancyGridBaseT const& occgrid);
-    COccupancyGridBaseT(COccupancyGridBaseT&& occgrid);
-    COccupancyGridBaseT& operator=(COccupancyGridBaseT const& occgrid);
-    COccupancyGridBaseT& operator=(COccupancyGridBaseT&& occgrid);
 
     // Update the occupancy grid. 'pose' is the robot's pose. 
     // The obstacle is assumed to be a pixel at polar coordinates (fAngle, nDistance)
@@ -26,32 +70,75 @@ struct COccupancyGridBaseT {
     // are in world coordinates
     void update(rbt::pose<double> const& pose, std::vector<rbt::point<double>> const& vecptf);
 
-    cv::Mat const& LogOddsMap() const { return m_matfMapLogOdds; }
+    // Update the occupancy grid with all obstacles of a scan measured at pose.
+    // Much faster than calling update(pose, fAngle, nDistance) per scan point,
+    // every grid cell is written at most once and the robot footprint is only 
+    // rendered once.
+    void update(rbt::pose<double> const& pose, SScanLine const& scanline);
+
+    // The map images returned by LogOddsMap() and the derived classes' ObstacleMap()
+    // cover the bounding box of the grid. Origin() is the grid coordinate of their top-left pixel.
+    cv::Mat LogOddsMap() const { return m_gridtLogOdds.ToMat(); }
+    rbt::point<int> const& Origin() const { return m_gridtLogOdds.Origin(); }
+
+    // The log odds, e.g. to save the map, see SaveMap()
+    CTiledGrid<TLogOdds> const& LogOdds() const { return m_gridtLogOdds; }
+    // The log odds converted to float, the format of SSavedMap
+    CTiledGrid<float> FloatLogOdds() const;
+    // Replaces the map by the log odds gridfLogOdds, e.g. of a map loaded
+    // by LoadMap(). The derived grids are rebuilt from the cells.
+    void assign(CTiledGrid<float> const& gridfLogOdds);
+
     bool occupied(rbt::point<int> const& pt) const;
-    bool is_inside(rbt::point<int> const& pt) const;
+    bool is_inside(rbt::point<int> const& pt) const; // inside the bounding box
+
+    // The likelihood field is updated lazily, call UpdateLikelihoodField() 
+    // after updating the grid and before using LikelihoodField()
+    CLikelihoodField const& LikelihoodField() const { return m_likelihoodfield; }
+    void UpdateLikelihoodField();
 protected:
     void internalUpdatePerObstacle(rbt::point<double> const& ptf, rbt::point<double> const& ptfObstacle);
+    void internalUpdatePerScan(rbt::point<double> const& ptf, std::vector<rbt::point<double>> const& vecptfObstacle);
+    void internalUpdateCell(rbt::point<int> const& pt, delta_type tDelta);
     void internalUpdatePerPose(rbt::pose<double> const& pose);
 
-    cv::Mat m_matfMapLogOdds;
+    static constexpr delta_type c_tOccupiedDelta = traits_type::delta(c_fOccupiedDelta);
+    static constexpr delta_type c_tFreeDelta = traits_type::delta(c_fFreeDelta);
+    static constexpr TLogOdds c_tFreeThreshold = traits_type::value(c_fFreeThreshold);
+    static constexpr TLogOdds c_tOccupancyRover = traits_type::value(c_fOccupancyRover);
+
+    CTiledGrid<TLogOdds> m_gridtLogOdds;
+    CLikelihoodField m_likelihoodfield;
 };
 
-cv::Mat ObstacleMapWithPoses(cv::Mat const& matn, std::vector<rbt::pose<double>> const& vecpose);
-std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::pose<double> const& pose, cv::Scalar color);
+// ptnOrigin is the grid coordinate of the top-left pixel of the map image matn
+cv::Mat ObstacleMapWithPoses(cv::Mat const& matn, rbt::point<int> const& ptnOrigin, std::vector<rbt::pose<double>> const& vecpose);
+std::vector<rbt::point<int>> RenderRobotPose(cv::Mat& mat, rbt::point<int> const& ptnOrigin, rbt::pose<double> const& pose, cv::Scalar color);
+
+std::vector<rbt::point<int>> RobotFootprint(rbt::pose<double> const& pose); // in grid coordinates
+std::vector<rbt::point<int>> ConvexPolygonCells(std::vector<rbt::point<int>> const& vecpt);
 
-struct COccupancyGrid : COccupancyGridBaseT<COccupancyGrid> {
-    COccupancyGrid();        
-    COccupancyGrid(COccupancyGrid const& occgrid);
-    COccupancyGrid& operator=(COccupancyGrid const& occgrid);
+template<typename TLogOdds>
+struct COccupancyGridT : COccupancyGridBaseT<COccupancyGridT<TLogOdds>, TLogOdds> {
+    COccupancyGridT();        
 
-    cv::Mat const& ObstacleMap() const { return m_matnMapObstacle; }
+    cv::Mat ObstacleMap() const {
+        CScopedTimer timer(estageObstacleMap);
+        return m_gridnObstacle.ToMat(); 
+    }
     cv::Mat ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const;
+    // The grid ObstacleMap() is copied from, for incremental rendering with CTiledGridImage
+    CTiledGrid<std::uint8_t> const& ObstacleGrid() const { return m_gridnObstacle; }
 
 private:
-    friend struct COccupancyGridBaseT<COccupancyGrid>;
-    void updateGrid(rbt::point<int> const& pt, double fOdds);
+    friend struct COccupancyGridBaseT<COccupancyGridT<TLogOdds>, TLogOdds>;
+    void updateGrid(rbt::point<int> const& pt, TLogOdds tOddsPrev, TLogOdds tOdds);
     void updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds);
 
-    cv::Mat m_matnMapObstacle; // thresholded version of m_matfMapLogOdds
+    CTiledGrid<std::uint8_t> m_gridnObstacle; // thresholded version of m_gridtLogOdds
 };
 
+using COccupancyGrid = COccupancyGridT<float>;
+using COccupancyGrid8 = COccupancyGridT<std::int8_t>;   // log odds in [-64, 63.5]
+using COccupancyGrid16 = COccupancyGridT<std::int16_t>; // log odds in [-16384, 16383.5]
+
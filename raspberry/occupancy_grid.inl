@@ -18,85 +18,154 @@
 #include <boost/range/size.hpp>
 #include <opencv2/imgproc.hpp>
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>::COccupancyGridBaseT()
-:   m_matfMapLogOdds(c_nMapExtent, c_nMapExtent, CV_32FC1, cv::Scalar(0.0f))
+template<typename Derived, typename TLogOdds>
+COccupancyGridBaseT<Derived, TLogOdds>::COccupancyGridBaseT()
+:   m_gridtLogOdds(rbt::size<int>(c_nMapExtent, c_nMapExtent), TLogOdds(0))
 {}
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>::COccupancyGridBaseT(COccupancyGridBaseT<Derived> const& occgrid) 
-:   m_matfMapLogOdds(occgrid.m_matfMapLogOdds.clone())
-{}
+template<typename Derived, typename TLogOdds>
+bool COccupancyGridBaseT<Derived, TLogOdds>::occupied(rbt::point<int> const& pt) const {
+    return c_tFreeThreshold<m_gridtLogOdds.at(pt);
+}
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>::COccupancyGridBaseT(COccupancyGridBaseT<Derived>&& occgrid) 
-:   m_matfMapLogOdds(occgrid.m_matfMapLogOdds)
-{}
+template<typename Derived, typename TLogOdds>
+bool COccupancyGridBaseT<Derived, TLogOdds>::is_inside(rbt::point<int> const& pt) const {
+	return m_gridtLogOdds.is_inside(pt);
+}
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>& COccupancyGridBaseT<Derived>::operator=(COccupancyGridBaseT<Derived> const& occgrid) { 
-    m_matfMapLogOdds=occgrid.m_matfMapLogOdds.clone();
-    return *this;
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::UpdateLikelihoodField() {
+    m_likelihoodfield.update([this](rbt::point<int> const& pt) { return occupied(pt); });
 }
 
-template<typename Derived>
-COccupancyGridBaseT<Derived>& COccupancyGridBaseT<Derived>::operator=(COccupancyGridBaseT<Derived>&& occgrid) { 
-    m_matfMapLogOdds=occgrid.m_matfMapLogOdds;
-    return *this;
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::assign(CTiledGrid<float> const& gridfLogOdds) {
+    *static_cast<Derived*>(this) = Derived();
+    int constexpr c_nTileExtent = CTiledGrid<float>::c_nTileExtent;
+    gridfLogOdds.ForEachTile([&](rbt::point<int> const& ptTile, CTiledGrid<float>::STileVersion const&, float const* pf) {
+        for(int y = 0; y < c_nTileExtent; ++y) {
+            for(int x = 0; x < c_nTileExtent; ++x) {
+                auto const t = traits_type::value(pf[y * c_nTileExtent + x]);
+                if(m_gridtLogOdds.Default()!=t) {
+                    internalUpdateCell(ptTile * c_nTileExtent + rbt::size<int>(x, y), static_cast<delta_type>(t - m_gridtLogOdds.Default()));
+                }
+            }
+        }
+    });
 }
 
-template<typename Derived>
-bool COccupancyGridBaseT<Derived>::occupied(rbt::point<int> const& pt) const {
-	assert(is_inside(pt));
-    return c_fFreeThreshold<m_matfMapLogOdds.at<float>(pt.y, pt.x);
+template<typename Derived, typename TLogOdds>
+CTiledGrid<float> COccupancyGridBaseT<Derived, TLogOdds>::FloatLogOdds() const {
+    int constexpr c_nTileCells = CTiledGrid<float>::c_nTileExtent * CTiledGrid<float>::c_nTileExtent;
+    CTiledGrid<float> gridfLogOdds(rbt::size<int>(c_nMapExtent, c_nMapExtent), static_cast<float>(traits_type::real(m_gridtLogOdds.Default())));
+    m_gridtLogOdds.ForEachTile([&](rbt::point<int> const& ptTile, typename CTiledGrid<TLogOdds>::STileVersion const&, TLogOdds const* pt) {
+        std::transform(pt, pt + c_nTileCells, gridfLogOdds.mutable_tile(ptTile), [](TLogOdds t) {
+            return static_cast<float>(traits_type::real(t));
+        });
+    });
+    return gridfLogOdds;
 }
 
-template<typename Derived>
-bool COccupancyGridBaseT<Derived>::is_inside(rbt::point<int> const& pt) const {
-	auto const sz = m_matfMapLogOdds.size();
-	return 0<=pt.x && 0<=pt.y && pt.x < sz.width && pt.y < sz.height;
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdateCell(rbt::point<int> const& pt, delta_type tDelta) {
+    auto& tOdds = m_gridtLogOdds.mutable_at(pt);
+    auto const tOddsPrev = tOdds;
+    tOdds = traits_type::add(tOdds, tDelta);
+    if((c_tFreeThreshold<tOddsPrev) != (c_tFreeThreshold<tOdds)) {
+        m_likelihoodfield.invalidate(pt);
+    }
+
+    static_cast<Derived*>(this)->updateGrid(pt, tOddsPrev, tOdds);
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::internalUpdatePerObstacle(rbt::point<double> const& ptf, rbt::point<double> const& ptfObstacle) {
-    cv::LineIterator itpt(
-        m_matfMapLogOdds, 
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdatePerObstacle(rbt::point<double> const& ptf, rbt::point<double> const& ptfObstacle) {
+    rbt::line_iterator itpt(
         ToGridCoordinate(ptf), 
         ToGridCoordinate(ptfObstacle)
     );
     for(int i = 0; i < itpt.count; i++, ++itpt) {    	
-        auto const pt = rbt::point<int>(itpt.pos());
-        assert(is_inside(pt)); // LineIterator clips to line boundaries
+        internalUpdateCell(
+            itpt.pos(),
+            i<itpt.count-1 
+                ? c_tFreeDelta // free
+                : c_tOccupiedDelta // occupied  
+        );
+    }
+}
 
-        auto const fDeltaValue = i<itpt.count-1 
-            ? c_fFreeDelta // free
-            : c_fOccupiedDelta; // occupied  
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdatePerScan(rbt::point<double> const& ptf, std::vector<rbt::point<double>> const& vecptfObstacle) {
+    // Cells close to the robot are crossed by almost every beam. Sum up the
+    // changes of all beams in a dense buffer covering the bounding box of the
+    // scan first, then apply them to the grid row by row, once per cell.
+    // The final log odds are the same as when updating beam by beam.
+    auto const ptnCenter = ToGridCoordinate(ptf);
+    std::vector<rbt::point<int>> vecptnObstacle;
+    vecptnObstacle.reserve(vecptfObstacle.size());
+    auto rectn = rbt::rect<int>::bound({ptnCenter});
+    boost::for_each(vecptfObstacle, [&](rbt::point<double> const& ptfObstacle) {
+        vecptnObstacle.emplace_back(ToGridCoordinate(ptfObstacle));
+        rectn |= vecptnObstacle.back();
+    });
 
-        auto const fOdds = m_matfMapLogOdds.at<float>(pt.y, pt.x) + fDeltaValue;
-        m_matfMapLogOdds.at<float>(pt.y, pt.x) = fOdds;
+    int const nWidth = rectn.right - rectn.left + 1;
+    int const nHeight = rectn.top - rectn.bottom + 1;
+    thread_local std::vector<delta_type> s_vectDelta; // reused, particles are updated in parallel
+    s_vectDelta.assign(static_cast<std::size_t>(nWidth) * nHeight, delta_type(0));
+    auto const Delta = [&](rbt::point<int> const& pt) -> delta_type& {
+        return s_vectDelta[(pt.y - rectn.bottom) * nWidth + (pt.x - rectn.left)];
+    };
+
+    boost::for_each(vecptnObstacle, [&](rbt::point<int> const& ptnObstacle) {
+        rbt::line_iterator itpt(ptnCenter, ptnObstacle);
+        for(int i = 0; i < itpt.count - 1; i++, ++itpt) {
+            Delta(itpt.pos()) += c_tFreeDelta;
+        }
+        Delta(itpt.pos()) += c_tOccupiedDelta;
+    });
 
-        static_cast<Derived*>(this)->updateGrid(pt, fOdds);	
+    for(int y = 0; y < nHeight; ++y) {
+        auto const* ptDelta = s_vectDelta.data() + y * nWidth;
+        for(int x = 0; x < nWidth; ++x) {
+            if(delta_type(0)!=ptDelta[x]) {
+                internalUpdateCell(rbt::point<int>(rectn.left + x, rectn.bottom + y), ptDelta[x]);
+            }
+        }
     }
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::internalUpdatePerPose(rbt::pose<double> const& pose) {
-    static_cast<Derived*>(this)->updateGridPoly(
-    	RenderRobotPose(m_matfMapLogOdds, pose, cv::Scalar(c_fOccupancyRover)), 
-    	c_fOccupiedDelta
-    );
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::internalUpdatePerPose(rbt::pose<double> const& pose) {
+    auto const vecpt = RobotFootprint(pose);
+    boost::for_each(ConvexPolygonCells(vecpt), [&](rbt::point<int> const& pt) {
+        auto& tOdds = m_gridtLogOdds.mutable_at(pt);
+        if(c_tFreeThreshold<tOdds) {
+            m_likelihoodfield.invalidate(pt);
+        }
+        tOdds = c_tOccupancyRover;
+    });
+    static_cast<Derived*>(this)->updateGridPoly(vecpt, c_fOccupiedDelta);
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::update(rbt::pose<double> const& pose, double fRadAngle, int nDistance) {
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::update(rbt::pose<double> const& pose, double fRadAngle, int nDistance) {
     internalUpdatePerObstacle(pose.m_pt, Obstacle(pose, fRadAngle, nDistance));
     internalUpdatePerPose(pose);
 }
 
-template<typename Derived>
-void COccupancyGridBaseT<Derived>::update(rbt::pose<double> const& pose, std::vector<rbt::point<double>> const& vecptf) {
-    boost::for_each(vecptf, [&](auto const& ptf) {
-        internalUpdatePerObstacle(pose.m_pt, ptf);
-    });
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::update(rbt::pose<double> const& pose, std::vector<rbt::point<double>> const& vecptf) {
+    internalUpdatePerScan(pose.m_pt, vecptf);
     internalUpdatePerPose(pose);
 }
+
+template<typename Derived, typename TLogOdds>
+void COccupancyGridBaseT<Derived, TLogOdds>::update(rbt::pose<double> const& pose, SScanLine const& scanline) {
+    std::vector<rbt::point<double>> vecptf;
+    vecptf.reserve(scanline.m_vecscan.size());
+    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+        vecptf.emplace_back(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance));
+    });
+    update(pose, vecptf);
+}
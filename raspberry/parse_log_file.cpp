@@ -1,13 +1,16 @@
 #include "error_handling.h"
 #include "rover.h"
 #include "robot_configuration.h"
-#include "fast_particle_slam.h"
+#include "slam_backend.h"
+#include "occupancy_grid.h"
 #include "path_finding.h"
+#include "log_file.h"
+#include "map_file.h"
+#include "video_writer.h"
 
-#include <stdio.h>
 #include <chrono>
-#include <fstream>
-#include  <clocale>
+#include <cmath>
+#include <memory>
 
 #include <boost/range/adaptor/transformed.hpp>
 #include <boost/optional.hpp>
@@ -15,22 +18,23 @@
 #include <opencv2/imgcodecs/imgcodecs.hpp>     // cv::imread()
 #include <opencv2/opencv.hpp>
 
-int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> const& ostrOutput) {
+int ParseLogFile(std::string const& strLogFile, boost::optional<SVideoOptions> const& ovideooptions, boost::optional<std::string> const& ostrOutput, SSlamBackendOptions const& slamoptions, SMapFileOptions const& mapfileoptions) {
 
-    cv::VideoWriter vid;
-    
-    if(bVideo && ostrOutput) {
-        vid.open(
-            ostrOutput.get() + ".mov",
-            cv::VideoWriter::fourcc('m', 'p', '4', 'v'), 
-            5, 
-            cv::Size(c_nMapExtent, c_nMapExtent)
-        );
+    std::unique_ptr<CVideoWriter> pvideowriter;
+    if(ovideooptions && ostrOutput) {
+        pvideowriter = std::make_unique<CVideoWriter>(ostrOutput.get() + ".mov", ovideooptions.get());
+        if(!pvideowriter->isOpened()) {
+            std::cerr << "Couldn't write " << ostrOutput.get() << ".mov" << std::endl;
+            return 1;
+        }
     }
+    // At most one frame per 1/fps seconds of log time, so the video plays in real time
+    double fSecondsNextFrame = 0;
     
     auto const tpStart = std::chrono::system_clock::now();
 
-    CFastParticleSlamBase pfslam;
+    auto const pslam = MakeSlamBackend(slamoptions, mapfileoptions);
+    if(!pslam) return 1;
     SScanLine scanline;
     
     SOdometryData odomPrev = {0};
@@ -52,75 +56,47 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
     rbt::interval<double> intvlfAcceleration = rbt::interval<double>::empty();
     rbt::interval<double> intvlfSpeed = rbt::interval<double>::empty();
 
-    std::setlocale(LC_ALL, "en_US.utf8");
-    for( std::string strLine; std::getline( ifs, strLine ); ) {
-        if(!strLine.empty()) {
-            switch(strLine[0]) {
-                case 'o':
-                    SOdometryData odom;
-                    double fSeconds;
-                    if(5==sscanf(strLine.data(), "o;%lf;%hd;%hd;%hd;%hd", 
-                        &fSeconds,
-                        &odom.m_nFrontLeft, 
-                        &odom.m_nFrontRight,
-						&odom.m_nBackLeft,
-						&odom.m_nBackRight)) 
-                    {
-                        scanline.add(odom);
-
-                        intvlfAcceleration |= Acceleration(odom, fSeconds, /*bLeft*/ true);
-                        intvlfAcceleration |= Acceleration(odom, fSeconds, /*bLeft*/ false);
-
-                        intvlfSpeed |= Speed(odom, fSeconds, /*bLeft*/ true);
-                        intvlfSpeed |= Speed(odom, fSeconds, /*bLeft*/ false);
-
-                        odomPrev = odom;
-                        fSpeedPrevLeft = Speed(odom, fSeconds, /*bLeft*/ true);
-                        fSpeedPrevRight = Speed(odom, fSeconds, /*bLeft*/ false);
-                        fSecondsPrev = fSeconds;
-                    } else {
-                        std::cerr << "Invalid odometry data: " << strLine << std::endl;
-                    }
-                    break;
-                case 'l':
-                {
-                    std::vector<SScanLine::SScan> vecscan;
-                    for(auto i = strLine.find(';', strLine.find(';') + 1);;) {
-                        auto iEnd = strLine.find(';', i+1);
-                        if(iEnd==std::string::npos) break;
-
-                        int nAngle;
-                        int nDistance;
-                        if(2==sscanf(&strLine[i+1], "%d/%d", &nAngle, &nDistance)) {
-                            vecscan.emplace_back(nAngle < 180 ? nAngle + 180 : nAngle - 180, nDistance);
-                        } else {
-                            std::cerr << "Invalid lidar data: " << &strLine[i] << std::endl;
-                        }
-                        i = iEnd;
-                    }
-                    scanline.m_vecscan = std::move(vecscan);
-
-                    if(scanline.translation()!=rbt::size<double>::zero() || scanline.rotation()!=0.0) {
-                        pfslam.receivedSensorData(scanline);
-                        if(vid.isOpened()) {
-                            cv::Mat matTemp;
-                            cv::cvtColor(pfslam.getMapWithPoses(), matTemp, cv::COLOR_GRAY2RGB);
-                            vid << matTemp;
-                        }
-                    }
-                    scanline.clear();
-                    break;
+    bool const bRead = ReadLogFile(strLogFile,
+        [&](double fSeconds, SOdometryData const& odom) {
+            scanline.add(odom);
+
+            intvlfAcceleration |= Acceleration(odom, fSeconds, /*bLeft*/ true);
+            intvlfAcceleration |= Acceleration(odom, fSeconds, /*bLeft*/ false);
+
+            intvlfSpeed |= Speed(odom, fSeconds, /*bLeft*/ true);
+            intvlfSpeed |= Speed(odom, fSeconds, /*bLeft*/ false);
+
+            odomPrev = odom;
+            fSpeedPrevLeft = Speed(odom, fSeconds, /*bLeft*/ true);
+            fSpeedPrevRight = Speed(odom, fSeconds, /*bLeft*/ false);
+            fSecondsPrev = fSeconds;
+        },
+        [&](double fSeconds, SLogScan const* pscan, std::size_t cScans) {
+            AssignReplayScans(pscan, cScans, scanline.m_vecscan);
+
+            if(scanline.translation()!=rbt::size<double>::zero() || scanline.rotation()!=0.0) {
+                if(pslam->receivedSensorData(scanline) && pvideowriter && fSecondsNextFrame <= fSeconds) {
+                    pvideowriter->post(pslam->getObstacleGrid(), pslam->Poses());
+                    auto const fInterval = 1.0 / ovideooptions->m_fFps;
+                    fSecondsNextFrame = (std::floor(fSeconds / fInterval) + 1) * fInterval;
                 }
-                default:
-                    std::cerr << "Invalid line in log file: " << strLine << std::endl;
-                    return 1;
             }
-        }
+            scanline.clear();
+        });
+    if(!bRead) {
+        std::cerr << "Couldn't read " << strLogFile << std::endl;
+        return 1;
+    }
+    pvideowriter.reset(); // wait for the queued frames
+
+    if(mapfileoptions.m_ostrSave && !SaveMap(mapfileoptions.m_ostrSave.get(), pslam->save(), mapfileoptions.m_bCompress)) {
+        std::cerr << "Couldn't write " << mapfileoptions.m_ostrSave.get() << std::endl;
+        return 1;
     }
 
-    if(!bVideo && ostrOutput) {
+    if(!ovideooptions && ostrOutput) {
         try {
-            cv::imwrite(ostrOutput.get() + ".png", pfslam.getMap());
+            cv::imwrite(ostrOutput.get() + ".png", pslam->getMap());
         } catch (cv::Exception& ex) {
             std::cerr << "Exception while writing to " << ostrOutput.get() << ": " << ex.what();
             return 1;
@@ -130,7 +106,7 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
     // We are ignoring the rest of the last scan line
     auto const tpEnd = std::chrono::system_clock::now();
     std::chrono::duration<double> const durDiff = tpEnd-tpStart;
-    auto const poseFinal = pfslam.Poses().back();
+    auto const poseFinal = pslam->Poses().back();
     std::cout << durDiff.count() << " s\n"
         << " Final pose: ("<< poseFinal.m_pt.x  <<";"<< poseFinal.m_pt.y <<";" << poseFinal.m_fYaw << ")\n";
     
@@ -139,9 +115,12 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
 
     std::cout << " Finding path back to (0;0) \n";
 
+    // Both planners use the same cost map
+    CCostMap costmap;
+    costmap.update(pslam->getObstacleGrid());
     {
         auto const tpStart = std::chrono::system_clock::now();
-        auto const vecptf = FindPath(pfslam.getMap(), poseFinal, rbt::point<double>::zero());
+        auto const vecptf = CGridPathPlanner().FindPath(costmap, poseFinal, rbt::point<double>::zero());
         auto const tpEnd = std::chrono::system_clock::now();
     
         std::chrono::duration<double> const durDiff = tpEnd-tpStart;
@@ -151,7 +130,8 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
             cv::imwrite(
                 ostrOutput.get() + "_astar.png", 
                 ObstacleMapWithPoses(
-                    pfslam.getMap(), 
+                    pslam->getMap(), 
+                    pslam->getMapOrigin(),
                     boost::copy_range<std::vector<rbt::pose<double>>>(
                         boost::adaptors::transform(vecptf, [](rbt::point<double> const& ptf) { return rbt::pose<double>(ptf, 0); })
                     )
@@ -161,7 +141,7 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
     }
     {
         auto const tpStart = std::chrono::system_clock::now();
-        auto const vecposeConfigSpace = PathConfigurationSpace(matn, poseFinal, rbt::point<double>::zero());
+        auto const vecposeConfigSpace = PathConfigurationSpace(costmap, poseFinal, rbt::point<double>::zero());
         auto const tpEnd = std::chrono::system_clock::now();
     
         std::chrono::duration<double> const durDiff = tpEnd-tpStart;
@@ -171,7 +151,8 @@ int ParseLogFile(std::ifstream& ifs, bool bVideo, boost::optional<std::string> c
             cv::imwrite(
                 ostrOutput.get() + "_cp.png", 
                 ObstacleMapWithPoses(
-                    matn, 
+                    pslam->getMap(), 
+                    pslam->getMapOrigin(),
                     vecposeConfigSpace
                 )
             );
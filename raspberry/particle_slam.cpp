@@ -1,84 +1,74 @@
 #include "particle_slam.h"
 #include "robot_configuration.h"
 #include "error_handling.h"
+#include "worker_pool.h"
+#include "profiling.h"
 #include "occupancy_grid.inl"
 
 #include <boost/range/algorithm/max_element.hpp>
 #include <boost/range/adaptor/transformed.hpp>
 
 #include <opencv2/imgproc.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
 #include <iostream>
 #include <random>
-#include <future>
 
 /////////////////////
 // SParticle
 SParticle::SParticle() 
-    : m_pose(rbt::pose<double>::zero()),
-    m_matLikelihood(c_nMapExtent, c_nMapExtent, CV_32FC1, cv::Scalar(0))
+    : m_pose(rbt::pose<double>::zero())
 {}
 
-SParticle::SParticle(SParticle const& p)
-    : m_pose(p.m_pose),
-     m_matLikelihood(p.m_matLikelihood.clone()),
-     m_occgrid(p.m_occgrid)
-{}
-
-SParticle& SParticle::operator=(SParticle const& p) {
-    m_pose = p.m_pose;
-    m_matLikelihood = p.m_matLikelihood.clone();
-    m_occgrid = p.m_occgrid;
-    return *this;
-}
-
-void SParticle::update(SScanLine const& scanline) {
-    m_pose = sample_motion_model(m_pose, scanline.translation(), scanline.rotation());
+void SParticle::update(SScanLine const& scanlineMatch, SScanLine const& scanline) {
+    {
+        CScopedTimer timer(estageUpdatePose);
+        m_pose = sample_motion_model(m_pose, scanline.translation(), scanline.rotation(), m_rng);
 
-    // OPTIMIZE: Match fewer points
-    m_fWeight = measurement_model_map(m_pose, scanline, 
-        [this](rbt::point<double> const& pt) {
-            auto const ptn = ToGridCoordinate(pt);
-            return static_cast<double>(m_matLikelihood.at<float>(ptn.y, ptn.x));
-        });
+        CScopedTimer timerLikelihood(estageLikelihood);
+        m_fWeight = measurement_model_map(m_pose, scanlineMatch, 
+            [this](rbt::point<double> const& pt) {
+                // Unknown area is c_nMaxDistance from obstacles
+                return static_cast<double>(m_occgrid.LikelihoodField().distance(ToGridCoordinate(pt)));
+            });
+    }
 
     // OPTIMIZE: Recalculate occupancy grid after resampling?
-    // OPTIMIZE: m_occgrid.update also sets occupancy of robot itself each time
-    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        m_occgrid.update(m_pose, scan.m_fRadAngle, scan.m_nDistance);
-    });
-    cv::distanceTransform(m_occgrid.ObstacleMap(), m_matLikelihood, CV_DIST_L2, 3); 
+    CScopedTimer timer(estageUpdateMap);
+    m_occgrid.update(m_pose, scanline);
+    m_occgrid.UpdateLikelihoodField();
 }
 
 ///////////////////////
 // SParticleSLAM
-CParticleSlamBase::CParticleSlamBase(int cParticles)
-    : m_vecparticle(cParticles), m_itparticleBest(m_vecparticle.end()), m_vecparticleTemp(cParticles) 
-{}
+CParticleSlamBase::CParticleSlamBase(int cParticles, SScanFilterParameters const& paramsFilter, SUpdateGateParameters const& paramsGate, SParticleCountParameters const& paramsCount)
+    : m_vecparticle(CParticleCount(paramsCount).clamp(cParticles)), m_itparticleBest(m_vecparticle.end())
+    , m_particlecount(paramsCount), m_filter(paramsFilter), m_gate(paramsGate), m_rng(RandomSeed())
+{
+    boost::for_each(m_vecparticle, [&](SParticle& p) { p.m_rng = rbt::xoshiro256(m_rng()); });
+}
+
+bool CParticleSlamBase::receivedSensorData(SScanLine const& scanlineSensor) {
+    CScopedTimer timer(estageScan);
+    auto const pscanlineGated = m_gate.pass(scanlineSensor);
+    if(!pscanlineGated) return false;
+    auto const& scanline = *pscanlineGated;
 
-static std::random_device s_rd;
-void CParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
-    // TODO: Ignore data when robot is not moving for a long time
-    
     // if scanline full, update all particles,
     LOG("Update particles");
     LOG("t = (" << scanline.translation().x << 
         ";" << scanline.translation().y << ") "
         "r = " << scanline.rotation());
 
-    std::vector<std::future<double>> vecfuture;
-    boost::for_each(m_vecparticle, [&](SParticle& p) {
-        vecfuture.emplace_back( 
-            std::async(std::launch::async | std::launch::deferred,
-                [&] {
-                    p.update(scanline);
-                    return p.m_fWeight;
-                }
-            ));
+    auto const& scanlineMatch = m_filter.filter(scanline);
+    WorkerPool().for_each(m_vecparticle, [&](SParticle& p) {
+        p.update(scanlineMatch, scanline);
     }); 
 
     double fWeightTotal = 0.0;
-    for(int i=0; i<vecfuture.size(); ++i) {
-        fWeightTotal += vecfuture[i].get();
+    for(int i=0; i<m_vecparticle.size(); ++i) {
+        fWeightTotal += m_vecparticle[i].m_fWeight;
 
 #ifdef ENABLE_LOG
         auto const& p = m_vecparticle[i];
@@ -91,19 +81,22 @@ void CParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
 
     // Resampling
     // Thrun, Probabilistic robotics, p. 110
-    auto const fStepSize = fWeightTotal/m_vecparticle.size();
-    auto const r = std::uniform_real_distribution<double>(0.0, fStepSize)(s_rd);
-    auto c = m_vecparticle.front().m_fWeight;
+    CScopedTimer timerResample(estageResample);
+    auto const cParticles = static_cast<int>(m_vecparticle.size());
+    auto const fnWeight = [&](int i) { return m_vecparticle[i].m_fWeight; };
+    LowVarianceSample(cParticles, fnWeight, fWeightTotal, cParticles, m_rng, m_veciparticle);
+    if(m_particlecount.Adaptive()) {
+        auto const cNeeded = m_particlecount.count(m_veciparticle, [&](int i) { return m_vecparticle[i].m_pose; });
+        m_particlecount.resize(m_veciparticle, cNeeded, cParticles, fnWeight, fWeightTotal, m_rng);
+    }
 
+    m_vecparticleTemp.resize(m_veciparticle.size());
     auto itparticleOut = m_vecparticleTemp.begin();
-    for(int i = 0, m = 0; m<m_vecparticle.size(); ++m) {
-        auto const u = r + m * fStepSize;
-        while(c<u) {
-            ++i;
-            c += m_vecparticle[i].m_fWeight;
-        }
+    for(int i : m_veciparticle) {
         LOG("Sample particle " << i);
         *itparticleOut = m_vecparticle[i];
+        // Reseed, otherwise duplicated particles would sample the same motion
+        itparticleOut->m_rng = rbt::xoshiro256(m_rng());
         ++itparticleOut;
     }
     std::swap(m_vecparticle, m_vecparticleTemp);
@@ -112,9 +105,168 @@ void CParticleSlamBase::receivedSensorData(SScanLine const& scanline) {
         boost::adaptors::transform(m_vecparticle, std::mem_fn(&SParticle::m_fWeight))
     ).base();
     m_vecpose.emplace_back(m_itparticleBest->m_pose);
+    return true;
+}
+
+rbt::point<int> const& CParticleSlamBase::getMapOrigin() const {
+    ASSERT(m_itparticleBest!=m_vecparticle.end());
+    return m_itparticleBest->m_occgrid.Origin();
 }
 
 cv::Mat CParticleSlamBase::getMap() const {
     ASSERT(m_itparticleBest!=m_vecparticle.end());
     return m_itparticleBest->m_occgrid.ObstacleMapWithPoses(m_vecpose);
-}
\ No newline at end of file
+}
+
+CTiledGrid<std::uint8_t> const& CParticleSlamBase::getObstacleGrid() const {
+    ASSERT(m_itparticleBest!=m_vecparticle.end());
+    return m_itparticleBest->m_occgrid.ObstacleGrid();
+}
+
+SSavedMap CParticleSlamBase::save() const {
+    ASSERT(m_itparticleBest!=m_vecparticle.end());
+    return {m_itparticleBest->m_occgrid.FloatLogOdds(), m_itparticleBest->m_pose};
+}
+///////////////////////
+// CParticleLocalization
+namespace {
+    // The particles start this far from the saved pose
+    double constexpr c_fInitialStdDevTranslation = 10; // cm
+    double constexpr c_fInitialStdDevRotation = 0.1; // rad
+
+    // The obstacles of a scan are far from independent, so the log likelihood
+    // of a scan is damped. Otherwise a single scan would leave few particles.
+    double constexpr c_fLikelihoodGain = 0.2;
+
+    // Particles are sampled and weighted in blocks, one task per block
+    int constexpr c_cBlockParticles = 64;
+}
+
+CParticleLocalization::CParticleLocalization(SSavedMap const& savedmap, int cParticles, SScanFilterParameters const& paramsFilter, SUpdateGateParameters const& paramsGate, SParticleCountParameters const& paramsCount)
+    : m_vecparticle(CParticleCount(paramsCount).clamp(cParticles))
+    , m_vecparticleTemp(m_vecparticle.size())
+    , m_vecfWeight(m_vecparticle.size())
+    , m_vecnSeed((m_vecparticle.size() + c_cBlockParticles - 1) / c_cBlockParticles)
+    , m_particlecount(paramsCount), m_filter(paramsFilter), m_gate(paramsGate), m_rng(RandomSeed())
+{
+    ASSERT(0<cParticles);
+    m_occgrid.assign(savedmap.m_gridfLogOdds);
+    m_occgrid.UpdateLikelihoodField();
+
+    m_vecfLogLikelihood.resize(CLikelihoodField::c_nMaxDistance * c_nLikelihoodSteps + 1);
+    for(std::size_t i = 0; i < m_vecfLogLikelihood.size(); ++i) {
+        m_vecfLogLikelihood[i] = c_fLikelihoodGain * log_measurement_model(static_cast<double>(i) / c_nLikelihoodSteps);
+    }
+
+    std::normal_distribution<double> distTranslation(0, c_fInitialStdDevTranslation);
+    std::normal_distribution<double> distRotation(0, c_fInitialStdDevRotation);
+    boost::for_each(m_vecparticle, [&](SLocalizationParticle& p) {
+        p.m_pose = rbt::pose<double>(
+            savedmap.m_pose.m_pt + rbt::size<double>(distTranslation(m_rng), distTranslation(m_rng)),
+            savedmap.m_pose.m_fYaw + distRotation(m_rng)
+        );
+        p.m_fLogWeight = 0;
+    });
+    m_vecpose.emplace_back(savedmap.m_pose);
+}
+
+double CParticleLocalization::LogLikelihood(rbt::pose<double> const& pose) const {
+    // Like Obstacle(pose, ...), see robot_configuration.cpp
+    auto const fCos = std::cos(pose.m_fYaw);
+    auto const fSin = std::sin(pose.m_fYaw);
+    double fLogLikelihood = 0;
+    boost::for_each(m_vecszfScan, [&](rbt::size<double> const& szf) {
+        // ToGridCoordinate without the overflow checks of rbt::numeric_cast
+        rbt::point<int> const ptn(
+            static_cast<int>(std::lround((pose.m_pt.x + szf.x * fCos - szf.y * fSin) / c_nScale)) + c_nMapExtent/2,
+            static_cast<int>(std::lround((pose.m_pt.y + szf.x * fSin + szf.y * fCos) / c_nScale)) + c_nMapExtent/2
+        );
+        // Unknown area is c_nMaxDistance from obstacles
+        auto const fDistance = m_occgrid.LikelihoodField().distance(ptn);
+        auto const i = std::min(static_cast<std::size_t>(fDistance * c_nLikelihoodSteps + 0.5), m_vecfLogLikelihood.size() - 1);
+        fLogLikelihood += m_vecfLogLikelihood[i];
+    });
+    return fLogLikelihood;
+}
+
+bool CParticleLocalization::receivedSensorData(SScanLine const& scanlineSensor) {
+    CScopedTimer timer(estageScan);
+    auto const pscanlineGated = m_gate.pass(scanlineSensor);
+    if(!pscanlineGated) return false;
+    auto const& scanline = *pscanlineGated;
+
+    m_vecszfScan.clear();
+    boost::for_each(m_filter.filter(scanline).m_vecscan, [&](SScanLine::SScan const& scan) {
+        m_vecszfScan.emplace_back(rbt::size<double>::fromAngleAndDistance(scan.m_fRadAngle, scan.m_nDistance) + c_szfLidarOffset);
+    });
+    boost::for_each(m_vecnSeed, [&](std::uint64_t& nSeed) { nSeed = m_rng(); });
+    WorkerPool().parallel_for(static_cast<int>(m_vecnSeed.size()), [&](int iBlock) {
+        CScopedTimer timer(estageUpdatePose);
+        rbt::xoshiro256 rng(m_vecnSeed[iBlock]);
+        auto const itBegin = m_vecparticle.begin() + iBlock * c_cBlockParticles;
+        auto const itEnd = m_vecparticle.begin() + std::min<std::size_t>((iBlock + 1) * c_cBlockParticles, m_vecparticle.size());
+        std::for_each(itBegin, itEnd, [&](SLocalizationParticle& p) {
+            p.m_pose = sample_motion_model(p.m_pose, scanline.translation(), scanline.rotation(), rng);
+            p.m_fLogWeight += LogLikelihood(p.m_pose);
+        });
+    });
+
+    CScopedTimer timerResample(estageResample);
+    auto const fMax = *boost::max_element(boost::adaptors::transform(m_vecparticle, std::mem_fn(&SLocalizationParticle::m_fLogWeight)));
+    double fWeightSum = 0;
+    for(std::size_t i = 0; i < m_vecparticle.size(); ++i) {
+        m_vecfWeight[i] = std::exp(m_vecparticle[i].m_fLogWeight - fMax);
+        fWeightSum += m_vecfWeight[i];
+    }
+
+    // The weighted mean pose, the yaw is averaged on the unit circle
+    rbt::point<double> ptfMean = rbt::point<double>::zero();
+    double fCos = 0;
+    double fSin = 0;
+    double fSumSquares = 0;
+    for(std::size_t i = 0; i < m_vecparticle.size(); ++i) {
+        auto& fWeight = m_vecfWeight[i];
+        fWeight /= fWeightSum;
+        auto const& pose = m_vecparticle[i].m_pose;
+        ptfMean.x += fWeight * pose.m_pt.x;
+        ptfMean.y += fWeight * pose.m_pt.y;
+        fCos += fWeight * std::cos(pose.m_fYaw);
+        fSin += fWeight * std::sin(pose.m_fYaw);
+        fSumSquares += fWeight * fWeight;
+    }
+    m_vecpose.emplace_back(ptfMean, std::atan2(fSin, fCos));
+
+    // Resample if the effective sample size is less than half the particles
+    // or the particle count should change
+    // Thrun, Probabilistic robotics, p. 110
+    auto const cParticles = static_cast<int>(m_vecparticle.size());
+    auto const fnWeight = [&](int i) { return m_vecfWeight[i]; };
+    auto cParticlesNew = cParticles;
+    bool bSampled = false;
+    if(m_particlecount.Adaptive()) {
+        LowVarianceSample(cParticles, fnWeight, 1.0, cParticles, m_rng, m_veciparticle);
+        bSampled = true;
+        auto const cNeeded = m_particlecount.count(m_veciparticle, [&](int i) { return m_vecparticle[i].m_pose; });
+        // Resampling too often loses diversity, small changes are ignored
+        if(cParticles < 4 * std::abs(cNeeded - cParticles)) cParticlesNew = cNeeded;
+    }
+    if(1.0 / fSumSquares < 0.5 * cParticles || cParticlesNew!=cParticles) {
+        if(bSampled) {
+            m_particlecount.resize(m_veciparticle, cParticlesNew, cParticles, fnWeight, 1.0, m_rng);
+        } else {
+            LowVarianceSample(cParticles, fnWeight, 1.0, cParticlesNew, m_rng, m_veciparticle);
+        }
+        m_vecparticleTemp.resize(m_veciparticle.size());
+        for(std::size_t m = 0; m < m_veciparticle.size(); ++m) {
+            m_vecparticleTemp[m] = {m_vecparticle[m_veciparticle[m]].m_pose, 0.0};
+        }
+        std::swap(m_vecparticle, m_vecparticleTemp);
+        m_vecfWeight.resize(m_vecparticle.size());
+        m_vecnSeed.resize((m_vecparticle.size() + c_cBlockParticles - 1) / c_cBlockParticles);
+    }
+    return true;
+}
+
+cv::Mat CParticleLocalization::getMap() const {
+    return m_occgrid.ObstacleMapWithPoses(m_vecpose);
+}
@@ -2,10 +2,15 @@
 
 #include "geometry.h"
 #include "occupancy_grid.h"
+#include "map_file.h"
+#include "random_generator.h"
+#include "resampling.h"
 
 #include <vector>
 #include <opencv2/core.hpp>
 #include "scanline.h"
+#include "scan_filter.h"
+#include "update_gate.h"
 
 // Simple particle filter algorithm as described 
 // in Thrun et al "Probabilistic Robotics" p 478
@@ -13,23 +18,37 @@ struct SParticle {
     rbt::pose<double> m_pose;
     
     double m_fWeight;
-    cv::Mat m_matLikelihood; // likelihood field
+    rbt::xoshiro256 m_rng;
     
-    COccupancyGrid m_occgrid;
+    // The map updates are exact in int16 cells, which halve the memory
+    // and the cost of the tiles cloned after resampling
+    COccupancyGrid16 m_occgrid;
     
     SParticle();
-    SParticle(SParticle const& p);
-    SParticle& operator=(SParticle const& p);
 
-    void update(SScanLine const& scanline);
+    // The weight is computed from scanlineMatch, the map is updated with scanline
+    void update(SScanLine const& scanlineMatch, SScanLine const& scanline);
 };
 
+// The particles are resampled after every scan line. With adaptive
+// SParticleCountParameters, the particle count starts at cParticles within the
+// bounds and is chosen by KLD sampling on every resampling, see CParticleCount.
 struct CParticleSlamBase : rbt::nonmoveable {
-    CParticleSlamBase(int cParticles = 100);
-    void receivedSensorData(SScanLine const& scanline);
+    CParticleSlamBase(int cParticles = 100, 
+        SScanFilterParameters const& paramsFilter = SScanFilterParameters(),
+        SUpdateGateParameters const& paramsGate = SUpdateGateParameters(),
+        SParticleCountParameters const& paramsCount = SParticleCountParameters());
+    // Returns false if the scan line has been gated out, see CUpdateGate
+    bool receivedSensorData(SScanLine const& scanlineSensor);
     cv::Mat getMap() const;
+    rbt::point<int> const& getMapOrigin() const; // grid coordinate of top-left pixel of getMap()
+    // The obstacle grid of the best particle, copies share its tiles
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const;
+    // The map and the pose of the best particle
+    SSavedMap save() const;
 
     std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; } 
+    int ParticleCount() const { return static_cast<int>(m_vecparticle.size()); }
 
 private:
     std::vector<SParticle> m_vecparticle;
@@ -37,4 +56,65 @@ private:
     std::vector<rbt::pose<double>> m_vecpose; // history of best poses
 
     std::vector<SParticle> m_vecparticleTemp;
-}; 
\ No newline at end of file
+    CParticleCount m_particlecount;
+    std::vector<int> m_veciparticle; // resampled particles
+    CScanFilter m_filter;
+    CUpdateGate m_gate;
+    rbt::xoshiro256 m_rng; // for resampling and seeding the particles' generators
+};
+
+// Monte Carlo localization in a fixed map, see Thrun et al "Probabilistic Robotics" p 252.
+// Unlike CParticleSlamBase, all particles share one read-only map and its
+// likelihood field, so a particle is only a pose and a weight and the map is
+// never updated. The matched scans are converted to points in the robot's
+// frame once per scan line, the likelihood of each obstacle is looked up in a
+// table by its distance to the map. So the cost per particle is a motion
+// sample, one rotation and one table lookup per matched scan.
+// The particles start around the pose of the saved map. Like CFastParticleSlamBase,
+// the particles are only resampled when the effective sample size gets small,
+// or with adaptive SParticleCountParameters when the count needed changes.
+struct SLocalizationParticle {
+    rbt::pose<double> m_pose;
+    double m_fLogWeight;
+};
+
+struct CParticleLocalization : rbt::nonmoveable {
+    CParticleLocalization(SSavedMap const& savedmap, int cParticles = 1000,
+        SScanFilterParameters const& paramsFilter = SScanFilterParameters(),
+        SUpdateGateParameters const& paramsGate = SUpdateGateParameters(),
+        SParticleCountParameters const& paramsCount = SParticleCountParameters());
+    // Returns false if the scan line has been gated out, see CUpdateGate
+    bool receivedSensorData(SScanLine const& scanlineSensor);
+    cv::Mat getMap() const;
+    rbt::point<int> const& getMapOrigin() const { return m_occgrid.Origin(); } // grid coordinate of top-left pixel of getMap()
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const { return m_occgrid.ObstacleGrid(); }
+    // The map and the last pose, the map is never updated
+    SSavedMap save() const { return {m_occgrid.LogOdds(), m_vecpose.back()}; }
+
+    // The weighted mean poses of the particles
+    std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; }
+    std::vector<SLocalizationParticle> const& Particles() const { return m_vecparticle; }
+
+private:
+    // The log likelihood of an obstacle at a distance to the map in c_nLikelihoodSteps per cell
+    static int constexpr c_nLikelihoodSteps = 8;
+    // Of the obstacles in m_vecszfScan seen from pose
+    double LogLikelihood(rbt::pose<double> const& pose) const;
+
+    COccupancyGrid m_occgrid;
+    std::vector<double> m_vecfLogLikelihood;
+    std::vector<rbt::size<double>> m_vecszfScan; // obstacles in the robot's frame
+
+    std::vector<SLocalizationParticle> m_vecparticle;
+    std::vector<SLocalizationParticle> m_vecparticleTemp;
+    std::vector<double> m_vecfWeight; // normalized
+    std::vector<std::uint64_t> m_vecnSeed; // per block of particles sampled in parallel
+    std::vector<rbt::pose<double>> m_vecpose;
+
+    CParticleCount m_particlecount;
+    std::vector<int> m_veciparticle; // resampled particles
+
+    CScanFilter m_filter;
+    CUpdateGate m_gate;
+    rbt::xoshiro256 m_rng;
+};
@@ -7,287 +7,601 @@
 
 #include <opencv2/opencv.hpp>
 
+#include <array>
+#include <cmath>
 #include <vector>
-#include <queue>
 
-#include <boost/functional/hash.hpp>
-#include <boost/optional.hpp>
 #include <boost/range/algorithm/reverse.hpp>
+#include <boost/range/algorithm/sort.hpp>
 
-// A* path finding algorithm
-template<typename TNode, typename T, typename FMinimalNodeCost, typename FForEachNeighbor, typename FIsGoal>
-boost::optional<TNode> GenericAStar(rbt::pose<T> const& poseStart, 
-    rbt::point<T> const& ptEnd, 
-    FMinimalNodeCost MinimalNodeCost, 
-    FForEachNeighbor ForEachNeighbor,
-	FIsGoal IsGoal
-) {
-    auto GreaterDistance = [&](TNode const& lhs, TNode const& rhs) noexcept {
-        return (lhs.Position() - ptEnd).Abs() + lhs.m_fCost > (rhs.Position() - ptEnd).Abs() + rhs.m_fCost;
-    };
+namespace {
+    // Lower bound of the path cost between two cells, every step costs at least its length
+    float OctileDistance(rbt::point<int> const& ptnA, rbt::point<int> const& ptnB) {
+        auto const nDX = std::abs(ptnA.x - ptnB.x);
+        auto const nDY = std::abs(ptnA.y - ptnB.y);
+        return std::max(nDX, nDY) + static_cast<float>(M_SQRT2 - 1) * std::min(nDX, nDY);
+    }
+
+    // Cost of the step from a cell to its neighbor at offset (x, y)
+    // that has cost map value nFree, infinite if the neighbor is blocked.
+    float StepCost(int x, int y, std::uint8_t nFree) {
+        if(nFree<=CCostMap::c_nMaxBlocked) return std::numeric_limits<float>::infinity();
+        return (0==x || 0==y ? 1.0f : M_SQRT2) * (1 + (255 - nFree)/10);
+    }
+
+    // Calls fn(ptNext, x, y) for the 8 neighbors ptNext = pt + (x, y) inside an image of size sz
+    template<typename Func>
+    void ForEachNeighbor(cv::Size const& sz, rbt::point<int> const& pt, Func fn) {
+        for(int x = -1; x <= 1; ++x) {
+            for(int y = -1; y <= 1; ++y) {
+                auto const ptNext = pt + rbt::size<int>(x, y);
+                if((0!=x || 0!=y) && 0<=ptNext.x && ptNext.x<sz.width && 0<=ptNext.y && ptNext.y<sz.height) fn(ptNext, x, y);
+            }
+        }
+    }
+}
+
+CGridPathPlanner::SCell& CGridPathPlanner::Cell(int i) {
+    auto& cell = m_veccell[i];
+    if(cell.m_nQuery!=m_nQuery) {
+        cell.m_nQuery = m_nQuery;
+        cell.m_fCost = std::numeric_limits<float>::max();
+        cell.m_fHeuristic = m_optptnEnd ? OctileDistance(rbt::point<int>(i % m_nCols, i / m_nCols), *m_optptnEnd) : 0;
+        cell.m_bClosed = false;
+        cell.m_iParent = -1;
+    }
+    return cell;
+}
+
+bool CGridPathPlanner::Reset(CCostMap const& costmap, rbt::point<int> const& ptnStart, boost::optional<rbt::point<int>> const& optptnEnd) {
+    auto const& matnCost = costmap.Costs();
+    if(!costmap.is_inside(ptnStart)) return false;
 
-    std::priority_queue<TNode, std::vector<TNode>, decltype(GreaterDistance)> queue(GreaterDistance);
-    
-    TNode nodeStart(poseStart);
-    queue.push(nodeStart);
-    MinimalNodeCost(nodeStart) = nodeStart.m_fCost;
+    // Reset all cells only if the map size changed or the query counter wraps around
+    if(m_nCols!=matnCost.cols || m_veccell.size()!=static_cast<std::size_t>(matnCost.rows * matnCost.cols)) {
+        m_nCols = matnCost.cols;
+        m_veccell.assign(matnCost.rows * matnCost.cols, SCell());
+        m_heap.reset(matnCost.rows * matnCost.cols);
+        m_nQuery = 0;
+    }
+    if(0==++m_nQuery) {
+        for(auto& cell : m_veccell) cell.m_nQuery = 0;
+        m_nQuery = 1;
+    }
+    m_heap.clear();
+    m_optptnEnd = optptnEnd;
+
+    auto const iStart = ptnStart.y * m_nCols + ptnStart.x;
+    auto& cellStart = Cell(iStart);
+    cellStart.m_fCost = 0;
+    m_heap.push(iStart, Key(cellStart));
+    return true;
+}
+
+void CGridPathPlanner::Expand(CCostMap const& costmap, int i) {
+    auto& cell = m_veccell[i];
+    cell.m_bClosed = true;
+
+    ForEachNeighbor(costmap.Costs().size(), rbt::point<int>(i % m_nCols, i / m_nCols), [&](rbt::point<int> const& ptNext, int x, int y) {
+        auto const fStep = StepCost(x, y, costmap.at(ptNext));
+        if(std::isinf(fStep)) return;
+
+        auto const iNext = ptNext.y * m_nCols + ptNext.x;
+        auto& cellNext = Cell(iNext);
+        // The heuristic is consistent, closed cells can't be improved
+        if(cellNext.m_bClosed) return;
+
+        auto const fCostNext = cell.m_fCost + fStep;
+        if(fCostNext < cellNext.m_fCost) {
+            cellNext.m_fCost = fCostNext;
+            cellNext.m_iParent = i;
+            if(m_heap.contains(iNext)) {
+                m_heap.update(iNext, Key(cellNext));
+            } else {
+                m_heap.push(iNext, Key(cellNext));
+            }
+        }
+    });
+}
 
-    while(!queue.empty()) {
-        auto const nodeTop = queue.top();
-        queue.pop();
+std::vector<rbt::point<double>> CGridPathPlanner::Path(CCostMap const& costmap, int iEnd, rbt::point<double> const& ptfEnd) const {
+    std::vector<rbt::point<double>> vecptfResult;
+    vecptfResult.emplace_back(ptfEnd);
+    for(auto i = m_veccell[iEnd].m_iParent; 0<=i; i = m_veccell[i].m_iParent) {
+        vecptfResult.emplace_back(ToWorldCoordinate(rbt::point<double>(i % m_nCols, i / m_nCols), costmap.Origin()));
+    }
+    return vecptfResult;
+}
 
-        if(MinimalNodeCost(nodeTop) < nodeTop.m_fCost) continue;
+std::vector<rbt::point<double>> CGridPathPlanner::FindPath(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    auto const ptnEnd = ToGridCoordinate(ptfEnd, costmap.Origin());
+    if(!costmap.is_inside(ptnEnd) || !Reset(costmap, ToGridCoordinate(posefStart, costmap.Origin()).m_pt, ptnEnd)) return {};
 
-        if(IsGoal(nodeTop, ptEnd)) return nodeTop;
+    auto const iEnd = ptnEnd.y * m_nCols + ptnEnd.x;
+    while(!m_heap.empty() && m_heap.top()!=iEnd) {
+        Expand(costmap, m_heap.pop());
+    }
+    if(m_heap.empty()) return {};
+    return Path(costmap, iEnd, ptfEnd);
+}
+
+std::vector<CGridPathPlanner::SPathToTarget> CGridPathPlanner::FindPaths(CCostMap const& costmap, rbt::pose<double> const& posefStart, std::vector<rbt::point<double>> const& vecptfTargets) {
+    std::vector<SPathToTarget> vecpath(vecptfTargets.size(), SPathToTarget{std::numeric_limits<float>::infinity(), {}});
+    if(!Reset(costmap, ToGridCoordinate(posefStart, costmap.Origin()).m_pt, boost::none)) return vecpath;
+
+    // The targets by cell, several targets may be in the same cell
+    std::vector<std::pair<int, int>> vecpairiCelliTarget;
+    for(int iTarget = 0; iTarget < static_cast<int>(vecptfTargets.size()); ++iTarget) {
+        auto const ptn = ToGridCoordinate(vecptfTargets[iTarget], costmap.Origin());
+        if(costmap.is_inside(ptn)) vecpairiCelliTarget.emplace_back(ptn.y * m_nCols + ptn.x, iTarget);
+    }
+    boost::sort(vecpairiCelliTarget);
+
+    auto cRemaining = vecpairiCelliTarget.size();
+    while(!m_heap.empty() && 0<cRemaining) {
+        auto const i = m_heap.pop();
+        auto itpair = std::lower_bound(vecpairiCelliTarget.begin(), vecpairiCelliTarget.end(), std::make_pair(i, 0));
+        for(; itpair!=vecpairiCelliTarget.end() && itpair->first==i; ++itpair, --cRemaining) {
+            auto& path = vecpath[itpair->second];
+            path.m_fCost = m_veccell[i].m_fCost;
+            path.m_vecptf = Path(costmap, i, vecptfTargets[itpair->second]);
+        }
+        Expand(costmap, i);
+    }
+    return vecpath;
+}
+
+std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::point<int> const& ptnOrigin, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    CCostMap costmap;
+    costmap.update(matn, ptnOrigin);
+    CGridPathPlanner planner;
+    return planner.FindPath(costmap, posefStart, ptfEnd);
+}
+
+// D* Lite, following the pseudo code in Koenig, Likhachev, "D* Lite", AAAI 2002, Fig. 3.
+// m_fG and m_fRhs are the costs from a cell to the goal.
+float CIncrementalPathPlanner::Heuristic(int i) const {
+    return OctileDistance(Position(m_iStart), Position(i));
+}
+
+CIncrementalPathPlanner::key_type CIncrementalPathPlanner::Key(int i) const {
+    auto const fMin = std::min(m_veccell[i].m_fG, m_veccell[i].m_fRhs);
+    return key_type(fMin + Heuristic(i) + m_fKm, fMin);
+}
+
+float CIncrementalPathPlanner::MinSuccessorCost(int i, int* piNext) const {
+    auto fMin = std::numeric_limits<float>::infinity();
+    ForEachNeighbor(m_szn, Position(i), [&](rbt::point<int> const& ptNext, int x, int y) {
+        auto const iNext = Index(ptNext);
+        if(rbt::assign_min(fMin, StepCost(x, y, m_veccell[iNext].m_nCost) + m_veccell[iNext].m_fG) && piNext) {
+            *piNext = iNext;
+        }
+    });
+    return fMin;
+}
+
+void CIncrementalPathPlanner::UpdateCell(int i) {
+    auto& cell = m_veccell[i];
+    if(i!=m_iGoal) cell.m_fRhs = MinSuccessorCost(i, nullptr);
+
+    if(cell.m_fG!=cell.m_fRhs) {
+        if(m_heap.contains(i)) {
+            m_heap.update(i, Key(i));
+        } else {
+            m_heap.push(i, Key(i));
+        }
+    } else if(m_heap.contains(i)) {
+        m_heap.erase(i);
+    }
+}
+
+void CIncrementalPathPlanner::UpdatePredecessors(int i) {
+    ForEachNeighbor(m_szn, Position(i), [&](rbt::point<int> const& ptPrev, int, int) {
+        UpdateCell(Index(ptPrev));
+    });
+}
+
+void CIncrementalPathPlanner::ComputeShortestPath() {
+    auto const& cellStart = m_veccell[m_iStart];
+    while(!m_heap.empty() && (m_heap.top_key() < Key(m_iStart) || cellStart.m_fRhs!=cellStart.m_fG)) {
+        auto const i = m_heap.top();
+        auto const keyOld = m_heap.top_key();
+        auto const keyNew = Key(i);
+        auto& cell = m_veccell[i];
+        if(keyOld < keyNew) {
+            m_heap.update(i, keyNew);
+        } else if(cell.m_fRhs < cell.m_fG) {
+            cell.m_fG = cell.m_fRhs;
+            m_heap.erase(i);
+            UpdatePredecessors(i);
+        } else {
+            cell.m_fG = std::numeric_limits<float>::infinity();
+            UpdateCell(i);
+            UpdatePredecessors(i);
+        }
+    }
+}
 
-        ForEachNeighbor(
-            nodeTop, 
-            [&](TNode const& nodeNeighbor) {
-                if(rbt::assign_min(MinimalNodeCost(nodeNeighbor), nodeNeighbor.m_fCost)) {
-                    queue.push(nodeNeighbor);
+std::vector<rbt::point<double>> CIncrementalPathPlanner::FindPath(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    auto const& ptnOrigin = costmap.Origin();
+    auto const& matnCost = costmap.Costs();
+    auto const ptnStart = ToGridCoordinate(posefStart, ptnOrigin).m_pt;
+    auto const ptnEnd = ToGridCoordinate(ptfEnd, ptnOrigin);
+    if(!costmap.is_inside(ptnStart) || !costmap.is_inside(ptnEnd)) return {};
+
+    auto const bSameMap = m_ptnOrigin==ptnOrigin && m_szn==matnCost.size();
+    m_ptnOrigin = ptnOrigin;
+    m_szn = matnCost.size();
+    auto const iStart = Index(ptnStart);
+    auto const iGoal = Index(ptnEnd);
+    if(!bSameMap || m_iGoal!=iGoal) {
+        // Search from scratch
+        m_iGoal = iGoal;
+        m_iStart = iStart;
+        m_fKm = 0;
+
+        SCell const cellInit = {std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), 0};
+        m_veccell.assign(matnCost.rows * matnCost.cols, cellInit);
+        for(int y = 0; y < matnCost.rows; ++y) {
+            for(int x = 0; x < matnCost.cols; ++x) m_veccell[y * matnCost.cols + x].m_nCost = costmap.at(rbt::point<int>(x, y));
+        }
+        m_heap.reset(matnCost.rows * matnCost.cols);
+        m_veccell[m_iGoal].m_fRhs = 0;
+        m_heap.push(m_iGoal, Key(m_iGoal));
+    } else {
+        // The heuristic of all queued keys decreases by at most the distance the robot moved
+        m_fKm += OctileDistance(Position(m_iStart), Position(iStart));
+        m_iStart = iStart;
+
+        // Repair the cells whose step costs into changed cells changed.
+        // After more than one cost map update, any cell may have changed.
+        auto rectChanged = costmap.Changed();
+        if(costmap.Version()!=m_nCostVersion + 1) {
+            rectChanged = costmap.Version()==m_nCostVersion
+                ? rbt::rect<int>::empty()
+                : rbt::rect<int>{0, 0, matnCost.cols - 1, matnCost.rows - 1};
+        }
+        for(int y = rectChanged.bottom; y <= rectChanged.top; ++y) {
+            auto const* pnCost = matnCost.ptr<std::uint8_t>(y);
+            for(int x = rectChanged.left; x <= rectChanged.right; ++x) {
+                auto& cell = m_veccell[y * matnCost.cols + x];
+                if(cell.m_nCost!=pnCost[x]) {
+                    cell.m_nCost = pnCost[x];
+                    UpdatePredecessors(y * matnCost.cols + x);
                 }
-            });
+            }
+        }
+    }
+    m_nCostVersion = costmap.Version();
+    ComputeShortestPath();
+
+    std::vector<rbt::point<double>> vecptfResult;
+    if(std::isinf(m_veccell[m_iStart].m_fG)) return vecptfResult;
+
+    // Follow the cheapest steps to the goal
+    std::vector<int> veci(1, m_iStart);
+    while(veci.back()!=m_iGoal && veci.size() <= m_veccell.size()) {
+        int iNext = -1;
+        MinSuccessorCost(veci.back(), &iNext);
+        if(iNext<0) break;
+        veci.push_back(iNext);
     }
+    if(veci.back()!=m_iGoal) return vecptfResult;
 
-    return boost::none;
+    // Same order as CGridPathPlanner, from the goal to the start
+    vecptfResult.emplace_back(ptfEnd);
+    std::for_each(boost::next(veci.rbegin()), veci.rend(), [&](int i) {
+        vecptfResult.emplace_back(ToWorldCoordinate(rbt::point<double>(Position(i)), ptnOrigin));
+    });
+    return vecptfResult;
 }
 
-std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
-    cv::Mat matnEroded;
-    auto const nMaxExtent = std::max(c_nRobotWidth/c_nScale, c_nRobotHeight/c_nScale);
-    cv::erode(
-        matn, 
-        matnEroded, 
-        cv::Mat::ones(nMaxExtent, nMaxExtent, CV_8U)
-    );
-    
-    // Include costs of traveling close to an obstacle in calculation
-    cv::Mat matnGauss;
-    auto const nMaxExtentOdd = 2*nMaxExtent + 1;
-    cv::GaussianBlur(matnEroded, matnGauss, cv::Size(nMaxExtentOdd, nMaxExtentOdd), 0, 0);
-
-    float aanMinimalCost[c_nMapExtent][c_nMapExtent];
-    std::fill_n(&aanMinimalCost[0][0], c_nMapExtent*c_nMapExtent, std::numeric_limits<float>::max());
-
-    struct node {
-        node() {}
-        node(rbt::pose<int> const& pose) : m_pt(pose.m_pt), m_fCost(0) {}
-        node(rbt::point<int> const& pt, float fCost) : m_pt(pt), m_fCost(fCost) {}
-
-		rbt::point<int> Position() const { return m_pt; }
-
-        rbt::point<int> m_pt; // in grid coordinates
-        float m_fCost;
+namespace {
+    // The wheel speeds change by at most one speed step per time step
+    int constexpr c_nSpeedStep = 100;
+    int constexpr c_nMaxSpeedSteps = c_nMaxSpeed / c_nSpeedStep;
+    int constexpr c_nMaxSpeedStepDifference = 4; // between left and right
+    int constexpr c_cSpeeds = 2 * c_nMaxSpeedSteps + 1;
+    constexpr double c_fTimeStep = 0.2; // s
+    const float c_fHighTravelDistance = encoderTicksToCm(c_nMaxSpeed*0.8*c_fTimeStep);
+
+    // States on the same lattice point are considered equal
+    double constexpr c_fLatticeResolution = c_nScale / 2.0; // cm
+    int constexpr c_nYawBins = 72;
+
+    // The largest ratio of the octile distance and the Euclidean distance
+    float constexpr c_fMaxOctileRatio = 1.0824f;
+    // Weighted A*, the path costs at most 25% more than the optimal path.
+    // An optimal search would expand every state with a lower estimated
+    // total cost, i.e., millions for a path of a few meters.
+    float constexpr c_fHeuristicWeight = 1.25f;
+
+    int YawBin(double fYaw) { // fYaw in [-pi, pi]
+        return static_cast<int>(std::floor((fYaw + M_PI) / (2 * M_PI) * c_nYawBins)) % c_nYawBins;
+    }
+
+    // The pose change during one time step at constant wheel speeds in the robot frame.
+    // UpdatePose only depends on the robot pose through a rotation by its yaw.
+    struct SMotionPrimitive {
+        rbt::size<double> m_szf = rbt::size<double>(0, 0);
+        double m_fDeltaYaw = 0;
+        float m_fDistance = 0;
+        float m_fCostFactor = 0; // the cost per average cell cost
     };
 
-    auto MinimalNodeCost = [&](node const& node) noexcept -> float& {
-        return aanMinimalCost[node.m_pt.x][node.m_pt.y];
+    // The motion primitives, and the cells they sweep over when starting from the
+    // center of a cell at the center of a yaw bin, relative to the start cell.
+    // Expanding a node only looks up the primitives and the cell costs.
+    struct SPrimitiveTable {
+        SPrimitiveTable();
+
+        int Index(int nYawBin, int nLeft, int nRight) const {
+            return (nYawBin * c_cSpeeds + nLeft + c_nMaxSpeedSteps) * c_cSpeeds + nRight + c_nMaxSpeedSteps;
+        }
+        SMotionPrimitive const& Primitive(int nLeft, int nRight) const {
+            return m_aaprimitive[nLeft + c_nMaxSpeedSteps][nRight + c_nMaxSpeedSteps];
+        }
+
+        std::array<std::array<SMotionPrimitive, c_cSpeeds>, c_cSpeeds> m_aaprimitive;
+        // The cells swept by primitive Index(...) are
+        // [m_veciSwept[Index(...)], m_veciSwept[Index(...) + 1]) in m_vecsznSwept
+        std::vector<int> m_veciSwept;
+        std::vector<rbt::size<int>> m_vecsznSwept;
+        // The cost of driving over a cell by cost map value
+        std::array<float, 256> m_afCellCost;
     };
 
-    auto ForEachNeighbor = [&](node const& n, auto fn) noexcept {
-        for(int x = -1; x <= 1; ++x) {
-            for(int y = -1; y <= 1; ++y) {
-                auto const ptNext = n.m_pt + rbt::size<int>(x, y);
-                if((0!=x || 0!=y)
-                && 128<matnGauss.at<std::uint8_t>(ptNext.y, ptNext.x)) {
-                    fn(node(
-                        ptNext,
-                        n.m_fCost + (0==x || 0==y ? 1.0f : M_SQRT2) * (1 + (255 - matnGauss.at<std::uint8_t>(ptNext.y, ptNext.x))/10)
-                    ));
+    SPrimitiveTable::SPrimitiveTable() {
+        for(int nLeft = -c_nMaxSpeedSteps; nLeft <= c_nMaxSpeedSteps; ++nLeft) {
+            for(int nRight = -c_nMaxSpeedSteps; nRight <= c_nMaxSpeedSteps; ++nRight) {
+                auto const pose = UpdatePose(
+                    rbt::pose<double>(rbt::point<double>::zero(), 0),
+                    static_cast<int>(nLeft * c_nSpeedStep * c_fTimeStep),
+                    static_cast<int>(nRight * c_nSpeedStep * c_fTimeStep)
+                );
+                auto& primitive = m_aaprimitive[nLeft + c_nMaxSpeedSteps][nRight + c_nMaxSpeedSteps];
+                primitive.m_szf = pose.m_pt - rbt::point<double>::zero();
+                primitive.m_fDeltaYaw = pose.m_fYaw;
+                primitive.m_fDistance = primitive.m_szf.Abs();
+                // Penalize several short moves, i.e., slow moves
+                if(0<primitive.m_fDistance) {
+                    primitive.m_fCostFactor = primitive.m_fDistance * std::max(1.0, std::pow(c_fHighTravelDistance/primitive.m_fDistance, 2));
                 }
             }
         }
-    };
-	auto IsGoal = [](node const& n, rbt::point<int> const& ptnEnd) {
-		return n.m_pt == ptnEnd;
-	};
-
-	auto const posenStart = ToGridCoordinate(posefStart);
 
-    std::vector<rbt::point<double>> vecptfResult;
-    if(auto onode = GenericAStar<node>(posenStart, ToGridCoordinate(ptfEnd), MinimalNodeCost, ForEachNeighbor, IsGoal)) {
-        vecptfResult.emplace_back(ptfEnd);
-        auto const ptnStart = posenStart.m_pt;
-        for(auto nodePrev = *onode; nodePrev.m_pt!=ptnStart; ) {
-            float fMinCost = std::numeric_limits<float>::max();
-            node nodeMin;
-            ForEachNeighbor(
-                nodePrev,
-                [&](node const& node) {
-                    if(rbt::assign_min(fMinCost, MinimalNodeCost(node))) {
-                        nodeMin = node;
+        m_veciSwept.reserve(c_nYawBins * c_cSpeeds * c_cSpeeds + 1);
+        for(int nYawBin = 0; nYawBin < c_nYawBins; ++nYawBin) {
+            auto const fYaw = (nYawBin + 0.5) * 2 * M_PI / c_nYawBins - M_PI;
+            for(auto const& aprimitive : m_aaprimitive) {
+                for(auto const& primitive : aprimitive) {
+                    m_veciSwept.emplace_back(m_vecsznSwept.size());
+                    auto const szf = primitive.m_szf.rotated(fYaw) / c_nScale;
+                    rbt::line_iterator itpt(
+                        rbt::point<int>::zero(),
+                        rbt::point<int>(static_cast<int>(std::round(szf.x)), static_cast<int>(std::round(szf.y)))
+                    );
+                    for(int i = 0; i < itpt.count; ++i, ++itpt) {
+                        m_vecsznSwept.emplace_back(itpt.pos() - rbt::point<int>::zero());
                     }
                 }
-            );
+            }
+        }
+        m_veciSwept.emplace_back(m_vecsznSwept.size());
 
-            nodePrev = nodeMin;
-            vecptfResult.emplace_back(ToWorldCoordinate(rbt::point<double>(nodeMin.m_pt)));
+        for(int n = 0; n < 256; ++n) {
+            m_afCellCost[n] = std::pow((255.0 - n)/30, 2);
         }
     }
-    return vecptfResult;
+
+    std::uint64_t LatticeState(rbt::pose<double> const& pose, int nSpeedLeft, int nSpeedRight) {
+        // 20 bits per coordinate cover +-13km
+        auto const Coordinate = [](double f) {
+            return static_cast<std::uint64_t>(static_cast<std::int64_t>(std::floor(f / c_fLatticeResolution)) & 0xFFFFF);
+        };
+        return Coordinate(pose.m_pt.x)
+            | Coordinate(pose.m_pt.y) << 20
+            | static_cast<std::uint64_t>(YawBin(pose.m_fYaw)) << 40
+            | static_cast<std::uint64_t>(nSpeedLeft + c_nMaxSpeedSteps) << 48
+            | static_cast<std::uint64_t>(nSpeedRight + c_nMaxSpeedSteps) << 52;
+    }
 }
 
+CConfigurationSpacePlanner::CConfigurationSpacePlanner(int cMaxNodes) : m_cMaxNodes(cMaxNodes) {
+    std::size_t cSlots = 1;
+    while(cSlots < 2 * static_cast<std::size_t>(cMaxNodes)) cSlots *= 2;
+    m_vecnode.reserve(cMaxNodes);
+    m_vecslot.assign(cSlots, SSlot{c_nNoState, -1});
+    m_heap.reset(cMaxNodes);
+}
 
-namespace {
-    struct config_space_node {
-		config_space_node() {}
-        config_space_node(rbt::pose<double> const& pose) : m_pose(pose) {}
-        
-		rbt::point<double> Position() const { return m_pose.m_pt; }
-		
-		int RoundedYaw() const { return (int)std::round(m_pose.m_fYaw*100); }
-		rbt::point<int> RoundedPosition() const { 
-			return rbt::point<int>((int)std::round(m_pose.m_pt.x), (int)std::round(m_pose.m_pt.y));
-		}
-        rbt::pose<double> m_pose;
-
-		// as used for robot commands, encoder ticks / s?
-        int m_nSpeedLeft = 0;
-        int m_nSpeedRight = 0;
-
-        // path cost
-        float m_fCost = 0;
-
-		config_space_node const* m_pnodeParent = nullptr;
-
-        friend bool operator==(config_space_node const& lhs, config_space_node const& rhs) {
-            return lhs.RoundedPosition()==rhs.RoundedPosition()
-				&& lhs.RoundedYaw()==rhs.RoundedYaw()
-                && lhs.m_nSpeedLeft==rhs.m_nSpeedLeft
-                && rhs.m_nSpeedRight==rhs.m_nSpeedRight;
+int CConfigurationSpacePlanner::Find(std::uint64_t nState) const {
+    auto const nMask = m_vecslot.size() - 1;
+    auto i = static_cast<std::size_t>((nState * 0x9E3779B97F4A7C15ull) >> 32) & nMask; // Fibonacci hashing
+    while(m_vecslot[i].m_nState!=c_nNoState && m_vecslot[i].m_nState!=nState) i = (i + 1) & nMask;
+    return static_cast<int>(i);
+}
+
+void CConfigurationSpacePlanner::Clear() {
+    for(auto const& node : m_vecnode) m_vecslot[node.m_iSlot] = SSlot{c_nNoState, -1};
+    m_vecnode.clear();
+    m_heap.clear();
+}
+
+void CConfigurationSpacePlanner::ComputeHeuristic(CCostMap const& costmap, std::vector<rbt::point<double>> const& vecptfGrid) {
+    auto const& ptnOrigin = costmap.Origin();
+    auto const sz = costmap.Costs().size();
+
+    // The robot may deviate 25cm from the shortest grid path
+    m_matnCorridor.create(sz, CV_8U);
+    m_matnCorridor.setTo(0);
+    rbt::point<int> ptnPrev = ToGridCoordinate(vecptfGrid.front(), ptnOrigin);
+    boost::for_each(vecptfGrid, [&](rbt::point<double> const& ptf) {
+        auto const ptnGrid = ToGridCoordinate(ptf, ptnOrigin);
+        cv::line(m_matnCorridor, ptnPrev, ptnGrid, cv::Scalar(255), 50/c_nScale);
+        ptnPrev = ptnGrid;
+    });
+
+    // Dijkstra from the goal through the corridor
+    if(m_matfDistance.size()!=sz) m_heapCells.reset(sz.width * sz.height);
+    m_matfDistance.create(sz, CV_32F);
+    m_matfDistance.setTo(std::numeric_limits<float>::infinity());
+
+    auto const Index = [&](rbt::point<int> const& pt) { return pt.y * sz.width + pt.x; };
+    auto const ptnEnd = ToGridCoordinate(vecptfGrid.front(), ptnOrigin);
+    m_matfDistance.at<float>(ptnEnd.y, ptnEnd.x) = 0;
+    m_heapCells.push(Index(ptnEnd), 0);
+    while(!m_heapCells.empty()) {
+        auto const fDistance = m_heapCells.top_key();
+        auto const i = m_heapCells.pop();
+        ForEachNeighbor(sz, rbt::point<int>(i % sz.width, i / sz.width), [&](rbt::point<int> const& ptNext, int x, int y) {
+            if(m_matnCorridor.at<std::uint8_t>(ptNext.y, ptNext.x)<255) return;
+
+            auto const fDistanceNext = fDistance + (0==x || 0==y ? 1.0f : static_cast<float>(M_SQRT2)) * c_nScale;
+            auto& fDistanceCell = m_matfDistance.at<float>(ptNext.y, ptNext.x);
+            if(fDistanceNext < fDistanceCell) {
+                fDistanceCell = fDistanceNext;
+                auto const iNext = Index(ptNext);
+                if(m_heapCells.contains(iNext)) {
+                    m_heapCells.update(iNext, fDistanceNext);
+                } else {
+                    m_heapCells.push(iNext, fDistanceNext);
+                }
+            }
+        });
+    }
+}
+
+std::vector<rbt::pose<double>> CConfigurationSpacePlanner::FindPath(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    auto const vecptfGrid = m_plannerGrid.FindPath(costmap, posefStart, ptfEnd);
+    if(vecptfGrid.empty()) return {};
+
+    ComputeHeuristic(costmap, vecptfGrid);
+    Clear();
+
+    auto const& ptnOrigin = costmap.Origin();
+
+    auto const Heuristic = [&](rbt::point<double> const& ptf) {
+        // The corridor distance is measured between cell centers with octile steps
+        auto const ptn = ToGridCoordinate(ptf, ptnOrigin);
+        return std::max(
+            static_cast<float>((ptf - ptfEnd).Abs()),
+            m_matfDistance.at<float>(ptn.y, ptn.x) / c_fMaxOctileRatio - c_nScale
+        );
+    };
+    // Adds the node of a new state or improves the node of a known state,
+    // returns false if the arena is full
+    auto const Visit = [&](rbt::pose<double> const& pose, int nSpeedLeft, int nSpeedRight, float fCost, int iParent) {
+        auto const nState = LatticeState(pose, nSpeedLeft, nSpeedRight);
+        auto const iSlot = Find(nState);
+        auto& slot = m_vecslot[iSlot];
+        if(c_nNoState==slot.m_nState) {
+            if(m_cMaxNodes<=static_cast<int>(m_vecnode.size())) return false;
+
+            slot = SSlot{nState, static_cast<int>(m_vecnode.size())};
+            m_vecnode.push_back(SNode{
+                pose, fCost, Heuristic(pose.m_pt), iParent, iSlot,
+                static_cast<std::int8_t>(nSpeedLeft), static_cast<std::int8_t>(nSpeedRight), false
+            });
+            m_heap.push(slot.m_iNode, fCost + c_fHeuristicWeight * m_vecnode.back().m_fHeuristic);
+        } else {
+            auto& node = m_vecnode[slot.m_iNode];
+            if(!node.m_bClosed && fCost < node.m_fCost) {
+                node.m_pose = pose;
+                node.m_fCost = fCost;
+                node.m_fHeuristic = Heuristic(pose.m_pt);
+                node.m_iParent = iParent;
+                m_heap.update(slot.m_iNode, fCost + c_fHeuristicWeight * node.m_fHeuristic);
+            }
         }
+        return true;
     };
+    Visit(posefStart, 0, 0, 0, -1);
+
+    static SPrimitiveTable const s_table;
+    int cExpanded = 0;
+    int iGoal = -1;
+    bool bFull = false;
+    while(!m_heap.empty() && !bFull) {
+        auto const i = m_heap.pop();
+        m_vecnode[i].m_bClosed = true;
+        auto const node = m_vecnode[i];
+        if((node.m_pose.m_pt - ptfEnd).SqrAbs() < c_nScale*c_nScale) {
+            iGoal = i;
+            break;
+        }
+        ++cExpanded;
+
+        auto const ptnNode = ToGridCoordinate(node.m_pose.m_pt, ptnOrigin);
+        auto const nYawBin = YawBin(node.m_pose.m_fYaw);
+        auto const fCos = std::cos(node.m_pose.m_fYaw);
+        auto const fSin = std::sin(node.m_pose.m_fYaw);
+
+        // [decelerate both, left, right, no change, accelerate right, left, both]
+        for(int nLeft = node.m_nSpeedLeft - 1; nLeft <= node.m_nSpeedLeft + 1; ++nLeft) {
+            for(int nRight = node.m_nSpeedRight - 1; nRight <= node.m_nSpeedRight + 1; ++nRight) {
+                if(c_nMaxSpeedSteps<std::abs(nLeft) || c_nMaxSpeedSteps<std::abs(nRight)
+                || c_nMaxSpeedStepDifference<std::abs(nRight - nLeft)) {
+                    continue;
+                }
 
-	constexpr int c_nSpeedStep = 100;
-	constexpr double c_fTimeStep = 0.2; // s
-	const float c_fHighTravelDistance = encoderTicksToCm(c_nMaxSpeed*0.8*c_fTimeStep);
+                auto const& primitive = s_table.Primitive(nLeft, nRight);
+                if(0==primitive.m_fDistance) continue; // turning on the spot or standing still has no travel cost
+
+                rbt::pose<double> const pose(
+                    node.m_pose.m_pt + rbt::size<double>(
+                        primitive.m_szf.x * fCos - primitive.m_szf.y * fSin,
+                        primitive.m_szf.x * fSin + primitive.m_szf.y * fCos
+                    ),
+                    std::remainder(node.m_pose.m_fYaw + primitive.m_fDeltaYaw, 2 * M_PI)
+                );
+                if(!costmap.is_inside(ToGridCoordinate(pose.m_pt, ptnOrigin))) continue;
+
+                // -> check if still in range of shortest path and
+                // integrate costs over node.m_pose.m_pt -> pose.m_pt
+                auto const iPrimitive = s_table.Index(nYawBin, nLeft, nRight);
+                auto const itsznBegin = s_table.m_vecsznSwept.begin() + s_table.m_veciSwept[iPrimitive];
+                auto const itsznEnd = s_table.m_vecsznSwept.begin() + s_table.m_veciSwept[iPrimitive + 1];
+                float fWeightedCost = 0;
+                bool bInside = true;
+                for(auto itszn = itsznBegin; bInside && itszn!=itsznEnd; ++itszn) {
+                    auto const pt = ptnNode + *itszn;
+                    bInside = costmap.is_inside(pt) && 255==m_matnCorridor.at<std::uint8_t>(pt.y, pt.x);
+                    if(bInside) fWeightedCost += s_table.m_afCellCost[costmap.at(pt)];
+                }
+                if(!bInside) continue;
+
+                fWeightedCost = std::max(1.f, fWeightedCost/(itsznEnd - itsznBegin));
+                auto const fCost = node.m_fCost + primitive.m_fCostFactor * fWeightedCost;
+                if(!Visit(pose, nLeft, nRight, fCost, i)) bFull = true;
+            }
+        }
+    }
+
+    std::cout << "Discovered " << m_vecnode.size() << " states, " << cExpanded << " expanded." << std::endl;
+#ifdef ENABLE_LOG
+    if(bFull) LOG("Configuration space search stopped after " << m_cMaxNodes << " states");
+#endif
+
+    std::vector<rbt::pose<double>> vecposef;
+    for(auto iNode = iGoal; 0<=iNode; iNode = m_vecnode[iNode].m_iParent) {
+        auto const& node = m_vecnode[iNode];
+        std::cout << node.m_pose <<
+        " (" << node.m_nSpeedLeft * c_nSpeedStep << ", " << node.m_nSpeedRight * c_nSpeedStep << ") " << std::endl;
+        vecposef.emplace_back(node.m_pose);
+    }
+    boost::reverse(vecposef);
+    return vecposef;
 }
 
-namespace std {
-	template <> struct hash<config_space_node> {
-		size_t operator()(config_space_node const& node) const {
-			std::size_t seed = 0;
-			auto pt = node.RoundedPosition();
-			boost::hash_combine(seed, pt.x);
-			boost::hash_combine(seed, pt.y);
-			boost::hash_combine(seed, node.RoundedYaw());
-			boost::hash_combine(seed, node.m_nSpeedLeft);
-			boost::hash_combine(seed, node.m_nSpeedRight);
-			return seed;
-		}
-	};
+std::vector<rbt::pose<double>> PathConfigurationSpace(cv::Mat matn, rbt::point<int> const& ptnOrigin, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    CCostMap costmap;
+    costmap.update(matn, ptnOrigin);
+    return PathConfigurationSpace(costmap, posefStart, ptfEnd);
 }
 
-std::vector<rbt::pose<double>> PathConfigurationSpace(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
-    auto const vecptf = FindPath(matn, posefStart, ptfEnd);
-
-	// TODO: Share code?
-	cv::Mat matnEroded;
-    auto const nMaxExtent = std::max(c_nRobotWidth/c_nScale, c_nRobotHeight/c_nScale);
-    cv::erode(
-        matn, 
-        matnEroded, 
-        cv::Mat::ones(nMaxExtent, nMaxExtent, CV_8U)
-    );
-    
-    cv::Mat matnGauss;
-    auto const nMaxExtentOdd = 2*nMaxExtent + 1;
-    cv::GaussianBlur(matnEroded, matnGauss, cv::Size(nMaxExtentOdd, nMaxExtentOdd), 0, 0);
-
-	cv::Mat matnPath = cv::Mat::zeros(matn.size(), CV_8U);
-	rbt::point<int> ptnPrev = ToGridCoordinate(vecptf.front());
-	boost::for_each(vecptf, [&](rbt::point<double> const& ptf) {
-		auto const ptnGrid = ToGridCoordinate(ptf);
-        cv::line(matnPath, ptnPrev, ptnGrid, cv::Scalar(255), 50/c_nScale);
-        ptnPrev = ptnGrid;
-	});
-
-	int cExpanded = 0;
-	std::unordered_map<config_space_node, float> mapnodefCosts;
-	auto onode = GenericAStar<config_space_node>(
-		posefStart, 
-		// Calculating a longer path in configuration space takes too much time to compute due to large state space.
-		*(vecptf.end() - 80), 
-		[&](config_space_node const& node) noexcept -> float& {
-			return mapnodefCosts.emplace(node, std::numeric_limits<float>::max()).first->second;
-		},
-		[&](config_space_node const& node, auto fn) noexcept {
-			++cExpanded;
-
-			auto const pnodeParent = [&] {
-				auto const itpair = mapnodefCosts.find(node);
-				ASSERT(itpair!=mapnodefCosts.end());
-				return &itpair->first;
-			}();
-
-			for(int nStepLeft = -1; nStepLeft <= 1; ++nStepLeft) {
-				// [decelerate both, left, right, no change, accelerate right, left, both]
-				for(int nStepRight = -1; nStepRight <= 1; ++nStepRight) {
-					// -> Calculate new positions / angle 
-					auto nodeNeighbor = node;
-					nodeNeighbor.m_pnodeParent = pnodeParent;
-					nodeNeighbor.m_nSpeedLeft += nStepLeft * c_nSpeedStep;
-					nodeNeighbor.m_nSpeedRight += nStepRight * c_nSpeedStep;
-
-					if(std::abs(nodeNeighbor.m_nSpeedLeft)<=c_nMaxSpeed
-					&& std::abs(nodeNeighbor.m_nSpeedRight)<=c_nMaxSpeed
-					&& std::abs(nodeNeighbor.m_nSpeedRight-nodeNeighbor.m_nSpeedLeft)<=400) 
-					{
-						nodeNeighbor.m_pose = UpdatePose(
-							node.m_pose, 
-							nodeNeighbor.m_nSpeedLeft*c_fTimeStep, 
-							nodeNeighbor.m_nSpeedRight*c_fTimeStep
-						);
-
-						cv::LineIterator itpt(
-							matn, 
-							ToGridCoordinate(node.Position()), 
-							ToGridCoordinate(nodeNeighbor.Position())
-						);
-
-						float fWeightedCost = 0;
-						for(int i = 0; i < itpt.count; ++i, ++itpt) {    	
-							auto const pt = rbt::point<int>(itpt.pos());
-							// -> check if still in range of shortest path 
-							if(matnPath.at<std::uint8_t>(pt.y, pt.x)<255) {
-								goto outside_range;
-							}
-
-							// integrate costs over node.m_pt -> nodeNeighbor.m_pt
-							fWeightedCost += std::pow((255.0 - matnGauss.at<std::uint8_t>(pt.y, pt.x))/30, 2);
-						}
-						{
-							fWeightedCost = std::max(1.f, fWeightedCost/itpt.count);
-							float const fDistance = (nodeNeighbor.Position()-node.Position()).Abs();
-							// Penalize several short moves, i.e., slow moves
-							nodeNeighbor.m_fCost += fDistance * std::max(1.0, std::pow(c_fHighTravelDistance/fDistance, 2)) * fWeightedCost;
-						}
-
-						fn(nodeNeighbor);
-
-outside_range: 
-						;
-					}
-				}
-			}
-		},
-		[](config_space_node const& node, rbt::point<double> const ptfEnd) {
-			return (node.m_pose.m_pt - ptfEnd).SqrAbs() < c_nScale*c_nScale;
-		}
-	);
-
-	std::cout << "Discovered " << mapnodefCosts.size() << " states, " << cExpanded << " expanded." << std::endl;
-	std::vector<rbt::pose<double>> vecposef;
-	if(onode) {	
-		auto const* pnodeNext = &*onode;
-		while(pnodeNext) {
-			std::cout << pnodeNext->m_pose << 
-			" (" << pnodeNext->m_nSpeedLeft << ", " << pnodeNext->m_nSpeedRight << ") " << std::endl;
-
-			vecposef.emplace_back(pnodeNext->m_pose);
-			pnodeNext = pnodeNext->m_pnodeParent;
-		}
-		boost::reverse(vecposef);
-	} 
-	return vecposef;
-}
\ No newline at end of file
+std::vector<rbt::pose<double>> PathConfigurationSpace(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd) {
+    // Reuses the arena and hash table, also for the replays running in parallel
+    thread_local CConfigurationSpacePlanner s_planner;
+    return s_planner.FindPath(costmap, posefStart, ptfEnd);
+}
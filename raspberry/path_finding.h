@@ -1,6 +1,150 @@
 #pragma once
 #include "geometry.h"
+#include "cost_map.h"
+#include "indexed_heap.h"
+#include <cstdint>
+#include <utility>
 #include <vector>
 
-std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
-std::vector<rbt::pose<double>> PathConfigurationSpace(cv::Mat matn, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
\ No newline at end of file
+#include <boost/optional.hpp>
+
+// A* path search on the grid cells of a cost map.
+// The planner keeps its per-cell state between queries, so replanning on a
+// map of the same size neither allocates nor clears any buffers: cells are
+// reset lazily by stamping them with the number of the query. The open list
+// is a binary heap indexed by cell that supports decrease-key, the heuristic
+// is computed only once per cell and query.
+struct CGridPathPlanner {
+    // Returns the path from ptfEnd back to posefStart, empty if there is none
+    std::vector<rbt::point<double>> FindPath(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
+
+    struct SPathToTarget {
+        float m_fCost; // infinity if there is no path
+        std::vector<rbt::point<double>> m_vecptf; // from the target back to the start as returned by FindPath
+    };
+    // The shortest paths to all targets, in the order of vecptfTargets.
+    // A single Dijkstra search from posefStart that stops when all targets
+    // have been reached, instead of one search per target.
+    std::vector<SPathToTarget> FindPaths(CCostMap const& costmap, rbt::pose<double> const& posefStart, std::vector<rbt::point<double>> const& vecptfTargets);
+
+private:
+    struct SCell {
+        std::uint32_t m_nQuery = 0; // the other members are only valid if m_nQuery==CGridPathPlanner::m_nQuery
+        float m_fCost;      // from the start
+        float m_fHeuristic; // lower bound of the cost to the goal
+        bool m_bClosed;
+        int m_iParent;      // previous cell on the shortest path
+    };
+    using key_type = std::pair<float, float>; // estimated total cost, heuristic
+    // On ties, prefer the cell closer to the goal
+    static key_type Key(SCell const& cell) { return key_type(cell.m_fCost + cell.m_fHeuristic, cell.m_fHeuristic); }
+
+    // Starts a new query on costmap, returns false if ptnStart is outside of it
+    bool Reset(CCostMap const& costmap, rbt::point<int> const& ptnStart, boost::optional<rbt::point<int>> const& optptnEnd);
+    SCell& Cell(int i);
+    // Relaxes the neighbors of the cell i popped from the heap
+    void Expand(CCostMap const& costmap, int i);
+    std::vector<rbt::point<double>> Path(CCostMap const& costmap, int iEnd, rbt::point<double> const& ptfEnd) const;
+
+    boost::optional<rbt::point<int>> m_optptnEnd; // the goal of the query, the heuristic is 0 without one
+    int m_nCols = 0;
+    std::uint32_t m_nQuery = 0;
+    std::vector<SCell> m_veccell;
+    CIndexedHeap<key_type> m_heap;
+};
+
+// D* Lite path search on the grid cells of a cost map.
+// The search runs backwards from the goal, so when the robot moves and the
+// map changes, the previous search can be repaired instead of repeated:
+// If FindPath is called with the same goal and a cost map of the same extent
+// as before, only the cells whose costs changed and their neighbors are
+// updated. The changed cells are searched within CCostMap::Changed() if the
+// cost map has been updated at most once since the previous call. Returns the same paths as CGridPathPlanner, up to ties.
+struct CIncrementalPathPlanner {
+    std::vector<rbt::point<double>> FindPath(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
+
+private:
+    struct SCell {
+        float m_fG;   // cost to the goal
+        float m_fRhs; // one step lookahead of m_fG
+        std::uint8_t m_nCost; // cost map value the search is based on
+    };
+    using key_type = std::pair<float, float>;
+
+    int Index(rbt::point<int> const& pt) const { return pt.y * m_szn.width + pt.x; }
+    rbt::point<int> Position(int i) const { return rbt::point<int>(i % m_szn.width, i / m_szn.width); }
+
+    float Heuristic(int i) const; // from the start
+    key_type Key(int i) const;
+    float MinSuccessorCost(int i, int* piNext) const;
+    void UpdateCell(int i);
+    void UpdatePredecessors(int i);
+    void ComputeShortestPath();
+
+    rbt::point<int> m_ptnOrigin = rbt::point<int>::zero();
+    cv::Size m_szn;
+    int m_iGoal = -1;
+    int m_iStart = -1;
+    float m_fKm = 0; // key modifier, sum of the heuristic between successive starts
+    int m_nCostVersion = 0; // CCostMap::Version() the search is based on
+    std::vector<SCell> m_veccell;
+    CIndexedHeap<key_type> m_heap;
+};
+
+// Kinodynamic A* search over poses and wheel speeds, restricted to a corridor
+// around the shortest grid path. States are merged on a lattice of positions,
+// yaw bins and speed steps. The nodes live in an arena of fixed capacity and
+// refer to their parents by index, the visited states are found through an
+// open-addressed hash table of lattice states. All buffers are allocated by
+// the constructor, so the search never uses more memory than that. If the
+// arena is full before the goal is reached, no path is returned.
+// The heuristic is the distance to the goal through the corridor, it is
+// weighted so that the search finds a close to optimal path quickly.
+struct CConfigurationSpacePlanner {
+    explicit CConfigurationSpacePlanner(int cMaxNodes = 1 << 18);
+
+    // Returns the poses from posefStart to ptfEnd, empty if there is no path
+    std::vector<rbt::pose<double>> FindPath(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
+
+private:
+    struct SNode {
+        rbt::pose<double> m_pose;
+        float m_fCost;      // from the start
+        float m_fHeuristic; // lower bound of the cost to the goal
+        int m_iParent;
+        int m_iSlot;        // in m_vecslot
+        std::int8_t m_nSpeedLeft;  // in speed steps
+        std::int8_t m_nSpeedRight;
+        bool m_bClosed;
+    };
+    struct SSlot {
+        std::uint64_t m_nState; // c_nNoState if empty
+        int m_iNode;
+    };
+    static std::uint64_t constexpr c_nNoState = ~std::uint64_t(0);
+
+    // The slot of nState, either holding it or the empty slot where it belongs
+    int Find(std::uint64_t nState) const;
+    void Clear();
+    void ComputeHeuristic(CCostMap const& costmap, std::vector<rbt::point<double>> const& vecptfGrid);
+
+    int m_cMaxNodes;
+    std::vector<SNode> m_vecnode; // the arena, never exceeds m_cMaxNodes
+    std::vector<SSlot> m_vecslot; // power of two size, at most half full
+    CIndexedHeap<float> m_heap;   // elements are indices into m_vecnode
+
+    CGridPathPlanner m_plannerGrid;
+    cv::Mat m_matnCorridor; // 255 where the robot may drive
+    cv::Mat m_matfDistance; // from a cell through the corridor to the goal in cm
+    CIndexedHeap<float> m_heapCells;
+};
+
+// matn is a map image as returned by e.g. CFastParticleSlamBase::getMap(), 
+// ptnOrigin is the grid coordinate of its top-left pixel.
+// These compute the cost map of matn for every query, use the CCostMap
+// overloads to plan repeatedly on the same map. PathConfigurationSpace reuses
+// one CConfigurationSpacePlanner per thread.
+std::vector<rbt::point<double>> FindPath(cv::Mat matn, rbt::point<int> const& ptnOrigin, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
+std::vector<rbt::pose<double>> PathConfigurationSpace(cv::Mat matn, rbt::point<int> const& ptnOrigin, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
+
+std::vector<rbt::pose<double>> PathConfigurationSpace(CCostMap const& costmap, rbt::pose<double> const& posefStart, rbt::point<double> const& ptfEnd);
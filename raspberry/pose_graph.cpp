@@ -0,0 +1,210 @@
+#include "pose_graph.h"
+#include "error_handling.h"
+
+#include <cmath>
+
+namespace {
+    using vector_type = std::array<double, 3>;
+    using matrix_type = std::array<double, 9>;
+
+    double NormalizeAngle(double fRad) {
+        return std::remainder(fRad, 2 * M_PI);
+    }
+
+    double Dot(vector_type const& a, vector_type const& b) {
+        return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
+    }
+
+    vector_type Multiply(matrix_type const& m, vector_type const& v) {
+        return {{
+            m[0]*v[0] + m[1]*v[1] + m[2]*v[2],
+            m[3]*v[0] + m[4]*v[1] + m[5]*v[2],
+            m[6]*v[0] + m[7]*v[1] + m[8]*v[2]
+        }};
+    }
+
+    vector_type MultiplyTransposed(matrix_type const& m, vector_type const& v) {
+        return {{
+            m[0]*v[0] + m[3]*v[1] + m[6]*v[2],
+            m[1]*v[0] + m[4]*v[1] + m[7]*v[2],
+            m[2]*v[0] + m[5]*v[1] + m[8]*v[2]
+        }};
+    }
+
+    // m += a^T diag(w) b
+    void AddProduct(matrix_type& m, matrix_type const& a, vector_type const& w, matrix_type const& b) {
+        for(int i = 0; i<3; ++i) {
+            for(int j = 0; j<3; ++j) {
+                for(int k = 0; k<3; ++k) m[3*i + j] += a[3*k + i] * w[k] * b[3*k + j];
+            }
+        }
+    }
+
+    matrix_type Inverse(matrix_type const& m) {
+        auto const fDet = m[0]*(m[4]*m[8] - m[5]*m[7]) - m[1]*(m[3]*m[8] - m[5]*m[6]) + m[2]*(m[3]*m[7] - m[4]*m[6]);
+        if(0==fDet) return {{1, 0, 0, 0, 1, 0, 0, 0, 1}};
+        return {{
+            (m[4]*m[8] - m[5]*m[7]) / fDet, (m[2]*m[7] - m[1]*m[8]) / fDet, (m[1]*m[5] - m[2]*m[4]) / fDet,
+            (m[5]*m[6] - m[3]*m[8]) / fDet, (m[0]*m[8] - m[2]*m[6]) / fDet, (m[2]*m[3] - m[0]*m[5]) / fDet,
+            (m[3]*m[7] - m[4]*m[6]) / fDet, (m[1]*m[6] - m[0]*m[7]) / fDet, (m[0]*m[4] - m[1]*m[3]) / fDet
+        }};
+    }
+}
+
+rbt::pose<double> RelativePose(rbt::pose<double> const& a, rbt::pose<double> const& b) {
+    return rbt::pose<double>(
+        rbt::point<double>::zero() + (b.m_pt - a.m_pt).rotated(-a.m_fYaw),
+        NormalizeAngle(b.m_fYaw - a.m_fYaw)
+    );
+}
+
+rbt::pose<double> ComposePose(rbt::pose<double> const& a, rbt::pose<double> const& poseRelative) {
+    return rbt::pose<double>(
+        a.m_pt + rbt::size<double>(poseRelative.m_pt).rotated(a.m_fYaw),
+        NormalizeAngle(a.m_fYaw + poseRelative.m_fYaw)
+    );
+}
+
+int CPoseGraph::add(rbt::pose<double> const& pose) {
+    m_vecpose.emplace_back(pose);
+    return size() - 1;
+}
+
+void CPoseGraph::connect(int iFrom, int iTo, rbt::pose<double> const& poseRelative, double fInfoTranslation, double fInfoRotation) {
+    ASSERT(iFrom!=iTo && iFrom<size() && iTo<size());
+    m_vecedge.push_back({iFrom, iTo, poseRelative, {{fInfoTranslation, fInfoTranslation, fInfoRotation}}, {}});
+}
+
+double CPoseGraph::Linearize() {
+    m_vecmatH.assign(m_vecpose.size(), matrix_type{});
+    m_vecb.assign(m_vecpose.size(), vector_type{});
+
+    double fError = 0;
+    for(auto& edge : m_vecedge) {
+        auto const& posei = m_vecpose[edge.m_iFrom];
+        auto const& posej = m_vecpose[edge.m_iTo];
+        auto const& posez = edge.m_poseRelative;
+
+        // e = [Rz^T (Ri^T (tj - ti) - tz); yawj - yawi - yawz]
+        auto const szfDelta = posej.m_pt - posei.m_pt;
+        auto const ci = std::cos(posei.m_fYaw), si = std::sin(posei.m_fYaw);
+        auto const cz = std::cos(posez.m_fYaw), sz = std::sin(posez.m_fYaw);
+        auto const szfRelative = szfDelta.rotated(-posei.m_fYaw) - rbt::size<double>(posez.m_pt);
+        vector_type const e = {{
+            cz * szfRelative.x + sz * szfRelative.y,
+            -sz * szfRelative.x + cz * szfRelative.y,
+            NormalizeAngle(posej.m_fYaw - posei.m_fYaw - posez.m_fYaw)
+        }};
+
+        // Rotation Rz^T Ri^T and the derivative of Ri^T (tj - ti) by yawi
+        auto const c = cz*ci - sz*si, s = cz*si + sz*ci; // cos, sin of yawi + yawz
+        auto const dx = -si * szfDelta.x + ci * szfDelta.y;
+        auto const dy = -ci * szfDelta.x - si * szfDelta.y;
+        matrix_type const A = {{
+            -c, -s, cz * dx + sz * dy,
+            s, -c, -sz * dx + cz * dy,
+            0, 0, -1
+        }};
+        matrix_type const B = {{
+            c, s, 0,
+            -s, c, 0,
+            0, 0, 1
+        }};
+
+        auto const& w = edge.m_afInformation;
+        AddProduct(m_vecmatH[edge.m_iFrom], A, w, A);
+        AddProduct(m_vecmatH[edge.m_iTo], B, w, B);
+        edge.m_matH = matrix_type{};
+        AddProduct(edge.m_matH, A, w, B);
+
+        vector_type const we = {{w[0]*e[0], w[1]*e[1], w[2]*e[2]}};
+        auto const bi = MultiplyTransposed(A, we);
+        auto const bj = MultiplyTransposed(B, we);
+        for(int k = 0; k<3; ++k) {
+            m_vecb[edge.m_iFrom][k] += bi[k];
+            m_vecb[edge.m_iTo][k] += bj[k];
+        }
+        fError += Dot(e, we);
+    }
+    return fError;
+}
+
+void CPoseGraph::Multiply(std::vector<vector_type> const& vecx, std::vector<vector_type>& vecy) const {
+    for(std::size_t i = 1; i<vecx.size(); ++i) vecy[i] = ::Multiply(m_vecmatH[i], vecx[i]);
+    for(auto const& edge : m_vecedge) {
+        // The first node is fixed, its row and column are dropped
+        if(0!=edge.m_iFrom && 0!=edge.m_iTo) {
+            auto const yi = ::Multiply(edge.m_matH, vecx[edge.m_iTo]);
+            auto const yj = MultiplyTransposed(edge.m_matH, vecx[edge.m_iFrom]);
+            for(int k = 0; k<3; ++k) {
+                vecy[edge.m_iFrom][k] += yi[k];
+                vecy[edge.m_iTo][k] += yj[k];
+            }
+        }
+    }
+}
+
+void CPoseGraph::Solve(std::vector<vector_type>& vecx) const {
+    auto const n = m_vecpose.size();
+    std::vector<matrix_type> vecmatPreconditioner(n);
+    for(std::size_t i = 1; i<n; ++i) vecmatPreconditioner[i] = Inverse(m_vecmatH[i]);
+
+    vecx.assign(n, vector_type{});
+    std::vector<vector_type> vecr(n), vecz(n), vecp(n), vecq(n, vector_type{});
+    double fRz = 0;
+    double fRr0 = 0;
+    for(std::size_t i = 1; i<n; ++i) {
+        for(int k = 0; k<3; ++k) vecr[i][k] = -m_vecb[i][k];
+        vecz[i] = ::Multiply(vecmatPreconditioner[i], vecr[i]);
+        vecp[i] = vecz[i];
+        fRz += Dot(vecr[i], vecz[i]);
+        fRr0 += Dot(vecr[i], vecr[i]);
+    }
+
+    int const cMaxIterations = static_cast<int>(3 * n);
+    for(int nIteration = 0; nIteration<cMaxIterations && 0<fRz; ++nIteration) {
+        Multiply(vecp, vecq);
+        double fPq = 0;
+        for(std::size_t i = 1; i<n; ++i) fPq += Dot(vecp[i], vecq[i]);
+        if(fPq<=0) break;
+
+        auto const fAlpha = fRz / fPq;
+        double fRr = 0;
+        double fRzNext = 0;
+        for(std::size_t i = 1; i<n; ++i) {
+            for(int k = 0; k<3; ++k) {
+                vecx[i][k] += fAlpha * vecp[i][k];
+                vecr[i][k] -= fAlpha * vecq[i][k];
+            }
+            vecz[i] = ::Multiply(vecmatPreconditioner[i], vecr[i]);
+            fRzNext += Dot(vecr[i], vecz[i]);
+            fRr += Dot(vecr[i], vecr[i]);
+        }
+        if(fRr<=1e-12 * fRr0) break;
+
+        auto const fBeta = fRzNext / fRz;
+        fRz = fRzNext;
+        for(std::size_t i = 1; i<n; ++i) {
+            for(int k = 0; k<3; ++k) vecp[i][k] = vecz[i][k] + fBeta * vecp[i][k];
+        }
+    }
+}
+
+double CPoseGraph::optimize(int cIterations) {
+    std::vector<vector_type> vecx;
+    for(int nIteration = 0; nIteration<cIterations; ++nIteration) {
+        auto const fError = Linearize();
+        Solve(vecx);
+
+        double fStep = 0;
+        for(std::size_t i = 1; i<m_vecpose.size(); ++i) {
+            m_vecpose[i] = rbt::pose<double>(
+                m_vecpose[i].m_pt + rbt::size<double>(vecx[i][0], vecx[i][1]),
+                NormalizeAngle(m_vecpose[i].m_fYaw + vecx[i][2])
+            );
+            fStep = std::max(fStep, std::abs(vecx[i][0]) + std::abs(vecx[i][1]) + std::abs(vecx[i][2]));
+        }
+        if(fStep<1e-3) return fError;
+    }
+    return Linearize();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "geometry.h"
+
+#include <array>
+#include <vector>
+
+// The pose of b in the frame of a and its inverse
+rbt::pose<double> RelativePose(rbt::pose<double> const& a, rbt::pose<double> const& b);
+rbt::pose<double> ComposePose(rbt::pose<double> const& a, rbt::pose<double> const& poseRelative);
+
+// A graph of robot poses connected by relative pose measurements, e.g., from
+// scan matching between consecutive keyframes or from loop closures.
+// optimize() finds the poses that best agree with all measurements by
+// Gauss-Newton iteration. The normal equations are sparse; they are kept as
+// 3x3 blocks per node and per edge and solved by conjugate gradients with a
+// block Jacobi preconditioner, so an iteration is linear in the graph size.
+// The first node is fixed.
+struct CPoseGraph {
+    int add(rbt::pose<double> const& pose); // returns the node index
+    // poseRelative is the measured pose of node iTo in the frame of node iFrom.
+    // The information is the inverse variance of the translation in cm^2
+    // and of the rotation in rad^2.
+    void connect(int iFrom, int iTo, rbt::pose<double> const& poseRelative, double fInfoTranslation, double fInfoRotation);
+
+    // Returns the sum of the squared weighted errors after optimizing
+    double optimize(int cIterations);
+
+    rbt::pose<double> const& pose(int i) const { return m_vecpose[i]; }
+    int size() const { return static_cast<int>(m_vecpose.size()); }
+
+private:
+    using vector_type = std::array<double, 3>;
+    using matrix_type = std::array<double, 9>; // row major
+
+    struct SEdge {
+        int m_iFrom;
+        int m_iTo;
+        rbt::pose<double> m_poseRelative;
+        vector_type m_afInformation; // diagonal
+        matrix_type m_matH;          // off diagonal block of the normal equations, (iFrom, iTo)
+    };
+
+    // Accumulates the normal equations, returns the error
+    double Linearize();
+    // Solves H x = -b for all nodes but the first
+    void Solve(std::vector<vector_type>& vecx) const;
+    void Multiply(std::vector<vector_type> const& vecx, std::vector<vector_type>& vecy) const;
+
+    std::vector<rbt::pose<double>> m_vecpose;
+    std::vector<SEdge> m_vecedge;
+    std::vector<matrix_type> m_vecmatH; // diagonal blocks of the normal equations
+    std::vector<vector_type> m_vecb;
+};
@@ -0,0 +1,176 @@
+#include "pose_graph_slam.h"
+#include "robot_configuration.h"
+#include "profiling.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace {
+    // A new keyframe every 50cm or about 30 degrees
+    double constexpr c_fKeyframeDistance = 50;
+    double constexpr c_fKeyframeRotation = 0.5;
+
+    // Loop closure candidates are at least c_cMinKeyframeGap keyframes older
+    // than the new keyframe, closer than c_fLoopSearchRadius according to the
+    // current estimate and have a similar descriptor. At most c_cLoopCandidates
+    // of them are verified.
+    int constexpr c_cMinKeyframeGap = 20;
+    double constexpr c_fLoopSearchRadius = 200;
+    float constexpr c_fMaxDescriptorDistance = 0.3f;
+    std::size_t constexpr c_cLoopCandidates = 3;
+    // The candidate's map is built from the keyframes [j - n, j + n]
+    int constexpr c_nLocalMapKeyframes = 2;
+    // Fraction of the scans that must lie within a cell of an obstacle of the candidate's map
+    double constexpr c_fMinInlierRatio = 0.7;
+
+    // Inverse variances of a scan matching result with 5cm and 0.05rad standard deviation
+    double constexpr c_fInfoTranslation = 1.0 / (5 * 5);
+    double constexpr c_fInfoRotation = 1.0 / (0.05 * 0.05);
+    int constexpr c_cOptimizeIterations = 10;
+
+    // The descriptor bins are 25cm wide, the last bin counts all larger distances
+    int constexpr c_nDescriptorBinWidth = 25;
+
+    template<typename Descriptor>
+    float Distance(Descriptor const& descA, Descriptor const& descB) { // L1
+        float f = 0;
+        for(std::size_t i = 0; i < descA.size(); ++i) f += std::abs(descA[i] - descB[i]);
+        return f;
+    }
+
+    bool MovedSignificantly(rbt::pose<double> const& poseA, rbt::pose<double> const& poseB) {
+        return c_nScale/2.0 < (poseA.m_pt - poseB.m_pt).Abs() || 0.01 < std::abs(RelativePose(poseA, poseB).m_fYaw);
+    }
+}
+
+CPoseGraphSlam::CPoseGraphSlam(SScanFilterParameters const& paramsFilter, SUpdateGateParameters const& paramsGate)
+    : m_filter(paramsFilter), m_gate(paramsGate)
+{
+    m_vecpose.emplace_back(rbt::pose<double>::zero());
+    m_vecposeRelative.push_back({-1, rbt::pose<double>::zero()}); // before the first keyframe
+}
+
+bool CPoseGraphSlam::receivedSensorData(SScanLine const& scanlineSensor) {
+    CScopedTimer timer(estageScan);
+    auto const pscanlineGated = m_gate.pass(scanlineSensor);
+    if(!pscanlineGated) return false;
+    auto const& scanline = *pscanlineGated;
+    rbt::pose<double> poseNewCandidate(
+        m_vecpose.back().m_pt + scanline.translation().rotated(m_vecpose.back().m_fYaw),
+        m_vecpose.back().m_fYaw + scanline.rotation()
+    );
+
+    m_vecpose.emplace_back(m_occgrid.fit(poseNewCandidate, m_filter.filter(scanline)));
+    m_occgrid.update(m_vecpose.back(), scanline);
+
+    auto const bKeyframe = m_veckeyframe.empty() || [&] {
+        auto const poseRelative = RelativePose(m_graph.pose(m_graph.size() - 1), m_vecpose.back());
+        return c_fKeyframeDistance <= rbt::size<double>(poseRelative.m_pt.x, poseRelative.m_pt.y).Abs()
+            || c_fKeyframeRotation <= std::abs(poseRelative.m_fYaw);
+    }();
+    if(bKeyframe) {
+        if(AddKeyframe(scanline)) Rebuild(); // also corrects the pose just added
+    } else {
+        auto const iKeyframe = m_graph.size() - 1;
+        m_vecposeRelative.push_back({iKeyframe, RelativePose(m_graph.pose(iKeyframe), m_vecpose.back())});
+    }
+    return true;
+}
+
+cv::Mat CPoseGraphSlam::getMap() const {
+    return m_occgrid.ObstacleMapWithPoses(m_vecpose);
+}
+
+CPoseGraphSlam::descriptor_type CPoseGraphSlam::Descriptor(SScanLine const& scanline) {
+    descriptor_type descriptor;
+    descriptor.fill(0);
+    for(auto const& scan : scanline.m_vecscan) {
+        descriptor[std::min(scan.m_nDistance / c_nDescriptorBinWidth, c_cDescriptorBins - 1)] += 1;
+    }
+    if(!scanline.m_vecscan.empty()) {
+        for(auto& f : descriptor) f /= scanline.m_vecscan.size();
+    }
+    return descriptor;
+}
+
+bool CPoseGraphSlam::AddKeyframe(SScanLine const& scanline) {
+    auto const iKeyframe = m_graph.add(m_vecpose.back());
+    if(0 < iKeyframe) {
+        m_graph.connect(
+            iKeyframe - 1, iKeyframe,
+            RelativePose(m_graph.pose(iKeyframe - 1), m_vecpose.back()),
+            c_fInfoTranslation, c_fInfoRotation
+        );
+    }
+    m_veckeyframe.push_back({std::make_shared<SScanLine const>(scanline), Descriptor(scanline)});
+    m_vecposeRelative.push_back({iKeyframe, rbt::pose<double>::zero()});
+    return CloseLoop(iKeyframe);
+}
+
+bool CPoseGraphSlam::CloseLoop(int iKeyframe) {
+    CScopedTimer timer(estageLoopClosure);
+    auto const& keyframe = m_veckeyframe[iKeyframe];
+    auto const& pose = m_graph.pose(iKeyframe);
+
+    // The descriptor index is a linear scan, cheap compared to matching even with thousands of keyframes
+    std::vector<std::pair<float, int>> vecpairfi;
+    for(int i = 0; i + c_cMinKeyframeGap <= iKeyframe; ++i) {
+        if(c_fLoopSearchRadius < (m_graph.pose(i).m_pt - pose.m_pt).Abs()) continue;
+        auto const fDistance = Distance(m_veckeyframe[i].m_descriptor, keyframe.m_descriptor);
+        if(fDistance <= c_fMaxDescriptorDistance) vecpairfi.emplace_back(fDistance, i);
+    }
+    std::sort(vecpairfi.begin(), vecpairfi.end());
+    if(c_cLoopCandidates < vecpairfi.size()) vecpairfi.resize(c_cLoopCandidates);
+
+    auto const& scanlineMatch = m_filter.filter(*keyframe.m_pscanline);
+    if(scanlineMatch.m_vecscan.empty()) return false;
+    for(auto const& pairfi : vecpairfi) {
+        auto const iCandidate = pairfi.second;
+        COccupancyGridWithObstacleList occgrid;
+        auto const iLast = std::min(iCandidate + c_nLocalMapKeyframes, iKeyframe - c_cMinKeyframeGap);
+        for(int i = std::max(0, iCandidate - c_nLocalMapKeyframes); i <= iLast; ++i) {
+            occgrid.update(m_graph.pose(i), *m_veckeyframe[i].m_pscanline);
+        }
+
+        auto const poseFit = occgrid.fit(pose, scanlineMatch);
+        occgrid.UpdateLikelihoodField();
+        auto const cInliers = std::count_if(scanlineMatch.m_vecscan.begin(), scanlineMatch.m_vecscan.end(), [&](SScanLine::SScan const& scan) {
+            return occgrid.LikelihoodField().distance(ToGridCoordinate(Obstacle(poseFit, scan.m_fRadAngle, scan.m_nDistance))) <= 1;
+        });
+        if(cInliers < c_fMinInlierRatio * scanlineMatch.m_vecscan.size()) continue;
+
+        m_graph.connect(iCandidate, iKeyframe, RelativePose(m_graph.pose(iCandidate), poseFit), c_fInfoTranslation, c_fInfoRotation);
+        ++m_cLoopClosures;
+        return true;
+    }
+    return false;
+}
+
+void CPoseGraphSlam::Rebuild() {
+    CScopedTimer timer(estageLoopClosure);
+    std::vector<rbt::pose<double>> vecposeKeyframe;
+    for(int i = 0; i < m_graph.size(); ++i) vecposeKeyframe.push_back(m_graph.pose(i));
+    m_graph.optimize(c_cOptimizeIterations);
+
+    // Revisiting a mapped area closes a loop at every keyframe, most of them
+    // barely change the poses and the map need not be rebuilt
+    auto const bChanged = [&] {
+        for(int i = 0; i < m_graph.size(); ++i) {
+            if(MovedSignificantly(vecposeKeyframe[i], m_graph.pose(i))) return true;
+        }
+        return false;
+    }();
+    if(bChanged) {
+        m_occgrid = COccupancyGridWithObstacleList();
+        for(int i = 0; i < m_graph.size(); ++i) {
+            m_occgrid.update(m_graph.pose(i), *m_veckeyframe[i].m_pscanline);
+        }
+    }
+
+    for(std::size_t i = 0; i < m_vecpose.size(); ++i) {
+        auto const& poseRelative = m_vecposeRelative[i];
+        if(0 <= poseRelative.m_iKeyframe) {
+            m_vecpose[i] = ComposePose(m_graph.pose(poseRelative.m_iKeyframe), poseRelative.m_pose);
+        }
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "nonmoveable.h"
+#include "geometry.h"
+#include "pose_graph.h"
+#include "scanmatching.h"
+#include "scanline.h"
+#include "scan_filter.h"
+#include "update_gate.h"
+#include "map_file.h"
+
+#include <array>
+#include <memory>
+#include <vector>
+#include <opencv2/core.hpp>
+
+// Scan matching with loop closures.
+// Like CScanMatchingBase, each scan line is matched against the map built so
+// far. When the robot has moved far enough since the last keyframe, the scan
+// line becomes a keyframe, a node of a CPoseGraph connected to the previous
+// keyframe by the matched relative pose.
+// A new keyframe is compared to older keyframes nearby by a rotation invariant
+// descriptor, the histogram of its measured distances. The best candidates are
+// verified by matching the keyframe against a map of the candidate's
+// neighborhood. A verified loop closure adds an edge to the graph, the graph is
+// optimized and the map is rebuilt from the keyframes at the corrected poses.
+struct CPoseGraphSlam : rbt::nonmoveable {
+    explicit CPoseGraphSlam(
+        SScanFilterParameters const& paramsFilter = SScanFilterParameters(),
+        SUpdateGateParameters const& paramsGate = SUpdateGateParameters());
+    // Returns false if the scan line has been gated out, see CUpdateGate
+    bool receivedSensorData(SScanLine const& scanlineSensor);
+    cv::Mat getMap() const;
+    rbt::point<int> const& getMapOrigin() const { return m_occgrid.Origin(); } // grid coordinate of top-left pixel of getMap()
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const { return m_occgrid.ObstacleGrid(); }
+    SSavedMap save() const { return {m_occgrid.LogOdds(), m_vecpose.back()}; }
+
+    // Corrected after every loop closure
+    std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; }
+    int LoopClosures() const { return m_cLoopClosures; }
+
+private:
+    static int constexpr c_cDescriptorBins = 16;
+    using descriptor_type = std::array<float, c_cDescriptorBins>;
+
+    struct SKeyframe {
+        std::shared_ptr<SScanLine const> m_pscanline;
+        descriptor_type m_descriptor;
+    };
+    // Each pose in m_vecpose relative to the keyframe before it
+    struct SRelativePose {
+        int m_iKeyframe;
+        rbt::pose<double> m_pose;
+    };
+
+    static descriptor_type Descriptor(SScanLine const& scanline);
+    // Adds the keyframe at m_vecpose.back(), returns true if it closed a loop
+    bool AddKeyframe(SScanLine const& scanline);
+    bool CloseLoop(int iKeyframe);
+    // Rebuilds the map and m_vecpose from the keyframes at the optimized poses
+    void Rebuild();
+
+    CScanFilter m_filter;
+    CUpdateGate m_gate;
+    COccupancyGridWithObstacleList m_occgrid;
+    CPoseGraph m_graph; // one node per keyframe
+    std::vector<SKeyframe> m_veckeyframe;
+    std::vector<SRelativePose> m_vecposeRelative;
+    std::vector<rbt::pose<double>> m_vecpose; // history of best poses
+    int m_cLoopClosures = 0;
+};
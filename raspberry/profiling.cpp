@@ -0,0 +1,109 @@
+#include "profiling.h"
+
+#include <atomic>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+    struct SThreadProfile {
+        std::array<std::atomic<std::uint64_t>, estageCOUNT> m_acCalls{};
+        std::array<std::atomic<std::uint64_t>, estageCOUNT> m_anNanoseconds{};
+    };
+
+    // The counters of all threads, never freed so the totals include finished threads
+    std::mutex s_mtxProfiles;
+    std::vector<std::unique_ptr<SThreadProfile>> s_vecpprofile;
+    thread_local SThreadProfile* t_pprofile = nullptr;
+
+    SThreadProfile& ThreadProfile() {
+        if(!t_pprofile) {
+            std::lock_guard<std::mutex> lock(s_mtxProfiles);
+            s_vecpprofile.emplace_back(std::make_unique<SThreadProfile>());
+            t_pprofile = s_vecpprofile.back().get();
+        }
+        return *t_pprofile;
+    }
+
+    // Only the owning thread writes its counters, no need for an atomic read-modify-write
+    void Add(std::atomic<std::uint64_t>& n, std::uint64_t nDelta) {
+        n.store(n.load(std::memory_order_relaxed) + nDelta, std::memory_order_relaxed);
+    }
+}
+
+void rbt::detail::AddTime(EStage estage, std::uint64_t nNanoseconds) {
+    auto& profile = ThreadProfile();
+    Add(profile.m_acCalls[estage], 1);
+    Add(profile.m_anNanoseconds[estage], nNanoseconds);
+}
+
+char const* StageName(EStage estage) {
+    switch(estage) {
+        case estageScan: return "scan";
+        case estageUpdatePose: return "update pose";
+        case estageFit: return "fit";
+        case estageIndexRebuild: return "kd tree rebuild";
+        case estageCoarseMatch: return "coarse match";
+        case estageIcp: return "icp";
+        case estageLikelihood: return "likelihood";
+        case estageUpdateMap: return "update map";
+        case estageResample: return "resample";
+        case estageLoopClosure: return "loop closure";
+        case estageObstacleMap: return "obstacle map";
+        case estagePublishMap: return "publish map";
+        case estageCOUNT: break;
+    }
+    return "";
+}
+
+SProfile Profile() {
+    SProfile profile;
+    std::lock_guard<std::mutex> lock(s_mtxProfiles);
+    for(auto const& pprofile : s_vecpprofile) {
+        for(int i = 0; i < estageCOUNT; ++i) {
+            profile.m_astage[i].m_cCalls += pprofile->m_acCalls[i].load(std::memory_order_relaxed);
+            profile.m_astage[i].m_nNanoseconds += pprofile->m_anNanoseconds[i].load(std::memory_order_relaxed);
+        }
+    }
+    return profile;
+}
+
+SProfile SProfile::operator-(SProfile const& profile) const {
+    SProfile profileDiff;
+    for(int i = 0; i < estageCOUNT; ++i) {
+        profileDiff.m_astage[i].m_cCalls = m_astage[i].m_cCalls - profile.m_astage[i].m_cCalls;
+        profileDiff.m_astage[i].m_nNanoseconds = m_astage[i].m_nNanoseconds - profile.m_astage[i].m_nNanoseconds;
+    }
+    return profileDiff;
+}
+
+std::ostream& operator<<(std::ostream& os, SProfile const& profile) {
+    auto const flags = os.flags();
+    auto const nPrecision = os.precision();
+    os << std::fixed << std::setprecision(3);
+    for(int i = 0; i < estageCOUNT; ++i) {
+        auto const& stage = profile.m_astage[i];
+        os << std::left << std::setw(18) << StageName(static_cast<EStage>(i)) << std::right
+            << std::setw(10) << stage.m_cCalls << " calls"
+            << std::setw(12) << stage.m_nNanoseconds / 1e6 << " ms"
+            << std::setw(12) << (0<stage.m_cCalls ? stage.m_nNanoseconds / 1e3 / stage.m_cCalls : 0.0) << " us/call\n";
+    }
+    os.flags(flags);
+    os.precision(nPrecision);
+    return os;
+}
+
+std::string SProfile::ToJson() const {
+    std::stringstream ss;
+    ss << '{';
+    for(int i = 0; i < estageCOUNT; ++i) {
+        if(0<i) ss << ',';
+        ss << '"' << StageName(static_cast<EStage>(i)) << "\":{"
+            << "\"calls\":" << m_astage[i].m_cCalls << ','
+            << "\"ns\":" << m_astage[i].m_nNanoseconds << '}';
+    }
+    ss << '}';
+    return ss.str();
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+// Lightweight profiling of the SLAM hot spots
+//
+// A CScopedTimer adds the time spent in its scope to a per-thread counter
+// of its EStage. Each thread only writes its own counters, so timing a
+// scope costs two clock reads and two relaxed atomic stores. 
+// Profile() sums up the counters of all threads.
+enum EStage {
+    estageScan,             // SLAM receivedSensorData
+    estageUpdatePose,       // particle pose update including scan matching
+    estageFit,              // COccupancyGridWithObstacleList::fit
+    estageIndexRebuild,     // kd tree rebuild in fit
+    estageCoarseMatch,      // correlative search before ICP in fit
+    estageIcp,              // ICP in fit
+    estageLikelihood,       // log_likelihood_field
+    estageUpdateMap,        // map integration of a scan
+    estageResample,         // weight normalization and resampling
+    estageLoopClosure,      // loop closure search, pose graph optimization and map rebuild
+    estageObstacleMap,      // rendering the map image
+    estagePublishMap,       // rendering and encoding the map for the http server
+    estageCOUNT
+};
+
+char const* StageName(EStage estage);
+
+struct SProfile {
+    struct SStage {
+        std::uint64_t m_cCalls = 0;
+        std::uint64_t m_nNanoseconds = 0;
+    };
+    std::array<SStage, estageCOUNT> m_astage;
+
+    SProfile operator-(SProfile const& profile) const;
+
+    // Table with calls, total and mean time per stage
+    friend std::ostream& operator<<(std::ostream& os, SProfile const& profile);
+    std::string ToJson() const;
+};
+
+// Current totals of all threads
+SProfile Profile();
+
+namespace rbt {
+    namespace detail {
+        void AddTime(EStage estage, std::uint64_t nNanoseconds);
+    }
+}
+
+struct CScopedTimer {
+    explicit CScopedTimer(EStage estage)
+        : m_estage(estage), m_bStopped(false), m_tpStart(std::chrono::steady_clock::now())
+    {}
+
+    ~CScopedTimer() { stop(); }
+
+    // Stops timing before the end of the scope
+    void stop() {
+        if(m_bStopped) return;
+        m_bStopped = true;
+        auto const dur = std::chrono::steady_clock::now() - m_tpStart;
+        rbt::detail::AddTime(m_estage, std::chrono::duration_cast<std::chrono::nanoseconds>(dur).count());
+    }
+
+    CScopedTimer(CScopedTimer const&) = delete;
+    void operator=(CScopedTimer const&) = delete;
+
+private:
+    EStage m_estage;
+    bool m_bStopped;
+    std::chrono::steady_clock::time_point m_tpStart;
+};
@@ -0,0 +1,20 @@
+#include "random_generator.h"
+
+#include <random>
+#include <boost/optional.hpp>
+
+namespace {
+    boost::optional<std::uint64_t> s_onSeed;
+}
+
+void SetRandomSeed(std::uint64_t nSeed) {
+    s_onSeed = nSeed;
+}
+
+std::uint64_t RandomSeed() {
+    if(!s_onSeed) {
+        std::random_device rd;
+        s_onSeed = (static_cast<std::uint64_t>(rd()) << 32) | rd();
+    }
+    return s_onSeed.get();
+}
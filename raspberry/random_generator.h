@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+
+namespace rbt {
+    // xoshiro256** pseudo random number generator by David Blackman and Sebastiano Vigna
+    // (http://xoshiro.di.unimi.it). Satisfies UniformRandomBitGenerator and can be used
+    // with the distributions in <random>. It is much faster than std::random_device
+    // and std::mt19937 and has only 32 bytes of state, so every particle has its own. 
+    struct xoshiro256 {
+        using result_type = std::uint64_t;
+
+        explicit xoshiro256(std::uint64_t nSeed = 0) {
+            // Initialize state with splitmix64 as recommended by the authors
+            for(auto& n : m_an) {
+                nSeed += 0x9e3779b97f4a7c15ull;
+                auto z = nSeed;
+                z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+                z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+                n = z ^ (z >> 31);
+            }
+        }
+
+        static constexpr result_type min() { return 0; }
+        static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+        result_type operator()() {
+            auto const nResult = rotl(m_an[1] * 5, 7) * 9;
+            auto const t = m_an[1] << 17;
+            m_an[2] ^= m_an[0];
+            m_an[3] ^= m_an[1];
+            m_an[1] ^= m_an[2];
+            m_an[0] ^= m_an[3];
+            m_an[2] ^= t;
+            m_an[3] = rotl(m_an[3], 45);
+            return nResult;
+        }
+
+    private:
+        static std::uint64_t rotl(std::uint64_t n, int k) {
+            return (n << k) | (n >> (64 - k));
+        }
+
+        std::uint64_t m_an[4];
+    };
+}
+
+// The seed of all random number generators. If SetRandomSeed is not called,
+// RandomSeed() returns a seed from std::random_device.
+void SetRandomSeed(std::uint64_t nSeed);
+std::uint64_t RandomSeed();
@@ -0,0 +1,32 @@
+#include "resampling.h"
+
+#include <algorithm>
+#include <cmath>
+
+int CParticleCount::clamp(int cParticles) const {
+    if(!Adaptive()) return cParticles;
+    return std::max(m_params.m_cMinParticles, std::min(cParticles, m_params.m_cMaxParticles));
+}
+
+std::uint64_t CParticleCount::Bin(rbt::pose<double> const& pose) const {
+    // 21 bits per coordinate, the yaw is not normalized since the poses of
+    // one filter stay close to each other
+    auto const Coordinate = [](double f) {
+        return static_cast<std::uint64_t>(static_cast<std::int64_t>(std::floor(f)) + (1 << 20)) & ((1 << 21) - 1);
+    };
+    return Coordinate(pose.m_pt.x / m_params.m_fBinTranslation)
+        | Coordinate(pose.m_pt.y / m_params.m_fBinTranslation) << 21
+        | Coordinate(pose.m_fYaw / m_params.m_fBinRotation) << 42;
+}
+
+int CParticleCount::Count() {
+    std::sort(m_vecnBin.begin(), m_vecnBin.end());
+    auto const cBins = std::distance(m_vecnBin.begin(), std::unique(m_vecnBin.begin(), m_vecnBin.end()));
+    if(cBins<=1) return clamp(0);
+
+    // Wilson-Hilferty approximation of the chi-square quantile with cBins - 1 degrees of freedom
+    auto const k = static_cast<double>(cBins - 1);
+    auto const f = 2 / (9 * k);
+    auto const fParticles = k / (2 * m_params.m_fEpsilon) * std::pow(1 - f + std::sqrt(f) * m_params.m_fQuantile, 3);
+    return clamp(static_cast<int>(std::min(std::ceil(fParticles), static_cast<double>(m_params.m_cMaxParticles))));
+}
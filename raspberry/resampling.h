@@ -0,0 +1,94 @@
+#pragma once
+
+#include "geometry.h"
+#include "random_generator.h"
+#include "error_handling.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+// Low variance sampling, Thrun et al "Probabilistic Robotics" p 110.
+// Replaces veci by the indices of cSamples particles drawn in proportion to
+// their weights fnWeight(i), i < cParticles, that sum up to fWeightTotal.
+// The indices are sorted.
+template<typename FnWeight>
+void LowVarianceSample(int cParticles, FnWeight fnWeight, double fWeightTotal, int cSamples, rbt::xoshiro256& rng, std::vector<int>& veci) {
+    veci.clear();
+    auto const fStepSize = fWeightTotal/cSamples;
+    auto const r = std::uniform_real_distribution<double>(0.0, fStepSize)(rng);
+    auto c = fnWeight(0);
+    for(int i = 0, m = 0; m<cSamples; ++m) {
+        auto const u = r + m * fStepSize;
+        // Rounding errors must not take i past the last particle
+        while(c<u && i+1<cParticles) {
+            ++i;
+            c += fnWeight(i);
+        }
+        veci.emplace_back(i);
+    }
+}
+
+struct SParticleCountParameters {
+    // The particle count adapts between m_cMinParticles and m_cMaxParticles,
+    // it is fixed if m_cMaxParticles is 0
+    int m_cMinParticles = 1;
+    int m_cMaxParticles = 0;
+    // Size of the histogram bins. Like AMCL's, they are much larger than the
+    // spread of converged particles, so these occupy one or two bins.
+    double m_fBinTranslation = 50; // cm
+    double m_fBinRotation = 0.17;  // rad, about 10 degrees
+    double m_fEpsilon = 0.05;      // bound of the Kullback-Leibler distance
+    double m_fQuantile = 2.33;     // of the standard normal distribution, the bound holds with probability 0.99
+};
+
+// KLD sampling, Fox "Adapting the Sample Size in Particle Filters Through KLD-Sampling"
+// and Thrun et al "Probabilistic Robotics" p 263.
+// Approximating the posterior by a histogram over poses, count() is the number
+// of particles for which the Kullback-Leibler distance between the particles
+// and the posterior is below m_fEpsilon. It grows with the number of occupied
+// bins, i.e., an uncertain filter gets more particles than a converged one.
+struct CParticleCount {
+    explicit CParticleCount(SParticleCountParameters const& params) : m_params(params) {
+        ASSERT(!Adaptive() || (1<=m_params.m_cMinParticles && m_params.m_cMinParticles<=m_params.m_cMaxParticles));
+    }
+
+    bool Adaptive() const { return 0<m_params.m_cMaxParticles; }
+    // cParticles within the bounds if the count is adaptive
+    int clamp(int cParticles) const;
+
+    // The number of particles needed for the poses fnPose(i), i in veci, which
+    // are a sample of the posterior, e.g., drawn by LowVarianceSample
+    template<typename FnPose>
+    int count(std::vector<int> const& veci, FnPose fnPose) {
+        m_vecnBin.clear();
+        for(int i : veci) m_vecnBin.emplace_back(Bin(fnPose(i)));
+        return Count();
+    }
+
+    // Resizes the sorted low variance sample veci, e.g., to the count() for it,
+    // so the draw that has been counted is the one that is kept. veci is thinned
+    // out evenly or extended by another low variance sample and stays sorted.
+    template<typename FnWeight>
+    void resize(std::vector<int>& veci, int cSamples, int cParticles, FnWeight fnWeight, double fWeightTotal, rbt::xoshiro256& rng) {
+        auto const cDrawn = static_cast<int>(veci.size());
+        if(cSamples<cDrawn) {
+            // The source index is never smaller than m
+            for(int m = 0; m<cSamples; ++m) veci[m] = veci[static_cast<int>((m + 0.5) * cDrawn / cSamples)];
+            veci.resize(cSamples);
+        } else if(cDrawn<cSamples) {
+            LowVarianceSample(cParticles, fnWeight, fWeightTotal, cSamples - cDrawn, rng, m_veciExtra);
+            veci.insert(veci.end(), m_veciExtra.begin(), m_veciExtra.end());
+            std::inplace_merge(veci.begin(), veci.begin() + cDrawn, veci.end());
+        }
+    }
+
+private:
+    std::uint64_t Bin(rbt::pose<double> const& pose) const;
+    int Count(); // from the bins in m_vecnBin
+
+    SParticleCountParameters m_params;
+    std::vector<std::uint64_t> m_vecnBin;
+    std::vector<int> m_veciExtra; // samples added by resize
+};
@@ -3,18 +3,16 @@
 #include "particle_slam.h"
 #include "error_handling.h"
 #include "robot_configuration.h"
+#include "likelihood_field.h"
 
 #include <random>
+#include <algorithm>
 #include <opencv2/imgproc.hpp>
 
 namespace {
     int const c_nWheelRadius = 6; // cm
     double const c_fWheelDistance = 24.5; // cm
 
-    // Offset of robot center to lidar center as x, y coordinates
-    // y-axis points into direction of robot front
-    rbt::size<double> const c_szfLidarOffset(0, 7); 
-
     double encoderTicksToRadians(short nTicks) { // Note: Formula depends on wheel encoders
         return nTicks * 6.0 * M_PI / 1000.0;
     }
@@ -73,26 +71,30 @@ rbt::pose<int> ToGridCoordinate(rbt::pose<double> const& pose) {
     return rbt::pose<int>( ToGridCoordinate(pose.m_pt), pose.m_fYaw );
 }
 
+rbt::point<int> ToGridCoordinate(rbt::point<double> const& pt, rbt::point<int> const& ptnOrigin) {
+    return ToGridCoordinate(pt) - rbt::size<int>(ptnOrigin);
+}
+
+rbt::pose<int> ToGridCoordinate(rbt::pose<double> const& pose, rbt::point<int> const& ptnOrigin) {
+    return rbt::pose<int>( ToGridCoordinate(pose.m_pt, ptnOrigin), pose.m_fYaw );
+}
+
 rbt::point<double> Obstacle(rbt::pose<double> const& pose, double fRadAngle, double fDistance) {
     auto const szfLidar = rbt::size<double>::fromAngleAndDistance(fRadAngle, fDistance)
         + c_szfLidarOffset;
     return rbt::point<double>(pose.m_pt + szfLidar.rotated(pose.m_fYaw));
 }
 
-static std::random_device s_rd;
-rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<double> const& szf, double fRadAngle) {
+rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<double> const& szf, double fRadAngle, rbt::xoshiro256& rng, SMotionModelParameters const& params) {
     // http://gki.informatik.uni-freiburg.de/lehre/ws0203/Robotik/papers/kalman/kurt_robot_notes.pdf
     // TODO: Make measurements to get actual errors
-    double const c_fRangeStdDev = 0.1; // 0.1 cm/cm range error 
-    double const c_fTurnVar = 0.09; // (0.3 rad)^2 / rad turn error
-    double const c_fDriftVar = 0.0003; // (pi/18 rad)^2/100 cm drift error ~ (5 deg)^2/m 
 
     auto const fDistance = szf.Abs();
     rbt::size<double> const szfTranslation = [&] {
         if(0!=fDistance) { 
             // there was actual movement -> sample range error
             auto const szfSampled = szf.normalized() 
-                * std::normal_distribution<double>(fDistance, c_fRangeStdDev * fDistance)(s_rd);
+                * std::normal_distribution<double>(fDistance, params.m_fRangeStdDev * fDistance)(rng);
             return szfSampled.rotated(pose.m_fYaw);
         } else {
             return rbt::size<double>::zero();
@@ -105,15 +107,12 @@ rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<d
             // sample from rotation errors
             std::normal_distribution<double>(
                 fRadAngle, 
-                std::sqrt(c_fTurnVar * std::abs(fRadAngle) + c_fDriftVar * fDistance)
-            )(s_rd)
+                std::sqrt(params.m_fTurnVar * std::abs(fRadAngle) + params.m_fDriftVar * fDistance)
+            )(rng)
         );
 }
 
-double measurement_model_map(rbt::pose<double> const& pose, 
-    SScanLine const& scanline, 
-    std::function<double (rbt::point<double>)> Distance
-) {
+namespace {
     // Likelihood field model
     // Thrun, Probabilistic Robotics, p. 169ff
 
@@ -123,7 +122,12 @@ double measurement_model_map(rbt::pose<double> const& pose,
     double const z_rand = 0.1;
 
     double const c_fSensorSigma = 2; // ~ +-10cm with current map scale, in grid coordinates
+}
 
+double measurement_model_map(rbt::pose<double> const& pose, 
+    SScanLine const& scanline, 
+    std::function<double (rbt::point<double>)> Distance
+) {
     double fWeight = 1.0;
     boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
         double const fLikelihood = 
@@ -133,3 +137,20 @@ double measurement_model_map(rbt::pose<double> const& pose,
     });
     return fWeight;
 }
+
+double log_measurement_model(double fDistance) {
+    return std::log(z_hit * gauss_probability(fDistance, c_fSensorSigma) + z_rand);
+}
+
+double log_likelihood_field(rbt::pose<double> const& pose, SScanLine const& scanline, CLikelihoodField const& likelihoodfield, SSensorModelParameters const& params) {
+    // Equivalent to the kernel search in log_likelihood_field above, but the squared
+    // distance is truncated smoothly instead of falling back to a constant penalty
+
+    double fLogLikelihood = 0.0;
+    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
+        auto const ptn = ToGridCoordinate(Obstacle(pose, scan.m_fRadAngle, scan.m_nDistance));
+        double const fDistance = likelihoodfield.distance(ptn) * c_nScale;
+        fLogLikelihood+=(-1./params.m_fSigma)*std::min(fDistance*fDistance, params.m_fSqrDistMax);
+    });
+    return fLogLikelihood;
+}
@@ -3,9 +3,12 @@
 #include "rover.h"
 #include "geometry.h"
 #include "scanline.h"
+#include "random_generator.h"
 
 #include <functional>
 
+struct CLikelihoodField;
+
 // Robot configuration
 // All robot parameters are configurable here, as well as global parameters
 // such as the map dimensions, the map scaling factor etc. 
@@ -19,6 +22,8 @@ rbt::pose<double> UpdatePose(rbt::pose<double> const& pose, SOdometryData const&
 rbt::pose<double> UpdatePose(rbt::pose<double> const& pose, int nTicksLeft, int nTicksRight);
 
 // Occupancy grid
+// The occupancy grid is unbounded and grows as the robot explores. 
+// c_nMapExtent is the initial size of the map, the world origin is at its center.
 int constexpr c_nScale = 5; // 5cm / px
 int constexpr c_nMapExtent = 400; // px ~ 20m
 double constexpr c_fOccupiedDelta = 2;
@@ -38,16 +43,41 @@ rbt::pose<T> ToWorldCoordinate(rbt::pose<T> const& pose) {
     return rbt::pose<T>(ToWorldCoordinate(pose.m_pt), pose.m_fYaw);
 }
 
+// Map images, e.g., COccupancyGridBaseT::ObstacleMap(), only cover the bounding box
+// of the allocated part of the grid. ptnOrigin is the grid coordinate of the 
+// top-left pixel of such an image. These overloads convert between world coordinates
+// and pixel coordinates in the map image. 
+rbt::point<int> ToGridCoordinate(rbt::point<double> const& pt, rbt::point<int> const& ptnOrigin);
+rbt::pose<int> ToGridCoordinate(rbt::pose<double> const& pose, rbt::point<int> const& ptnOrigin);
+
+template<typename T>
+rbt::point<T> ToWorldCoordinate(rbt::point<T> const& pt, rbt::point<int> const& ptnOrigin) {
+    return ToWorldCoordinate(pt + rbt::size<T>(rbt::size<int>(ptnOrigin)));
+}
+
+// Offset of robot center to lidar center as x, y coordinates
+// y-axis points into direction of robot front
+rbt::size<double> const c_szfLidarOffset(0, 7); 
+
 rbt::point<double> Obstacle(rbt::pose<double> const& pose, double fRadAngle, double nDistance);
 
 
 const int c_nRobotWidth = 30; // cm
 const int c_nRobotHeight = 30; // cm
-const float c_fOccupancyRover = -100; // value in occupancy grid of positions occupied by rover itself
+float constexpr c_fOccupancyRover = -100; // value in occupancy grid of positions occupied by rover itself
 
 // Particle filter
-rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<double> const& szf, double fRadAngle);
+// The noise of sample_motion_model
+struct SMotionModelParameters {
+    double m_fRangeStdDev = 0.1; // 0.1 cm/cm range error 
+    double m_fTurnVar = 0.09;    // (0.3 rad)^2 / rad turn error
+    double m_fDriftVar = 0.0003; // (pi/18 rad)^2/100 cm drift error ~ (5 deg)^2/m 
+};
+rbt::pose<double> sample_motion_model(rbt::pose<double> const& pose, rbt::size<double> const& szf, double fRadAngle, rbt::xoshiro256& rng,
+    SMotionModelParameters const& params = SMotionModelParameters());
 double measurement_model_map(rbt::pose<double> const& pose, SScanLine const& scanline, std::function<double (rbt::point<double>)> Distance);
+// The log of the likelihood measurement_model_map assigns to a single obstacle fDistance grid cells away from the closest obstacle in the map
+double log_measurement_model(double fDistance);
 
 const double c_fSqrt2 = std::sqrt(2);
 
@@ -108,3 +138,13 @@ double log_likelihood_field(rbt::pose<double> const& pose, SScanLine const& scan
 #endif
     return fLogLikelihood;
 }
+
+// The sensor model of the log_likelihood_field below
+struct SSensorModelParameters {
+    double m_fSigma = 10;      // ~ +-10cm
+    double m_fSqrDistMax = 60; // the squared distance in cm is truncated to this
+};
+
+// Same as above, but looks up the distance to the closest obstacle in a precomputed likelihood field
+double log_likelihood_field(rbt::pose<double> const& pose, SScanLine const& scanline, CLikelihoodField const& likelihoodfield,
+    SSensorModelParameters const& params = SSensorModelParameters());
@@ -3,7 +3,15 @@
 #include "robot_configuration.h"
 
 #include "robot_strategy.h"
-
+#include "map_publisher.h"
+#include "log_file.h"
+#include "map_file.h"
+#include "profiling.h"
+#include "scanline.h"
+#include "spsc_ring.h"
+
+#include <array>
+#include <atomic>
 #include <chrono>
 #include <future>
 #include <thread>
@@ -59,7 +67,7 @@ enum ECalibration {
 };
 
 using FOnOdometryData = std::function< void (SOdometryData const&) >;
-using FOnLidarData = std::function< void(std::vector<unsigned char>) >;
+using FOnLidarData = std::function< void(SLidarData const&) >;
 using FOnChar = std::function< void(char) >;
 /*
 	Connection to robot using boost::asio 
@@ -201,21 +209,18 @@ struct SRobotConnection : SConfigureStdin {
 	
 	void wait_for_lidar_data() {
 		// TODO: Separate time-out timer for lidar data?
-		// We read a large chunk of the lidar data and then filter the invalid packets. 
-		// The XV11 serial data was not 100% reliable. Syncing to the lidar stream and 
-		// then relying on the validity of the data didn't work. 
-		m_vecbBuffer.resize(c_cbLIDAR_FULL_ROTATION);
-		boost::asio::async_read(
-			m_serialLidar, 
-			boost::asio::buffer(m_vecbBuffer),
+		// The packets are decoded straight from the read buffer, the parser only
+		// copies packets that straddle two reads. Since the buffer is parsed
+		// before the next read is started, a single buffer suffices.
+		m_serialLidar.async_read_some(
+			boost::asio::buffer(m_abBuffer),
 			[&](boost::system::error_code const& ec, std::size_t length) {
 				ASSERT(!ec);
-				ASSERT(length==m_vecbBuffer.size());
 				// Ignore further data if we're waiting for the last reset command to be delivered
 				if(m_bShutdown) return;
 				// m_timer.cancel();
 
-				m_funcOnLidarData(std::move(m_vecbBuffer));
+				m_parserLidar.parse(m_abBuffer.data(), length, m_funcOnLidarData);
 				wait_for_lidar_data();
 			}); 
 	}
@@ -257,7 +262,8 @@ private:
 	SOdometryData m_odometry;
 	FOnOdometryData m_funcOnOdometryData;
 
-	std::vector<unsigned char> m_vecbBuffer;
+	std::array<unsigned char, c_cbLIDAR_FULL_ROTATION> m_abBuffer;
+	CLidarStreamParser m_parserLidar;
 	FOnLidarData m_funcOnLidarData;
 
 	FOnChar m_funcOnChar;
@@ -267,174 +273,225 @@ private:
 	bool const m_bManual;
 };
 
-int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std::ofstream& ofsLog, bool bManual, boost::optional<std::string> const& strOutput) {
+// State the http request handler needs
+struct SServerContext {
+	SRobotConnection& m_rc;
+	CMapPublisher const& m_mappublisher;
+	bool m_bManual;
+};
+
+int ConnectToRobot(std::string const& strPort, std::string const& strLidar, CLogWriter& logwriter, bool bManual, boost::optional<std::string> const& strOutput, double fMapRate, SSlamBackendOptions const& slamoptions, SMapFileOptions const& mapfileoptions) {
 	// Establish robot connection via serial port
 	try {
-		CRobotStrategy robotstrategy;
+		auto pslam = MakeSlamBackend(slamoptions, mapfileoptions);
+		if(!pslam) return 1;
+		CRobotStrategy robotstrategy(std::move(pslam));
 		robotstrategy.PrintHelp();
-
-		// State shared between main thread communicating with robot, 
-		// and helper thread handling sensory input
-		std::mutex m;
-		std::condition_variable cv;
-		SScanLine scanlineNext;
+		if(mapfileoptions.m_ostrSave) {
+			std::cout << "s\t- save the map to " << mapfileoptions.m_ostrSave.get() << std::endl;
+		}
+		// Set by the I/O thread, the map is saved by the SLAM thread
+		std::atomic<bool> bSaveMap(false);
+
+		// Scans are handed from the main thread communicating with the robot
+		// to the helper thread running SLAM. Two slots let the I/O thread fill
+		// the next scan while SLAM processes the previous one without adding
+		// latency. If SLAM falls behind, the pending scan is coalesced with the
+		// next one: its odometry is kept and its lidar data is replaced.
+		CSpscRing<SScanLine> ringscanline(2);
+		SScanLine scanlineNext; // only accessed by the I/O thread
+		scanlineNext.m_vecscan.reserve(360);
+		int cCoalesced = 0;
 		
 		boost::asio::io_service io_service;
 		
 		auto tpStart = std::chrono::system_clock::now();
 		auto tpLastLidarMessage = std::chrono::system_clock::now();
 		int cLidarUpdates = 0;
+		SProfile profilePrev;
+		int nIndexPrev = 0;
+		auto const OnRotation = [&] {
+			auto& vecscan = scanlineNext.m_vecscan;
+			{
+				++cLidarUpdates;
+
+				auto tpMessage = std::chrono::system_clock::now();
+				std::chrono::duration<double> durDiff = tpMessage - tpLastLidarMessage;
+				if(30 < durDiff.count()) {
+					std::cout << "Lidar update frequency " << (cLidarUpdates/durDiff.count()) << " Hz, " << cCoalesced << " scans coalesced\n";
+
+					auto const profile = Profile();
+					std::cout << "Time spent in the last " << durDiff.count() << " s:\n" << (profile - profilePrev);
+					profilePrev = profile;
+
+					tpLastLidarMessage = tpMessage;
+					cLidarUpdates = 0;
+				}
+			}
+
+			if(logwriter.is_open()) {
+				auto tpEnd = std::chrono::system_clock::now();
+				std::chrono::duration<double> durDiff = tpEnd-tpStart;
+				logwriter.write(durDiff.count(), vecscan);
+			} 
+
+			if(vecscan.empty()) return;
+			if(auto pscanline = ringscanline.write_slot()) {
+				scanlineNext.move_to(*pscanline);
+				ringscanline.push();
+			} else {
+				++cCoalesced; // SLAM has not taken the previous scan
+				scanlineNext.clear_scans();
+			}
+		};
 		SRobotConnection rc(io_service, strPort, strLidar, bManual,
 			 [&](SOdometryData const& odom) {
-				if(ofsLog.is_open()) {
+				if(logwriter.is_open()) {
 					auto tpEnd = std::chrono::system_clock::now();
 					std::chrono::duration<double> durDiff = tpEnd-tpStart;
-
-					ofsLog << "o;" << durDiff.count() << ';'
-						<< odom.m_nFrontLeft << ';'
-						<< odom.m_nFrontRight << ';'
-						<< odom.m_nBackLeft << ';'
-						<< odom.m_nBackRight;
-					ofsLog << '\n';
+					logwriter.write(durDiff.count(), odom);
 				} 
 				
-				std::unique_lock<std::mutex> lk(m);
-				scanlineNext.add(odom);
+				scanlineNext.add(odom, SScanLine::clock::now());
 			 },
-			 [&](std::vector<unsigned char> vecblidar) {
-				std::vector<SScanLine::SScan> vecscan;
-				auto itb = std::find(vecblidar.begin(), vecblidar.end(), 0xFA);
-				do {
-					auto itbNext = std::find(boost::next(itb), vecblidar.end(), 0xFA);
-
-					if(itbNext-itb == sizeof(SLidarData)) {
-						SLidarData const& lidar = *reinterpret_cast<SLidarData*>(std::addressof(*itb));
-						if(lidar.ValidChecksum()) {
-							ForEachScan(lidar, [&](SScanLine::SScan const& scan) {
-								vecscan.emplace_back(scan);
-							});
-						}
-					}
-					itb = itbNext;
-				} while(itb != vecblidar.end());
-
-				{
-					++cLidarUpdates;
-
-					auto tpMessage = std::chrono::system_clock::now();
-					std::chrono::duration<double> durDiff = tpMessage - tpLastLidarMessage;
-					if(30 < durDiff.count()) {
-						std::cout << "Lidar update frequency " << (cLidarUpdates/durDiff.count()) << " Hz\n";
-
-						tpLastLidarMessage = tpMessage;
-						cLidarUpdates = 0;
-					}
-				}
-
-				if(ofsLog.is_open()) {
-				 	auto tpEnd = std::chrono::system_clock::now();
-					std::chrono::duration<double> durDiff = tpEnd-tpStart;
-
-					ofsLog << "l;" << durDiff.count() << ';';
-					boost::for_each(vecscan, [&](SScanLine::SScan const& scan) {
-						ofsLog << scan.m_nAngle << '/' << scan.m_nDistance << ';';
-					});
-					ofsLog << '\n';
-				} 
-					
-				std::unique_lock<std::mutex> lk(m);
-				scanlineNext.m_vecscan = std::move(vecscan);
-				cv.notify_one();
+			 [&](SLidarData const& lidar) {
+				// A rotation is complete when the packet index wraps around
+				if(lidar.m_nIndex<=nIndexPrev) OnRotation();
+				nIndexPrev = lidar.m_nIndex;
+				scanlineNext.add(lidar, SScanLine::clock::now());
 			 },
 			 [&](char ch) {
-				 robotstrategy.OnChar(ch);
+				 if('s'==ch && mapfileoptions.m_ostrSave) {
+					 bSaveMap = true;
+				 } else {
+					 robotstrategy.OnChar(ch);
+				 }
 			 }		 
 		); // throws boost::system:::system_error
 
-		// Setup HTTP server to receive control commands
-		MHD_Daemon* pdaemon = nullptr;
-		if(bManual) {
-			std::cout << "Starting server on port 8088" << std::endl;
-			pdaemon = MHD_start_daemon(
-				MHD_USE_THREAD_PER_CONNECTION, 
-				/*port*/ 8088, 
-				/*accept all connections*/ nullptr, nullptr, 
-				[](void* pvData, struct MHD_Connection* pconn, 
-					const char* szUrl, const char* szMethod, const char* szVersion, const char* szUploadData, size_t* stUploadDataSize, 
-					void** ppvConnectionData) {
-
-					if(0 != strcmp(szMethod, MHD_HTTP_METHOD_GET)) { 
+		// Renders and encodes the map off the SLAM thread
+		CMapPublisher mappublisher(fMapRate, strOutput);
+		SServerContext servercontext{rc, mappublisher, bManual};
+
+		// Setup HTTP server to serve the map and, in manual mode, to receive control commands
+		std::cout << "Starting server on port 8088" << std::endl;
+		MHD_Daemon* pdaemon = MHD_start_daemon(
+			MHD_USE_THREAD_PER_CONNECTION, 
+			/*port*/ 8088, 
+			/*accept all connections*/ nullptr, nullptr, 
+			[](void* pvData, struct MHD_Connection* pconn, 
+				const char* szUrl, const char* szMethod, const char* szVersion, const char* szUploadData, size_t* stUploadDataSize, 
+				void** ppvConnectionData) {
+
+				if(0 != strcmp(szMethod, MHD_HTTP_METHOD_GET)) { 
     					return MHD_NO; // unexpected method
-					}
+				}
 
-					static int s_nDummy;
+				static int s_nDummy;
   					if(&s_nDummy != *ppvConnectionData) { // do never respond on first call
       					*ppvConnectionData = &s_nDummy;
       					return MHD_YES;
     				}
   					*ppvConnectionData = nullptr;
 
-					// Set Access-Control-Allow-Origin header for any client IP
-					sockaddr* psockaddr = MHD_get_connection_info(pconn, MHD_CONNECTION_INFO_CLIENT_ADDRESS)->client_addr;
+				// Set Access-Control-Allow-Origin header for any client IP
+				sockaddr* psockaddr = MHD_get_connection_info(pconn, MHD_CONNECTION_INFO_CLIENT_ADDRESS)->client_addr;
   
-					constexpr int c_cbIPADDRESS = 20;
+				constexpr int c_cbIPADDRESS = 20;
    					char strIP[c_cbIPADDRESS];
-					if(psockaddr->sa_family == AF_INET) { 
-						sockaddr_in *v4 = reinterpret_cast<sockaddr_in*>(psockaddr); 
-						inet_ntop(AF_INET, std::addressof(v4->sin_addr), strIP, c_cbIPADDRESS); 
-					} else {
-						ASSERT(psockaddr->sa_family == AF_INET6); 
-						sockaddr_in6 *v6 = reinterpret_cast<sockaddr_in6*>(psockaddr); 
-						inet_ntop(AF_INET6, std::addressof(v6->sin6_addr), strIP, c_cbIPADDRESS);
-					}
+				if(psockaddr->sa_family == AF_INET) { 
+					sockaddr_in *v4 = reinterpret_cast<sockaddr_in*>(psockaddr); 
+					inet_ntop(AF_INET, std::addressof(v4->sin_addr), strIP, c_cbIPADDRESS); 
+				} else {
+					ASSERT(psockaddr->sa_family == AF_INET6); 
+					sockaddr_in6 *v6 = reinterpret_cast<sockaddr_in6*>(psockaddr); 
+					inet_ntop(AF_INET6, std::addressof(v6->sin6_addr), strIP, c_cbIPADDRESS);
+				}
   					
-					auto EmptyResponse = [&](int nCode) {
-						auto* presponse = MHD_create_response_from_buffer(0, nullptr, MHD_RESPMEM_PERSISTENT);
-						ASSERT(presponse);
-						VERIFYEQUAL(MHD_add_response_header(presponse, "Access-Control-Allow-Origin", strIP), MHD_YES);
-						VERIFYEQUAL(MHD_queue_response(pconn, nCode, presponse), MHD_YES);
-						MHD_destroy_response(presponse);
-						return MHD_YES;
-					};
-
-					if(0==strcmp(szUrl, "/command")) {
-						const char* szLeft = MHD_lookup_connection_value(pconn, MHD_GET_ARGUMENT_KIND, "left");
-						const char* szRight = MHD_lookup_connection_value(pconn, MHD_GET_ARGUMENT_KIND, "right");
-
-						if(szLeft && szRight) {
-							try {						
-								auto const nLeft = boost::lexical_cast<short>(szLeft);
-								auto const nRight = boost::lexical_cast<short>(szRight);
-
-								reinterpret_cast<SRobotConnection*>(pvData)->send_command(
-									{ecmdMOVE, std::min(nLeft, c_nMaxFwdSpeed), std::min(nRight, c_nMaxFwdSpeed)}
-								);
-								return EmptyResponse(200);
-							} catch(boost::bad_lexical_cast const&) {}
+				auto EmptyResponse = [&](int nCode) {
+					auto* presponse = MHD_create_response_from_buffer(0, nullptr, MHD_RESPMEM_PERSISTENT);
+					ASSERT(presponse);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Access-Control-Allow-Origin", strIP), MHD_YES);
+					VERIFYEQUAL(MHD_queue_response(pconn, nCode, presponse), MHD_YES);
+					MHD_destroy_response(presponse);
+					return MHD_YES;
+				};
+
+				if(0==strcmp(szUrl, "/stats")) {
+					// Total calls and time per SLAM stage since start
+					auto const strJson = Profile().ToJson();
+					auto* presponse = MHD_create_response_from_buffer(strJson.size(), const_cast<char*>(strJson.data()), MHD_RESPMEM_MUST_COPY);
+					ASSERT(presponse);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Access-Control-Allow-Origin", strIP), MHD_YES);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Content-Type", "application/json"), MHD_YES);
+					VERIFYEQUAL(MHD_queue_response(pconn, 200, presponse), MHD_YES);
+					MHD_destroy_response(presponse);
+					return MHD_YES;
+				} else if(0==strcmp(szUrl, "/map.png")) {
+					// Latest map rendered by the map publisher
+					auto const pvecbPng = reinterpret_cast<SServerContext*>(pvData)->m_mappublisher.png();
+					if(!pvecbPng) return EmptyResponse(503);
+
+					auto* presponse = MHD_create_response_from_buffer(pvecbPng->size(), const_cast<unsigned char*>(pvecbPng->data()), MHD_RESPMEM_MUST_COPY);
+					ASSERT(presponse);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Access-Control-Allow-Origin", strIP), MHD_YES);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Content-Type", "image/png"), MHD_YES);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Cache-Control", "no-cache"), MHD_YES);
+					VERIFYEQUAL(MHD_queue_response(pconn, 200, presponse), MHD_YES);
+					MHD_destroy_response(presponse);
+					return MHD_YES;
+				} else if(0==strcmp(szUrl, "/tiles")) {
+					// Long poll for the map tiles that changed since version 'since', see CMapPublisher::tiles
+					std::uint32_t nSince = 0;
+					if(const char* szSince = MHD_lookup_connection_value(pconn, MHD_GET_ARGUMENT_KIND, "since")) {
+						try {
+							nSince = boost::lexical_cast<std::uint32_t>(szSince);
+						} catch(boost::bad_lexical_cast const&) {
+							return EmptyResponse(400);
 						}
-						return EmptyResponse(400);
 					}
-					return EmptyResponse(404);
-				},
-				std::addressof(rc),
-				MHD_OPTION_END
-			);
-			ASSERT(pdaemon);
-			std::cout << "Started http server on port 8088." << std::endl;
-			std::cout << "See raspberry/html/map.html for an example on how to control the robot via http" << std::endl;
-		}
 
-		std::thread t([&robotstrategy, &rc, &bManual, &m, &cv, &scanlineNext, &strOutput] {
+					auto const vecb = reinterpret_cast<SServerContext*>(pvData)->m_mappublisher.tiles(nSince, 10s);
+					auto* presponse = MHD_create_response_from_buffer(vecb.size(), const_cast<unsigned char*>(vecb.data()), MHD_RESPMEM_MUST_COPY);
+					ASSERT(presponse);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Access-Control-Allow-Origin", strIP), MHD_YES);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Content-Type", "application/octet-stream"), MHD_YES);
+					VERIFYEQUAL(MHD_add_response_header(presponse, "Cache-Control", "no-cache"), MHD_YES);
+					VERIFYEQUAL(MHD_queue_response(pconn, 200, presponse), MHD_YES);
+					MHD_destroy_response(presponse);
+					return MHD_YES;
+				} else if(0==strcmp(szUrl, "/command") && reinterpret_cast<SServerContext*>(pvData)->m_bManual) {
+					const char* szLeft = MHD_lookup_connection_value(pconn, MHD_GET_ARGUMENT_KIND, "left");
+					const char* szRight = MHD_lookup_connection_value(pconn, MHD_GET_ARGUMENT_KIND, "right");
+
+					if(szLeft && szRight) {
+						try {						
+							auto const nLeft = boost::lexical_cast<short>(szLeft);
+							auto const nRight = boost::lexical_cast<short>(szRight);
+
+							reinterpret_cast<SServerContext*>(pvData)->m_rc.send_command(
+								{ecmdMOVE, std::min(nLeft, c_nMaxFwdSpeed), std::min(nRight, c_nMaxFwdSpeed)}
+							);
+							return EmptyResponse(200);
+						} catch(boost::bad_lexical_cast const&) {}
+					}
+					return EmptyResponse(400);
+				}
+				return EmptyResponse(404);
+			},
+			std::addressof(servercontext),
+			MHD_OPTION_END
+		);
+		ASSERT(pdaemon);
+		std::cout << "Started http server on port 8088." << std::endl;
+		std::cout << "See raspberry/html/map.html for an example on how to view the map and control the robot via http" << std::endl;
+
+		std::thread t([&robotstrategy, &rc, &bManual, &ringscanline, &mappublisher, &bSaveMap, &mapfileoptions] {
 			bool bLastUpdateZeroMovement = false;
 			while(true) {	
-				SScanLine scanline;
-				{
-					std::unique_lock<std::mutex> lk(m);
-					cv.wait(lk, [&]{ return !scanlineNext.m_vecscan.empty(); });
-					scanline = std::move(scanlineNext);
-					scanlineNext.clear();
-				}
-				
+				auto& scanline = ringscanline.wait_read_slot();
+				scanline.deskew();
+
 				auto const bZeroMovement = scanline.translation()==rbt::size<double>::zero() && scanline.rotation()==0.0;
 				if(!bLastUpdateZeroMovement || !bZeroMovement) { // ignore successive scans with zero movement
 					bLastUpdateZeroMovement = bZeroMovement;
@@ -444,17 +501,17 @@ int ConnectToRobot(std::string const& strPort, std::string const& strLidar, std:
 						rc.send_command(rcmd);
 					}
 
-					if(strOutput) {
-						try {					
-							cv::imwrite(strOutput.get(), robotstrategy.getMapWithPose());	
-						} catch(std::exception const& e) {
-							std::cerr << "Error writing to " << strOutput.get() << ": " << e.what() << std::endl;
-						} catch(...) {
-							std::cerr << "Unknown error writing to " << strOutput.get() << std::endl;
-							std::abort();
-						}
-					}	
+					mappublisher.post({robotstrategy.Slam().getObstacleGrid(), robotstrategy.Slam().Poses().back()});
+				}
+				// Also while the robot stands still, the first scan line has always been processed
+				if(bSaveMap.exchange(false)) {
+					if(SaveMap(mapfileoptions.m_ostrSave.get(), robotstrategy.Slam().save(), mapfileoptions.m_bCompress)) {
+						std::cout << "Saved map to " << mapfileoptions.m_ostrSave.get() << std::endl;
+					} else {
+						std::cerr << "Couldn't write " << mapfileoptions.m_ostrSave.get() << std::endl;
+					}
 				}
+				ringscanline.pop();
 			}
 		});
 
@@ -1,11 +1,111 @@
 #include "robot_strategy.h"
+#include "robot_configuration.h"
+#include "error_handling.h"
 
+#include <iostream>
+#include <numeric>
+
+#include <boost/range/algorithm/sort.hpp>
+
+namespace {
+    // Frontiers narrower than the robot are most likely noise
+    int constexpr c_nMinFrontierCells = c_nRobotWidth / c_nScale;
+
+    // Frontier cells are next to unknown cells, which the cost map treats as
+    // obstacles. Returns the closest cell within nRadius the robot can drive to.
+    boost::optional<rbt::point<int>> ClosestDrivableCell(CCostMap const& costmap, rbt::point<int> const& ptn, int nRadius) {
+        boost::optional<rbt::point<int>> optptnBest;
+        int nSqrDistBest = std::numeric_limits<int>::max();
+        for(int y = -nRadius; y <= nRadius; ++y) {
+            for(int x = -nRadius; x <= nRadius; ++x) {
+                auto const ptnCell = ptn + rbt::size<int>(x, y);
+                if(x*x + y*y < nSqrDistBest && costmap.is_inside(ptnCell) && CCostMap::c_nMaxBlocked < costmap.at(ptnCell)) {
+                    nSqrDistBest = x*x + y*y;
+                    optptnBest = ptnCell;
+                }
+            }
+        }
+        return optptnBest;
+    }
+}
+
+CRobotStrategy::CRobotStrategy(std::unique_ptr<CSlamBackend> pslam)
+    : m_pslam(std::move(pslam))
+{
+    ASSERT(m_pslam);
+}
 
 SRobotCommand CRobotStrategy::receivedSensorData(SScanLine const& scanline) {
-    CFastParticleSlamBase::receivedSensorData(scanline);
+    m_pslam->receivedSensorData(scanline);
+    boost::optional<rbt::point<double>> optfGoal;
+    bool bExplore;
+    {
+        std::lock_guard<std::mutex> lock(m_mtxGoal);
+        optfGoal = m_optfGoal;
+        bExplore = m_bExplore;
+    }
+
+    m_vecptfTargets.clear();
+    if(optfGoal || bExplore) m_costmap.update(m_pslam->getObstacleGrid());
+    if(!optfGoal && bExplore) {
+        m_frontiers.update(m_pslam->getObstacleGrid());
+        m_vecptfTargets = ExplorationTargets();
+        if(!m_vecptfTargets.empty()) optfGoal = m_vecptfTargets.front();
+    }
+    if(optfGoal) {
+        m_vecptfPath = m_planner.FindPath(m_costmap, m_pslam->Poses().back(), *optfGoal);
+    } else {
+        m_vecptfPath.clear();
+    }
     // TODO: Calculate strategy, return robot control
     return SRobotCommand::stop();
 }
 
-void CRobotStrategy::PrintHelp() {}
-void CRobotStrategy::OnChar(char ch) {}
+std::vector<rbt::point<double>> CRobotStrategy::ExplorationTargets() {
+    auto const& ptnOrigin = m_costmap.Origin();
+    std::vector<rbt::point<double>> vecptf;
+    for(auto const& frontier : m_frontiers.Frontiers(c_nMinFrontierCells)) {
+        auto const optptn = ClosestDrivableCell(m_costmap, frontier.m_ptnTarget - rbt::size<int>(ptnOrigin), c_nMinFrontierCells);
+        if(optptn) vecptf.emplace_back(ToWorldCoordinate(rbt::point<double>(*optptn), ptnOrigin));
+    }
+
+    // One search for the path costs to all frontiers, the closest frontier first
+    auto const vecpath = m_plannerTargets.FindPaths(m_costmap, m_pslam->Poses().back(), vecptf);
+    std::vector<int> veci(vecptf.size());
+    std::iota(veci.begin(), veci.end(), 0);
+    boost::sort(veci, [&](int iA, int iB) { return vecpath[iA].m_fCost < vecpath[iB].m_fCost; });
+
+    std::vector<rbt::point<double>> vecptfTargets;
+    for(auto i : veci) {
+        if(!std::isinf(vecpath[i].m_fCost)) vecptfTargets.emplace_back(vecptf[i]);
+    }
+    return vecptfTargets;
+}
+
+void CRobotStrategy::SetGoal(boost::optional<rbt::point<double>> const& optfGoal) {
+    std::lock_guard<std::mutex> lock(m_mtxGoal);
+    m_optfGoal = optfGoal;
+}
+
+void CRobotStrategy::SetExplore(bool bExplore) {
+    std::lock_guard<std::mutex> lock(m_mtxGoal);
+    m_bExplore = bExplore;
+}
+
+void CRobotStrategy::PrintHelp() {
+    std::cout << "h\t- plan path back to start" << std::endl;
+    std::cout << "f\t- start or stop exploring frontiers" << std::endl;
+}
+
+void CRobotStrategy::OnChar(char ch) {
+    switch(ch) {
+        case 'h':
+            SetGoal(rbt::point<double>::zero());
+            break;
+        case 'f': {
+            std::lock_guard<std::mutex> lock(m_mtxGoal);
+            m_bExplore = !m_bExplore;
+            break;
+        }
+    }
+}
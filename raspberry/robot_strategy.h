@@ -1,10 +1,48 @@
 #pragma once
 
-#include "fast_particle_slam.h"
+#include "slam_backend.h"
+#include "cost_map.h"
+#include "frontier.h"
+#include "path_finding.h"
 #include "scanline.h"
 
-struct CRobotStrategy : CFastParticleSlamBase {
+#include <memory>
+#include <mutex>
+
+#include <boost/optional.hpp>
+
+// Plans the robot's path in the map of any SLAM backend
+struct CRobotStrategy : rbt::nonmoveable {
+    explicit CRobotStrategy(std::unique_ptr<CSlamBackend> pslam);
     SRobotCommand receivedSensorData(SScanLine const& scanline);    
+    CSlamBackend const& Slam() const { return *m_pslam; }
     void PrintHelp();
     void OnChar(char ch);
-};
\ No newline at end of file
+
+    // While a goal is set, the path to it is replanned after every scan.
+    // The cost map is updated incrementally and the planner repairs its previous search.
+    // SetGoal may be called from any thread, Path() only from the thread calling receivedSensorData.
+    void SetGoal(boost::optional<rbt::point<double>> const& optfGoal);
+    std::vector<rbt::point<double>> const& Path() const { return m_vecptfPath; } // from the goal to the robot
+
+    // While exploring and no goal is set, the goal is the closest reachable frontier.
+    // The frontiers are tracked incrementally. SetExplore may be called from any thread.
+    void SetExplore(bool bExplore);
+    std::vector<rbt::point<double>> const& Targets() const { return m_vecptfTargets; } // ranked exploration targets
+
+private:
+    std::vector<rbt::point<double>> ExplorationTargets();
+
+    std::unique_ptr<CSlamBackend> m_pslam;
+
+    std::mutex m_mtxGoal; // protects m_optfGoal and m_bExplore
+    boost::optional<rbt::point<double>> m_optfGoal;
+    bool m_bExplore = false;
+    CCostMap m_costmap;
+    CIncrementalPathPlanner m_planner;
+    std::vector<rbt::point<double>> m_vecptfPath;
+
+    CFrontierDetector m_frontiers;
+    CGridPathPlanner m_plannerTargets;
+    std::vector<rbt::point<double>> m_vecptfTargets;
+};
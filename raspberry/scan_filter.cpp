@@ -0,0 +1,29 @@
+#include "scan_filter.h"
+
+#include <cmath>
+
+SScanLine const& CScanFilter::filter(SScanLine const& scanline) {
+    m_scanline.clear();
+    m_scanline.m_pose = scanline.m_pose;
+    m_setptn.clear();
+
+    auto& vecscan = m_scanline.m_vecscan;
+    for(auto const& scan : scanline.m_vecscan) {
+        if(scan.m_nDistance<m_params.m_nMinDistance) continue;
+
+        auto const ptf = Obstacle(rbt::pose<double>::zero(), scan.m_fRadAngle, scan.m_nDistance) / static_cast<double>(m_params.m_nCellExtent);
+        if(m_setptn.insert(rbt::point<int>(static_cast<int>(std::floor(ptf.x)), static_cast<int>(std::floor(ptf.y))))) {
+            vecscan.emplace_back(scan);
+        }
+    }
+
+    auto const cScans = vecscan.size();
+    if(0<m_params.m_cMaxScans && m_params.m_cMaxScans<cScans) {
+        // i * cScans / m_cMaxScans >= i, so the scans can be moved in place
+        for(std::size_t i = 0; i<m_params.m_cMaxScans; ++i) {
+            vecscan[i] = vecscan[i * cScans / m_params.m_cMaxScans];
+        }
+        vecscan.erase(vecscan.begin() + m_params.m_cMaxScans, vecscan.end());
+    }
+    return m_scanline;
+}
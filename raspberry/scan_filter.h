@@ -0,0 +1,31 @@
+#pragma once
+
+#include "cell_set.h"
+#include "robot_configuration.h"
+#include "scanline.h"
+
+#include <cstddef>
+
+struct SScanFilterParameters {
+    int m_nMinDistance = c_nRobotHeight/2; // cm, closer scans hit the robot or are noise
+    int m_nCellExtent = c_nScale;          // cm, of the cells in which scans are merged
+    std::size_t m_cMaxScans = 0;           // 0 keeps all scans
+};
+
+// The cost of matching a scan line is linear in the number of scans.
+// Before matching, the filter drops scans closer than m_nMinDistance and
+// keeps only the first scan whose obstacle falls into each cell of
+// m_nCellExtent. Of the remaining scans, at most m_cMaxScans are kept,
+// spread evenly over the angles so that the match stays constrained in
+// all directions. The map is still updated from the complete scan line.
+struct CScanFilter {
+    explicit CScanFilter(SScanFilterParameters const& params = SScanFilterParameters()) : m_params(params) {}
+
+    // The filtered copy of scanline, valid until the next call
+    SScanLine const& filter(SScanLine const& scanline);
+
+private:
+    SScanFilterParameters m_params;
+    CCellSet m_setptn;
+    SScanLine m_scanline;
+};
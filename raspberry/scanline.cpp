@@ -1,22 +1,67 @@
 #include "scanline.h"
 #include "robot_configuration.h"
+#include "error_handling.h"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+
+namespace {
+    // The checksum is a shift-add over the first ten 16 bit words,
+    // ((w0 << 1) + w1) << 1 ... + w9, i.e., the sum of w_i << (9 - i).
+    // Summed as a tree, the terms don't depend on each other. The sum
+    // is < 2^26 and the words are little endian like the host.
+    bool ChecksumMatches(unsigned char const* pb) {
+        static_assert(sizeof(SLidarData)==22, "");
+        std::uint16_t an[11];
+        std::memcpy(an, pb, sizeof(an));
+        std::uint32_t const nSum =
+            (((std::uint32_t(an[0]) << 9) + (std::uint32_t(an[1]) << 8)) + ((std::uint32_t(an[2]) << 7) + (std::uint32_t(an[3]) << 6)))
+            + (((std::uint32_t(an[4]) << 5) + (std::uint32_t(an[5]) << 4)) + ((std::uint32_t(an[6]) << 3) + (std::uint32_t(an[7]) << 2)))
+            + ((std::uint32_t(an[8]) << 1) + std::uint32_t(an[9]));
+        std::uint32_t const nChecksum = ((nSum & 0x7FFF) + (nSum >> 15)) & 0x7FFF;
+        return nChecksum == an[10];
+    }
+}
 
 bool SLidarData::ValidChecksum() const {
-    int nChecksum = 0;
-
-    static_assert(sizeof(SLidarData)==22, "");
-    static_assert(sizeof(m_nChecksum)==2, "");
-    for(unsigned short const* pshort = reinterpret_cast<unsigned short const*>(this);
-        pshort < reinterpret_cast<unsigned short const*>(this)+10;
-        ++pshort) 
-    {
-        nChecksum = (nChecksum << 1) + *pshort;
+    return ChecksumMatches(reinterpret_cast<unsigned char const*>(this));
+}
+
+std::uint64_t ValidChecksums(SLidarData const* apacket, std::size_t c) {
+    ASSERT(c<=64);
+    std::uint64_t nValid = 0;
+    auto const pb = reinterpret_cast<unsigned char const*>(apacket);
+    for(std::size_t i = 0; i<c; ++i) {
+        nValid |= std::uint64_t(ChecksumMatches(pb + i * sizeof(SLidarData))) << i;
     }
-    nChecksum = (nChecksum & 0x7FFF) + (nChecksum >> 15);
-    nChecksum &= 0x7FFF;
+    return nValid;
+}
 
-    return nChecksum == m_nChecksum;
+/////////////////////
+// CLidarStreamParser
+std::size_t CLidarStreamParser::Candidates(unsigned char const* pb, unsigned char const* pbEnd) {
+    std::size_t c = 0;
+    while(c<64 && sizeof(SLidarData)<=static_cast<std::size_t>(pbEnd - pb) && c_nFIRST_LIDAR_BYTE==pb[0] && ValidIndex(pb[1])) {
+        ++c;
+        pb += sizeof(SLidarData);
+    }
+    return c;
 }
+
+bool CLidarStreamParser::Sync() {
+    while(0<m_cb) {
+        bool const bValid = (m_cb<2 || ValidIndex(m_ab[1]))
+            && (m_cb<m_ab.size() || Packet().ValidChecksum());
+        if(bValid) return m_cb==m_ab.size();
+
+        auto const itb = std::find(m_ab.begin() + 1, m_ab.begin() + m_cb, c_nFIRST_LIDAR_BYTE);
+        m_cb = std::copy(itb, m_ab.begin() + m_cb, m_ab.begin()) - m_ab.begin();
+    }
+    return false;
+}
+
 /////////////////////
 // SScanLine
 void SScanLine::add(SLidarData const& lidar) {
@@ -29,6 +74,16 @@ void SScanLine::add(SOdometryData const& odom) {
     m_pose = UpdatePose(m_pose, odom);
 }
 
+void SScanLine::add(SLidarData const& lidar, clock::time_point tp) {
+    m_vecpacket.push_back({tp, m_vecscan.size()});
+    add(lidar);
+}
+
+void SScanLine::add(SOdometryData const& odom, clock::time_point tp) {
+    add(odom);
+    m_vecodom.push_back({tp, m_pose});
+}
+
 rbt::size<double> SScanLine::translation() const {
     return rbt::size<double>(m_pose.m_pt);
 }
@@ -40,4 +95,56 @@ double SScanLine::rotation() const {
 void SScanLine::clear() {
     m_pose = rbt::pose<double>::zero();
     m_vecscan.clear();
+    m_vecodom.clear();
+    m_vecpacket.clear();
+}
+
+void SScanLine::clear_scans() {
+    m_vecscan.clear();
+    m_vecpacket.clear();
+}
+
+void SScanLine::move_to(SScanLine& scanline) {
+    std::swap(scanline, *this);
+    clear();
+    if(!scanline.m_vecodom.empty()) {
+        m_vecodom.push_back({scanline.m_vecodom.back().m_tp, m_pose});
+    }
+}
+
+void SScanLine::deskew() {
+    if(m_vecodom.empty()) return;
+
+    auto itodom = m_vecodom.begin();
+    for(auto itpacket = m_vecpacket.begin(); itpacket!=m_vecpacket.end(); ++itpacket) {
+        // Packets are in time order, before the first and after the last
+        // sample the pose is clamped
+        while(std::next(itodom)!=m_vecodom.end() && std::next(itodom)->m_tp<=itpacket->m_tp) ++itodom;
+        auto posePacket = itodom->m_pose;
+        if(std::next(itodom)!=m_vecodom.end() && itodom->m_tp<itpacket->m_tp) {
+            auto const& odomNext = *std::next(itodom);
+            double const f = std::chrono::duration<double>(itpacket->m_tp - itodom->m_tp) / (odomNext.m_tp - itodom->m_tp);
+            posePacket = rbt::pose<double>(
+                itodom->m_pose.m_pt + (odomNext.m_pose.m_pt - itodom->m_pose.m_pt) * f,
+                itodom->m_pose.m_fYaw + std::remainder(odomNext.m_pose.m_fYaw - itodom->m_pose.m_fYaw, 2*M_PI) * f
+            );
+        }
+
+        // Relative to the lidar at m_pose, a scan at posePacket is rotated by
+        // fRadDelta and offset by szfDelta. See Obstacle.
+        double const fRadDelta = posePacket.m_fYaw - m_pose.m_fYaw;
+        auto const szfDelta = (posePacket.m_pt - m_pose.m_pt).rotated(-m_pose.m_fYaw)
+            + c_szfLidarOffset.rotated(fRadDelta) - c_szfLidarOffset;
+        if(0==fRadDelta && szfDelta==rbt::size<double>::zero()) continue;
+
+        auto const itscanEnd = std::next(itpacket)!=m_vecpacket.end() 
+            ? m_vecscan.begin() + std::next(itpacket)->m_iScan
+            : m_vecscan.end();
+        for(auto itscan = m_vecscan.begin() + itpacket->m_iScan; itscan!=itscanEnd; ++itscan) {
+            auto const szf = rbt::size<double>::fromAngleAndDistance(itscan->m_fRadAngle + fRadDelta, itscan->m_nDistance) + szfDelta;
+            itscan->m_fRadAngle = std::atan2(szf.y, szf.x);
+            itscan->m_nAngle = (static_cast<int>(std::lround(itscan->m_fRadAngle * 180 / M_PI)) + 360) % 360;
+            itscan->m_nDistance = static_cast<int>(std::lround(szf.Abs()));
+        }
+    }
 }
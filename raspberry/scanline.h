@@ -3,13 +3,23 @@
 #include "geometry.h"
 #include "rover.h"
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
 // The XV11 Neato Lidar is reporting 4 Lidar measurements at a time.
 // We accumulate them in a SScanLine and can then process an entire 360 deg
 // scanline at a time.
 
 // The robot moves while the scan line is being accumulated and this is an
-// error source. With the relatively fast XV11 Neato Lidar, we ignore this error.
+// error source. If the lidar packets and odometry are added with time stamps,
+// deskew() projects each packet from the pose at which it was measured to the
+// pose at the end of the scan line.
 struct SScanLine {
+    using clock = std::chrono::steady_clock;
+
     struct SScan {
         SScan(int nAngle, int nDistance)
             : m_nAngle(nAngle), m_fRadAngle(rbt::rad(nAngle)), m_nDistance(nDistance)
@@ -20,8 +30,20 @@ struct SScanLine {
         int m_nDistance;
     };
 
+    struct SOdometrySample {
+        clock::time_point m_tp;
+        rbt::pose<double> m_pose; // relative to the start of the scan line
+    };
+    struct SPacketTime {
+        clock::time_point m_tp;
+        std::size_t m_iScan; // first scan of the packet in m_vecscan
+    };
+
     rbt::pose<double> m_pose = rbt::pose<double>::zero();
     std::vector< SScan > m_vecscan;
+    // The first sample is the zero pose at the time of the last odometry of the previous scan line
+    std::vector< SOdometrySample > m_vecodom;
+    std::vector< SPacketTime > m_vecpacket;
 
     rbt::size<double> translation() const;
     double rotation() const;
@@ -30,7 +52,19 @@ struct SScanLine {
     // and data belongs into new SScanLine
     void add(SLidarData const& data);
     void add(SOdometryData const& odom); 
+    void add(SLidarData const& data, clock::time_point tp);
+    void add(SOdometryData const& odom, clock::time_point tp);
     void clear();
+    // Drops the lidar data but keeps the odometry
+    void clear_scans();
+    // Hands the scan line to scanline and starts the next one where this one
+    // ended. Swaps, so all vectors keep their capacity.
+    void move_to(SScanLine& scanline);
+
+    // Moves the scans of each time stamped packet as if they had been measured
+    // at m_pose, from the pose interpolated between the odometry samples
+    // enclosing the packet time
+    void deskew();
 };
 
 template<typename Func>
@@ -43,4 +77,67 @@ void ForEachScan(SLidarData const& lidar, Func fn) {
         }
         ++nAngle;
     }
-}
\ No newline at end of file
+}
+
+// Bit i of the result is set iff apacket[i] has a valid checksum, c <= 64.
+// Branch-free, the packets are checked independently of each other.
+std::uint64_t ValidChecksums(SLidarData const* apacket, std::size_t c);
+
+// Splits the lidar byte stream into packets, copying bytes into a fixed packet buffer.
+// A packet starts with c_nFIRST_LIDAR_BYTE followed by a valid index. The
+// XV11 serial data is not 100% reliable: after invalid data, the parser
+// resyncs to the next start byte, also if it is inside the rejected packet.
+// Runs of consecutive packets are validated in place and in one batch, only
+// the start of a packet that straddles two reads is kept until the next call.
+struct CLidarStreamParser {
+    // Calls fn(SLidarData const&) for every valid packet completed by [pb, pb + cb).
+    // fn is taken by reference, so a std::function is not copied per read.
+    template<typename Func>
+    void parse(unsigned char const* pb, std::size_t cb, Func&& fn);
+
+private:
+    static bool ValidIndex(unsigned char nIndex) {
+        return c_nFIRST_LIDAR_INDEX<=nIndex && nIndex<c_nFIRST_LIDAR_INDEX + c_cbLIDAR_FULL_ROTATION/sizeof(SLidarData);
+    }
+    // The number of consecutive packets in [pb, pbEnd) with a start byte and
+    // a valid index, at most 64
+    static std::size_t Candidates(unsigned char const* pb, unsigned char const* pbEnd);
+    // Drops bytes from the front of m_ab until it holds the plausible start
+    // of a packet, returns true iff it holds a complete valid packet
+    bool Sync();
+    SLidarData const& Packet() const { return *reinterpret_cast<SLidarData const*>(m_ab.data()); }
+
+    std::array<unsigned char, sizeof(SLidarData)> m_ab;
+    std::size_t m_cb = 0; // bytes of the current packet in m_ab
+};
+
+template<typename Func>
+void CLidarStreamParser::parse(unsigned char const* pb, std::size_t cb, Func&& fn) {
+    auto const pbEnd = pb + cb;
+    while(pb!=pbEnd) {
+        if(0==m_cb) {
+            pb = std::find(pb, pbEnd, c_nFIRST_LIDAR_BYTE);
+            if(pb==pbEnd) break;
+
+            auto const cCandidates = Candidates(pb, pbEnd);
+            auto const apacket = reinterpret_cast<SLidarData const*>(pb);
+            auto const nValid = ValidChecksums(apacket, cCandidates);
+            std::size_t cValid = 0;
+            while(cValid<cCandidates && (nValid >> cValid & 1)) {
+                fn(apacket[cValid]);
+                ++cValid;
+            }
+            pb += cValid * sizeof(SLidarData);
+            // Resync on the first rejected or incomplete packet below
+            if(0<cValid && cValid==cCandidates) continue;
+        }
+        auto const cbCopy = std::min<std::size_t>(m_ab.size() - m_cb, pbEnd - pb);
+        std::copy(pb, pb + cbCopy, m_ab.begin() + m_cb);
+        m_cb += cbCopy;
+        pb += cbCopy;
+        if(Sync()) {
+            fn(Packet());
+            m_cb = 0;
+        }
+    }
+}
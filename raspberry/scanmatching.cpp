@@ -1,8 +1,13 @@
 #include "scanmatching.h"
 #include "robot_configuration.h"
 #include "occupancy_grid.inl"
+#include "profiling.h"
 
-#include "icpPointToPoint.h"
+#include "icpFixed.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <limits>
 #include <opencv2/imgproc.hpp>
 
 // #define ENABLE_SCANMATCH_LOG
@@ -12,13 +17,13 @@
 #ifdef ENABLE_SCANMATCH_LOG
 #include <iostream>
 
-void DebugOutputScan(cv::Mat const& matObstacle, std::vector<rbt::point<double>> const& vecptfTemplate, char const* szFile) {
+void DebugOutputScan(cv::Mat const& matObstacle, rbt::point<int> const& ptnOrigin, std::vector<rbt::point<double>> const& vecptfTemplate, char const* szFile) {
     cv::Mat matDebug;
     cv::Mat amatInput[] = {matObstacle, matObstacle, matObstacle};
     cv::merge(amatInput, 3, matDebug);
 
     boost::for_each(vecptfTemplate, [&](rbt::point<double> const& ptf) {
-        rbt::point<int> ptn(ptf);
+        rbt::point<int> ptn = rbt::point<int>(ptf) - rbt::size<int>(ptnOrigin);
         auto& vec = matDebug.at<cv::Vec3b>(ptn.y, ptn.x);
         vec.val[0] = 0;
         vec.val[1] = 0;
@@ -29,78 +34,158 @@ void DebugOutputScan(cv::Mat const& matObstacle, std::vector<rbt::point<double>>
 }
 #endif
 
-COccupancyGridWithObstacleList::COccupancyGridWithObstacleList() noexcept : m_iEndSorted(0)  
-{}
+namespace {
+    // ICP only refines the coarse match
+    int constexpr c_nIcpIterations = 20;
+    double constexpr c_fInlierDistance = 250; // squared grid cells
 
-COccupancyGridWithObstacleList::COccupancyGridWithObstacleList(COccupancyGridWithObstacleList const& occgrid) noexcept
-    : COccupancyGridBaseT(occgrid)
-    , m_vecptfOccupied(occgrid.m_vecptfOccupied)
-    , m_iEndSorted(occgrid.m_iEndSorted)
-{}
+    // Coarse search window in grid cells
+    int constexpr c_nCoarseSearch = (1 << (CLikelihoodField::c_nLevels - 1)) * 3;
 
-COccupancyGridWithObstacleList::COccupancyGridWithObstacleList(COccupancyGridWithObstacleList&& occgrid) noexcept
-    : COccupancyGridBaseT(std::move(occgrid))
-    , m_vecptfOccupied(std::move(occgrid.m_vecptfOccupied))
-    , m_iEndSorted(occgrid.m_iEndSorted)
-{}
+    // Offset of the scan relative to the initial pose, rotated around the robot position
+    struct SOffset {
+        rbt::size<double> m_szf; // grid cells
+        double m_fYaw; // radians
+    };
 
-COccupancyGridWithObstacleList& COccupancyGridWithObstacleList::operator=(COccupancyGridWithObstacleList const& occgrid) noexcept {
-    COccupancyGridBaseT::operator=(occgrid);
-    m_vecptfOccupied = occgrid.m_vecptfOccupied;
-    m_iEndSorted = occgrid.m_iEndSorted;
-    return *this;
-}
+    // Sum of the squared distances of the shifted template points to the
+    // closest obstacle on level nLevel of the likelihood field. Lower is better.
+    // Uses every nStride-th template point only.
+    double Score(
+        CLikelihoodField const& likelihoodfield, int nLevel,
+        std::vector<rbt::point<double>> const& vecptfTemplate, int nStride,
+        rbt::point<double> const& ptfCenter, SOffset const& offset
+    ) {
+        auto const fCos = std::cos(offset.m_fYaw);
+        auto const fSin = std::sin(offset.m_fYaw);
+        double fScore = 0;
+        for(std::size_t i = 0; i < vecptfTemplate.size(); i += nStride) {
+            auto const sz = vecptfTemplate[i] - ptfCenter;
+            auto const ptf = ptfCenter + offset.m_szf + rbt::size<double>(fCos * sz.x - fSin * sz.y, fSin * sz.x + fCos * sz.y);
+            auto const fDistance = likelihoodfield.distance(rbt::point<int>(ptf), nLevel);
+            fScore += fDistance * fDistance;
+        }
+        return fScore;
+    }
+
+    // Correlative scan matching on the likelihood field pyramid, see
+    // Olson, "Real-Time Correlative Scan Matching", ICRA 2009.
+    // Searches a large window on the coarsest level and refines the best offset on
+    // each finer level with half the step size. The result seeds ICP, which then
+    // converges in a few iterations even if the odometry error is large.
+    SOffset CoarseMatch(
+        CLikelihoodField const& likelihoodfield,
+        std::vector<rbt::point<double>> const& vecptfTemplate,
+        rbt::point<double> const& ptfCenter
+    ) {
+        int constexpr c_nLevelTop = CLikelihoodField::c_nLevels - 1;
+        int constexpr c_nSearchSteps = c_nCoarseSearch >> c_nLevelTop; // search window on top level is +/- c_nSearchSteps steps
+        double constexpr c_fRadStepTop = 0.05; // moves points at 4m distance by one top level cell
 
-COccupancyGridWithObstacleList& COccupancyGridWithObstacleList::operator=(COccupancyGridWithObstacleList&& occgrid) noexcept {
-    COccupancyGridBaseT::operator=(std::move(occgrid));
-    m_vecptfOccupied = std::move(occgrid.m_vecptfOccupied);
-    m_iEndSorted = occgrid.m_iEndSorted;
-    return *this;
+        SOffset offsetBest = {rbt::size<double>::zero(), 0.0};
+        for(int nLevel = c_nLevelTop; 0 <= nLevel; --nLevel) {
+            int const nSteps = c_nLevelTop==nLevel ? c_nSearchSteps : 1;
+            double const fStep = 1 << nLevel;
+            double const fRadStep = c_fRadStepTop / (1 << (c_nLevelTop - nLevel));
+            int const nStride = 1 << nLevel; // coarse levels need fewer points
+
+            SOffset const offsetCenter = offsetBest;
+            double fScoreBest = std::numeric_limits<double>::max();
+            int nStepsBest = 0; // of offsetBest from offsetCenter
+            for(int nYaw = -2 * nSteps; nYaw <= 2 * nSteps; ++nYaw) {
+                for(int nY = -nSteps; nY <= nSteps; ++nY) {
+                    for(int nX = -nSteps; nX <= nSteps; ++nX) {
+                        SOffset const offset = {
+                            offsetCenter.m_szf + rbt::size<double>(nX * fStep,  nY * fStep),
+                            offsetCenter.m_fYaw + nYaw * fRadStep
+                        };
+                        auto const fScore = Score(likelihoodfield, nLevel, vecptfTemplate, nStride, ptfCenter, offset);
+                        // Prefer the smaller offset from the center if scores are equal
+                        auto const nOffsetSteps = std::abs(nX) + std::abs(nY) + std::abs(nYaw);
+                        if(fScore < fScoreBest || (fScore==fScoreBest && nOffsetSteps < nStepsBest)) {
+                            fScoreBest = fScore;
+                            offsetBest = offset;
+                            nStepsBest = nOffsetSteps;
+                        }
+                    }
+                }
+            }
+        }
+        return offsetBest;
+    }
 }
 
 rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& poseWorld, SScanLine const& scanline) {
-    if(m_iEndSorted<m_vecptfOccupied.size()) {
-        auto itptfEndSorted = m_vecptfOccupied.begin()+m_iEndSorted;
-        std::sort(itptfEndSorted, m_vecptfOccupied.end());
-        m_vecptfOccupied.erase(std::unique(itptfEndSorted, m_vecptfOccupied.end()), m_vecptfOccupied.end());
-        std::inplace_merge(m_vecptfOccupied.begin(), itptfEndSorted, m_vecptfOccupied.end());
-        m_iEndSorted = m_vecptfOccupied.size();
-    }
-    
-    if(m_vecptfOccupied.size()<10) return poseWorld;
+    CScopedTimer timer(estageFit);
+    if(m_index.size()<10) return poseWorld;
     
     std::vector<rbt::point<double>> vecptfTemplate;
+    auto rectnTemplate = rbt::rect<int>::empty();
     boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
         vecptfTemplate.emplace_back(ToGridCoordinate(Obstacle(poseWorld, scan.m_fRadAngle, scan.m_nDistance)));
+        rectnTemplate |= rbt::point<int>(vecptfTemplate.back());
     });
+    if(vecptfTemplate.empty()) return poseWorld;
+
+    // Only match against obstacles the scan can have seen, i.e., inside
+    // the bounding box of the scan extended by the coarse search window
+    // and the inlier distance
+    int const nMargin = c_nCoarseSearch + static_cast<int>(std::ceil(std::sqrt(c_fInlierDistance)));
+    rectnTemplate.left -= nMargin;
+    rectnTemplate.bottom -= nMargin;
+    rectnTemplate.right += nMargin;
+    rectnTemplate.top += nMargin;
+    // The robot footprint clears cells without notifying the index,
+    // so the index checks every cell against the grid when rebuilding
+    if(m_index.select(rectnTemplate, [&](rbt::point<int> const& pt) { return occupied(pt); })<10) {
+        return poseWorld;
+    }
+    UpdateLikelihoodField();
         
 #ifdef ENABLE_SCANMATCH_LOG
     static int c_nCount = 0;
     {
         std::stringstream ss;
         ss << "scanmatch" << c_nCount << "_a.png";
-        DebugOutputScan(ObstacleMap(), vecptfTemplate, ss.str().c_str());
+        DebugOutputScan(ObstacleMap(), Origin(), vecptfTemplate, ss.str().c_str());
     }
     LOG(c_nCount);
 #endif
         
     rbt::pose<double> poseGrid(ToGridCoordinate(poseWorld));
         
-    // Transformation matrix from pose
-    Matrix R = Matrix::eye(2);
-    Matrix t(2,1);
+    // Initial transformation matrix from coarse match, 
+    // i.e., rotation around poseGrid.m_pt followed by translation
+    SOffset offset = {rbt::size<double>::zero(), 0.0};
+    {
+        CScopedTimer timerCoarse(estageCoarseMatch);
+        offset = CoarseMatch(LikelihoodField(), vecptfTemplate, poseGrid.m_pt);
+    }
+    auto R = libicp::Matrix<2, 2>::eye();
+    R.val[0][0] = std::cos(offset.m_fYaw); R.val[0][1] = -std::sin(offset.m_fYaw);
+    R.val[1][0] = std::sin(offset.m_fYaw); R.val[1][1] = std::cos(offset.m_fYaw);
+    libicp::Matrix<2, 1> t;
+    t.val[0][0] = poseGrid.m_pt.x + offset.m_szf.x - (R.val[0][0] * poseGrid.m_pt.x + R.val[0][1] * poseGrid.m_pt.y);
+    t.val[1][0] = poseGrid.m_pt.y + offset.m_szf.y - (R.val[1][0] * poseGrid.m_pt.x + R.val[1][1] * poseGrid.m_pt.y);
     static_assert(sizeof(rbt::point<double>)==2*sizeof(double), "");
         
     // Use libicp, an iterative closest point implementation (http://www.cvlibs.net/software/libicp/)
-    IcpPointToPoint icp(&m_vecptfOccupied[0].x, m_vecptfOccupied.size(), 2);
-    icp.fit(&vecptfTemplate[0].x,vecptfTemplate.size(), R, t, 250);
+    {
+        CScopedTimer timerIcp(estageIcp);
+        libicp::IcpPointToPoint<2, CObstacleIndex> icp(m_index);
+        icp.setMaxIterations(c_nIcpIterations);
+        icp.fit(&vecptfTemplate[0].x,vecptfTemplate.size(), R, t, c_fInlierDistance);
+    }
     
 #ifdef ENABLE_SCANMATCH_LOG
-    LOG("ICP: R = " << R << " t = " << t);
+    LOG("ICP: yaw = " << -asin(R.val[0][1]) << " t = " << t.val[0][0] << ", " << t.val[1][0]);
 #endif
 
     // Pose from transformation matrix
-    Matrix vecLastPose = (R * Matrix(2, 1, &poseGrid.m_pt.x)) + t;
+    libicp::Matrix<2, 1> vecPose;
+    vecPose.val[0][0] = poseGrid.m_pt.x;
+    vecPose.val[1][0] = poseGrid.m_pt.y;
+    auto const vecLastPose = R * vecPose + t;
     rbt::pose<double> const poseWorldCorrected(
         ToWorldCoordinate(
             rbt::pose<double>(
@@ -120,7 +205,7 @@ rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& p
 
         std::stringstream ss;
         ss << "scanmatch" << c_nCount << "_b.png";
-        DebugOutputScan(ObstacleMap(), vecptfTemplateCorrected, ss.str().c_str());
+        DebugOutputScan(ObstacleMap(), Origin(), vecptfTemplateCorrected, ss.str().c_str());
     }
     ++c_nCount;
 #endif
@@ -128,62 +213,83 @@ rbt::pose<double> COccupancyGridWithObstacleList::fit(rbt::pose<double> const& p
     return poseWorldCorrected;
 }
 
-void COccupancyGridWithObstacleList::updateGrid(rbt::point<int> const& pt, double fOdds) {
-    auto itptfEndSorted =m_vecptfOccupied.begin()+m_iEndSorted;
-    rbt::point<double> const ptf(pt);
-    auto itpt = std::lower_bound(m_vecptfOccupied.begin(), itptfEndSorted, ptf);
-    if(c_fFreeThreshold<fOdds) { // occupied point
-        if(itpt==m_vecptfOccupied.end() || *itpt!=ptf) {
-            m_vecptfOccupied.emplace_back(pt);
-        }
-    } else { // free point
-        if(itpt!=m_vecptfOccupied.end() && *itpt==ptf) {
-            std::swap(*itpt, *boost::prior(itptfEndSorted));
-            m_iEndSorted=itpt-m_vecptfOccupied.begin()+1;
-        }
+namespace {
+    // In the map image, each pixel is -1 * fOdds + 128, so p = 0.5 is color 128, 
+    // less means probably occupied, higher means probably free. 
+    // Pixels that are occupied with certainty are set to 0, free ones to 255.
+    std::uint8_t ObstacleColor(double fOdds) {
+        auto const nColor = cv::saturate_cast<std::uint8_t>(128 - fOdds);
+        if(nColor<=128-c_fFreeThreshold-1) return 0;
+        if(128+c_fFreeThreshold<nColor) return 255;
+        return nColor;
     }
 }
 
-cv::Mat COccupancyGridWithObstacleList::ObstacleMap() const {
-    cv::Mat matnMapLogOdds;
-    m_matfMapLogOdds.convertTo(matnMapLogOdds, CV_8U, /*alpha*/ -1, 128);
-    // p = 1/(1 + exp(fOdds))
-    // So fOdds = 0 means p = 0.5, less means probably free space, higher means probably occupied
+COccupancyGridWithObstacleList::COccupancyGridWithObstacleList()
+    : m_gridnObstacle(rbt::size<int>(c_nMapExtent, c_nMapExtent), ObstacleColor(0))
+{}
 
-    // In matnMapLogOdds, each pixel is -1 * fOdds + 128, so p = 0.5 is color 128, 
-    // less means probably occupied, higher means probably free. 
-    
-    cv::Mat matn; 
-    // Set everything to 0 that is < 127, leave rest as is
-    cv::threshold(matnMapLogOdds, matn, 128-c_fFreeThreshold-1, /*ignored*/ 255, cv::THRESH_TOZERO);
+void COccupancyGridWithObstacleList::assign(CTiledGrid<float> const& gridfLogOdds) {
+    COccupancyGridBaseT<COccupancyGridWithObstacleList>::assign(gridfLogOdds);
+    auto const& ptn = Origin();
+    auto const& szn = m_gridtLogOdds.Extent();
+    m_index.select({ptn.x, ptn.y, ptn.x + szn.x - 1, ptn.y + szn.y - 1}, [&](rbt::point<int> const& pt) { return occupied(pt); });
+    UpdateLikelihoodField();
+}
 
-    cv::Mat matnFree; 
-    // Set everything to 255 that is > 129, everything else to 0
-    cv::threshold(matnMapLogOdds, matnFree, 128+c_fFreeThreshold, 255.0, cv::THRESH_BINARY);
-    
-    matnFree.copyTo(matn, /*mask*/ matnFree);
-    return matn;
+void COccupancyGridWithObstacleList::updateGrid(rbt::point<int> const& pt, double fOddsPrev, double fOdds) {
+    bool const bOccupiedPrev = c_fFreeThreshold<fOddsPrev;
+    bool const bOccupied = c_fFreeThreshold<fOdds;
+    if(bOccupied && !bOccupiedPrev) {
+        m_index.insert(pt);
+    } else if(!bOccupied && bOccupiedPrev) {
+        m_index.erase(pt);
+    }
+
+    auto const nColor = ObstacleColor(fOdds);
+    if(m_gridnObstacle.at(pt)!=nColor) {
+        m_gridnObstacle.mutable_at(pt) = nColor;
+    }
+}
+
+void COccupancyGridWithObstacleList::updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double /*fOdds*/) {
+    boost::for_each(ConvexPolygonCells(rngpt), [&](rbt::point<int> const& pt) {
+        auto const nColor = ObstacleColor(m_gridtLogOdds.at(pt));
+        if(m_gridnObstacle.at(pt)!=nColor) {
+            m_gridnObstacle.mutable_at(pt) = nColor;
+        }
+    });
+}
+
+cv::Mat COccupancyGridWithObstacleList::ObstacleMap() const {
+    CScopedTimer timer(estageObstacleMap);
+    return m_gridnObstacle.ToMat();
 }
 
 cv::Mat COccupancyGridWithObstacleList::ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const {
-    return ::ObstacleMapWithPoses(ObstacleMap(), vecpose);
+    return ::ObstacleMapWithPoses(ObstacleMap(), Origin(), vecpose);
 }
 
-CScanMatchingBase::CScanMatchingBase() {
+CScanMatchingBase::CScanMatchingBase(SScanFilterParameters const& paramsFilter, SUpdateGateParameters const& paramsGate)
+    : m_filter(paramsFilter), m_gate(paramsGate)
+{
     m_vecpose.emplace_back(rbt::pose<double>::zero());
 }
 
-void CScanMatchingBase::receivedSensorData(SScanLine const& scanline) {
+bool CScanMatchingBase::receivedSensorData(SScanLine const& scanlineSensor) {
+    CScopedTimer timer(estageScan);
+    auto const pscanlineGated = m_gate.pass(scanlineSensor);
+    if(!pscanlineGated) return false;
+    auto const& scanline = *pscanlineGated;
     // TODO: Use rotation matrix everywhere
     rbt::pose<double> poseNewCandidate(
         m_vecpose.back().m_pt + scanline.translation().rotated(m_vecpose.back().m_fYaw),
         m_vecpose.back().m_fYaw + scanline.rotation() 
     );
     
-    m_vecpose.emplace_back(m_occgrid.fit(poseNewCandidate, scanline));
-    boost::for_each(scanline.m_vecscan, [&](auto const& scan) {
-        m_occgrid.update(m_vecpose.back(), scan.m_fRadAngle, scan.m_nDistance);
-    });
+    m_vecpose.emplace_back(m_occgrid.fit(poseNewCandidate, m_filter.filter(scanline)));
+    m_occgrid.update(m_vecpose.back(), scanline);
+    return true;
 }
 
 cv::Mat CScanMatchingBase::getMap() const {
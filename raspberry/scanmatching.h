@@ -3,9 +3,14 @@
 #include "nonmoveable.h"
 #include "geometry.h"
 #include "occupancy_grid.h"
+#include "obstacle_index.h"
 #include "scanline.h"
+#include "scan_filter.h"
+#include "update_gate.h"
+#include "map_file.h"
 
 #include <vector>
+#include <memory>
 #include <opencv2/core.hpp>
 #include <boost/range/iterator_range.hpp>
 
@@ -15,34 +20,51 @@
 // the measured obstacles in each SScanLine against the 
 // existing occupancy grid.
 struct COccupancyGridWithObstacleList : COccupancyGridBaseT<COccupancyGridWithObstacleList> {
-    COccupancyGridWithObstacleList() noexcept;
-    COccupancyGridWithObstacleList(COccupancyGridWithObstacleList const& occgrid) noexcept;
-    COccupancyGridWithObstacleList(COccupancyGridWithObstacleList&& occgrid) noexcept;
-    COccupancyGridWithObstacleList& operator=(COccupancyGridWithObstacleList const& occgrid) noexcept;
-    COccupancyGridWithObstacleList& operator=(COccupancyGridWithObstacleList&& occgrid) noexcept;
+    COccupancyGridWithObstacleList();
 
     rbt::pose<double> fit(rbt::pose<double> const& poseWorld, SScanLine const& scanline);
 
+    // Like COccupancyGridBaseT::assign, but also builds the kd trees and the
+    // likelihood field of the whole map, so that copies of the grid share them
+    void assign(CTiledGrid<float> const& gridfLogOdds);
+
+    // 0 is occupied, 255 is free, unknown cells are grey
     cv::Mat ObstacleMap() const;
     cv::Mat ObstacleMapWithPoses(std::vector<rbt::pose<double>> const& vecpose) const;
+    // The grid ObstacleMap() is copied from, for incremental rendering with CTiledGridImage
+    CTiledGrid<std::uint8_t> const& ObstacleGrid() const { return m_gridnObstacle; }
 
     friend struct COccupancyGridBaseT<COccupancyGridWithObstacleList>;
-    void updateGrid(rbt::point<int> const& pt, double fOdds);
-    void updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds) {}
+    void updateGrid(rbt::point<int> const& pt, double fOddsPrev, double fOdds);
+    void updateGridPoly(std::vector<rbt::point<int>> const& rngpt, double fOdds);
 
 private:
-    std::vector<rbt::point<double>> m_vecptfOccupied;
-    std::size_t m_iEndSorted;
+    // The map image, updated together with the log odds
+    CTiledGrid<std::uint8_t> m_gridnObstacle;
+
+    // Index of occupied cells used as ICP model points.
+    // The kd tree snapshot in it is shared between copies of the grid like
+    // the tiles in m_gridtLogOdds.
+    CObstacleIndex m_index;
 };
  
 struct CScanMatchingBase : rbt::nonmoveable {
-    CScanMatchingBase();
-    void receivedSensorData(SScanLine const& scanline);
+    // The pose is fit to the scans selected by a CScanFilter, the map is updated with all scans
+    explicit CScanMatchingBase(
+        SScanFilterParameters const& paramsFilter = SScanFilterParameters(),
+        SUpdateGateParameters const& paramsGate = SUpdateGateParameters());
+    // Returns false if the scan line has been gated out, see CUpdateGate
+    bool receivedSensorData(SScanLine const& scanlineSensor);
     cv::Mat getMap() const;
+    rbt::point<int> const& getMapOrigin() const { return m_occgrid.Origin(); } // grid coordinate of top-left pixel of getMap()
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const { return m_occgrid.ObstacleGrid(); }
+    SSavedMap save() const { return {m_occgrid.LogOdds(), m_vecpose.back()}; }
 
     std::vector<rbt::pose<double>> const& Poses() const { return m_vecpose; } 
 
 private:
+    CScanFilter m_filter;
+    CUpdateGate m_gate;
     COccupancyGridWithObstacleList m_occgrid;
     std::vector<rbt::pose<double>> m_vecpose; // history of best poses
 }; 
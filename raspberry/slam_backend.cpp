@@ -0,0 +1,82 @@
+#include "slam_backend.h"
+#include "fast_particle_slam.h"
+#include "particle_slam.h"
+#include "scanmatching.h"
+#include "pose_graph_slam.h"
+#include "deadreckoning.h"
+#include "error_handling.h"
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <type_traits>
+
+namespace {
+    // In the order of c_aszSlamBackend
+    enum ESlamBackend {
+        eslambackendFastSlam,
+        eslambackendParticle,
+        eslambackendScanMatch,
+        eslambackendPoseGraph,
+        eslambackendDeadReckoning,
+        eslambackendLocalization,
+        eslambackendCount
+    };
+}
+
+char const* const c_aszSlamBackend[] = {"fastslam", "particle", "scanmatch", "posegraph", "deadreckoning", "mcl"};
+int const c_cSlamBackend = static_cast<int>(std::extent<decltype(c_aszSlamBackend)>::value);
+static_assert(std::extent<decltype(c_aszSlamBackend)>::value==eslambackendCount, "One name per ESlamBackend");
+
+std::unique_ptr<CSlamBackend> MakeSlamBackend(SSlamBackendOptions const& options, SMapFileOptions const& mapfileoptions) {
+    auto const& strBackend = options.m_strBackend;
+    auto const itsz = std::find_if(std::begin(c_aszSlamBackend), std::end(c_aszSlamBackend), [&](char const* sz) { return strBackend==sz; });
+    if(itsz==std::end(c_aszSlamBackend)) {
+        std::cerr << "Unknown SLAM backend " << strBackend << ", choose one of";
+        for(char const* sz : c_aszSlamBackend) std::cerr << ' ' << sz;
+        std::cerr << std::endl;
+        return nullptr;
+    }
+    auto const ebackend = static_cast<ESlamBackend>(std::distance(std::begin(c_aszSlamBackend), itsz));
+
+    boost::optional<SSavedMap> osavedmap;
+    if(mapfileoptions.m_ostrLoad) {
+        osavedmap = LoadMap(mapfileoptions.m_ostrLoad.get());
+        if(!osavedmap) {
+            std::cerr << "Couldn't read " << mapfileoptions.m_ostrLoad.get() << std::endl;
+            return nullptr;
+        }
+    }
+    if(osavedmap && eslambackendFastSlam!=ebackend && eslambackendLocalization!=ebackend) {
+        std::cerr << "The SLAM backend " << strBackend << " can't start from a saved map" << std::endl;
+        return nullptr;
+    }
+
+    switch(ebackend) {
+        case eslambackendFastSlam: {
+            SFastSlamParameters params;
+            params.m_count = options.m_count;
+            auto pslam = std::make_unique<CSlamBackendT<CFastParticleSlamBase>>(params);
+            if(osavedmap) pslam->Slam().load(osavedmap.get(), mapfileoptions.m_bLocalizeOnly);
+            return pslam;
+        }
+        case eslambackendParticle:
+            return std::make_unique<CSlamBackendT<CParticleSlamBase>>(100, SScanFilterParameters(), SUpdateGateParameters(), options.m_count);
+        case eslambackendScanMatch:
+            return std::make_unique<CSlamBackendT<CScanMatchingBase>>();
+        case eslambackendPoseGraph:
+            return std::make_unique<CSlamBackendT<CPoseGraphSlam>>();
+        case eslambackendDeadReckoning:
+            return std::make_unique<CSlamBackendT<CDeadReckoningMapping>>();
+        case eslambackendLocalization:
+            if(!osavedmap) {
+                std::cerr << "The SLAM backend mcl only localizes in a map, see --load-map" << std::endl;
+                return nullptr;
+            }
+            return std::make_unique<CSlamBackendT<CParticleLocalization>>(osavedmap.get(), 1000, SScanFilterParameters(), SUpdateGateParameters(), options.m_count);
+        case eslambackendCount:
+            break;
+    }
+    ASSERT(false);
+    return nullptr;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include "geometry.h"
+#include "nonmoveable.h"
+#include "map_file.h"
+#include "resampling.h"
+#include "scanline.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <opencv2/core.hpp>
+
+// The SLAM algorithms behind one interface, so the robot and the log replay
+// can select the algorithm at runtime. The algorithms themselves don't derive
+// from CSlamBackend, CSlamBackendT adapts them.
+// As with the algorithms, the accessors must be called from the thread calling
+// receivedSensorData.
+struct CSlamBackend : rbt::nonmoveable {
+    virtual ~CSlamBackend() = default;
+
+    // Returns false if the scan line has been gated out
+    virtual bool receivedSensorData(SScanLine const& scanline) = 0;
+    // The obstacle map, copies share its tiles. 0 is occupied, 255 is free.
+    virtual CTiledGrid<std::uint8_t> const& getObstacleGrid() const = 0;
+    // The trajectory, the last pose is the current one
+    virtual std::vector<rbt::pose<double>> const& Poses() const = 0;
+    // The log odds map and the current pose
+    virtual SSavedMap save() const = 0;
+
+    // The map image of the algorithm, most algorithms draw the trajectory into it
+    virtual cv::Mat getMap() const = 0;
+    virtual rbt::point<int> const& getMapOrigin() const = 0; // grid coordinate of top-left pixel of getMap()
+
+    // The obstacle map image without the trajectory, its top-left pixel is
+    // at getObstacleGrid().Origin()
+    cv::Mat getObstacleMap() const { return getObstacleGrid().ToMat(); }
+};
+
+template<typename TSlam>
+struct CSlamBackendT final : CSlamBackend {
+    template<typename... Args>
+    explicit CSlamBackendT(Args&&... args) : m_slam(std::forward<Args>(args)...) {}
+
+    bool receivedSensorData(SScanLine const& scanline) override { return m_slam.receivedSensorData(scanline); }
+    CTiledGrid<std::uint8_t> const& getObstacleGrid() const override { return m_slam.getObstacleGrid(); }
+    std::vector<rbt::pose<double>> const& Poses() const override { return m_slam.Poses(); }
+    SSavedMap save() const override { return m_slam.save(); }
+    cv::Mat getMap() const override { return m_slam.getMap(); }
+    rbt::point<int> const& getMapOrigin() const override { return m_slam.getMapOrigin(); }
+
+    TSlam& Slam() { return m_slam; }
+
+private:
+    TSlam m_slam;
+};
+
+// The names of the backends MakeSlamBackend can create, the first one is the default
+extern char const* const c_aszSlamBackend[];
+extern int const c_cSlamBackend; // entries of c_aszSlamBackend
+
+struct SSlamBackendOptions {
+    std::string m_strBackend = c_aszSlamBackend[0]; // one of c_aszSlamBackend
+    SParticleCountParameters m_count; // of "fastslam", "particle" and "mcl"
+};
+
+// Creates the backend options.m_strBackend. If mapfileoptions.m_ostrLoad is set,
+// the backend starts from that map. Only "fastslam" and "mcl" can start from a
+// saved map, "mcl" requires one.
+// Prints the error and returns nullptr if m_strBackend is not one of
+// c_aszSlamBackend, the map can't be read or the backend can't use it.
+std::unique_ptr<CSlamBackend> MakeSlamBackend(SSlamBackendOptions const& options, SMapFileOptions const& mapfileoptions);
@@ -0,0 +1,336 @@
+// Headless benchmark of the SLAM algorithms
+//
+// Replays sensor logs through CScanMatchingBase, CPoseGraphSlam, CParticleSlamBase
+// and CFastParticleSlamBase and reports the latency of receivedSensorData per scan,
+// the peak memory use and, if reference results are given, the deviation of
+// the final pose and map from the reference.
+//
+// Each run is executed in a separate process, so the peak RSS of one run
+// is not affected by the runs before it.
+
+#include "error_handling.h"
+#include "robot_configuration.h"
+#include "scanmatching.h"
+#include "pose_graph_slam.h"
+#include "particle_slam.h"
+#include "fast_particle_slam.h"
+#include "worker_pool.h"
+#include "random_generator.h"
+#include "log_file.h"
+#include "profiling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/program_options.hpp>
+#include <boost/optional.hpp>
+
+#include <opencv2/imgcodecs/imgcodecs.hpp>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr char c_szHELP[] = "help";
+constexpr char c_szINPUT[] = "input-file";
+constexpr char c_szALGORITHM[] = "algorithm";
+constexpr char c_szPARTICLES[] = "particles";
+constexpr char c_szMAXPARTICLES[] = "max-particles";
+constexpr char c_szTHREADS[] = "threads";
+constexpr char c_szSEED[] = "seed";
+constexpr char c_szPROFILE[] = "profile";
+constexpr char c_szREFERENCE[] = "reference";
+constexpr char c_szWRITEREFERENCE[] = "write-reference";
+
+constexpr char c_szSCANMATCH[] = "scanmatch";
+constexpr char c_szPOSEGRAPH[] = "posegraph";
+constexpr char c_szPARTICLE[] = "particle";
+constexpr char c_szFASTSLAM[] = "fastslam";
+
+namespace {
+    struct SResult {
+        std::vector<double> m_vecfSeconds; // per scan
+        rbt::pose<double> m_poseFinal = rbt::pose<double>::zero();
+        cv::Mat m_matnMap;
+        rbt::point<int> m_ptnOrigin = rbt::point<int>::zero();
+    };
+
+    template<typename TSlam>
+    boost::optional<SResult> Replay(std::string const& strLogFile, TSlam& slam) {
+        SResult result;
+        SScanLine scanline;
+        bool const bRead = ReadLogFile(strLogFile,
+            [&](double /*fSeconds*/, SOdometryData const& odom) {
+                scanline.add(odom);
+            },
+            [&](double /*fSeconds*/, SLogScan const* pscan, std::size_t cScans) {
+                AssignReplayScans(pscan, cScans, scanline.m_vecscan);
+                if(scanline.translation()!=rbt::size<double>::zero() || scanline.rotation()!=0.0) {
+                    auto const tpStart = std::chrono::steady_clock::now();
+                    slam.receivedSensorData(scanline);
+                    std::chrono::duration<double> const durDiff = std::chrono::steady_clock::now() - tpStart;
+                    result.m_vecfSeconds.emplace_back(durDiff.count());
+                }
+                scanline.clear();
+            });
+        if(!bRead || slam.Poses().empty()) return boost::none;
+
+        result.m_poseFinal = slam.Poses().back();
+        result.m_matnMap = slam.getMap();
+        result.m_ptnOrigin = slam.getMapOrigin();
+        return result;
+    }
+
+    double Percentile(std::vector<double> vecf, double fPercentile) {
+        if(vecf.empty()) return 0;
+        auto const it = vecf.begin() + static_cast<std::size_t>(fPercentile * (vecf.size() - 1));
+        std::nth_element(vecf.begin(), it, vecf.end());
+        return *it;
+    }
+
+    // Fraction of cells known in either map whose occupancy differs.
+    // Both maps are compared in grid coordinates, cells outside of a map are unknown.
+    double MapDifference(cv::Mat const& matn, rbt::point<int> const& ptnOrigin, cv::Mat const& matnRef, rbt::point<int> const& ptnOriginRef) {
+        auto const Value = [](cv::Mat const& m, rbt::point<int> const& ptnOrigin, rbt::point<int> const& pt) {
+            auto const ptn = pt - rbt::size<int>(ptnOrigin);
+            if(ptn.x<0 || ptn.y<0 || m.cols<=ptn.x || m.rows<=ptn.y) return 128;
+            int const n = m.at<std::uint8_t>(ptn.y, ptn.x);
+            return n<128 ? 0 : (128<n ? 255 : 128); // occupied, free, unknown
+        };
+
+        rbt::point<int> const ptnMin(std::min(ptnOrigin.x, ptnOriginRef.x), std::min(ptnOrigin.y, ptnOriginRef.y));
+        rbt::point<int> const ptnMax(
+            std::max(ptnOrigin.x + matn.cols, ptnOriginRef.x + matnRef.cols),
+            std::max(ptnOrigin.y + matn.rows, ptnOriginRef.y + matnRef.rows)
+        );
+
+        int cKnown = 0;
+        int cDifferent = 0;
+        for(int y = ptnMin.y; y < ptnMax.y; ++y) {
+            for(int x = ptnMin.x; x < ptnMax.x; ++x) {
+                rbt::point<int> const pt(x, y);
+                auto const n = Value(matn, ptnOrigin, pt);
+                auto const nRef = Value(matnRef, ptnOriginRef, pt);
+                if(128!=n || 128!=nRef) {
+                    ++cKnown;
+                    if(n!=nRef) ++cDifferent;
+                }
+            }
+        }
+        return 0<cKnown ? static_cast<double>(cDifferent) / cKnown : 0;
+    }
+
+    std::string ReferenceName(std::string const& strDir, std::string const& strLogFile, std::string const& strAlgorithm, int cParticles) {
+        auto const iSlash = strLogFile.find_last_of('/');
+        auto strName = strLogFile.substr(iSlash==std::string::npos ? 0 : iSlash + 1);
+        strName = strName.substr(0, strName.find_last_of('.'));
+        return strDir + "/" + strName + "_" + strAlgorithm + "_" + std::to_string(cParticles);
+    }
+
+    void WriteReference(std::string const& strBase, SResult const& result) {
+        cv::imwrite(strBase + ".png", result.m_matnMap);
+        std::ofstream ofs(strBase + ".pose");
+        ofs << std::setprecision(17)
+            << result.m_poseFinal.m_pt.x << ' ' << result.m_poseFinal.m_pt.y << ' ' << result.m_poseFinal.m_fYaw << ' '
+            << result.m_ptnOrigin.x << ' ' << result.m_ptnOrigin.y << '\n';
+    }
+
+    boost::optional<SResult> ReadReference(std::string const& strBase) {
+        SResult result;
+        std::ifstream ifs(strBase + ".pose");
+        if(!(ifs >> result.m_poseFinal.m_pt.x >> result.m_poseFinal.m_pt.y >> result.m_poseFinal.m_fYaw
+            >> result.m_ptnOrigin.x >> result.m_ptnOrigin.y)) {
+            return boost::none;
+        }
+        result.m_matnMap = cv::imread(strBase + ".png", cv::IMREAD_GRAYSCALE);
+        if(result.m_matnMap.empty()) return boost::none;
+        return result;
+    }
+
+    boost::optional<SResult> Run(std::string const& strLogFile, std::string const& strAlgorithm, int cParticles, SParticleCountParameters const& paramsCount) {
+        if(strAlgorithm==c_szSCANMATCH) {
+            CScanMatchingBase slam;
+            return Replay(strLogFile, slam);
+        } else if(strAlgorithm==c_szPOSEGRAPH) {
+            CPoseGraphSlam slam;
+            return Replay(strLogFile, slam);
+        } else if(strAlgorithm==c_szPARTICLE) {
+            CParticleSlamBase slam(cParticles, SScanFilterParameters(), SUpdateGateParameters(), paramsCount);
+            return Replay(strLogFile, slam);
+        } else {
+            SFastSlamParameters params;
+            params.m_cParticles = cParticles;
+            params.m_count = paramsCount;
+            CFastParticleSlamBase slam(params);
+            return Replay(strLogFile, slam);
+        }
+    }
+
+    // Runs the benchmark and prints one line of results. Called in a child process.
+    int Benchmark(
+        std::string const& strLogFile, std::string const& strAlgorithm, int cParticles, SParticleCountParameters const& paramsCount,
+        boost::optional<std::string> const& ostrReference, boost::optional<std::string> const& ostrWriteReference,
+        bool bProfile
+    ) {
+        auto const tpStart = std::chrono::steady_clock::now();
+        auto const oresult = Run(strLogFile, strAlgorithm, cParticles, paramsCount);
+        std::chrono::duration<double> const durTotal = std::chrono::steady_clock::now() - tpStart;
+        if(!oresult) {
+            std::cerr << "Couldn't replay " << strLogFile << std::endl;
+            return 1;
+        }
+        auto const& result = oresult.get();
+
+        rusage ru;
+        getrusage(RUSAGE_SELF, &ru);
+
+        std::cout << std::fixed << std::setprecision(2)
+            << std::left << std::setw(24) << strLogFile << std::right
+            << std::setw(10) << strAlgorithm
+            << std::setw(5) << (strAlgorithm==c_szSCANMATCH ? 1 : cParticles)
+            << std::setw(7) << result.m_vecfSeconds.size()
+            << std::setw(9) << Percentile(result.m_vecfSeconds, 0.5) * 1000
+            << std::setw(9) << Percentile(result.m_vecfSeconds, 0.9) * 1000
+            << std::setw(9) << Percentile(result.m_vecfSeconds, 0.99) * 1000
+            << std::setw(9) << Percentile(result.m_vecfSeconds, 1.0) * 1000
+            << std::setw(9) << durTotal.count()
+            << std::setw(9) << ru.ru_maxrss / 1024.0 // ru_maxrss is in kB on Linux
+            << "  (" << result.m_poseFinal.m_pt.x << ";" << result.m_poseFinal.m_pt.y << ";" << result.m_poseFinal.m_fYaw << ")";
+
+        if(ostrReference) {
+            auto const oresultRef = ReadReference(ReferenceName(ostrReference.get(), strLogFile, strAlgorithm, cParticles));
+            if(oresultRef) {
+                std::cout << std::setw(9) << (result.m_poseFinal.m_pt - oresultRef->m_poseFinal.m_pt).Abs()
+                    << std::setw(9) << std::abs(result.m_poseFinal.m_fYaw - oresultRef->m_poseFinal.m_fYaw)
+                    << std::setw(9) << MapDifference(result.m_matnMap, result.m_ptnOrigin, oresultRef->m_matnMap, oresultRef->m_ptnOrigin) * 100;
+            } else {
+                std::cout << "  no reference";
+            }
+        }
+        std::cout << std::endl;
+        if(bProfile) {
+            std::cout << Profile() << std::endl;
+        }
+
+        if(ostrWriteReference) {
+            WriteReference(ReferenceName(ostrWriteReference.get(), strLogFile, strAlgorithm, cParticles), result);
+        }
+        return 0;
+    }
+}
+
+int main(int nArgs, char* aczArgs[]) {
+    namespace po = boost::program_options;
+
+    po::options_description optdesc("Allowed options");
+    optdesc.add_options()
+        (c_szHELP, "Print help message")
+        (c_szINPUT, po::value<std::vector<std::string>>()->value_name("file")
+            ->default_value({"test/flur.log", "test/apartment.log", "test/apartment2.log"}, "test/flur.log test/apartment.log test/apartment2.log"),
+            "Replay log <file>")
+        (c_szALGORITHM, po::value<std::vector<std::string>>()->value_name("a")->multitoken()
+            ->default_value({c_szSCANMATCH, c_szPARTICLE, c_szFASTSLAM}, "scanmatch particle fastslam"),
+            "Benchmark algorithm <a>, one of scanmatch, posegraph, particle or fastslam")
+        (c_szPARTICLES, po::value<std::vector<int>>()->value_name("n")->multitoken()
+            ->default_value({5, 10, 20}, "5 10 20"),
+            "Run particle filters with <n> particles")
+        (c_szMAXPARTICLES, po::value<int>()->value_name("n"), "Adapt the particle count between the --particles count and <n>")
+        (c_szTHREADS, po::value<int>()->value_name("n"), "Update particles using <n> threads (default: number of cores)")
+        (c_szPROFILE, "Print time spent per stage after each run")
+        (c_szSEED, po::value<std::uint64_t>()->value_name("n")->default_value(1), "Seed random number generators with <n>")
+        (c_szREFERENCE, po::value<std::string>()->value_name("dir"), "Compare final pose and map to reference results in <dir>")
+        (c_szWRITEREFERENCE, po::value<std::string>()->value_name("dir"), "Write final pose and map as reference results to <dir>");
+
+    po::positional_options_description posoptdesc;
+    posoptdesc.add(c_szINPUT, -1);
+
+    po::variables_map vm;
+    po::store(po::command_line_parser(nArgs, aczArgs).options(optdesc).positional(posoptdesc).run(), vm);
+    po::notify(vm);
+
+    if(vm.count(c_szHELP)) {
+        std::cout << optdesc << std::endl;
+        return 0;
+    }
+
+    if(vm.count(c_szTHREADS)) {
+        auto const cThreads = vm[c_szTHREADS].as<int>();
+        if(cThreads<1) {
+            std::cerr << "The number of threads must be at least 1" << std::endl;
+            return 1;
+        }
+        SetWorkerPoolThreads(cThreads);
+    }
+    auto const& veccParticles = vm[c_szPARTICLES].as<std::vector<int>>();
+    if(std::any_of(veccParticles.begin(), veccParticles.end(), [](int c) { return c<1; })) {
+        std::cerr << "The number of particles must be at least 1" << std::endl;
+        return 1;
+    }
+    SetRandomSeed(vm[c_szSEED].as<std::uint64_t>());
+
+    auto const ostrReference = vm.count(c_szREFERENCE)
+        ? boost::make_optional(vm[c_szREFERENCE].as<std::string>())
+        : boost::none;
+    auto const ostrWriteReference = vm.count(c_szWRITEREFERENCE)
+        ? boost::make_optional(vm[c_szWRITEREFERENCE].as<std::string>())
+        : boost::none;
+
+    std::cout << std::left << std::setw(24) << "log" << std::right
+        << std::setw(10) << "algorithm"
+        << std::setw(5) << "n"
+        << std::setw(7) << "scans"
+        << std::setw(9) << "p50 ms"
+        << std::setw(9) << "p90 ms"
+        << std::setw(9) << "p99 ms"
+        << std::setw(9) << "max ms"
+        << std::setw(9) << "total s"
+        << std::setw(9) << "RSS MB"
+        << "  final pose";
+    if(ostrReference) {
+        std::cout << " | pose err cm, yaw err rad, map diff %";
+    }
+    std::cout << std::endl;
+
+    int nResult = 0;
+    for(auto const& strLogFile : vm[c_szINPUT].as<std::vector<std::string>>()) {
+        for(auto const& strAlgorithm : vm[c_szALGORITHM].as<std::vector<std::string>>()) {
+            if(strAlgorithm!=c_szSCANMATCH && strAlgorithm!=c_szPOSEGRAPH && strAlgorithm!=c_szPARTICLE && strAlgorithm!=c_szFASTSLAM) {
+                std::cerr << "Unknown algorithm " << strAlgorithm << std::endl;
+                return 1;
+            }
+
+            auto const vecnParticles = strAlgorithm==c_szSCANMATCH || strAlgorithm==c_szPOSEGRAPH
+                ? std::vector<int>{1}
+                : veccParticles;
+            for(int cParticles : vecnParticles) {
+                SParticleCountParameters paramsCount;
+                if(vm.count(c_szMAXPARTICLES)) {
+                    paramsCount.m_cMinParticles = cParticles;
+                    paramsCount.m_cMaxParticles = std::max(cParticles, vm[c_szMAXPARTICLES].as<int>());
+                }
+                // Run in child process to measure its peak memory use separately
+                std::cout.flush();
+                pid_t const pid = fork();
+                if(pid<0) {
+                    std::cerr << "fork failed" << std::endl;
+                    return 1;
+                } else if(0==pid) {
+                    auto const nResultChild = Benchmark(strLogFile, strAlgorithm, cParticles, paramsCount, ostrReference, ostrWriteReference, vm.count(c_szPROFILE));
+                    std::cout.flush();
+                    _exit(nResultChild);
+                }
+
+                int nStatus = 0;
+                waitpid(pid, &nStatus, 0);
+                if(!WIFEXITED(nStatus) || 0!=WEXITSTATUS(nStatus)) nResult = 1;
+            }
+        }
+    }
+    return nResult;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "nonmoveable.h"
+#include "error_handling.h"
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+// A ring of preallocated slots between exactly one producer and one consumer
+// thread. The producer fills the next free slot in place and push()es it,
+// the consumer works on the oldest slot in place and pop()s it. Slots are
+// reused, so buffers inside of T keep their capacity and nothing is copied
+// or allocated once they have grown to their working size.
+//
+// The slot indices are atomics, neither thread ever waits for the other
+// to access a slot. Only a consumer that waits for data or a producer that
+// waits for a free slot sleeps on a condition variable. The ring is never
+// full and empty at the same time, so at most one thread waits on it.
+template<typename T>
+struct CSpscRing : rbt::nonmoveable {
+    explicit CSpscRing(int cSlots) : m_vect(cSlots) {
+        ASSERT(0 < cSlots);
+    }
+
+    // Producer: The slot to fill next, nullptr if all slots are in use
+    T* write_slot() {
+        auto const nWrite = m_nWrite.load(std::memory_order_relaxed);
+        if(nWrite - m_nRead.load(std::memory_order_acquire)==m_vect.size()) return nullptr;
+        return &m_vect[nWrite % m_vect.size()];
+    }
+
+    // Producer: Blocks until a slot is free
+    T& wait_write_slot() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        T* pt = nullptr;
+        m_cv.wait(lock, [&] { return nullptr!=(pt = write_slot()); });
+        return *pt;
+    }
+
+    // Producer: Hands the slot returned by write_slot() to the consumer
+    void push() {
+        m_nWrite.store(m_nWrite.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(m_mtx); } // a waiting consumer has checked its predicate or is asleep
+        m_cv.notify_one();
+    }
+
+    // Consumer: The oldest slot, nullptr if the ring is empty
+    T* read_slot() {
+        auto const nRead = m_nRead.load(std::memory_order_relaxed);
+        if(nRead==m_nWrite.load(std::memory_order_acquire)) return nullptr;
+        return &m_vect[nRead % m_vect.size()];
+    }
+
+    // Consumer: Blocks until a slot is available
+    T& wait_read_slot() {
+        std::unique_lock<std::mutex> lock(m_mtx);
+        T* pt = nullptr;
+        m_cv.wait(lock, [&] { return nullptr!=(pt = read_slot()); });
+        return *pt;
+    }
+
+    // Consumer: Returns the slot returned by read_slot() to the producer
+    void pop() {
+        m_nRead.store(m_nRead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        { std::lock_guard<std::mutex> lock(m_mtx); } // a waiting producer has checked its predicate or is asleep
+        m_cv.notify_one();
+    }
+
+private:
+    std::vector<T> m_vect;
+    // Slot i is m_vect[i % m_vect.size()], the slots [m_nRead, m_nWrite) are filled
+    std::atomic<std::size_t> m_nWrite{0};
+    std::atomic<std::size_t> m_nRead{0};
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+};
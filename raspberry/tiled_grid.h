@@ -0,0 +1,289 @@
+#pragma once
+
+#include "geometry.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <vector>
+#include <algorithm>
+
+#include <opencv2/core.hpp>
+
+// An unbounded two-dimensional grid of cells of type T that is split into square
+// tiles of c_nTileExtent x c_nTileExtent cells. Tiles are allocated on demand
+// when a cell is written to, cells in tiles that have never been written to
+// read as the default value. Memory use therefore scales with the area that
+// has actually been explored.
+//
+// The tiles are reference counted and shared between copies of a grid,
+// so copying a grid only copies the tile pointers. A shared tile is cloned
+// the first time it is written to (copy-on-write).
+//
+// This is used by the particle filters: On resampling, duplicated particles
+// share their maps and a scan only dirties the tiles it touches.
+template<typename T>
+struct CTiledGrid {
+    static int constexpr c_nTileExtent = 32;
+
+    // The bounding box of the grid always covers [0, sznMin.x) x [0, sznMin.y)
+    CTiledGrid(rbt::size<int> const& sznMin, T tDefault)
+        : m_ptTileMin(rbt::point<int>::zero())
+        , m_nTilesX(TileCoordinate(sznMin.x - 1) + 1)
+        , m_nTilesY(TileCoordinate(sznMin.y - 1) + 1)
+        , m_vecptile(m_nTilesX * m_nTilesY)
+        , m_ptnOrigin(rbt::point<int>::zero())
+        , m_szn(sznMin)
+        , m_tDefault(tDefault)
+    {}
+
+    // The bounding box of all allocated tiles and the initial extent.
+    // Origin() is its top-left corner.
+    rbt::point<int> const& Origin() const { return m_ptnOrigin; }
+    rbt::size<int> const& Extent() const { return m_szn; }
+    T const& Default() const { return m_tDefault; } // value of cells never written to
+
+    bool is_inside(rbt::point<int> const& pt) const {
+        return m_ptnOrigin.x<=pt.x && m_ptnOrigin.y<=pt.y
+            && pt.x < m_ptnOrigin.x + m_szn.x && pt.y < m_ptnOrigin.y + m_szn.y;
+    }
+
+    T const& at(rbt::point<int> const& pt) const {
+        auto const ptTile = TileCoordinate(pt);
+        if(!IsInsideTiles(ptTile)) return m_tDefault;
+
+        auto const& ptile = m_vecptile[TileIndex(ptTile)];
+        return ptile ? ptile->m_at[CellIndex(pt, ptTile)] : m_tDefault;
+    }
+
+    // Returns a writeable reference to the cell at pt.
+    // Allocates the tile or clones it if it is shared with another grid.
+    T& mutable_at(rbt::point<int> const& pt) {
+        auto const ptTile = TileCoordinate(pt);
+        return mutable_tile(ptTile)[CellIndex(pt, ptTile)];
+    }
+
+    // Returns the writeable c_nTileExtent x c_nTileExtent cells of the tile
+    // ptTile in row-major order, allocates or clones it like mutable_at
+    T* mutable_tile(rbt::point<int> const& ptTile) {
+        if(!IsInsideTiles(ptTile)) Grow(ptTile);
+
+        auto& ptile = m_vecptile[TileIndex(ptTile)];
+        if(!ptile) {
+            ptile = std::make_shared<STile>();
+            ptile->m_at.fill(m_tDefault);
+            ptile->m_version = {NextTileId(), 0};
+            ExtendBounds(ptTile);
+        } else if(1<ptile.use_count()) {
+            ptile = std::make_shared<STile>(*ptile);
+            ptile->m_version = {NextTileId(), 0};
+        }
+        ++ptile->m_version.m_nWrites;
+        return ptile->m_at.data();
+    }
+
+    // Identifies the contents of a tile across all grids. A tile is only written
+    // to by the one grid owning it, shared tiles are cloned and get a new id.
+    struct STileVersion {
+        std::uint64_t m_nId;
+        std::uint64_t m_nWrites;
+
+        bool operator==(STileVersion const& version) const {
+            return m_nId==version.m_nId && m_nWrites==version.m_nWrites;
+        }
+    };
+
+    // Calls fn(ptTile, version, pt) for every allocated tile, pt points
+    // to its c_nTileExtent x c_nTileExtent cells in row-major order
+    template<typename Func>
+    void ForEachTile(Func fn) const {
+        for(int nTileY = 0; nTileY < m_nTilesY; ++nTileY) {
+            for(int nTileX = 0; nTileX < m_nTilesX; ++nTileX) {
+                auto const& ptile = m_vecptile[nTileY * m_nTilesX + nTileX];
+                if(ptile) fn(m_ptTileMin + rbt::size<int>(nTileX, nTileY), ptile->m_version, ptile->m_at.data());
+            }
+        }
+    }
+
+    // Copies the bounding box of the grid into a contiguous cv::Mat.
+    // The top-left pixel of the returned image is the cell at Origin().
+    cv::Mat ToMat() const {
+        cv::Mat mat(m_szn.y, m_szn.x, cv::DataType<T>::type, cv::Scalar(m_tDefault));
+        for(int nTileY = 0; nTileY < m_nTilesY; ++nTileY) {
+            for(int nTileX = 0; nTileX < m_nTilesX; ++nTileX) {
+                auto const& ptile = m_vecptile[nTileY * m_nTilesX + nTileX];
+                if(!ptile) continue;
+
+                // Allocated tiles are always inside the bounding box
+                rbt::point<int> const ptn = (m_ptTileMin + rbt::size<int>(nTileX, nTileY)) * c_nTileExtent;
+                int const nX = ptn.x - m_ptnOrigin.x;
+                for(int yTile = 0, y = ptn.y - m_ptnOrigin.y; yTile < c_nTileExtent; ++y, ++yTile) {
+                    auto const itBegin = ptile->m_at.begin() + yTile * c_nTileExtent;
+                    std::copy(itBegin, itBegin + c_nTileExtent, mat.ptr<T>(y) + nX);
+                }
+            }
+        }
+        return mat;
+    }
+
+    // The tile containing cell pt. Rounds towards negative infinity.
+    static int TileCoordinate(int n) {
+        return n<0 ? (n + 1) / c_nTileExtent - 1 : n / c_nTileExtent;
+    }
+
+    static rbt::point<int> TileCoordinate(rbt::point<int> const& pt) {
+        return rbt::point<int>(TileCoordinate(pt.x), TileCoordinate(pt.y));
+    }
+
+private:
+
+    bool IsInsideTiles(rbt::point<int> const& ptTile) const {
+        return m_ptTileMin.x<=ptTile.x && m_ptTileMin.y<=ptTile.y
+            && ptTile.x < m_ptTileMin.x + m_nTilesX && ptTile.y < m_ptTileMin.y + m_nTilesY;
+    }
+
+    int TileIndex(rbt::point<int> const& ptTile) const {
+        return (ptTile.y - m_ptTileMin.y) * m_nTilesX + ptTile.x - m_ptTileMin.x;
+    }
+
+    static int CellIndex(rbt::point<int> const& pt, rbt::point<int> const& ptTile) {
+        return (pt.y - ptTile.y * c_nTileExtent) * c_nTileExtent + pt.x - ptTile.x * c_nTileExtent;
+    }
+
+    // Extends the table of tiles to include ptTile
+    void Grow(rbt::point<int> const& ptTile) {
+        rbt::point<int> const ptTileMin(std::min(ptTile.x, m_ptTileMin.x), std::min(ptTile.y, m_ptTileMin.y));
+        rbt::point<int> const ptTileMax(
+            std::max(ptTile.x + 1, m_ptTileMin.x + m_nTilesX),
+            std::max(ptTile.y + 1, m_ptTileMin.y + m_nTilesY)
+        );
+        auto const szTiles = ptTileMax - ptTileMin;
+
+        std::vector<std::shared_ptr<STile>> vecptile(szTiles.x * szTiles.y);
+        for(int nTileY = 0; nTileY < m_nTilesY; ++nTileY) {
+            auto const itBegin = m_vecptile.begin() + nTileY * m_nTilesX;
+            auto const nOffset = (m_ptTileMin.y + nTileY - ptTileMin.y) * szTiles.x + m_ptTileMin.x - ptTileMin.x;
+            std::move(itBegin, itBegin + m_nTilesX, vecptile.begin() + nOffset);
+        }
+
+        m_vecptile = std::move(vecptile);
+        m_ptTileMin = ptTileMin;
+        m_nTilesX = szTiles.x;
+        m_nTilesY = szTiles.y;
+    }
+
+    // Extends the bounding box to include the tile ptTile
+    void ExtendBounds(rbt::point<int> const& ptTile) {
+        rbt::point<int> const ptnMin(
+            std::min(m_ptnOrigin.x, ptTile.x * c_nTileExtent),
+            std::min(m_ptnOrigin.y, ptTile.y * c_nTileExtent)
+        );
+        rbt::point<int> const ptnMax(
+            std::max(m_ptnOrigin.x + m_szn.x, (ptTile.x + 1) * c_nTileExtent),
+            std::max(m_ptnOrigin.y + m_szn.y, (ptTile.y + 1) * c_nTileExtent)
+        );
+        m_ptnOrigin = ptnMin;
+        m_szn = ptnMax - ptnMin;
+    }
+
+    struct STile {
+        std::array<T, c_nTileExtent * c_nTileExtent> m_at;
+        STileVersion m_version;
+    };
+
+    static std::uint64_t NextTileId() {
+        static std::atomic<std::uint64_t> s_nTileId(0);
+        return ++s_nTileId;
+    }
+
+    rbt::point<int> m_ptTileMin; // tile coordinate of m_vecptile[0]
+    int m_nTilesX;
+    int m_nTilesY;
+    std::vector<std::shared_ptr<STile>> m_vecptile;
+
+    rbt::point<int> m_ptnOrigin; // bounding box in cells
+    rbt::size<int> m_szn;
+    T m_tDefault;
+};
+
+// An image of a CTiledGrid that is kept up to date incrementally:
+// update() only copies the tiles that changed since the previous call.
+// The grid passed to update() may be a different one each time, e.g., the 
+// map of the currently best particle, shared tiles are not copied again.
+template<typename T>
+struct CTiledGridImage {
+    // The pixels modified by the last call to update(), all pixels if the image
+    // has been rendered again because the bounding box of the grid changed
+    rbt::rect<int> const& Changed() const { return m_rectChanged; }
+
+    // Returns the image of grid. The top-left pixel is the cell at grid.Origin().
+    // The image is modified by the next call to update().
+    cv::Mat const& update(CTiledGrid<T> const& grid) {
+        using grid_type = CTiledGrid<T>;
+        int constexpr c_nTileExtent = grid_type::c_nTileExtent;
+
+        if(m_mat.empty() || !(m_ptnOrigin==grid.Origin()) || m_mat.cols!=grid.Extent().x || m_mat.rows!=grid.Extent().y) {
+            m_mat = grid.ToMat();
+            m_ptnOrigin = grid.Origin();
+            m_rectChanged = {0, 0, m_mat.cols - 1, m_mat.rows - 1};
+            m_mapptversion.clear();
+            grid.ForEachTile([&](rbt::point<int> const& ptTile, typename grid_type::STileVersion const& version, T const*) {
+                m_mapptversion.emplace(ptTile, SEntry{version, true});
+            });
+            return m_mat;
+        }
+
+        auto const CopyTile = [&](rbt::point<int> const& ptTile, T const* pt) {
+            rbt::point<int> const ptn = ptTile * c_nTileExtent - rbt::size<int>(m_ptnOrigin);
+            m_rectChanged |= ptn;
+            m_rectChanged |= ptn + rbt::size<int>(c_nTileExtent - 1, c_nTileExtent - 1);
+            for(int y = 0; y < c_nTileExtent; ++y) {
+                auto* ptDst = m_mat.ptr<T>(ptn.y + y) + ptn.x;
+                if(pt) {
+                    std::copy(pt + y * c_nTileExtent, pt + (y + 1) * c_nTileExtent, ptDst);
+                } else {
+                    std::fill(ptDst, ptDst + c_nTileExtent, grid.Default());
+                }
+            }
+        };
+
+        m_rectChanged = rbt::rect<int>::empty();
+        for(auto& pairptentry : m_mapptversion) pairptentry.second.m_bSeen = false;
+        grid.ForEachTile([&](rbt::point<int> const& ptTile, typename grid_type::STileVersion const& version, T const* pt) {
+            auto const itpairptentry = m_mapptversion.find(ptTile);
+            if(itpairptentry==m_mapptversion.end()) {
+                m_mapptversion.emplace(ptTile, SEntry{version, true});
+                CopyTile(ptTile, pt);
+            } else {
+                itpairptentry->second.m_bSeen = true;
+                if(!(itpairptentry->second.m_version==version)) {
+                    itpairptentry->second.m_version = version;
+                    CopyTile(ptTile, pt);
+                }
+            }
+        });
+        // Tiles that are not allocated in grid
+        for(auto itpairptentry = m_mapptversion.begin(); itpairptentry!=m_mapptversion.end();) {
+            if(itpairptentry->second.m_bSeen) {
+                ++itpairptentry;
+            } else {
+                CopyTile(itpairptentry->first, nullptr);
+                itpairptentry = m_mapptversion.erase(itpairptentry);
+            }
+        }
+        return m_mat;
+    }
+
+private:
+    struct SEntry {
+        typename CTiledGrid<T>::STileVersion m_version;
+        bool m_bSeen;
+    };
+
+    cv::Mat m_mat;
+    rbt::point<int> m_ptnOrigin = rbt::point<int>::zero();
+    rbt::rect<int> m_rectChanged = rbt::rect<int>::empty();
+    std::map<rbt::point<int>, SEntry> m_mapptversion; // by tile coordinate
+};
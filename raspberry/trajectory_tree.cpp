@@ -0,0 +1,53 @@
+#include "trajectory_tree.h"
+#include "error_handling.h"
+
+#include <cassert>
+#include <algorithm>
+
+std::size_t constexpr CTrajectoryTree::c_cNodesPerChunk;
+
+CTrajectoryTree::~CTrajectoryTree() {
+    ASSERT(0==m_cNodes);
+}
+
+CTrajectoryTree::node_ptr CTrajectoryTree::add(node_ptr const& pnodeParent, rbt::pose<double> const& pose, std::shared_ptr<SScanLine const> pscanline) {
+    ASSERT(!pnodeParent || this==pnodeParent.m_ptree);
+    if(!m_pnodeFree) {
+        m_vecpnodeChunk.emplace_back(new SNode[c_cNodesPerChunk]);
+        auto const pnodeChunk = m_vecpnodeChunk.back().get();
+        for(std::size_t i = 0; i<c_cNodesPerChunk; ++i) {
+            pnodeChunk[i].m_pnodeParent = i+1<c_cNodesPerChunk ? pnodeChunk + i + 1 : nullptr;
+        }
+        m_pnodeFree = pnodeChunk;
+    }
+
+    auto const pnode = m_pnodeFree;
+    m_pnodeFree = pnode->m_pnodeParent;
+    ++m_cNodes;
+
+    pnode->m_pose = pose;
+    pnode->m_pscanline = std::move(pscanline);
+    pnode->m_pnodeParent = pnodeParent.m_pnode;
+    pnode->m_cRef = 1;
+    if(pnode->m_pnodeParent) ++pnode->m_pnodeParent->m_cRef;
+    return node_ptr(this, pnode);
+}
+
+std::vector<rbt::pose<double>> CTrajectoryTree::trajectory(node_ptr const& pnode) {
+    std::vector<rbt::pose<double>> vecpose;
+    for(auto p = pnode.get(); p; p = p->m_pnodeParent) vecpose.emplace_back(p->m_pose);
+    std::reverse(vecpose.begin(), vecpose.end());
+    return vecpose;
+}
+
+void CTrajectoryTree::Release(SNode* pnode) {
+    // Iteratively, a trajectory can be much longer than the stack is deep
+    while(pnode && 0==--pnode->m_cRef) {
+        auto const pnodeParent = pnode->m_pnodeParent;
+        pnode->m_pscanline.reset();
+        pnode->m_pnodeParent = m_pnodeFree;
+        m_pnodeFree = pnode;
+        --m_cNodes;
+        pnode = pnodeParent;
+    }
+}
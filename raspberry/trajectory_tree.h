@@ -0,0 +1,69 @@
+#pragma once
+
+#include "geometry.h"
+#include "nonmoveable.h"
+#include "scanline.h"
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// The pose histories of all particles of a particle filter as a tree.
+// Each particle refers to the node of its latest pose, each node to the
+// node of the previous pose. Particles that were resampled from the same
+// ancestor share their common history, so copying a particle only copies a
+// reference. A node may also refer to the scan line integrated at its pose,
+// which is shared by all nodes of the same update. Nodes are reference counted and return to a pool when the last
+// particle descending from them dies.
+// The reference counts are not atomic, node_ptrs must only be copied and
+// destroyed on one thread.
+struct CTrajectoryTree : rbt::nonmoveable {
+    struct SNode {
+        rbt::pose<double> m_pose;
+        std::shared_ptr<SScanLine const> m_pscanline; // may be empty
+        SNode* m_pnodeParent; // nullptr for the first pose, the next free node in the pool
+        int m_cRef;
+    };
+
+    struct node_ptr {
+        node_ptr() = default;
+        node_ptr(node_ptr const& p) : m_ptree(p.m_ptree), m_pnode(p.m_pnode) { if(m_pnode) ++m_pnode->m_cRef; }
+        node_ptr(node_ptr&& p) : m_ptree(p.m_ptree), m_pnode(p.m_pnode) { p.m_pnode = nullptr; }
+        node_ptr& operator=(node_ptr p) { swap(p); return *this; }
+        ~node_ptr() { if(m_pnode) m_ptree->Release(m_pnode); }
+
+        void swap(node_ptr& p) { std::swap(m_ptree, p.m_ptree); std::swap(m_pnode, p.m_pnode); }
+
+        explicit operator bool() const { return nullptr!=m_pnode; }
+        SNode const& operator*() const { return *m_pnode; }
+        SNode const* operator->() const { return m_pnode; }
+        SNode const* get() const { return m_pnode; }
+
+    private:
+        friend struct CTrajectoryTree;
+        node_ptr(CTrajectoryTree* ptree, SNode* pnode) : m_ptree(ptree), m_pnode(pnode) {}
+
+        CTrajectoryTree* m_ptree = nullptr;
+        SNode* m_pnode = nullptr;
+    };
+
+    // All node_ptrs must be destroyed before the tree
+    ~CTrajectoryTree();
+
+    // The node after pnodeParent, which may be empty
+    node_ptr add(node_ptr const& pnodeParent, rbt::pose<double> const& pose, std::shared_ptr<SScanLine const> pscanline = nullptr);
+
+    // The poses from the first pose to pnode
+    static std::vector<rbt::pose<double>> trajectory(node_ptr const& pnode);
+
+    std::size_t size() const { return m_cNodes; } // nodes in use
+
+private:
+    void Release(SNode* pnode);
+
+    static std::size_t constexpr c_cNodesPerChunk = 1024;
+    std::vector<std::unique_ptr<SNode[]>> m_vecpnodeChunk;
+    SNode* m_pnodeFree = nullptr;
+    std::size_t m_cNodes = 0;
+};
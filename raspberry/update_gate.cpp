@@ -0,0 +1,28 @@
+#include "update_gate.h"
+
+#include <cmath>
+
+SScanLine const* CUpdateGate::pass(SScanLine const& scanline) {
+    bool const bAccumulated = !(m_poseAccumulated.m_pt==rbt::point<double>::zero()) || 0!=m_poseAccumulated.m_fYaw;
+    // The motion of scanline starts at the end of the accumulated motion
+    m_poseAccumulated = rbt::pose<double>(
+        m_poseAccumulated.m_pt + scanline.translation().rotated(m_poseAccumulated.m_fYaw),
+        m_poseAccumulated.m_fYaw + scanline.rotation()
+    );
+
+    if(!m_bFirst
+    && rbt::size<double>(m_poseAccumulated.m_pt).Abs()<m_params.m_fMinTranslation
+    && std::abs(m_poseAccumulated.m_fYaw)<m_params.m_fMinRotation) {
+        return nullptr;
+    }
+    m_bFirst = false;
+
+    SScanLine const* pscanline = &scanline;
+    if(bAccumulated) {
+        m_scanline.m_vecscan = scanline.m_vecscan;
+        m_scanline.m_pose = m_poseAccumulated;
+        pscanline = &m_scanline;
+    }
+    m_poseAccumulated = rbt::pose<double>::zero();
+    return pscanline;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "robot_configuration.h"
+#include "scanline.h"
+
+struct SUpdateGateParameters {
+    double m_fMinTranslation = c_nScale;         // cm
+    double m_fMinRotation = c_nScale / 200.0;    // rad, moves an obstacle 2 m away by one cell
+};
+
+// Update gating as in gmapping: The SLAM update only runs once the robot has
+// moved far enough. Below the thresholds, the motion of each scan line is
+// only accumulated. Scans that are gated out are dropped, the next scan line
+// that passes carries the motion accumulated since the last update.
+// The first scan line always passes.
+struct CUpdateGate {
+    explicit CUpdateGate(SUpdateGateParameters const& params = SUpdateGateParameters()) : m_params(params) {}
+
+    // nullptr if scanline is gated out. Otherwise scanline itself or a copy
+    // with the accumulated motion, valid until the next call.
+    SScanLine const* pass(SScanLine const& scanline);
+
+private:
+    SUpdateGateParameters m_params;
+    bool m_bFirst = true;
+    rbt::pose<double> m_poseAccumulated = rbt::pose<double>::zero(); // since the last update
+    SScanLine m_scanline;
+};
@@ -0,0 +1,54 @@
+#include "video_writer.h"
+#include "robot_configuration.h"
+#include "occupancy_grid.h"
+#include "error_handling.h"
+
+#include <opencv2/imgproc.hpp>
+
+CVideoWriter::CVideoWriter(std::string const& strFile, SVideoOptions const& options)
+    : m_vid(strFile, cv::VideoWriter::fourcc('m', 'p', '4', 'v'), options.m_fFps, cv::Size(c_nMapExtent, c_nMapExtent))
+    , m_bChangedOnly(options.m_bChangedOnly)
+    , m_ringframe(c_cFrames)
+    , m_thread([this] { Run(); })
+{
+    ASSERT(0.0 < options.m_fFps);
+}
+
+CVideoWriter::~CVideoWriter() {
+    m_ringframe.wait_write_slot().m_bLast = true;
+    m_ringframe.push();
+    m_thread.join();
+}
+
+void CVideoWriter::post(CTiledGrid<std::uint8_t> const& gridn, std::vector<rbt::pose<double>> const& vecpose) {
+    // The slot keeps the capacity of its trajectory
+    auto& frame = m_ringframe.wait_write_slot();
+    frame.m_gridn = gridn;
+    frame.m_vecpose.assign(vecpose.begin(), vecpose.end());
+    m_ringframe.push();
+}
+
+void CVideoWriter::Run() {
+    while(true) {
+        auto& frame = m_ringframe.wait_read_slot();
+        if(frame.m_bLast) {
+            m_ringframe.pop();
+            return;
+        }
+
+        if(m_vid.isOpened()) {
+            // The map grows as necessary, the video shows the initial map area.
+            // Only the changed tiles are copied into m_imageMap, so draw into a copy.
+            auto const& ptnOrigin = frame.m_gridn.Origin();
+            cv::Mat matFrame = m_imageMap.update(frame.m_gridn)(cv::Rect(-ptnOrigin.x, -ptnOrigin.y, c_nMapExtent, c_nMapExtent)).clone();
+            if(!frame.m_vecpose.empty()) ObstacleMapWithPoses(matFrame, rbt::point<int>::zero(), frame.m_vecpose);
+
+            if(!m_bChangedOnly || m_matPrev.empty() || 0 < cv::norm(matFrame, m_matPrev, cv::NORM_INF)) {
+                cv::cvtColor(matFrame, m_matColor, cv::COLOR_GRAY2RGB);
+                m_vid << m_matColor;
+                m_matPrev = matFrame;
+            }
+        }
+        m_ringframe.pop();
+    }
+}
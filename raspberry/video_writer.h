@@ -0,0 +1,53 @@
+#pragma once
+
+#include "geometry.h"
+#include "nonmoveable.h"
+#include "spsc_ring.h"
+#include "tiled_grid.h"
+
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/videoio.hpp>
+
+struct SVideoOptions {
+    double m_fFps = 5; // frames per second of video and of log time
+    bool m_bChangedOnly = false; // skip frames that look like the previous one
+};
+
+// Writes the replay video on its own thread, so the SLAM thread only copies
+// the obstacle grid, which shares its tiles, and the trajectory.
+// The encoder thread renders the initial map area of each frame, draws the
+// trajectory and encodes it. post() blocks while c_cFrames frames are queued,
+// so no frame is lost when encoding is slower than SLAM.
+struct CVideoWriter : rbt::nonmoveable {
+    CVideoWriter(std::string const& strFile, SVideoOptions const& options);
+    ~CVideoWriter(); // writes the queued frames
+
+    bool isOpened() const { return m_vid.isOpened(); }
+
+    void post(CTiledGrid<std::uint8_t> const& gridn, std::vector<rbt::pose<double>> const& vecpose);
+
+private:
+    static int constexpr c_cFrames = 8;
+
+    struct SFrame {
+        CTiledGrid<std::uint8_t> m_gridn{rbt::size<int>(1, 1), 0}; // assigned by post()
+        std::vector<rbt::pose<double>> m_vecpose;
+        bool m_bLast = false; // stops the encoder thread
+    };
+
+    void Run();
+
+    cv::VideoWriter m_vid;
+    bool const m_bChangedOnly;
+    CSpscRing<SFrame> m_ringframe;
+
+    // Only used by m_thread
+    CTiledGridImage<std::uint8_t> m_imageMap;
+    cv::Mat m_matPrev;
+    cv::Mat m_matColor;
+    std::thread m_thread;
+};
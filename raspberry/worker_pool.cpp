@@ -0,0 +1,156 @@
+#include "worker_pool.h"
+#include "error_handling.h"
+
+#include <algorithm>
+#include <cassert>
+#include <exception>
+
+CWorkerPool::CWorkerPool(int cThreads)
+    : m_cTasks(0)
+    , m_iQueueNext(0)
+    , m_bStop(false)
+{
+    ASSERT(0<cThreads);
+    for(int i = 0; i < cThreads; ++i) {
+        m_vecpqueue.emplace_back(std::make_unique<SQueue>());
+    }
+    for(int i = 0; i < cThreads - 1; ++i) {
+        m_vecthread.emplace_back([this, i] { Worker(i); });
+    }
+}
+
+CWorkerPool::~CWorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtxWake);
+        m_bStop = true;
+    }
+    m_cvWake.notify_all();
+    for(auto& thread : m_vecthread) thread.join();
+}
+
+void CWorkerPool::parallel_for(int n, std::function<void(int)> const& fn) {
+    if(m_vecthread.empty()) {
+        std::exception_ptr pexception;
+        for(int i = 0; i < n; ++i) {
+            try {
+                fn(i);
+            } catch(...) {
+                if(!pexception) pexception = std::current_exception();
+            }
+        }
+        if(pexception) std::rethrow_exception(pexception);
+        return;
+    }
+
+    int cPending = n;
+    std::mutex mtxDone;
+    std::condition_variable cvDone;
+    std::exception_ptr pexception;
+
+    // Distribute the tasks evenly over all queues, including the queue of the calling thread
+    for(int i = 0; i < n; ++i) {
+        Push(i % m_vecpqueue.size(), [&, i] {
+            try {
+                fn(i);
+            } catch(...) {
+                std::lock_guard<std::mutex> lock(mtxDone);
+                if(!pexception) pexception = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mtxDone);
+            if(0==--cPending) cvDone.notify_all();
+        });
+    }
+    WakeWorkers();
+
+    // Help until no more tasks can be stolen, then wait for the running tasks
+    while(RunTask(m_vecpqueue.size() - 1)) {}
+    {
+        std::unique_lock<std::mutex> lock(mtxDone);
+        cvDone.wait(lock, [&] { return 0==cPending; });
+    }
+    if(pexception) std::rethrow_exception(pexception);
+}
+
+std::future<void> CWorkerPool::async(std::function<void()> fn) {
+    // std::function must be copyable, std::packaged_task is not
+    auto ptask = std::make_shared<std::packaged_task<void()>>(std::move(fn));
+    auto future = ptask->get_future();
+    if(m_vecthread.empty()) {
+        (*ptask)();
+        return future;
+    }
+    Push(m_iQueueNext++ % m_vecpqueue.size(), [ptask] { (*ptask)(); });
+    WakeWorkers();
+    return future;
+}
+
+void CWorkerPool::wait(std::future<void>& future) {
+    while(std::future_status::ready!=future.wait_for(std::chrono::seconds(0))) {
+        // If no task is queued, the task we are waiting for is running
+        if(!RunTask(m_vecpqueue.size() - 1)) future.wait();
+    }
+    future.get();
+}
+
+void CWorkerPool::Push(std::size_t iQueue, std::function<void()> fn) {
+    auto& queue = *m_vecpqueue[iQueue];
+    std::lock_guard<std::mutex> lock(queue.m_mtx);
+    queue.m_deqfn.emplace_back(std::move(fn));
+    ++m_cTasks;
+}
+
+void CWorkerPool::WakeWorkers() {
+    {
+        // Workers check m_cTasks while holding m_mtxWake
+        std::lock_guard<std::mutex> lock(m_mtxWake);
+    }
+    m_cvWake.notify_all();
+}
+
+bool CWorkerPool::RunTask(std::size_t iQueue) {
+    for(std::size_t i = 0; i < m_vecpqueue.size(); ++i) {
+        auto& queue = *m_vecpqueue[(iQueue + i) % m_vecpqueue.size()];
+        std::function<void()> fn;
+        {
+            std::lock_guard<std::mutex> lock(queue.m_mtx);
+            if(queue.m_deqfn.empty()) continue;
+            // Take the most recent task from the own queue, steal the oldest from others
+            if(0==i) {
+                fn = std::move(queue.m_deqfn.back());
+                queue.m_deqfn.pop_back();
+            } else {
+                fn = std::move(queue.m_deqfn.front());
+                queue.m_deqfn.pop_front();
+            }
+            --m_cTasks;
+        }
+        fn();
+        return true;
+    }
+    return false;
+}
+
+void CWorkerPool::Worker(std::size_t iQueue) {
+    while(true) {
+        if(RunTask(iQueue)) continue;
+
+        std::unique_lock<std::mutex> lock(m_mtxWake);
+        m_cvWake.wait(lock, [&] { return m_bStop || 0<m_cTasks; });
+        if(m_bStop) return;
+    }
+}
+
+namespace {
+    int s_cWorkerPoolThreads = 0;
+}
+
+void SetWorkerPoolThreads(int cThreads) {
+    s_cWorkerPoolThreads = cThreads;
+}
+
+CWorkerPool& WorkerPool() {
+    static CWorkerPool s_workerpool(0<s_cWorkerPoolThreads
+        ? s_cWorkerPoolThreads
+        : std::max(1, static_cast<int>(std::thread::hardware_concurrency())));
+    return s_workerpool;
+}
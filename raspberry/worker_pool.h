@@ -0,0 +1,82 @@
+#pragma once
+
+#include "nonmoveable.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that is reused for all particle updates.
+// Each worker has its own task queue. Idle workers steal tasks from the
+// other queues, so one slow particle does not leave the other cores idle.
+// A pool without worker threads runs all tasks inline in the calling thread
+// and never touches its queues, so threads that share it don't run each
+// other's tasks, e.g., the replays of BatchReplay.
+struct CWorkerPool : rbt::nonmoveable {
+    // cThreads is the total number of threads working on a parallel_for,
+    // including the calling thread, i.e., cThreads-1 worker threads are started
+    explicit CWorkerPool(int cThreads);
+    ~CWorkerPool();
+
+    int Threads() const { return static_cast<int>(m_vecthread.size()) + 1; }
+
+    // Calls fn(i) for all i in [0, n) in parallel and waits until all calls
+    // have finished. The calling thread runs tasks as well.
+    // Rethrows the first exception thrown by fn.
+    void parallel_for(int n, std::function<void(int)> const& fn);
+
+    // Runs fn in the background and returns immediately
+    std::future<void> async(std::function<void()> fn);
+
+    // Waits until future is ready. Runs other tasks in the meantime, so 
+    // this works even if the pool has no worker threads.
+    // Rethrows the exception thrown by the task.
+    void wait(std::future<void>& future);
+
+    // Calls fn for every element of rng in parallel
+    template<typename Range, typename Func>
+    void for_each(Range& rng, Func fn) {
+        auto const itBegin = std::begin(rng);
+        parallel_for(static_cast<int>(std::distance(itBegin, std::end(rng))), [&](int i) {
+            fn(*std::next(itBegin, i));
+        });
+    }
+
+private:
+    struct SQueue {
+        std::mutex m_mtx;
+        std::deque<std::function<void()>> m_deqfn;
+    };
+
+    void Push(std::size_t iQueue, std::function<void()> fn);
+    void WakeWorkers();
+
+    // Runs a task from queue iQueue or steals one from another queue.
+    // Returns false if all queues are empty.
+    bool RunTask(std::size_t iQueue);
+    void Worker(std::size_t iQueue);
+
+    // One queue per worker thread, the last queue is used by calling threads
+    std::vector<std::unique_ptr<SQueue>> m_vecpqueue;
+    std::atomic<int> m_cTasks; // queued, not yet started
+    std::atomic<unsigned> m_iQueueNext; // queue for next async task
+
+    std::mutex m_mtxWake;
+    std::condition_variable m_cvWake;
+    bool m_bStop;
+
+    std::vector<std::thread> m_vecthread;
+};
+
+// The worker pool shared by all SLAM algorithms.
+// SetWorkerPoolThreads must be called before the first call to WorkerPool(),
+// by default the pool uses all cores.
+void SetWorkerPoolThreads(int cThreads);
+CWorkerPool& WorkerPool();